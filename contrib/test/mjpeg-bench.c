@@ -0,0 +1,302 @@
+/*
+ *  MJPEG decode benchmark for libv4lconvert
+ *
+ *  This program can be used and distributed without restrictions.
+ *
+ *  Reads a file with concatenated (M)JPEG frames, as captured from a webcam
+ *  with for example:
+ *    v4l2-ctl --set-fmt-video=pixelformat=MJPG --stream-mmap \
+ *             --stream-count=100 --stream-to=capture.mjpeg
+ *  and decodes all frames through v4lconvert_convert() for the given time,
+ *  once using libjpeg (when libv4lconvert was built with it) and once using
+ *  the builtin tinyjpeg decoder, reporting the frames per second for each.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+
+#include <linux/videodev2.h>
+#include "libv4l-plugin.h"
+#include "libv4lconvert.h"
+
+struct frame {
+	unsigned char *data;
+	int size;
+};
+
+/* Fake device, so that no real device is needed to run the benchmark */
+static void *dev_init(int fd)
+{
+	return NULL;
+}
+
+static void dev_close(void *dev_ops_priv)
+{
+}
+
+static int dev_ioctl(void *dev_ops_priv, int fd, unsigned long cmd, void *arg)
+{
+	if (cmd == VIDIOC_QUERYCAP) {
+		struct v4l2_capability *cap = arg;
+
+		memset(cap, 0, sizeof(*cap));
+		strcpy((char *)cap->driver, "mjpeg-bench");
+		strcpy((char *)cap->card, "mjpeg-bench");
+		cap->capabilities = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
+		return 0;
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+static ssize_t dev_read(void *dev_ops_priv, int fd, void *buf, size_t len)
+{
+	errno = EINVAL;
+	return -1;
+}
+
+static ssize_t dev_write(void *dev_ops_priv, int fd, const void *buf,
+		size_t len)
+{
+	errno = EINVAL;
+	return -1;
+}
+
+static const struct libv4l_dev_ops dev_ops = {
+	.init = dev_init,
+	.close = dev_close,
+	.ioctl = dev_ioctl,
+	.read = dev_read,
+	.write = dev_write,
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Split the file contents into frames at the SOI / EOI markers */
+static int split_frames(unsigned char *buf, long size, struct frame **frames)
+{
+	int count = 0, allocated = 0;
+	long i = 0, start;
+
+	*frames = NULL;
+	while (i + 1 < size) {
+		if (buf[i] != 0xff || buf[i + 1] != 0xd8) {
+			i++;
+			continue;
+		}
+		start = i;
+		for (i += 2; i + 1 < size; i++)
+			if (buf[i] == 0xff && buf[i + 1] == 0xd9)
+				break;
+		i += 2;
+		if (i > size)
+			break;
+
+		if (count == allocated) {
+			allocated = allocated ? allocated * 2 : 64;
+			*frames = realloc(*frames, allocated * sizeof(**frames));
+			if (!*frames) {
+				perror("realloc");
+				exit(EXIT_FAILURE);
+			}
+		}
+		(*frames)[count].data = buf + start;
+		(*frames)[count].size = i - start;
+		count++;
+	}
+	return count;
+}
+
+/* Get the frame size from the SOF marker */
+static int get_jpeg_size(const struct frame *f, int *width, int *height)
+{
+	int i = 2;
+
+	while (i + 9 < f->size) {
+		int marker, len;
+
+		if (f->data[i] != 0xff)
+			return -1;
+		marker = f->data[i + 1];
+		len = (f->data[i + 2] << 8) | f->data[i + 3];
+		if (marker >= 0xc0 && marker <= 0xc3) {
+			*height = (f->data[i + 5] << 8) | f->data[i + 6];
+			*width = (f->data[i + 7] << 8) | f->data[i + 8];
+			return 0;
+		}
+		i += 2 + len;
+	}
+	return -1;
+}
+
+static double bench(const char *name, int use_tinyjpeg, struct frame *frames,
+		int nframes, int width, int height, unsigned int dst_fmt,
+		double seconds)
+{
+	struct v4lconvert_data *data;
+	struct v4l2_format src = { .type = V4L2_BUF_TYPE_VIDEO_CAPTURE };
+	struct v4l2_format dst;
+	unsigned char *dst_buf;
+	double start, elapsed;
+	int i, decoded = 0, errors = 0;
+
+	if (use_tinyjpeg)
+		setenv("LIBV4LCONVERT_USE_TINYJPEG", "1", 1);
+	else
+		unsetenv("LIBV4LCONVERT_USE_TINYJPEG");
+
+	data = v4lconvert_create_with_dev_ops(-1, NULL, &dev_ops);
+	if (!data) {
+		fprintf(stderr, "v4lconvert_create failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	src.fmt.pix.width = width;
+	src.fmt.pix.height = height;
+	src.fmt.pix.pixelformat = V4L2_PIX_FMT_MJPEG;
+	src.fmt.pix.field = V4L2_FIELD_NONE;
+	dst = src;
+	dst.fmt.pix.pixelformat = dst_fmt;
+	dst.fmt.pix.bytesperline = 0;
+	dst.fmt.pix.sizeimage = width * height * 4;
+
+	dst_buf = malloc(dst.fmt.pix.sizeimage);
+	if (!dst_buf) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	start = now();
+	do {
+		for (i = 0; i < nframes; i++) {
+			src.fmt.pix.sizeimage = frames[i].size;
+			if (v4lconvert_convert(data, &src, &dst, frames[i].data,
+					frames[i].size, dst_buf,
+					dst.fmt.pix.sizeimage) < 0)
+				errors++;
+			decoded++;
+		}
+		elapsed = now() - start;
+	} while (elapsed < seconds);
+
+	printf("%-9s: %d frames in %.2f s, %.1f fps, %.2f ms / frame",
+		name, decoded, elapsed, decoded / elapsed,
+		elapsed * 1000 / decoded);
+	if (errors)
+		printf(", %d errors (%s)", errors,
+			v4lconvert_get_error_message(data));
+	printf("\n");
+
+	free(dst_buf);
+	v4lconvert_destroy(data);
+
+	return decoded / elapsed;
+}
+
+static void usage(FILE *fp, char *prog)
+{
+	fprintf(fp,
+		"Usage: %s [options] file\n\n"
+		"Options:\n"
+		"-f | --format fourcc  Destination format [RGB3]\n"
+		"-t | --time seconds   Time to run each decoder [5]\n"
+		"-T | --tinyjpeg       Only benchmark tinyjpeg\n"
+		"-h | --help           Print this message\n",
+		prog);
+}
+
+static const struct option long_options[] = {
+	{ "format",	required_argument,	NULL,	'f' },
+	{ "time",	required_argument,	NULL,	't' },
+	{ "tinyjpeg",	no_argument,		NULL,	'T' },
+	{ "help",	no_argument,		NULL,	'h' },
+	{ 0, 0, 0, 0 }
+};
+
+int main(int argc, char **argv)
+{
+	unsigned int dst_fmt = V4L2_PIX_FMT_RGB24;
+	double seconds = 5, fps_libjpeg = 0, fps_tinyjpeg;
+	int only_tinyjpeg = 0, nframes, width, height;
+	struct frame *frames;
+	unsigned char *buf;
+	long size;
+	FILE *f;
+	int c;
+
+	while ((c = getopt_long(argc, argv, "f:t:Th", long_options,
+				NULL)) != -1) {
+		switch (c) {
+		case 'f':
+			if (strlen(optarg) != 4) {
+				usage(stderr, argv[0]);
+				return EXIT_FAILURE;
+			}
+			dst_fmt = v4l2_fourcc(optarg[0], optarg[1], optarg[2],
+					      optarg[3]);
+			break;
+		case 't':
+			seconds = atof(optarg);
+			break;
+		case 'T':
+			only_tinyjpeg = 1;
+			break;
+		case 'h':
+			usage(stdout, argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			usage(stderr, argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind != argc - 1) {
+		usage(stderr, argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	f = fopen(argv[optind], "rb");
+	if (!f) {
+		perror(argv[optind]);
+		return EXIT_FAILURE;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	buf = malloc(size);
+	if (!buf || fread(buf, 1, size, f) != (size_t)size) {
+		fprintf(stderr, "Error reading %s\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+	fclose(f);
+
+	nframes = split_frames(buf, size, &frames);
+	if (nframes == 0 || get_jpeg_size(&frames[0], &width, &height)) {
+		fprintf(stderr, "No JPEG frames found in %s\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+	printf("%d frames of %dx%d, decoding to %.4s\n", nframes, width,
+		height, (char *)&dst_fmt);
+
+	if (!only_tinyjpeg)
+		fps_libjpeg = bench("libjpeg", 0, frames, nframes, width,
+				    height, dst_fmt, seconds);
+	fps_tinyjpeg = bench("tinyjpeg", 1, frames, nframes, width, height,
+			     dst_fmt, seconds);
+	if (!only_tinyjpeg)
+		printf("tinyjpeg / libjpeg: %.2f\n",
+			fps_tinyjpeg / fps_libjpeg);
+
+	free(frames);
+	free(buf);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,881 @@
+/*
+ *  libv4lconvert conversion benchmark
+ *
+ *  This program can be used and distributed without restrictions.
+ *
+ *  Converts synthesized frames of every source format libv4lconvert knows
+ *  about to every destination format it supports, at a number of resolutions,
+ *  plain and with flipping, cropping, scaling to 2/3 of the size, 90 degree
+ *  rotation and software processing (whitebalance + gamma) enabled. Raw
+ *  formats are generated with the test pattern generator also used by
+ *  v4l2-ctl and vivid, MJPEG / JPEG frames are encoded from
+ *  those with libjpeg. Cam specific compressed formats can not be synthesized,
+ *  frames for these can be given as a corpus directory with files named
+ *  <fourcc>-<width>x<height>.raw containing a single captured frame each, for
+ *  example S561-352x288.raw.
+ *
+ *  The results are printed as CSV, one line per source format / destination
+ *  format / resolution / variant, with the time per frame and throughput in
+ *  source MPixels per second. When built with -DCOUNT_ALLOCS, for example
+ *  with "make CFLAGS='-O2 -DCOUNT_ALLOCS' v4lconvert-bench", it also prints
+ *  the number of heap allocations done per frame once warmed up (which should
+ *  be 0).
+ *
+ *  No device is needed, libv4lconvert is used through fake device ops.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <glob.h>
+#include <limits.h>
+
+#include <linux/videodev2.h>
+#include "libv4l-plugin.h"
+#include "libv4lconvert.h"
+#include "v4l2-tpg.h"
+
+#ifdef HAVE_JPEG
+#include <jpeglib.h>
+#endif
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+#define ALIGN(x, a) (((x) + (a) - 1) & ~((a) - 1))
+
+/* HM12 lines are always this long, see lib/libv4lconvert/hm12.c */
+#define HM12_STRIDE 720
+
+#ifdef COUNT_ALLOCS
+/* Count heap allocations by interposing the glibc allocator entry points.
+   This replaces the allocator of the whole process, so it is only done when
+   building with -DCOUNT_ALLOCS, and does not work together with ASan & co. */
+#ifndef __GLIBC__
+#error "COUNT_ALLOCS needs glibc"
+#endif
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+#error "COUNT_ALLOCS cannot be combined with a sanitizer"
+#endif
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+static unsigned long allocs;
+
+static void count_alloc(void)
+{
+	__atomic_fetch_add(&allocs, 1, __ATOMIC_RELAXED);
+}
+
+void *malloc(size_t size)
+{
+	count_alloc();
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	count_alloc();
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	count_alloc();
+	return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+	count_alloc();
+	return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	count_alloc();
+	return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	void *p;
+
+	if (!alignment || (alignment & (alignment - 1)) ||
+	    alignment % sizeof(void *))
+		return EINVAL;
+	count_alloc();
+	p = __libc_memalign(alignment, size);
+	if (!p)
+		return ENOMEM;
+	*memptr = p;
+	return 0;
+}
+
+static unsigned long get_allocs(void)
+{
+	return __atomic_load_n(&allocs, __ATOMIC_RELAXED);
+}
+
+static void print_allocs(unsigned long start, int frames)
+{
+	printf("%.2f", (double)(get_allocs() - start) / frames);
+}
+#else
+/* Not counted, the allocs_per_frame column stays empty */
+static unsigned long get_allocs(void)
+{
+	return 0;
+}
+
+static void print_allocs(unsigned long start, int frames)
+{
+}
+#endif
+
+/* How a source frame gets generated */
+enum gen {
+	GEN_TPG,	/* Directly by the tpg */
+	GEN_RAW,	/* Cam specific raw layout, filled with tpg base data */
+	GEN_BAYER16,	/* 8 bit bayer from the tpg shifted to 16 bits */
+	GEN_BAYER10P,	/* 8 bit bayer from the tpg packed MIPI 10 bit style */
+	GEN_BAYER12P,	/* 8 bit bayer from the tpg packed MIPI 12 bit style */
+	GEN_Y4,
+	GEN_Y6,
+	GEN_Y10BPACK,
+	GEN_HM12,	/* tpg nv12 in 16x16 tiles with 720 byte lines */
+	GEN_JPEG,	/* Encoded from tpg rgb24 with libjpeg */
+	GEN_CORPUS,	/* Only from the corpus dir */
+};
+
+struct src_fmt {
+	unsigned int fourcc;
+	enum gen gen;
+	unsigned int base;	/* tpg fourcc the frame is derived from */
+	int bpp;		/* bits per pixel for GEN_RAW */
+};
+
+/* This mirrors supported_src_pixfmts in lib/libv4lconvert/libv4lconvert.c */
+static const struct src_fmt src_fmts[] = {
+	{ V4L2_PIX_FMT_RGB24,		GEN_TPG },
+	{ V4L2_PIX_FMT_BGR24,		GEN_TPG },
+	{ V4L2_PIX_FMT_YUV420,		GEN_TPG },
+	{ V4L2_PIX_FMT_YVU420,		GEN_TPG },
+	{ V4L2_PIX_FMT_NV12,		GEN_TPG },
+	{ V4L2_PIX_FMT_NV21,		GEN_TPG },
+	{ V4L2_PIX_FMT_YUYV,		GEN_TPG },
+	{ V4L2_PIX_FMT_XRGB32,		GEN_TPG },
+	{ V4L2_PIX_FMT_XBGR32,		GEN_TPG },
+	{ V4L2_PIX_FMT_RGB565,		GEN_TPG },
+	{ V4L2_PIX_FMT_BGR32,		GEN_TPG },
+	{ V4L2_PIX_FMT_RGB32,		GEN_TPG },
+	{ V4L2_PIX_FMT_ABGR32,		GEN_TPG },
+	{ V4L2_PIX_FMT_ARGB32,		GEN_TPG },
+	{ V4L2_PIX_FMT_YVYU,		GEN_TPG },
+	{ V4L2_PIX_FMT_UYVY,		GEN_TPG },
+	{ V4L2_PIX_FMT_NV16,		GEN_TPG },
+	{ V4L2_PIX_FMT_NV61,		GEN_TPG },
+	{ V4L2_PIX_FMT_SPCA501,		GEN_RAW,	V4L2_PIX_FMT_YUV420, 12 },
+	{ V4L2_PIX_FMT_SPCA505,		GEN_RAW,	V4L2_PIX_FMT_YUV420, 12 },
+	{ V4L2_PIX_FMT_SPCA508,		GEN_RAW,	V4L2_PIX_FMT_YUV420, 12 },
+	{ V4L2_PIX_FMT_CIT_YYVYUY,	GEN_RAW,	V4L2_PIX_FMT_YUV420, 12 },
+	{ V4L2_PIX_FMT_KONICA420,	GEN_RAW,	V4L2_PIX_FMT_YUV420, 12 },
+	{ V4L2_PIX_FMT_SN9C20X_I420,	GEN_RAW,	V4L2_PIX_FMT_YUV420, 12 },
+	{ V4L2_PIX_FMT_M420,		GEN_RAW,	V4L2_PIX_FMT_YUV420, 12 },
+	{ V4L2_PIX_FMT_HM12,		GEN_HM12,	V4L2_PIX_FMT_NV12 },
+	{ V4L2_PIX_FMT_CPIA1,		GEN_CORPUS },
+	{ V4L2_PIX_FMT_MJPEG,		GEN_JPEG },
+	{ V4L2_PIX_FMT_JPEG,		GEN_JPEG },
+	{ V4L2_PIX_FMT_PJPG,		GEN_CORPUS },
+	{ V4L2_PIX_FMT_JPGL,		GEN_CORPUS },
+	{ V4L2_PIX_FMT_OV511,		GEN_CORPUS },
+	{ V4L2_PIX_FMT_OV518,		GEN_CORPUS },
+	{ V4L2_PIX_FMT_SBGGR8,		GEN_TPG },
+	{ V4L2_PIX_FMT_SGBRG8,		GEN_TPG },
+	{ V4L2_PIX_FMT_SGRBG8,		GEN_TPG },
+	{ V4L2_PIX_FMT_SRGGB8,		GEN_TPG },
+	{ V4L2_PIX_FMT_STV0680,		GEN_RAW,	V4L2_PIX_FMT_SRGGB8, 8 },
+	{ V4L2_PIX_FMT_SBGGR10,		GEN_TPG },
+	{ V4L2_PIX_FMT_SGBRG10,		GEN_TPG },
+	{ V4L2_PIX_FMT_SGRBG10,		GEN_TPG },
+	{ V4L2_PIX_FMT_SRGGB10,		GEN_TPG },
+	{ V4L2_PIX_FMT_SBGGR12,		GEN_TPG },
+	{ V4L2_PIX_FMT_SGBRG12,		GEN_TPG },
+	{ V4L2_PIX_FMT_SGRBG12,		GEN_TPG },
+	{ V4L2_PIX_FMT_SRGGB12,		GEN_TPG },
+	{ V4L2_PIX_FMT_SBGGR16,		GEN_BAYER16,	V4L2_PIX_FMT_SBGGR8 },
+	{ V4L2_PIX_FMT_SGBRG16,		GEN_BAYER16,	V4L2_PIX_FMT_SGBRG8 },
+	{ V4L2_PIX_FMT_SGRBG16,		GEN_BAYER16,	V4L2_PIX_FMT_SGRBG8 },
+	{ V4L2_PIX_FMT_SRGGB16,		GEN_BAYER16,	V4L2_PIX_FMT_SRGGB8 },
+	{ V4L2_PIX_FMT_SBGGR10P,	GEN_BAYER10P,	V4L2_PIX_FMT_SBGGR8 },
+	{ V4L2_PIX_FMT_SGBRG10P,	GEN_BAYER10P,	V4L2_PIX_FMT_SGBRG8 },
+	{ V4L2_PIX_FMT_SGRBG10P,	GEN_BAYER10P,	V4L2_PIX_FMT_SGRBG8 },
+	{ V4L2_PIX_FMT_SRGGB10P,	GEN_BAYER10P,	V4L2_PIX_FMT_SRGGB8 },
+	{ V4L2_PIX_FMT_SBGGR12P,	GEN_BAYER12P,	V4L2_PIX_FMT_SBGGR8 },
+	{ V4L2_PIX_FMT_SGBRG12P,	GEN_BAYER12P,	V4L2_PIX_FMT_SGBRG8 },
+	{ V4L2_PIX_FMT_SGRBG12P,	GEN_BAYER12P,	V4L2_PIX_FMT_SGRBG8 },
+	{ V4L2_PIX_FMT_SRGGB12P,	GEN_BAYER12P,	V4L2_PIX_FMT_SRGGB8 },
+	{ V4L2_PIX_FMT_SPCA561,		GEN_CORPUS },
+	{ V4L2_PIX_FMT_SN9C10X,		GEN_CORPUS },
+	{ V4L2_PIX_FMT_SN9C2028,	GEN_CORPUS },
+	{ V4L2_PIX_FMT_PAC207,		GEN_CORPUS },
+	{ V4L2_PIX_FMT_MR97310A,	GEN_CORPUS },
+	{ V4L2_PIX_FMT_JL2005BCD,	GEN_CORPUS },
+	{ V4L2_PIX_FMT_SQ905C,		GEN_CORPUS },
+	{ V4L2_PIX_FMT_SE401,		GEN_CORPUS },
+	{ V4L2_PIX_FMT_GREY,		GEN_TPG },
+	{ V4L2_PIX_FMT_Y4,		GEN_Y4,		V4L2_PIX_FMT_GREY },
+	{ V4L2_PIX_FMT_Y6,		GEN_Y6,		V4L2_PIX_FMT_GREY },
+	{ V4L2_PIX_FMT_Y10BPACK,	GEN_Y10BPACK,	V4L2_PIX_FMT_GREY },
+	{ V4L2_PIX_FMT_Y16,		GEN_TPG },
+	{ V4L2_PIX_FMT_Y16_BE,		GEN_TPG },
+	{ V4L2_PIX_FMT_HSV32,		GEN_TPG },
+	{ V4L2_PIX_FMT_HSV24,		GEN_TPG },
+};
+
+static const unsigned int dst_fmts[] = {
+	V4L2_PIX_FMT_RGB24,
+	V4L2_PIX_FMT_BGR24,
+	V4L2_PIX_FMT_YUV420,
+	V4L2_PIX_FMT_YVU420,
+	V4L2_PIX_FMT_NV12,
+	V4L2_PIX_FMT_NV21,
+	V4L2_PIX_FMT_YUYV,
+	V4L2_PIX_FMT_XRGB32,
+	V4L2_PIX_FMT_XBGR32,
+};
+
+enum variant {
+	VARIANT_PLAIN,
+	VARIANT_FLIP,
+	VARIANT_CROP,
+	VARIANT_PROCESS,
+	VARIANT_ROTATE,
+	VARIANT_SCALE,
+	VARIANT_COUNT
+};
+
+static const char * const variant_names[VARIANT_COUNT] = {
+	"plain", "flip", "crop", "process", "rotate", "scale"
+};
+
+static const int default_sizes[][2] = {
+	{ 320, 240 },
+	{ 640, 480 },
+	{ 1280, 720 },
+	{ 1920, 1080 },
+};
+
+struct frame {
+	unsigned char *data;
+	int size;
+	int bytesperline;	/* 0 to let libv4lconvert pick the default */
+	int width;
+	int height;
+};
+
+/* Fake device, so that no real device is needed to run the benchmark */
+static void *dev_init(int fd)
+{
+	return NULL;
+}
+
+static void dev_close(void *dev_ops_priv)
+{
+}
+
+static int dev_ioctl(void *dev_ops_priv, int fd, unsigned long cmd, void *arg)
+{
+	if (cmd == VIDIOC_QUERYCAP) {
+		struct v4l2_capability *cap = arg;
+
+		memset(cap, 0, sizeof(*cap));
+		strcpy((char *)cap->driver, "v4lconvert-bench");
+		strcpy((char *)cap->card, "v4lconvert-bench");
+		strcpy((char *)cap->bus_info, "v4lconvert-bench");
+		cap->capabilities = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
+		return 0;
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+static ssize_t dev_read(void *dev_ops_priv, int fd, void *buf, size_t len)
+{
+	errno = EINVAL;
+	return -1;
+}
+
+static ssize_t dev_write(void *dev_ops_priv, int fd, const void *buf,
+		size_t len)
+{
+	errno = EINVAL;
+	return -1;
+}
+
+static const struct libv4l_dev_ops dev_ops = {
+	.init = dev_init,
+	.close = dev_close,
+	.ioctl = dev_ioctl,
+	.read = dev_read,
+	.write = dev_write,
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Fourcc as string, without trailing spaces and with -BE for big endian */
+static const char *fcc2s(unsigned int fourcc)
+{
+	static char buf[4][16];
+	static int idx;
+	char *s = buf[idx++ & 3];
+	int i;
+
+	for (i = 0; i < 4; i++)
+		s[i] = (fourcc >> (8 * i)) & 0x7f;
+	while (i > 1 && s[i - 1] == ' ')
+		i--;
+	strcpy(s + i, (fourcc & (1U << 31)) ? "-BE" : "");
+	return s;
+}
+
+static void *xmalloc(size_t size)
+{
+	void *p = malloc(size);
+
+	if (!p) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+static int tpg_frame(unsigned int fourcc, int width, int height, int pattern,
+		struct frame *f)
+{
+	struct tpg_data tpg;
+	unsigned int p;
+
+	tpg_init(&tpg, width, height);
+	if (tpg_alloc(&tpg, width))
+		return -1;
+	if (!tpg_s_fourcc(&tpg, fourcc)) {
+		tpg_free(&tpg);
+		return -1;
+	}
+	tpg_reset_source(&tpg, width, height, V4L2_FIELD_NONE);
+	tpg_s_pattern(&tpg, pattern);
+
+	f->width = width;
+	f->height = height;
+	f->bytesperline = tpg_g_bytesperline(&tpg, 0);
+	f->size = 0;
+	for (p = 0; p < tpg_g_planes(&tpg); p++)
+		f->size += tpg_calc_plane_size(&tpg, p);
+	f->data = xmalloc(f->size);
+	tpg_fillbuffer(&tpg, 0, 0, f->data);
+	tpg_free(&tpg);
+	return 0;
+}
+
+#ifdef HAVE_JPEG
+static int jpeg_frame(int width, int height, int pattern, struct frame *f)
+{
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+	struct frame rgb;
+	unsigned long size = 0;
+	JSAMPROW row;
+
+	if (tpg_frame(V4L2_PIX_FMT_RGB24, width, height, pattern, &rgb))
+		return -1;
+
+	cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_compress(&cinfo);
+	f->data = NULL;
+	jpeg_mem_dest(&cinfo, &f->data, &size);
+	cinfo.image_width = width;
+	cinfo.image_height = height;
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, 80, TRUE);
+	/* 4:2:2 like most webcams */
+	cinfo.comp_info[0].h_samp_factor = 2;
+	cinfo.comp_info[0].v_samp_factor = 1;
+	jpeg_start_compress(&cinfo, TRUE);
+	while (cinfo.next_scanline < cinfo.image_height) {
+		row = rgb.data + cinfo.next_scanline * rgb.bytesperline;
+		jpeg_write_scanlines(&cinfo, &row, 1);
+	}
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+	free(rgb.data);
+
+	f->size = size;
+	f->bytesperline = 0;
+	f->width = width;
+	f->height = height;
+	return 0;
+}
+#endif
+
+/* Store a plane as 16x16 tiles of 256 bytes each, like the cx2341x does */
+static void hm12_tile_plane(unsigned char *dst, const unsigned char *src,
+		int width, int height, int bytesperline)
+{
+	int x, y;
+
+	for (y = 0; y < height; y++)
+		for (x = 0; x < width; x++)
+			dst[(y / 16) * 16 * HM12_STRIDE + (x / 16) * 256 +
+			    (y % 16) * 16 + x % 16] = src[y * bytesperline + x];
+}
+
+/* Derive the frames which the tpg cannot generate itself from a tpg frame */
+static int derived_frame(const struct src_fmt *fmt, int width, int height,
+		int pattern, struct frame *f)
+{
+	struct frame base;
+	int i, x, y, n = width * height;
+
+	if (fmt->gen == GEN_HM12 && width > HM12_STRIDE)
+		return -1;
+	if (tpg_frame(fmt->base, width, height, pattern, &base))
+		return -1;
+
+	f->width = width;
+	f->height = height;
+	switch (fmt->gen) {
+	case GEN_RAW:
+		f->size = n * fmt->bpp / 8;
+		f->bytesperline = 0;
+		f->data = xmalloc(f->size);
+		memcpy(f->data, base.data, f->size < base.size ? f->size : base.size);
+		break;
+	case GEN_BAYER16:
+		f->size = n * 2;
+		f->bytesperline = width * 2;
+		f->data = xmalloc(f->size);
+		for (i = 0; i < n; i++) {
+			f->data[2 * i] = base.data[i];
+			f->data[2 * i + 1] = base.data[i];
+		}
+		break;
+	case GEN_BAYER10P:
+		/* 4 pixels in 5 bytes, the lsb-s byte after each (partial) group */
+		f->bytesperline = (width * 5 + 3) / 4;
+		f->size = f->bytesperline * height;
+		f->data = xmalloc(f->size);
+		memset(f->data, 0, f->size);
+		for (y = 0; y < height; y++) {
+			const unsigned char *s = base.data + y * base.bytesperline;
+			unsigned char *d = f->data + y * f->bytesperline;
+
+			for (x = 0; x < width; x++)
+				d[x / 4 * 5 + x % 4] = s[x];
+		}
+		break;
+	case GEN_BAYER12P:
+		/* 2 pixels in 3 bytes, the lsb-s byte after each (partial) group */
+		f->bytesperline = (width * 3 + 1) / 2;
+		f->size = f->bytesperline * height;
+		f->data = xmalloc(f->size);
+		memset(f->data, 0, f->size);
+		for (y = 0; y < height; y++) {
+			const unsigned char *s = base.data + y * base.bytesperline;
+			unsigned char *d = f->data + y * f->bytesperline;
+
+			for (x = 0; x < width; x++)
+				d[x / 2 * 3 + x % 2] = s[x];
+		}
+		break;
+	case GEN_Y4:
+	case GEN_Y6:
+		f->size = n;
+		f->bytesperline = width;
+		f->data = xmalloc(f->size);
+		for (i = 0; i < n; i++)
+			f->data[i] = base.data[i] >> (fmt->gen == GEN_Y4 ? 4 : 2);
+		break;
+	case GEN_Y10BPACK:
+		/* Big endian 10 bit packed, one bitstream without line padding */
+		f->bytesperline = 0;
+		f->size = (n * 10 + 7) / 8;
+		f->data = xmalloc(f->size);
+		memset(f->data, 0, f->size);
+		for (i = 0, y = 0; y < height; y++) {
+			const unsigned char *s = base.data + y * base.bytesperline;
+
+			for (x = 0; x < width; x++, i++) {
+				/* 10 bits starting at bit i * 10 always span 2 bytes */
+				unsigned int bits = (s[x] << 2) << (6 - i * 10 % 8);
+
+				f->data[i * 10 / 8] |= bits >> 8;
+				f->data[i * 10 / 8 + 1] |= bits & 0xff;
+			}
+		}
+		break;
+	case GEN_HM12:
+		/* The uv tiles follow the y plane directly, but are read in
+		   whole 32 line (16 chroma line) macroblocks */
+		f->bytesperline = HM12_STRIDE;
+		f->size = HM12_STRIDE * ALIGN(height, 32) * 3 / 2;
+		f->data = xmalloc(f->size);
+		memset(f->data, 0, f->size);
+		hm12_tile_plane(f->data, base.data, width, height,
+				base.bytesperline);
+		hm12_tile_plane(f->data + HM12_STRIDE * height,
+				base.data + base.bytesperline * height,
+				width, height / 2, base.bytesperline);
+		break;
+	default:
+		free(base.data);
+		return -1;
+	}
+	free(base.data);
+	return 0;
+}
+
+static int corpus_frame(const char *corpus, unsigned int fourcc,
+		struct frame *f)
+{
+	char pattern[PATH_MAX];
+	const char *name;
+	unsigned int w, h;
+	glob_t globbuf;
+	long size;
+	FILE *fp;
+
+	if (!corpus)
+		return -1;
+
+	snprintf(pattern, sizeof(pattern), "%s/%s-*x*.raw", corpus,
+			fcc2s(fourcc));
+	if (glob(pattern, 0, NULL, &globbuf))
+		return -1;
+
+	name = globbuf.gl_pathv[0];
+	if (sscanf(strrchr(name, '-') + 1, "%ux%u.raw", &w, &h) != 2) {
+		fprintf(stderr, "Cannot get the resolution from %s\n", name);
+		exit(EXIT_FAILURE);
+	}
+
+	fp = fopen(name, "rb");
+	if (!fp) {
+		perror(name);
+		exit(EXIT_FAILURE);
+	}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	f->data = xmalloc(size);
+	if (fread(f->data, 1, size, fp) != (size_t)size) {
+		fprintf(stderr, "Error reading %s\n", name);
+		exit(EXIT_FAILURE);
+	}
+	fclose(fp);
+	globfree(&globbuf);
+
+	f->size = size;
+	f->bytesperline = 0;
+	f->width = w;
+	f->height = h;
+	return 0;
+}
+
+static void set_ctrl(struct v4lconvert_data *data, unsigned int id, int value)
+{
+	struct v4l2_control ctrl = { .id = id, .value = value };
+
+	v4lconvert_vidioc_s_ctrl(data, &ctrl);
+}
+
+/* The fake controls live in shared memory, so always set all of them */
+static void set_variant(struct v4lconvert_data *data, enum variant variant)
+{
+	set_ctrl(data, V4L2_CID_HFLIP, variant == VARIANT_FLIP);
+	set_ctrl(data, V4L2_CID_VFLIP, variant == VARIANT_FLIP);
+	set_ctrl(data, V4L2_CID_AUTO_WHITE_BALANCE, variant == VARIANT_PROCESS);
+	set_ctrl(data, V4L2_CID_GAMMA, variant == VARIANT_PROCESS ? 1500 : 1000);
+	set_ctrl(data, V4L2_CID_ROTATE, variant == VARIANT_ROTATE ? 90 : 0);
+}
+
+/* CSV field, without the separators and newlines error messages may have */
+static void print_field(const char *s)
+{
+	for (; *s; s++)
+		putchar(*s == ',' || *s == '\n' ? ' ' : *s);
+}
+
+static void bench(struct v4lconvert_data *data, unsigned int src_fourcc,
+		const struct frame *f, unsigned int dst_fourcc,
+		enum variant variant, double seconds, unsigned char *dst_buf,
+		int dst_buf_size)
+{
+	struct v4l2_format src = { .type = V4L2_BUF_TYPE_VIDEO_CAPTURE };
+	struct v4l2_format dst;
+	unsigned long allocs_start;
+	double start, elapsed;
+	int frames = 0;
+
+	src.fmt.pix.width = f->width;
+	src.fmt.pix.height = f->height;
+	src.fmt.pix.pixelformat = src_fourcc;
+	src.fmt.pix.field = V4L2_FIELD_NONE;
+	src.fmt.pix.bytesperline = f->bytesperline;
+	src.fmt.pix.sizeimage = f->size;
+	dst = src;
+	dst.fmt.pix.pixelformat = dst_fourcc;
+	dst.fmt.pix.bytesperline = 0;
+	if (variant == VARIANT_CROP) {
+		dst.fmt.pix.width = (f->width * 7 / 8) & ~7;
+		dst.fmt.pix.height = (f->height * 7 / 8) & ~7;
+	}
+	if (variant == VARIANT_SCALE) {
+		dst.fmt.pix.width = (f->width * 2 / 3) & ~7;
+		dst.fmt.pix.height = (f->height * 2 / 3) & ~1;
+	}
+	if (variant == VARIANT_ROTATE) {
+		dst.fmt.pix.width = f->height;
+		dst.fmt.pix.height = f->width;
+	}
+	v4lconvert_fixup_fmt(&dst);
+
+	printf("%s,%s,%d,%d,%s,", fcc2s(src_fourcc), fcc2s(dst_fourcc),
+		f->width, f->height, variant_names[variant]);
+
+	set_variant(data, variant);
+
+	/* Warm up, this also does all the buffer allocations */
+	if (v4lconvert_convert(data, &src, &dst, f->data, f->size, dst_buf,
+				dst_buf_size) < 0) {
+		printf("0,,,,");
+		print_field(v4lconvert_get_error_message(data));
+		printf("\n");
+		return;
+	}
+
+	allocs_start = get_allocs();
+	start = now();
+	do {
+		v4lconvert_convert(data, &src, &dst, f->data, f->size, dst_buf,
+				dst_buf_size);
+		frames++;
+		elapsed = now() - start;
+	} while (elapsed < seconds);
+
+	printf("%d,%.0f,%.2f,", frames, elapsed * 1e9 / frames,
+		(double)f->width * f->height * frames / elapsed / 1e6);
+	print_allocs(allocs_start, frames);
+	printf(",ok\n");
+	fflush(stdout);
+}
+
+static void usage(FILE *fp, char *prog)
+{
+	fprintf(fp,
+		"Usage: %s [options]\n\n"
+		"Options:\n"
+		"-s | --src fourcc       Only benchmark this source format\n"
+		"-d | --dst fourcc       Only benchmark this destination format\n"
+		"-r | --res WxH          Resolution, can be given multiple times\n"
+		"                        [320x240 640x480 1280x720 1920x1080]\n"
+		"-v | --variant name     Only run this variant (plain, flip, crop,\n"
+		"                        process, rotate or scale)\n"
+		"-c | --corpus dir       Directory with captured frames named\n"
+		"                        <fourcc>-<width>x<height>.raw\n"
+		"-p | --pattern nr       Test pattern generator pattern [0]\n"
+		"-t | --time seconds     Time to run each conversion [0.1]\n"
+		"-h | --help             Print this message\n",
+		prog);
+}
+
+static const struct option long_options[] = {
+	{ "src",	required_argument,	NULL,	's' },
+	{ "dst",	required_argument,	NULL,	'd' },
+	{ "res",	required_argument,	NULL,	'r' },
+	{ "variant",	required_argument,	NULL,	'v' },
+	{ "corpus",	required_argument,	NULL,	'c' },
+	{ "pattern",	required_argument,	NULL,	'p' },
+	{ "time",	required_argument,	NULL,	't' },
+	{ "help",	no_argument,		NULL,	'h' },
+	{ 0, 0, 0, 0 }
+};
+
+/* The reverse of fcc2s() */
+static unsigned int parse_fourcc(const char *s, char *prog)
+{
+	char fcc[4] = { ' ', ' ', ' ', ' ' };
+	size_t len = strlen(s);
+	unsigned int be = 0;
+
+	if (len > 3 && !strcmp(s + len - 3, "-BE")) {
+		be = 1U << 31;
+		len -= 3;
+	}
+	if (len < 1 || len > 4) {
+		usage(stderr, prog);
+		exit(EXIT_FAILURE);
+	}
+	memcpy(fcc, s, len);
+	return v4l2_fourcc(fcc[0], fcc[1], fcc[2], fcc[3]) | be;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int only_src = 0, only_dst = 0;
+	int sizes[16][2], nsizes = 0, only_variant = -1, pattern = 0;
+	const char *corpus = NULL;
+	struct v4lconvert_data *data;
+	unsigned char *dst_buf = NULL;
+	int dst_buf_size = 0;
+	double seconds = 0.1;
+	int c, i, j, k, v;
+
+	while ((c = getopt_long(argc, argv, "s:d:r:v:c:p:t:h", long_options,
+				NULL)) != -1) {
+		switch (c) {
+		case 's':
+			only_src = parse_fourcc(optarg, argv[0]);
+			break;
+		case 'd':
+			only_dst = parse_fourcc(optarg, argv[0]);
+			break;
+		case 'r':
+			if (nsizes == ARRAY_SIZE(sizes) ||
+			    sscanf(optarg, "%dx%d", &sizes[nsizes][0],
+				   &sizes[nsizes][1]) != 2 ||
+			    sizes[nsizes][0] < 8 || sizes[nsizes][1] < 8) {
+				usage(stderr, argv[0]);
+				return EXIT_FAILURE;
+			}
+			nsizes++;
+			break;
+		case 'v':
+			for (v = 0; v < VARIANT_COUNT; v++)
+				if (!strcmp(optarg, variant_names[v]))
+					break;
+			if (v == VARIANT_COUNT) {
+				usage(stderr, argv[0]);
+				return EXIT_FAILURE;
+			}
+			only_variant = v;
+			break;
+		case 'c':
+			corpus = optarg;
+			break;
+		case 'p':
+			pattern = atoi(optarg);
+			break;
+		case 't':
+			seconds = atof(optarg);
+			break;
+		case 'h':
+			usage(stdout, argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			usage(stderr, argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind != argc) {
+		usage(stderr, argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (!nsizes) {
+		for (i = 0; i < ARRAY_SIZE(default_sizes); i++) {
+			sizes[i][0] = default_sizes[i][0];
+			sizes[i][1] = default_sizes[i][1];
+		}
+		nsizes = ARRAY_SIZE(default_sizes);
+	}
+
+	data = v4lconvert_create_with_dev_ops(-1, NULL, &dev_ops);
+	if (!data) {
+		fprintf(stderr, "v4lconvert_create failed\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("src,dst,width,height,variant,frames,ns_per_frame,mpix_per_s,"
+	       "allocs_per_frame,status\n");
+
+	for (i = 0; i < ARRAY_SIZE(src_fmts); i++) {
+		const struct src_fmt *fmt = &src_fmts[i];
+
+		if (only_src && fmt->fourcc != only_src)
+			continue;
+
+		for (j = 0; j < nsizes; j++) {
+			struct frame f = { NULL };
+			int r = -1;
+
+			switch (fmt->gen) {
+			case GEN_TPG:
+				r = tpg_frame(fmt->fourcc, sizes[j][0],
+					      sizes[j][1], pattern, &f);
+				break;
+			case GEN_JPEG:
+#ifdef HAVE_JPEG
+				r = jpeg_frame(sizes[j][0], sizes[j][1],
+					       pattern, &f);
+#endif
+				break;
+			case GEN_CORPUS:
+				/* Only 1 frame / resolution per format */
+				if (j == 0)
+					r = corpus_frame(corpus, fmt->fourcc,
+							 &f);
+				break;
+			default:
+				r = derived_frame(fmt, sizes[j][0],
+						  sizes[j][1], pattern, &f);
+				break;
+			}
+			if (r) {
+				if (j == 0)
+					printf("%s,,,,,0,,,,no input\n",
+					       fcc2s(fmt->fourcc));
+				continue;
+			}
+
+			if (dst_buf_size < f.width * f.height * 4) {
+				free(dst_buf);
+				dst_buf_size = f.width * f.height * 4;
+				dst_buf = xmalloc(dst_buf_size);
+			}
+
+			for (k = 0; k < ARRAY_SIZE(dst_fmts); k++) {
+				if (only_dst && dst_fmts[k] != only_dst)
+					continue;
+				if (!v4lconvert_supported_dst_format(dst_fmts[k]))
+					continue;
+				for (v = 0; v < VARIANT_COUNT; v++) {
+					if (only_variant != -1 &&
+					    v != only_variant)
+						continue;
+					bench(data, fmt->fourcc, &f,
+					      dst_fmts[k], v, seconds,
+					      dst_buf, dst_buf_size);
+				}
+			}
+			free(f.data);
+		}
+	}
+
+	set_variant(data, VARIANT_PLAIN);
+	free(dst_buf);
+	v4lconvert_destroy(data);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,520 @@
+/*
+ *  libv4lconvert SIMD test
+ *
+ *  This program can be used and distributed without restrictions.
+ *
+ *  Checks that the SIMD routines libv4lconvert picks for this CPU give
+ *  exactly the same output as the C versions they replace. Conversions which
+ *  end up in every v4lconvert_simd routine (packed yuv 4:2:2, yuv420, bayer
+ *  and HM12 sources, tinyjpeg decoding, flipping, cropping, scaling, 90
+ *  degree rotation and software processing) are run over odd and even
+ *  widths and with and without padded strides, once in a child process with
+ *  LIBV4LCONVERT_SIMD=0 and once with the SIMD routines, and the results are
+ *  compared.
+ *
+ *  Exits with 0 when all results are the same, 1 otherwise. No device is
+ *  needed, libv4lconvert is used through fake device ops.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <linux/videodev2.h>
+#include "libv4l-plugin.h"
+#include "libv4lconvert.h"
+
+#ifdef HAVE_JPEG
+#include <jpeglib.h>
+#endif
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+#define ALIGN(x, a) (((x) + (a) - 1) & ~((a) - 1))
+
+static const unsigned int src_fmts[] = {
+	V4L2_PIX_FMT_YUYV,
+	V4L2_PIX_FMT_YVYU,
+	V4L2_PIX_FMT_UYVY,
+	V4L2_PIX_FMT_YUV420,
+	V4L2_PIX_FMT_YVU420,
+	V4L2_PIX_FMT_RGB24,
+	V4L2_PIX_FMT_SBGGR8,
+	V4L2_PIX_FMT_SGRBG8,
+	V4L2_PIX_FMT_HM12,
+#ifdef HAVE_JPEG
+	V4L2_PIX_FMT_MJPEG,
+#endif
+};
+
+static const unsigned int dst_fmts[] = {
+	V4L2_PIX_FMT_RGB24,
+	V4L2_PIX_FMT_BGR24,
+	V4L2_PIX_FMT_YUV420,
+	V4L2_PIX_FMT_YVU420,
+	V4L2_PIX_FMT_NV12,
+};
+
+/* Odd and even widths, around and away from the vector sizes. The heights
+   are even, as the yuv420 code needs (and try_fmt gives) */
+static const int sizes[][2] = {
+	{ 16, 8 },
+	{ 18, 6 },
+	{ 31, 8 },
+	{ 33, 10 },
+	{ 34, 10 },
+	{ 62, 14 },
+	{ 64, 16 },
+	{ 66, 12 },
+	{ 97, 12 },
+	{ 130, 20 },
+	{ 322, 34 },
+};
+
+/* Extra bytes per line, for the formats which have a stride */
+static const int pads[] = { 0, 12 };
+
+enum variant {
+	VARIANT_PLAIN,
+	VARIANT_FLIP,
+	VARIANT_CROP,
+	VARIANT_PROCESS,
+	VARIANT_ROTATE,
+	VARIANT_SCALE,
+	VARIANT_COUNT
+};
+
+static const char * const variant_names[VARIANT_COUNT] = {
+	"plain", "flip", "crop", "process", "rotate", "scale"
+};
+
+#define NOT_TESTED -2
+
+struct result {
+	uint64_t hash;
+	int ret;
+};
+
+static struct v4lconvert_data *convert;
+
+/* Fake device, so that no real device is needed to run the test */
+static void *dev_init(int fd)
+{
+	return NULL;
+}
+
+static void dev_close(void *dev_ops_priv)
+{
+}
+
+static int dev_ioctl(void *dev_ops_priv, int fd, unsigned long cmd, void *arg)
+{
+	if (cmd == VIDIOC_QUERYCAP) {
+		struct v4l2_capability *cap = arg;
+
+		memset(cap, 0, sizeof(*cap));
+		strcpy((char *)cap->driver, "v4lconvert-simd-test");
+		strcpy((char *)cap->card, "v4lconvert-simd-test");
+		strcpy((char *)cap->bus_info, "v4lconvert-simd-test");
+		cap->capabilities = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
+		return 0;
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+static ssize_t dev_read(void *dev_ops_priv, int fd, void *buf, size_t len)
+{
+	errno = EINVAL;
+	return -1;
+}
+
+static ssize_t dev_write(void *dev_ops_priv, int fd, const void *buf,
+		size_t len)
+{
+	errno = EINVAL;
+	return -1;
+}
+
+static const struct libv4l_dev_ops dev_ops = {
+	.init = dev_init,
+	.close = dev_close,
+	.ioctl = dev_ioctl,
+	.read = dev_read,
+	.write = dev_write,
+};
+
+static void *xmalloc(size_t size)
+{
+	void *p = malloc(size);
+
+	if (!p) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+/* Deterministic pseudo random bytes, the same in both processes */
+static void fill_random(unsigned char *buf, int size, uint32_t seed)
+{
+	int i;
+
+	for (i = 0; i < size; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+}
+
+static uint64_t fnv1a(uint64_t hash, const unsigned char *buf, int size)
+{
+	int i;
+
+	for (i = 0; i < size; i++)
+		hash = (hash ^ buf[i]) * 0x100000001b3ULL;
+	return hash;
+}
+
+#ifdef HAVE_JPEG
+/* A smooth gradient with some noise, so that all DCT coefficients get used */
+static unsigned char *jpeg_frame(int width, int height, uint32_t seed,
+		int *size)
+{
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+	unsigned char *rgb, *data = NULL;
+	unsigned long jpeg_size = 0;
+	JSAMPROW row;
+	int i;
+
+	rgb = xmalloc(width * height * 3);
+	fill_random(rgb, width * height * 3, seed);
+	for (i = 0; i < width * height * 3; i++)
+		rgb[i] = (rgb[i] >> 3) + (i / 3 % width) * 200 / width;
+
+	cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_compress(&cinfo);
+	jpeg_mem_dest(&cinfo, &data, &jpeg_size);
+	cinfo.image_width = width;
+	cinfo.image_height = height;
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, 90, TRUE);
+	/* 4:2:2 like most webcams */
+	cinfo.comp_info[0].h_samp_factor = 2;
+	cinfo.comp_info[0].v_samp_factor = 1;
+	jpeg_start_compress(&cinfo, TRUE);
+	while (cinfo.next_scanline < cinfo.image_height) {
+		row = rgb + cinfo.next_scanline * width * 3;
+		jpeg_write_scanlines(&cinfo, &row, 1);
+	}
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+	free(rgb);
+
+	*size = jpeg_size;
+	return data;
+}
+#endif
+
+/* Fill in src for a width x height frame of fourcc with pad extra bytes per
+   line and return the frame, or NULL when the combination is not tested */
+static unsigned char *src_frame(unsigned int fourcc, int width, int height,
+		int pad, uint32_t seed, struct v4l2_format *src)
+{
+	unsigned char *data;
+
+	memset(src, 0, sizeof(*src));
+	src->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	src->fmt.pix.width = width;
+	src->fmt.pix.height = height;
+	src->fmt.pix.pixelformat = fourcc;
+	src->fmt.pix.field = V4L2_FIELD_NONE;
+
+	switch (fourcc) {
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_YVYU:
+	case V4L2_PIX_FMT_UYVY:
+		src->fmt.pix.bytesperline = width * 2 + pad;
+		break;
+	case V4L2_PIX_FMT_RGB24:
+		src->fmt.pix.bytesperline = width * 3 + pad;
+		break;
+	case V4L2_PIX_FMT_SBGGR8:
+	case V4L2_PIX_FMT_SGRBG8:
+		if (width & 1)
+			return NULL;
+		src->fmt.pix.bytesperline = width + pad;
+		break;
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+		if (pad || (width & 1))
+			return NULL;
+		src->fmt.pix.bytesperline = width;
+		src->fmt.pix.sizeimage = width * height * 3 / 2;
+		break;
+	case V4L2_PIX_FMT_HM12:
+		/* Always a 720 byte stride and 32 line chroma tiles */
+		if (pad || width > 720)
+			return NULL;
+		src->fmt.pix.bytesperline = width;
+		src->fmt.pix.sizeimage = 720 * ALIGN(height, 32) * 3 / 2;
+		break;
+#ifdef HAVE_JPEG
+	case V4L2_PIX_FMT_MJPEG: {
+		int size;
+
+		if (pad)
+			return NULL;
+		data = jpeg_frame(width, height, seed, &size);
+		src->fmt.pix.sizeimage = size;
+		return data;
+	}
+#endif
+	default:
+		return NULL;
+	}
+	if (!src->fmt.pix.sizeimage)
+		src->fmt.pix.sizeimage = src->fmt.pix.bytesperline * height;
+
+	data = xmalloc(src->fmt.pix.sizeimage);
+	fill_random(data, src->fmt.pix.sizeimage, seed);
+	return data;
+}
+
+static void set_ctrl(struct v4lconvert_data *data, unsigned int id, int value)
+{
+	struct v4l2_control ctrl = { .id = id, .value = value };
+
+	v4lconvert_vidioc_s_ctrl(data, &ctrl);
+}
+
+/* The fake controls live in shared memory, so always set all of them */
+static void set_variant(struct v4lconvert_data *data, enum variant variant)
+{
+	set_ctrl(data, V4L2_CID_HFLIP, variant == VARIANT_FLIP);
+	set_ctrl(data, V4L2_CID_VFLIP, variant == VARIANT_FLIP);
+	set_ctrl(data, V4L2_CID_AUTO_WHITE_BALANCE, variant == VARIANT_PROCESS);
+	set_ctrl(data, V4L2_CID_GAMMA, variant == VARIANT_PROCESS ? 1500 : 1000);
+	set_ctrl(data, V4L2_CID_ROTATE, variant == VARIANT_ROTATE ? 90 : 0);
+}
+
+/* Call func for all test cases, in the same order every time */
+static void for_each_case(void (*func)(void *arg, int nr, unsigned int src,
+		unsigned int dst, int width, int height, int pad, int variant),
+		void *arg)
+{
+	unsigned int s, d, i, p, v;
+	int nr = 0;
+
+	for (s = 0; s < ARRAY_SIZE(src_fmts); s++)
+		for (d = 0; d < ARRAY_SIZE(dst_fmts); d++)
+			for (i = 0; i < ARRAY_SIZE(sizes); i++)
+				for (p = 0; p < ARRAY_SIZE(pads); p++)
+					for (v = 0; v < VARIANT_COUNT; v++)
+						func(arg, nr++, src_fmts[s],
+						     dst_fmts[d], sizes[i][0],
+						     sizes[i][1], pads[p], v);
+}
+
+static void count_case(void *arg, int nr, unsigned int src, unsigned int dst,
+		int width, int height, int pad, int variant)
+{
+	(*(int *)arg)++;
+}
+
+/* Odd width 4:2:2 frames end with half a macro pixel, which the converters
+   drop. That leaves the last column of intermediate buffers unwritten, so
+   only test these when converting straight into the destination buffer */
+static int odd_width_ok(unsigned int src_fourcc, unsigned int dst_fourcc,
+		int variant)
+{
+	switch (src_fourcc) {
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_YVYU:
+	case V4L2_PIX_FMT_UYVY:
+		return variant == VARIANT_PLAIN &&
+		       dst_fourcc != V4L2_PIX_FMT_NV12;
+	}
+	return 1;
+}
+
+static void run_case(void *arg, int nr, unsigned int src_fourcc,
+		unsigned int dst_fourcc, int width, int height, int pad,
+		int variant)
+{
+	struct result *results = arg;
+	struct v4l2_format src, dst;
+	unsigned char *src_data, *dst_data;
+	int dst_size;
+
+	src_data = NULL;
+	if (!(width & 1) || odd_width_ok(src_fourcc, dst_fourcc, variant))
+		src_data = src_frame(src_fourcc, width, height, pad, nr, &src);
+	if (!src_data) {
+		results[nr].ret = NOT_TESTED;
+		results[nr].hash = 0;
+		return;
+	}
+
+	dst = src;
+	dst.fmt.pix.pixelformat = dst_fourcc;
+	dst.fmt.pix.bytesperline = 0;
+	dst.fmt.pix.sizeimage = 0;
+	switch (variant) {
+	case VARIANT_CROP:
+		dst.fmt.pix.width = (width * 7 / 8) & ~1;
+		dst.fmt.pix.height = (height * 7 / 8) & ~1;
+		break;
+	case VARIANT_SCALE:
+		dst.fmt.pix.width = (width * 2 / 3) & ~1;
+		dst.fmt.pix.height = (height * 2 / 3) & ~1;
+		break;
+	case VARIANT_ROTATE:
+		dst.fmt.pix.width = height;
+		dst.fmt.pix.height = width;
+		break;
+	}
+	v4lconvert_fixup_fmt(&dst);
+
+	/* Also catch writes past the end of the frame */
+	dst_size = width * height * 4 + 4096;
+	dst_data = xmalloc(dst_size);
+	memset(dst_data, 0xa5, dst_size);
+
+	set_variant(convert, variant);
+	results[nr].ret = v4lconvert_convert(convert, &src, &dst, src_data,
+			src.fmt.pix.sizeimage, dst_data, dst_size);
+	results[nr].hash = fnv1a(0xcbf29ce484222325ULL, dst_data, dst_size);
+
+	free(dst_data);
+	free(src_data);
+}
+
+static void run_cases(struct result *results)
+{
+	convert = v4lconvert_create_with_dev_ops(-1, NULL, &dev_ops);
+	if (!convert) {
+		fprintf(stderr, "v4lconvert_create failed\n");
+		exit(EXIT_FAILURE);
+	}
+	for_each_case(run_case, results);
+	set_variant(convert, VARIANT_PLAIN);
+	v4lconvert_destroy(convert);
+}
+
+struct check {
+	const struct result *expected;	/* With the C versions */
+	const struct result *results;
+	int ran, errors, skipped, failed;
+};
+
+static void fcc2s(unsigned int fourcc, char *s)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		s[i] = (fourcc >> (8 * i)) & 0x7f;
+	s[4] = 0;
+}
+
+static void check_case(void *arg, int nr, unsigned int src_fourcc,
+		unsigned int dst_fourcc, int width, int height, int pad,
+		int variant)
+{
+	struct check *check = arg;
+	const struct result *e = &check->expected[nr];
+	const struct result *r = &check->results[nr];
+	char src[5], dst[5];
+
+	if (e->ret == r->ret && e->hash == r->hash) {
+		if (r->ret == NOT_TESTED)
+			check->skipped++;
+		else if (r->ret < 0)
+			check->errors++;
+		else
+			check->ran++;
+		return;
+	}
+
+	fcc2s(src_fourcc, src);
+	fcc2s(dst_fourcc, dst);
+	printf("FAIL %s -> %s %dx%d pad %d %s: result %d, C %d%s\n", src, dst,
+	       width, height, pad, variant_names[variant], r->ret, e->ret,
+	       e->ret == r->ret ? ", output differs" : "");
+	check->failed++;
+}
+
+int main(void)
+{
+	struct result *expected, *results;
+	struct check check = { NULL };
+	int count = 0, status;
+	size_t size, done;
+	ssize_t n;
+	int fds[2];
+	pid_t pid;
+
+	/* Use the decoder and scaler which have SIMD routines */
+	setenv("LIBV4LCONVERT_USE_TINYJPEG", "1", 1);
+	setenv("LIBV4LCONVERT_SCALE", "1", 1);
+
+	for_each_case(count_case, &count);
+	size = count * sizeof(struct result);
+	expected = xmalloc(size);
+	results = xmalloc(size);
+
+	/* libv4lconvert picks the routines once per process */
+	if (pipe(fds)) {
+		perror("pipe");
+		return EXIT_FAILURE;
+	}
+	pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		return EXIT_FAILURE;
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		setenv("LIBV4LCONVERT_SIMD", "0", 1);
+		run_cases(expected);
+		for (done = 0; done < size; done += n) {
+			n = write(fds[1], (char *)expected + done, size - done);
+			if (n <= 0)
+				_exit(EXIT_FAILURE);
+		}
+		_exit(EXIT_SUCCESS);
+	}
+	close(fds[1]);
+	for (done = 0; done < size; done += n) {
+		n = read(fds[0], (char *)expected + done, size - done);
+		if (n <= 0)
+			break;
+	}
+	close(fds[0]);
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+	    WEXITSTATUS(status) || done != size) {
+		fprintf(stderr, "Running the conversions with the C versions failed\n");
+		return EXIT_FAILURE;
+	}
+
+	/* Now with the SIMD versions, after the child is done with the shared
+	   controls */
+	run_cases(results);
+
+	check.expected = expected;
+	check.results = results;
+	for_each_case(check_case, &check);
+	printf("%d conversions the same, %d failed the same way, %d different "
+	       "(%d combinations not tested)\n", check.ran, check.errors,
+	       check.failed, check.skipped);
+
+	free(expected);
+	free(results);
+	return check.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -100,6 +100,12 @@ LIBV4L_PUBLIC int v4l2_get_control(int fd, int cid);
 /* This flag is *OBSOLETE*, since version 0.5.98 libv4l *always* reports
    emulated formats to ENUM_FMT, except when conversion is disabled. */
 #define V4L2_ENABLE_ENUM_FMT_EMULATION 0x02
+/* Dequeue and convert frames in a background thread while streaming with
+   mmap buffers, so that the conversion of a frame overlaps with the app
+   processing the previous one, instead of being done inside VIDIOC_DQBUF.
+   This can also be enabled by setting the LIBV4L2_CONVERT_THREAD environment
+   variable to 1. */
+#define V4L2_CONVERT_THREAD 0x04
 
 /* v4l2_fd_open: open an already opened fd for further use through
    v4l2lib and possibly modify libv4l2's default behavior through the
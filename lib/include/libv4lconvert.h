@@ -116,6 +116,52 @@ LIBV4L_PUBLIC int v4lconvert_convert(struct v4lconvert_data *data,
 		const struct v4l2_format *dest_fmt, /* in */
 		unsigned char *src, int src_size, unsigned char *dest, int dest_size);
 
+/* Conversion plans, for applications which convert a stream of frames with
+   fixed src and dest formats: all decisions v4lconvert_convert makes per
+   frame based on the formats and on the state of the (software emulated)
+   image controls are made once when the plan is created, and the
+   intermediate buffers are allocated then too. The plan is rebuilt
+   automatically when the controls change. v4lconvert_plan_convert otherwise
+   behaves like v4lconvert_convert (including the double conversion NOTE),
+   the plan must be destroyed before the v4lconvert_data it was created
+   for. Returns NULL on error. */
+struct v4lconvert_plan;
+
+LIBV4L_PUBLIC struct v4lconvert_plan *v4lconvert_plan_create(
+		struct v4lconvert_data *data,
+		const struct v4l2_format *src_fmt,
+		const struct v4l2_format *dest_fmt);
+LIBV4L_PUBLIC void v4lconvert_plan_destroy(struct v4lconvert_plan *plan);
+LIBV4L_PUBLIC int v4lconvert_plan_convert(struct v4lconvert_plan *plan,
+		unsigned char *src, int src_size, unsigned char *dest, int dest_size);
+/* Returns 1 when v4lconvert_plan_convert would currently just copy the src
+   frame (because no conversion, processing, flipping, etc. is needed), so
+   that the caller can use the src frame as is instead, 0 when it would not,
+   and -1 on error. The answer changes when the controls change. */
+LIBV4L_PUBLIC int v4lconvert_plan_is_copy(struct v4lconvert_plan *plan);
+
+/* Conversion workspaces, for converting frames of one stream from multiple
+   threads in parallel. A workspace shares the device, format and control
+   state with the v4lconvert_data it is created for, and has its own decoder
+   state and conversion buffers. Each workspace may be used by one thread at
+   a time, without any locking. The v4lconvert_data must not be destroyed or
+   reconfigured (try_format, set_fps, ...) while its workspaces are in use.
+   Note that the decoders for some cams (cpia1, mr97310a) keep state between
+   frames, which is per workspace. */
+struct v4lconvert_workspace;
+
+LIBV4L_PUBLIC struct v4lconvert_workspace *v4lconvert_workspace_create(
+		struct v4lconvert_data *data);
+LIBV4L_PUBLIC void v4lconvert_workspace_destroy(
+		struct v4lconvert_workspace *ws);
+/* Like v4lconvert_convert, using the workspace's decoder state and buffers */
+LIBV4L_PUBLIC int v4lconvert_workspace_convert(struct v4lconvert_workspace *ws,
+		const struct v4l2_format *src_fmt,  /* in */
+		const struct v4l2_format *dest_fmt, /* in */
+		unsigned char *src, int src_size, unsigned char *dest, int dest_size);
+LIBV4L_PUBLIC const char *v4lconvert_workspace_get_error_message(
+		struct v4lconvert_workspace *ws);
+
 /* get a string describing the last error */
 LIBV4L_PUBLIC const char *v4lconvert_get_error_message(struct v4lconvert_data *data);
 
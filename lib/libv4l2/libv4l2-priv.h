@@ -25,11 +25,9 @@
 
 #include "../libv4lconvert/libv4lsyscall-priv.h"
 
-#define V4L2_MAX_DEVICES 16
-/* Warning when making this larger the frame_queued and frame_mapped members of
-   the v4l2_dev_info struct can no longer be a bitfield, so the code needs to
-   be adjusted! */
-#define V4L2_MAX_NO_FRAMES 32
+/* Limited by the number of buffer index bits in the mmap offsets of our fake
+   (converting mmap) buffers, see V4L2_MMAP_OFFSET_MAGIC */
+#define V4L2_MAX_NO_FRAMES 4096
 #define V4L2_DEFAULT_NREADBUFFERS 4
 #define V4L2_IGNORE_FIRST_FRAME_ERRORS 3
 #define V4L2_DEFAULT_FPS 30
@@ -46,7 +44,7 @@
 #define V4L2_PERROR(format, ...)		\
 	do { 					\
 		if (errno == ENODEV) {		\
-			devices[index].gone = 1;\
+			devices[index]->gone = 1;\
 			break;			\
 		}				\
 		V4L2_LOG_ERR(format ": %s\n", ##__VA_ARGS__, strerror(errno)); \
@@ -71,6 +69,24 @@
 
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 
+/* Frame bookkeeping is only done when in read or mmap-conversion mode */
+struct v4l2_frame {
+	unsigned char *pointer;		/* The real buffer, mapped by us */
+	int size;
+	__u32 offset;
+	int queued;
+	/* Our fake (converting mmap) buffer, allocated on first use */
+	unsigned char *convert_buf;
+	size_t convert_buf_size;
+	int zero_copy;			/* convert_buf maps the real buffer */
+	unsigned int map_count;		/* Number of mmaps of convert_buf */
+	int memfd;			/* Backs convert_buf once exported */
+	/* DQBUF result of a frame converted by the conversion thread, while it
+	   waits in the done queue for the app to dequeue it */
+	struct v4l2_buffer buf;
+	int done_next;
+};
+
 struct v4l2_dev_info {
 	int fd;
 	int flags;
@@ -87,16 +103,31 @@ struct v4l2_dev_info {
 	int fps;
 	int first_frame;
 	struct v4lconvert_data *convert;
-	unsigned char *convert_mmap_buf;
-	size_t convert_mmap_buf_size;
+	struct v4lconvert_plan *plan; /* NULL until the first converted frame */
+	/* Protects convert and plan against the conversion thread, which
+	   converts without holding the stream_lock. Always taken last. */
+	pthread_mutex_t convert_lock;
 	size_t convert_mmap_frame_size;
-	/* Frame bookkeeping is only done when in read or mmap-conversion mode */
-	unsigned char *frame_pointers[V4L2_MAX_NO_FRAMES];
-	int frame_sizes[V4L2_MAX_NO_FRAMES];
-	int frame_queued; /* 1 status bit per frame */
+	/* no_frames entries, grown (never shrunk) when more buffers get
+	   requested */
+	struct v4l2_frame *frames;
+	unsigned int frames_size;
+	unsigned int frames_queued;
+	unsigned int convert_bufs;	/* Number of allocated convert_buf-s */
 	int frame_info_generation;
-	/* mapping tracking of our fake (converting mmap) frame buffers */
-	unsigned char frame_map_count[V4L2_MAX_NO_FRAMES];
+	/* Background conversion (V4L2_CONVERT_THREAD), the thread dequeues and
+	   converts the frames and adds them to the done queue (linked through
+	   the frames' done_next, -1 terminated), from which DQBUF takes them */
+	pthread_t convert_thread;
+	pthread_cond_t convert_cond;
+	int convert_thread_started;
+	int convert_thread_stop;
+	int convert_thread_exited;
+	int convert_thread_busy;	/* Dequeuing / converting a frame */
+	int convert_thread_error;	/* errno for the next DQBUF */
+	int convert_thread_wakeup[2];	/* Pipe to wake it up from poll() */
+	int done_head;
+	int done_tail;
 	/* buffer when doing conversion and using read() for read() */
 	int readbuf_size;
 	unsigned char *readbuf;
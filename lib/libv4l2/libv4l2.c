@@ -67,9 +67,13 @@
 #include <fcntl.h>
 #include <string.h>
 #include <unistd.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#ifdef __linux__
+#include <linux/udmabuf.h>
+#endif
 #include "libv4l2.h"
 #include "libv4l2-priv.h"
 #include "libv4l-plugin.h"
@@ -84,49 +88,124 @@
 #define V4L2_STREAM_TOUCHED		0x1000
 #define V4L2_USE_READ_FOR_READ		0x2000
 #define V4L2_SUPPORTS_TIMEPERFRAME	0x4000
+#define V4L2_NO_ZERO_COPY		0x8000
 
-#define V4L2_MMAP_OFFSET_MAGIC      0xABCDEF00u
+/* QUERYBUF offset of our fake (converting mmap) buffers, the buffer index is
+   stored in bits 12 - 23. The low bits are never 0, so these never match the
+   (page aligned) offset of a real buffer */
+#define V4L2_MMAP_OFFSET_MAGIC      0xAB000F00u
+#define V4L2_MMAP_OFFSET_INDEX_MASK 0x00FFF000u
+#define V4L2_MMAP_OFFSET_INDEX_SHIFT 12
 
 static void v4l2_adjust_src_fmt_to_fps(int index, int fps);
+static void v4l2_stop_convert_thread(int index);
 static void v4l2_set_src_and_dest_format(int index,
 		struct v4l2_format *src_fmt, struct v4l2_format *dest_fmt);
 
-static pthread_mutex_t v4l2_open_mutex = PTHREAD_MUTEX_INITIALIZER;
-static struct v4l2_dev_info devices[V4L2_MAX_DEVICES] = {
-	{ .fd = -1 },
-	{ .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 },
-	{ .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 },
-	{ .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }
+/* The device slots are allocated one by one and never freed, so that they
+   (and their stream_lock) stay valid while another thread uses them. The
+   array of pointers to them and the fd -> slot map get replaced by a larger
+   copy when they are full. Readers do not take any locks, so the old copies
+   are not freed either (they are at most as large as the current ones
+   together). All changes are done with v4l2_open_mutex held.
+
+   Every ioctl / read / mmap / close of the process goes through
+   v4l2_get_index() when v4l2convert.so is preloaded, for fds which are not
+   ours that is just a couple of loads and compares. */
+struct v4l2_fd_map {
+	struct v4l2_fd_map *prev;	/* Replaced smaller copy */
+	int size;
+	int index[];			/* Slot + 1, 0 when not ours */
 };
+
+static pthread_mutex_t v4l2_open_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct v4l2_dev_info **devices;
 static int devices_used;
+static int devices_size;
+static struct v4l2_fd_map *v4l2_fd_map;
 
-static int v4l2_ensure_convert_mmap_buf(int index)
+/* Set the number of buffers, growing the frame bookkeeping array if
+   necessary. The bookkeeping of buffers beyond the old number must be in its
+   initial state, iow the buffers must be unmapped and not queued */
+static int v4l2_set_no_frames(int index, unsigned int no_frames)
 {
-	if (devices[index].convert_mmap_buf != MAP_FAILED) {
-		return 0;
+	unsigned int i;
+
+	if (no_frames > devices[index]->frames_size) {
+		struct v4l2_frame *frames;
+
+		frames = realloc(devices[index]->frames,
+				 no_frames * sizeof(*frames));
+		if (!frames) {
+			V4L2_LOG_ERR("allocating bookkeeping for %u buffers\n",
+				     no_frames);
+			errno = ENOMEM;
+			return -1;
+		}
+
+		for (i = devices[index]->frames_size; i < no_frames; i++) {
+			memset(&frames[i], 0, sizeof(frames[i]));
+			frames[i].pointer = MAP_FAILED;
+			frames[i].convert_buf = MAP_FAILED;
+			frames[i].memfd = -1;
+		}
+		devices[index]->frames = frames;
+		devices[index]->frames_size = no_frames;
 	}
 
-	devices[index].convert_mmap_buf_size =
-		devices[index].convert_mmap_frame_size * devices[index].no_frames;
+	devices[index]->no_frames = no_frames;
+	return 0;
+}
+
+static int v4l2_ensure_convert_mmap_buf(int index, unsigned int buffer_index)
+{
+	struct v4l2_frame *frame = &devices[index]->frames[buffer_index];
+
+	if (frame->convert_buf != MAP_FAILED)
+		return 0;
 
-	devices[index].convert_mmap_buf = (void *)SYS_MMAP(NULL,
-			devices[index].convert_mmap_buf_size,
+	frame->convert_buf_size = devices[index]->convert_mmap_frame_size;
+	frame->convert_buf = (void *)SYS_MMAP(NULL, frame->convert_buf_size,
 			PROT_READ | PROT_WRITE,
 			MAP_ANONYMOUS | MAP_PRIVATE,
 			-1, 0);
 
-	if (devices[index].convert_mmap_buf == MAP_FAILED) {
-		devices[index].convert_mmap_buf_size = 0;
-
+	if (frame->convert_buf == MAP_FAILED) {
 		int saved_err = errno;
-		V4L2_LOG_ERR("allocating conversion buffer\n");
+
+		frame->convert_buf_size = 0;
+		V4L2_LOG_ERR("allocating conversion buffer %u\n", buffer_index);
 		errno = saved_err;
 		return -1;
 	}
+	devices[index]->convert_bufs++;
 
 	return 0;
 }
 
+static void v4l2_free_convert_mmap_bufs(int index)
+{
+	unsigned int i;
+
+	for (i = 0; i < devices[index]->frames_size; i++) {
+		struct v4l2_frame *frame = &devices[index]->frames[i];
+
+		if (frame->convert_buf == MAP_FAILED)
+			continue;
+
+		SYS_MUNMAP(frame->convert_buf, frame->convert_buf_size);
+		frame->convert_buf = MAP_FAILED;
+		frame->convert_buf_size = 0;
+		frame->zero_copy = 0;
+		frame->map_count = 0;
+		if (frame->memfd != -1) {
+			SYS_CLOSE(frame->memfd);
+			frame->memfd = -1;
+		}
+	}
+	devices[index]->convert_bufs = 0;
+}
+
 static int v4l2_request_read_buffers(int index)
 {
 	int result;
@@ -134,12 +213,12 @@ static int v4l2_request_read_buffers(int index)
 
 	/* Note we re-request the buffers if they are already requested as the format
 	   and thus the needed buffer size may have changed. */
-	req.count = (devices[index].no_frames) ? devices[index].no_frames :
-		devices[index].nreadbuffers;
+	req.count = (devices[index]->no_frames) ? devices[index]->no_frames :
+		devices[index]->nreadbuffers;
 	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	req.memory = V4L2_MEMORY_MMAP;
-	result = devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
-			devices[index].fd, VIDIOC_REQBUFS, &req);
+	result = devices[index]->dev_ops->ioctl(devices[index]->dev_ops_priv,
+			devices[index]->fd, VIDIOC_REQBUFS, &req);
 	if (result < 0) {
 		int saved_err = errno;
 
@@ -148,19 +227,18 @@ static int v4l2_request_read_buffers(int index)
 		return result;
 	}
 
-	if (!devices[index].no_frames && req.count)
-		devices[index].flags |= V4L2_BUFFERS_REQUESTED_BY_READ;
+	if (!devices[index]->no_frames && req.count)
+		devices[index]->flags |= V4L2_BUFFERS_REQUESTED_BY_READ;
 
-	devices[index].no_frames = MIN(req.count, V4L2_MAX_NO_FRAMES);
-	return 0;
+	return v4l2_set_no_frames(index, MIN(req.count, V4L2_MAX_NO_FRAMES));
 }
 
 static void v4l2_unrequest_read_buffers(int index)
 {
 	struct v4l2_requestbuffers req;
 
-	if (!(devices[index].flags & V4L2_BUFFERS_REQUESTED_BY_READ) ||
-			devices[index].no_frames == 0)
+	if (!(devices[index]->flags & V4L2_BUFFERS_REQUESTED_BY_READ) ||
+			devices[index]->no_frames == 0)
 		return;
 
 	/* (Un)Request buffers, note not all driver support this, and those
@@ -168,13 +246,13 @@ static void v4l2_unrequest_read_buffers(int index)
 	req.count = 0;
 	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	req.memory = V4L2_MEMORY_MMAP;
-	if (devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
-			devices[index].fd, VIDIOC_REQBUFS, &req) < 0)
+	if (devices[index]->dev_ops->ioctl(devices[index]->dev_ops_priv,
+			devices[index]->fd, VIDIOC_REQBUFS, &req) < 0)
 		return;
 
-	devices[index].no_frames = MIN(req.count, V4L2_MAX_NO_FRAMES);
-	if (devices[index].no_frames == 0)
-		devices[index].flags &= ~V4L2_BUFFERS_REQUESTED_BY_READ;
+	v4l2_set_no_frames(index, MIN(req.count, V4L2_MAX_NO_FRAMES));
+	if (devices[index]->no_frames == 0)
+		devices[index]->flags &= ~V4L2_BUFFERS_REQUESTED_BY_READ;
 }
 
 static int v4l2_map_buffers(int index)
@@ -183,17 +261,17 @@ static int v4l2_map_buffers(int index)
 	unsigned int i;
 	struct v4l2_buffer buf;
 
-	for (i = 0; i < devices[index].no_frames; i++) {
-		if (devices[index].frame_pointers[i] != MAP_FAILED)
+	for (i = 0; i < devices[index]->no_frames; i++) {
+		if (devices[index]->frames[i].pointer != MAP_FAILED)
 			continue;
 
 		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 		buf.memory = V4L2_MEMORY_MMAP;
 		buf.index = i;
 		buf.reserved = buf.reserved2 = 0;
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
-				devices[index].fd, VIDIOC_QUERYBUF, &buf);
+		result = devices[index]->dev_ops->ioctl(
+				devices[index]->dev_ops_priv,
+				devices[index]->fd, VIDIOC_QUERYBUF, &buf);
 		if (result) {
 			int saved_err = errno;
 
@@ -202,10 +280,10 @@ static int v4l2_map_buffers(int index)
 			break;
 		}
 
-		devices[index].frame_pointers[i] = (void *)SYS_MMAP(NULL,
-				(size_t)buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, devices[index].fd,
+		devices[index]->frames[i].pointer = (void *)SYS_MMAP(NULL,
+				(size_t)buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, devices[index]->fd,
 				buf.m.offset);
-		if (devices[index].frame_pointers[i] == MAP_FAILED) {
+		if (devices[index]->frames[i].pointer == MAP_FAILED) {
 			int saved_err = errno;
 
 			V4L2_PERROR("mmapping buffer %u", i);
@@ -214,9 +292,10 @@ static int v4l2_map_buffers(int index)
 			break;
 		}
 		V4L2_LOG("mapped buffer %u at %p\n", i,
-				devices[index].frame_pointers[i]);
+				devices[index]->frames[i].pointer);
 
-		devices[index].frame_sizes[i] = buf.length;
+		devices[index]->frames[i].size = buf.length;
+		devices[index]->frames[i].offset = buf.m.offset;
 	}
 
 	return result;
@@ -227,11 +306,11 @@ static void v4l2_unmap_buffers(int index)
 	unsigned int i;
 
 	/* unmap the buffers */
-	for (i = 0; i < devices[index].no_frames; i++) {
-		if (devices[index].frame_pointers[i] != MAP_FAILED) {
-			SYS_MUNMAP(devices[index].frame_pointers[i],
-					devices[index].frame_sizes[i]);
-			devices[index].frame_pointers[i] = MAP_FAILED;
+	for (i = 0; i < devices[index]->no_frames; i++) {
+		if (devices[index]->frames[i].pointer != MAP_FAILED) {
+			SYS_MUNMAP(devices[index]->frames[i].pointer,
+					devices[index]->frames[i].size);
+			devices[index]->frames[i].pointer = MAP_FAILED;
 			V4L2_LOG("unmapped buffer %u\n", i);
 		}
 	}
@@ -242,10 +321,10 @@ static int v4l2_streamon(int index)
 	int result;
 	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
-	if (!(devices[index].flags & V4L2_STREAMON)) {
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
-				devices[index].fd, VIDIOC_STREAMON, &type);
+	if (!(devices[index]->flags & V4L2_STREAMON)) {
+		result = devices[index]->dev_ops->ioctl(
+				devices[index]->dev_ops_priv,
+				devices[index]->fd, VIDIOC_STREAMON, &type);
 		if (result) {
 			int saved_err = errno;
 
@@ -253,8 +332,8 @@ static int v4l2_streamon(int index)
 			errno = saved_err;
 			return result;
 		}
-		devices[index].flags |= V4L2_STREAMON;
-		devices[index].first_frame = V4L2_IGNORE_FIRST_FRAME_ERRORS;
+		devices[index]->flags |= V4L2_STREAMON;
+		devices[index]->first_frame = V4L2_IGNORE_FIRST_FRAME_ERRORS;
 	}
 
 	return 0;
@@ -262,13 +341,14 @@ static int v4l2_streamon(int index)
 
 static int v4l2_streamoff(int index)
 {
+	unsigned int i;
 	int result;
 	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
-	if (devices[index].flags & V4L2_STREAMON) {
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
-				devices[index].fd, VIDIOC_STREAMOFF, &type);
+	if (devices[index]->flags & V4L2_STREAMON) {
+		result = devices[index]->dev_ops->ioctl(
+				devices[index]->dev_ops_priv,
+				devices[index]->fd, VIDIOC_STREAMOFF, &type);
 		if (result) {
 			int saved_err = errno;
 
@@ -276,10 +356,19 @@ static int v4l2_streamoff(int index)
 			errno = saved_err;
 			return result;
 		}
-		devices[index].flags &= ~V4L2_STREAMON;
+		devices[index]->flags &= ~V4L2_STREAMON;
 
 		/* Stream off also dequeues all our buffers! */
-		devices[index].frame_queued = 0;
+		for (i = 0; i < devices[index]->no_frames; i++)
+			devices[index]->frames[i].queued = 0;
+		devices[index]->frames_queued = 0;
+
+		/* And makes the conversion thread exit, drop the frames it
+		   converted */
+		v4l2_stop_convert_thread(index);
+		devices[index]->done_head = -1;
+		devices[index]->done_tail = -1;
+		devices[index]->convert_thread_error = 0;
 	}
 
 	return 0;
@@ -290,15 +379,15 @@ static int v4l2_queue_read_buffer(int index, int buffer_index)
 	int result;
 	struct v4l2_buffer buf;
 
-	if (devices[index].frame_queued & (1 << buffer_index))
+	if (devices[index]->frames[buffer_index].queued)
 		return 0;
 
 	memset(&buf, 0, sizeof(buf));
 	buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	buf.memory = V4L2_MEMORY_MMAP;
 	buf.index  = buffer_index;
-	result = devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
-			devices[index].fd, VIDIOC_QBUF, &buf);
+	result = devices[index]->dev_ops->ioctl(devices[index]->dev_ops_priv,
+			devices[index]->fd, VIDIOC_QBUF, &buf);
 	if (result) {
 		int saved_err = errno;
 
@@ -307,7 +396,210 @@ static int v4l2_queue_read_buffer(int index, int buffer_index)
 		return result;
 	}
 
-	devices[index].frame_queued |= 1 << buffer_index;
+	devices[index]->frames[buffer_index].queued = 1;
+	devices[index]->frames_queued++;
+	return 0;
+}
+
+/* Get the conversion plan for the current src and dest format, the plan gets
+   created for the first frame after a format change */
+static struct v4lconvert_plan *v4l2_get_plan(int index)
+{
+	if (!devices[index]->plan)
+		devices[index]->plan = v4lconvert_plan_create(
+				devices[index]->convert, &devices[index]->src_fmt,
+				&devices[index]->dest_fmt);
+
+	return devices[index]->plan;
+}
+
+static int v4l2_convert(int index, unsigned char *src, int src_size,
+		unsigned char *dest, int dest_size)
+{
+	struct v4lconvert_plan *plan = v4l2_get_plan(index);
+
+	if (!plan)
+		return -1;
+
+	return v4lconvert_plan_convert(plan, src, src_size, dest, dest_size);
+}
+
+/* Is converting a frame currently just copying it? This is the case when the
+   src and dest format are the same, but we are converting anyways because
+   the cam has software controls (which are off) */
+static int v4l2_convert_is_copy(int index)
+{
+	struct v4lconvert_plan *plan;
+	int result;
+
+	pthread_mutex_lock(&devices[index]->convert_lock);
+	plan = v4l2_get_plan(index);
+	result = plan && v4lconvert_plan_is_copy(plan) == 1;
+	pthread_mutex_unlock(&devices[index]->convert_lock);
+
+	return result;
+}
+
+/* Make sure the fake buffer for buffer_index exists, and when converting is
+   just copying, let it map the real buffer, so that the frames do not need to
+   be copied at all. When a control gets turned on the fake buffer gets its
+   own memory (at the same address) again. Returns 1 when the fake buffer maps
+   the real buffer, 0 when not and -1 on error. */
+static int v4l2_prepare_convert_mmap_buf(int index, unsigned int buffer_index)
+{
+	struct v4l2_frame *frame = &devices[index]->frames[buffer_index];
+	long page_size = devices[index]->page_size;
+	int zero_copy;
+	void *p;
+
+	if (v4l2_ensure_convert_mmap_buf(index, buffer_index))
+		return -1;
+
+	zero_copy = !(devices[index]->flags & V4L2_NO_ZERO_COPY) &&
+		frame->memfd == -1 && frame->pointer != MAP_FAILED &&
+		frame->convert_buf_size <=
+			(frame->size + page_size - 1) / page_size * page_size &&
+		v4l2_convert_is_copy(index);
+	if (zero_copy == frame->zero_copy)
+		return zero_copy;
+
+	if (zero_copy) {
+		p = (void *)SYS_MMAP(frame->convert_buf,
+				frame->convert_buf_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_FIXED, devices[index]->fd,
+				frame->offset);
+		if (p != MAP_FAILED) {
+			frame->zero_copy = 1;
+			return 1;
+		}
+		V4L2_LOG("mapping buffer %u as its fake buffer failed: %s\n",
+			 buffer_index, strerror(errno));
+		devices[index]->flags |= V4L2_NO_ZERO_COPY;
+	}
+
+	/* Also after a failed MAP_FIXED, as the old mapping may be gone */
+	p = (void *)SYS_MMAP(frame->convert_buf, frame->convert_buf_size,
+			PROT_READ | PROT_WRITE,
+			MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED, -1, 0);
+	if (p == MAP_FAILED) {
+		int saved_err = errno;
+
+		V4L2_LOG_ERR("re-allocating conversion buffer %u\n",
+			     buffer_index);
+		errno = saved_err;
+		return -1;
+	}
+	frame->zero_copy = 0;
+
+	return 0;
+}
+
+/* Move a fake buffer into a memfd, mapped at the same address and keeping its
+   contents, so that it can be exported. From then on the fake buffer is never
+   turned into a mapping of the real buffer, as the exported fd would not
+   follow that. */
+static int v4l2_memfd_convert_mmap_buf(int index, unsigned int buffer_index)
+{
+#ifdef HAVE_MEMFD_CREATE
+	struct v4l2_frame *frame = &devices[index]->frames[buffer_index];
+	int memfd, saved_err;
+	void *p;
+
+	if (v4l2_ensure_convert_mmap_buf(index, buffer_index))
+		return -1;
+
+	memfd = memfd_create("libv4l2-frame", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (memfd == -1)
+		goto error;
+
+	/* udmabuf only accepts memfds which can not shrink */
+	if (ftruncate(memfd, frame->convert_buf_size) ||
+	    fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK) ||
+	    pwrite(memfd, frame->convert_buf, frame->convert_buf_size, 0) !=
+			(ssize_t)frame->convert_buf_size)
+		goto error;
+
+	p = (void *)SYS_MMAP(frame->convert_buf, frame->convert_buf_size,
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+			memfd, 0);
+	if (p == MAP_FAILED)
+		goto error;
+
+	frame->memfd = memfd;
+	frame->zero_copy = 0;
+	return 0;
+
+error:
+	saved_err = errno;
+	V4L2_LOG_ERR("moving conversion buffer %u to a memfd: %s\n",
+		     buffer_index, strerror(errno));
+	if (memfd != -1)
+		SYS_CLOSE(memfd);
+	errno = saved_err;
+	return -1;
+#else
+	errno = ENOTTY;
+	return -1;
+#endif
+}
+
+/* Returns a dmabuf fd for a memfd when the kernel has udmabuf, -1 otherwise */
+static int v4l2_udmabuf_create(int memfd, size_t size, int cloexec)
+{
+#ifdef UDMABUF_CREATE
+	struct udmabuf_create create = {
+		.memfd = memfd,
+		.flags = cloexec ? UDMABUF_FLAGS_CLOEXEC : 0,
+		.offset = 0,
+		.size = size,
+	};
+	int fd, result;
+
+	fd = SYS_OPEN("/dev/udmabuf", O_RDWR | O_CLOEXEC, 0);
+	if (fd == -1)
+		return -1;
+
+	result = SYS_IOCTL(fd, UDMABUF_CREATE, &create);
+	SYS_CLOSE(fd);
+	return result;
+#else
+	return -1;
+#endif
+}
+
+/* VIDIOC_EXPBUF of a fake buffer. The frames are converted into memory owned
+   by us, so export that: as a dmabuf through udmabuf when available, so that
+   it can be imported by drm / other v4l2 devices, and as the memfd itself
+   otherwise, which still can be mmap-ed or passed to another process. */
+static int v4l2_export_convert_mmap_buf(int index,
+		struct v4l2_exportbuffer *exp)
+{
+	struct v4l2_frame *frame;
+	int fd;
+
+	if (exp->index >= devices[index]->no_frames || exp->plane ||
+	    (exp->flags & ~(O_ACCMODE | O_CLOEXEC))) {
+		errno = EINVAL;
+		return -1;
+	}
+	frame = &devices[index]->frames[exp->index];
+
+	if (frame->memfd == -1) {
+		/* The thread may be converting into the buffer right now */
+		v4l2_stop_convert_thread(index);
+		if (v4l2_memfd_convert_mmap_buf(index, exp->index))
+			return -1;
+	}
+
+	fd = v4l2_udmabuf_create(frame->memfd, frame->convert_buf_size,
+				 exp->flags & O_CLOEXEC);
+	if (fd == -1)
+		fd = fcntl(frame->memfd, (exp->flags & O_CLOEXEC) ?
+				F_DUPFD_CLOEXEC : F_DUPFD, 0);
+	if (fd == -1)
+		return -1;
+
+	exp->fd = fd;
 	return 0;
 }
 
@@ -315,7 +607,7 @@ static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
 		unsigned char *dest, int dest_size)
 {
 	const int max_tries = V4L2_IGNORE_FIRST_FRAME_ERRORS + 1;
-	int result, tries = max_tries, frame_info_gen;
+	int result, tries = max_tries, frame_info_gen, zero_copy;
 
 	/* Make sure we have the real v4l2 buffers mapped */
 	result = v4l2_map_buffers(index);
@@ -323,12 +615,12 @@ static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
 		return result;
 
 	do {
-		frame_info_gen = devices[index].frame_info_generation;
-		pthread_mutex_unlock(&devices[index].stream_lock);
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
-				devices[index].fd, VIDIOC_DQBUF, buf);
-		pthread_mutex_lock(&devices[index].stream_lock);
+		frame_info_gen = devices[index]->frame_info_generation;
+		pthread_mutex_unlock(&devices[index]->stream_lock);
+		result = devices[index]->dev_ops->ioctl(
+				devices[index]->dev_ops_priv,
+				devices[index]->fd, VIDIOC_DQBUF, buf);
+		pthread_mutex_lock(&devices[index]->stream_lock);
 		if (result) {
 			if (errno != EAGAIN) {
 				int saved_err = errno;
@@ -339,27 +631,48 @@ static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
 			return result;
 		}
 
-		devices[index].frame_queued &= ~(1 << buf->index);
-
-		if (frame_info_gen != devices[index].frame_info_generation) {
+		if (frame_info_gen != devices[index]->frame_info_generation) {
 			errno = -EINVAL;
 			return -1;
 		}
 
-		result = v4lconvert_convert(devices[index].convert,
-				&devices[index].src_fmt, &devices[index].dest_fmt,
-				devices[index].frame_pointers[buf->index],
-				buf->bytesused, dest ? dest : (devices[index].convert_mmap_buf +
-					buf->index * devices[index].convert_mmap_frame_size),
+		if (devices[index]->frames[buf->index].queued) {
+			devices[index]->frames[buf->index].queued = 0;
+			devices[index]->frames_queued--;
+		}
+
+		/* An application can do a DQBUF before mmap-ing in the buffer,
+		   but we need the buffer _now_ to write our converted data
+		   to it! */
+		zero_copy = 0;
+		if (!dest) {
+			zero_copy = v4l2_prepare_convert_mmap_buf(index,
+								  buf->index);
+			if (zero_copy < 0) {
+				int saved_err = errno;
+
+				v4l2_queue_read_buffer(index, buf->index);
+				errno = saved_err;
+				return -1;
+			}
+		}
+
+		if (zero_copy)
+			result = MIN((int)buf->bytesused, dest_size);
+		else
+			result = v4l2_convert(index,
+				devices[index]->frames[buf->index].pointer,
+				buf->bytesused, dest ? dest :
+					devices[index]->frames[buf->index].convert_buf,
 				dest_size);
 
-		if (devices[index].first_frame) {
+		if (devices[index]->first_frame) {
 			/* Always treat convert errors as EAGAIN during the first few frames, as
 			   some cams produce bad frames at the start of the stream
 			   (hsync and vsync still syncing ??). */
 			if (result < 0)
 				errno = EAGAIN;
-			devices[index].first_frame--;
+			devices[index]->first_frame--;
 		}
 
 		if (result < 0) {
@@ -367,10 +680,10 @@ static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
 
 			if (errno == EAGAIN || errno == EPIPE)
 				V4L2_LOG("warning error while converting frame data: %s",
-						v4lconvert_get_error_message(devices[index].convert));
+						v4lconvert_get_error_message(devices[index]->convert));
 			else
 				V4L2_LOG_ERR("converting / decoding frame data: %s",
-						v4lconvert_get_error_message(devices[index].convert));
+						v4lconvert_get_error_message(devices[index]->convert));
 
 			/*
 			 * If this is the last try, and the frame is short
@@ -386,42 +699,295 @@ static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
 
 	if (result < 0 && errno == EAGAIN) {
 		V4L2_LOG_ERR("got %d consecutive frame decode errors, last error: %s",
-				max_tries, v4lconvert_get_error_message(devices[index].convert));
+				max_tries, v4lconvert_get_error_message(devices[index]->convert));
 		errno = EIO;
 	}
 
 	if (result < 0 && errno == EPIPE) {
 		V4L2_LOG("got %d consecutive short frame errors, "
 			 "returning short frame", max_tries);
-		result = devices[index].dest_fmt.fmt.pix.sizeimage;
+		result = devices[index]->dest_fmt.fmt.pix.sizeimage;
 		errno = 0;
 	}
 
 	return result;
 }
 
+/* The background conversion thread, it dequeues the frames as soon as the
+   driver is done with them and converts them into their fake buffer without
+   holding the stream_lock, so that the conversion of a frame overlaps with the
+   app processing the previous one. Everything which changes the format or the
+   buffers stops it first.
+
+   When poll() reports an error, or dequeuing fails, it exits and leaves it to
+   the next DQBUF to redo the dequeue without it, so that the error handling
+   is the same as without the thread. */
+static void *v4l2_convert_thread(void *arg)
+{
+	const int max_tries = V4L2_IGNORE_FIRST_FRAME_ERRORS + 1;
+	int index = (long)arg;
+	int result, zero_copy, errors = 0;
+	char error_msg[256];
+
+	pthread_mutex_lock(&devices[index]->stream_lock);
+	while (!devices[index]->convert_thread_stop) {
+		struct pollfd pfd[2];
+		struct v4l2_buffer buf;
+		struct v4l2_frame *frame;
+		unsigned char *src, *dest;
+
+		pfd[0].fd = devices[index]->fd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = devices[index]->convert_thread_wakeup[0];
+		pfd[1].events = POLLIN;
+		pthread_mutex_unlock(&devices[index]->stream_lock);
+		result = poll(pfd, 2, -1);
+		pthread_mutex_lock(&devices[index]->stream_lock);
+		if (result <= 0 || devices[index]->convert_thread_stop)
+			continue;
+		/* Apps which subscribed to events get POLLPRI, that is not
+		   an error */
+		if (!(pfd[0].revents & POLLIN)) {
+			if (pfd[0].revents & (POLLERR | POLLHUP | POLLNVAL))
+				break;
+			continue;
+		}
+
+		/* Make a non-blocking DQBUF wait for this frame, rather than
+		   returning EAGAIN while we have it */
+		devices[index]->convert_thread_busy = 1;
+
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		pthread_mutex_unlock(&devices[index]->stream_lock);
+		result = devices[index]->dev_ops->ioctl(
+				devices[index]->dev_ops_priv,
+				devices[index]->fd, VIDIOC_DQBUF, &buf);
+		pthread_mutex_lock(&devices[index]->stream_lock);
+		if (result) {
+			if (errno != EAGAIN)
+				break;
+			goto next;
+		}
+
+		frame = &devices[index]->frames[buf.index];
+		if (frame->queued) {
+			frame->queued = 0;
+			devices[index]->frames_queued--;
+		}
+
+		zero_copy = v4l2_prepare_convert_mmap_buf(index, buf.index);
+		if (zero_copy < 0) {
+			v4l2_queue_read_buffer(index, buf.index);
+			break;
+		}
+
+		if (zero_copy) {
+			result = MIN(buf.bytesused,
+				     devices[index]->convert_mmap_frame_size);
+		} else {
+			src = frame->pointer;
+			dest = frame->convert_buf;
+			pthread_mutex_unlock(&devices[index]->stream_lock);
+			pthread_mutex_lock(&devices[index]->convert_lock);
+			result = v4l2_convert(index, src, buf.bytesused, dest,
+					devices[index]->convert_mmap_frame_size);
+			/* Another ioctl may set a new error message as soon as
+			   we drop the convert_lock */
+			if (result < 0)
+				snprintf(error_msg, sizeof(error_msg), "%s",
+					 v4lconvert_get_error_message(
+						devices[index]->convert));
+			pthread_mutex_unlock(&devices[index]->convert_lock);
+			pthread_mutex_lock(&devices[index]->stream_lock);
+		}
+
+		if (devices[index]->first_frame) {
+			/* See v4l2_dequeue_and_convert() */
+			if (result < 0)
+				errno = EAGAIN;
+			devices[index]->first_frame--;
+		}
+
+		if (result < 0) {
+			if (errno == EAGAIN || errno == EPIPE)
+				V4L2_LOG("warning error while converting frame data: %s",
+						error_msg);
+			else
+				V4L2_LOG_ERR("converting / decoding frame data: %s",
+						error_msg);
+
+			errors++;
+			if (errors == max_tries && errno == EPIPE) {
+				V4L2_LOG("got %d consecutive short frame errors, "
+					 "returning short frame", max_tries);
+				result = devices[index]->dest_fmt.fmt.pix.sizeimage;
+			} else {
+				if (errors == max_tries) {
+					V4L2_LOG_ERR("got %d consecutive frame decode errors, last error: %s",
+							max_tries, error_msg);
+					devices[index]->convert_thread_error =
+						errno == EAGAIN ? EIO : errno;
+					errors = 0;
+				}
+				v4l2_queue_read_buffer(index, buf.index);
+				goto next;
+			}
+		}
+		errors = 0;
+
+		buf.bytesused = result;
+		frame->buf = buf;
+		frame->done_next = -1;
+		if (devices[index]->done_tail == -1)
+			devices[index]->done_head = buf.index;
+		else
+			devices[index]->frames[devices[index]->done_tail].done_next =
+				buf.index;
+		devices[index]->done_tail = buf.index;
+next:
+		devices[index]->convert_thread_busy = 0;
+		pthread_cond_broadcast(&devices[index]->convert_cond);
+	}
+
+	devices[index]->convert_thread_exited = 1;
+	devices[index]->convert_thread_busy = 0;
+	pthread_cond_broadcast(&devices[index]->convert_cond);
+	pthread_mutex_unlock(&devices[index]->stream_lock);
+
+	return NULL;
+}
+
+static int v4l2_start_convert_thread(int index)
+{
+	int result;
+
+	result = v4l2_map_buffers(index);
+	if (result)
+		return result;
+
+	if (pipe(devices[index]->convert_thread_wakeup)) {
+		int saved_err = errno;
+
+		V4L2_LOG_ERR("creating conversion thread pipe: %s\n",
+			     strerror(errno));
+		errno = saved_err;
+		return -1;
+	}
+
+	devices[index]->convert_thread_stop = 0;
+	devices[index]->convert_thread_exited = 0;
+	devices[index]->convert_thread_busy = 0;
+	result = pthread_create(&devices[index]->convert_thread, NULL,
+				v4l2_convert_thread, (void *)(long)index);
+	if (result) {
+		V4L2_LOG_ERR("creating conversion thread: %s\n",
+			     strerror(result));
+		SYS_CLOSE(devices[index]->convert_thread_wakeup[0]);
+		SYS_CLOSE(devices[index]->convert_thread_wakeup[1]);
+		errno = result;
+		return -1;
+	}
+	devices[index]->convert_thread_started = 1;
+
+	return 0;
+}
+
+/* Called with the stream_lock held, it gets dropped while waiting for the
+   thread to exit. The frames it already converted stay in the done queue. */
+static void v4l2_stop_convert_thread(int index)
+{
+	if (!devices[index]->convert_thread_started)
+		return;
+
+	devices[index]->convert_thread_stop = 1;
+	SYS_WRITE(devices[index]->convert_thread_wakeup[1], "", 1);
+	pthread_mutex_unlock(&devices[index]->stream_lock);
+	pthread_join(devices[index]->convert_thread, NULL);
+	pthread_mutex_lock(&devices[index]->stream_lock);
+
+	SYS_CLOSE(devices[index]->convert_thread_wakeup[0]);
+	SYS_CLOSE(devices[index]->convert_thread_wakeup[1]);
+	devices[index]->convert_thread_started = 0;
+	pthread_cond_broadcast(&devices[index]->convert_cond);
+}
+
+/* DQBUF when using the conversion thread */
+static int v4l2_dequeue_converted(int index, struct v4l2_buffer *buf)
+{
+	int fl = fcntl(devices[index]->fd, F_GETFL);
+	int nonblock = fl != -1 && (fl & O_NONBLOCK);
+	struct v4l2_frame *frame;
+
+	while (devices[index]->done_head == -1) {
+		if (devices[index]->convert_thread_error) {
+			errno = devices[index]->convert_thread_error;
+			devices[index]->convert_thread_error = 0;
+			return -1;
+		}
+		if (!(devices[index]->flags & V4L2_STREAMON)) {
+			errno = EINVAL;
+			return -1;
+		}
+		if (!devices[index]->convert_thread_started) {
+			if (v4l2_start_convert_thread(index))
+				return v4l2_dequeue_and_convert(index, buf, 0,
+					devices[index]->convert_mmap_frame_size);
+			continue;
+		}
+		if (devices[index]->convert_thread_exited &&
+				!devices[index]->convert_thread_stop) {
+			/* Let the normal dequeue path deal with the error */
+			v4l2_stop_convert_thread(index);
+			return v4l2_dequeue_and_convert(index, buf, 0,
+					devices[index]->convert_mmap_frame_size);
+		}
+		if (nonblock && !devices[index]->convert_thread_busy &&
+				!devices[index]->convert_thread_stop) {
+			errno = EAGAIN;
+			return -1;
+		}
+		pthread_cond_wait(&devices[index]->convert_cond,
+				  &devices[index]->stream_lock);
+	}
+
+	frame = &devices[index]->frames[devices[index]->done_head];
+	devices[index]->done_head = frame->done_next;
+	if (devices[index]->done_head == -1)
+		devices[index]->done_tail = -1;
+	*buf = frame->buf;
+
+	return buf->bytesused;
+}
+
 static int v4l2_read_and_convert(int index, unsigned char *dest, int dest_size)
 {
 	const int max_tries = V4L2_IGNORE_FIRST_FRAME_ERRORS + 1;
-	int result, buf_size, tries = max_tries;
+	int result, buf_size, copy, tries = max_tries;
+
+	buf_size = devices[index]->dest_fmt.fmt.pix.sizeimage;
 
-	buf_size = devices[index].dest_fmt.fmt.pix.sizeimage;
+	/* When converting is just copying, read straight into the app's
+	   buffer */
+	copy = dest_size >= buf_size && v4l2_convert_is_copy(index);
 
-	if (devices[index].readbuf_size < buf_size) {
+	if (!copy && devices[index]->readbuf_size < buf_size) {
 		unsigned char *new_buf;
 
-		new_buf = realloc(devices[index].readbuf, buf_size);
+		new_buf = realloc(devices[index]->readbuf, buf_size);
 		if (!new_buf)
 			return -1;
 
-		devices[index].readbuf = new_buf;
-		devices[index].readbuf_size = buf_size;
+		devices[index]->readbuf = new_buf;
+		devices[index]->readbuf_size = buf_size;
 	}
 
 	do {
-		result = devices[index].dev_ops->read(
-				devices[index].dev_ops_priv,
-				devices[index].fd, devices[index].readbuf,
+		result = devices[index]->dev_ops->read(
+				devices[index]->dev_ops_priv,
+				devices[index]->fd,
+				copy ? dest : devices[index]->readbuf,
 				buf_size);
 		if (result <= 0) {
 			if (result && errno != EAGAIN) {
@@ -433,17 +999,17 @@ static int v4l2_read_and_convert(int index, unsigned char *dest, int dest_size)
 			return result;
 		}
 
-		result = v4lconvert_convert(devices[index].convert,
-				&devices[index].src_fmt, &devices[index].dest_fmt,
-				devices[index].readbuf, result, dest, dest_size);
+		if (!copy)
+			result = v4l2_convert(index, devices[index]->readbuf,
+					      result, dest, dest_size);
 
-		if (devices[index].first_frame) {
+		if (devices[index]->first_frame) {
 			/* Always treat convert errors as EAGAIN during the first few frames, as
 			   some cams produce bad frames at the start of the stream
 			   (hsync and vsync still syncing ??). */
 			if (result < 0)
 				errno = EAGAIN;
-			devices[index].first_frame--;
+			devices[index]->first_frame--;
 		}
 
 		if (result < 0) {
@@ -451,10 +1017,10 @@ static int v4l2_read_and_convert(int index, unsigned char *dest, int dest_size)
 
 			if (errno == EAGAIN || errno == EPIPE)
 				V4L2_LOG("warning error while converting frame data: %s",
-						v4lconvert_get_error_message(devices[index].convert));
+						v4lconvert_get_error_message(devices[index]->convert));
 			else
 				V4L2_LOG_ERR("converting / decoding frame data: %s",
-						v4lconvert_get_error_message(devices[index].convert));
+						v4lconvert_get_error_message(devices[index]->convert));
 
 			errno = saved_err;
 		}
@@ -463,14 +1029,14 @@ static int v4l2_read_and_convert(int index, unsigned char *dest, int dest_size)
 
 	if (result < 0 && errno == EAGAIN) {
 		V4L2_LOG_ERR("got %d consecutive frame decode errors, last error: %s",
-				max_tries, v4lconvert_get_error_message(devices[index].convert));
+				max_tries, v4lconvert_get_error_message(devices[index]->convert));
 		errno = EIO;
 	}
 
 	if (result < 0 && errno == EPIPE) {
 		V4L2_LOG("got %d consecutive short frame errors, "
 			 "returning short frame", max_tries);
-		result = devices[index].dest_fmt.fmt.pix.sizeimage;
+		result = devices[index]->dest_fmt.fmt.pix.sizeimage;
 		errno = 0;
 	}
 
@@ -482,9 +1048,9 @@ static int v4l2_queue_read_buffers(int index)
 	unsigned int i;
 	int last_error = EIO, queued = 0;
 
-	for (i = 0; i < devices[index].no_frames; i++) {
+	for (i = 0; i < devices[index]->no_frames; i++) {
 		/* Don't queue unmapped buffers (should never happen) */
-		if (devices[index].frame_pointers[i] != MAP_FAILED) {
+		if (devices[index]->frames[i].pointer != MAP_FAILED) {
 			if (v4l2_queue_read_buffer(index, i)) {
 				last_error = errno;
 				continue;
@@ -504,7 +1070,7 @@ static int v4l2_activate_read_stream(int index)
 {
 	int result;
 
-	if ((devices[index].flags & V4L2_STREAMON) || devices[index].frame_queued) {
+	if ((devices[index]->flags & V4L2_STREAMON) || devices[index]->frames_queued) {
 		errno = EBUSY;
 		return -1;
 	}
@@ -517,7 +1083,7 @@ static int v4l2_activate_read_stream(int index)
 	if (result)
 		return result;
 
-	devices[index].flags |= V4L2_STREAM_CONTROLLED_BY_READ;
+	devices[index]->flags |= V4L2_STREAM_CONTROLLED_BY_READ;
 
 	return v4l2_streamon(index);
 }
@@ -536,18 +1102,18 @@ static int v4l2_deactivate_read_stream(int index)
 
 	v4l2_unrequest_read_buffers(index);
 
-	devices[index].flags &= ~V4L2_STREAM_CONTROLLED_BY_READ;
+	devices[index]->flags &= ~V4L2_STREAM_CONTROLLED_BY_READ;
 
 	return 0;
 }
 
 static int v4l2_needs_conversion(int index)
 {
-	if (devices[index].convert == NULL)
+	if (devices[index]->convert == NULL)
 		return 0;
 
-	return v4lconvert_needs_conversion(devices[index].convert,
-			&devices[index].src_fmt, &devices[index].dest_fmt);
+	return v4lconvert_needs_conversion(devices[index]->convert,
+			&devices[index]->src_fmt, &devices[index]->dest_fmt);
 }
 
 static void v4l2_set_conversion_buf_params(int index, struct v4l2_buffer *buf)
@@ -556,12 +1122,14 @@ static void v4l2_set_conversion_buf_params(int index, struct v4l2_buffer *buf)
 		return;
 
 	/* This may happen if the ioctl failed */
-	if (buf->index >= devices[index].no_frames)
+	if (buf->index >= devices[index]->no_frames)
 		buf->index = 0;
 
-	buf->m.offset = V4L2_MMAP_OFFSET_MAGIC | buf->index;
-	buf->length = devices[index].convert_mmap_frame_size;
-	if (devices[index].frame_map_count[buf->index])
+	buf->m.offset = V4L2_MMAP_OFFSET_MAGIC |
+		(buf->index << V4L2_MMAP_OFFSET_INDEX_SHIFT);
+	buf->length = devices[index]->convert_mmap_frame_size;
+	if (buf->index < devices[index]->no_frames &&
+			devices[index]->frames[buf->index].map_count)
 		buf->flags |= V4L2_BUF_FLAG_MAPPED;
 	else
 		buf->flags &= ~V4L2_BUF_FLAG_MAPPED;
@@ -575,14 +1143,14 @@ static int v4l2_buffers_mapped(int index)
 		/* Normal (no conversion) mode */
 		struct v4l2_buffer buf;
 
-		for (i = 0; i < devices[index].no_frames; i++) {
+		for (i = 0; i < devices[index]->no_frames; i++) {
 			buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 			buf.memory = V4L2_MEMORY_MMAP;
 			buf.index = i;
 			buf.reserved = buf.reserved2 = 0;
-			if (devices[index].dev_ops->ioctl(
-					devices[index].dev_ops_priv,
-					devices[index].fd, VIDIOC_QUERYBUF,
+			if (devices[index]->dev_ops->ioctl(
+					devices[index]->dev_ops_priv,
+					devices[index]->fd, VIDIOC_QUERYBUF,
 					&buf)) {
 				int saved_err = errno;
 
@@ -595,27 +1163,27 @@ static int v4l2_buffers_mapped(int index)
 		}
 	} else {
 		/* Conversion mode */
-		for (i = 0; i < devices[index].no_frames; i++)
-			if (devices[index].frame_map_count[i])
+		for (i = 0; i < devices[index]->no_frames; i++)
+			if (devices[index]->frames[i].map_count)
 				break;
 	}
 
-	if (i != devices[index].no_frames)
+	if (i != devices[index]->no_frames)
 		V4L2_LOG("v4l2_buffers_mapped(): buffers still mapped\n");
 
-	return i != devices[index].no_frames;
+	return i != devices[index]->no_frames;
 }
 
 static void v4l2_update_fps(int index, struct v4l2_streamparm *parm)
 {
-	if ((devices[index].flags & V4L2_SUPPORTS_TIMEPERFRAME) &&
+	if ((devices[index]->flags & V4L2_SUPPORTS_TIMEPERFRAME) &&
 	    parm->parm.capture.timeperframe.numerator != 0) {
 		int fps = parm->parm.capture.timeperframe.denominator;
 		fps += parm->parm.capture.timeperframe.numerator - 1;
 		fps /= parm->parm.capture.timeperframe.numerator;
-		devices[index].fps = fps;
+		devices[index]->fps = fps;
 	} else
-		devices[index].fps = 0;
+		devices[index]->fps = 0;
 }
 
 int v4l2_open(const char *file, int oflag, ...)
@@ -652,10 +1220,91 @@ int v4l2_open(const char *file, int oflag, ...)
 	return fd;
 }
 
+/* Is this an fd for which we are emulating v4l1 ? */
+static int v4l2_get_index(int fd)
+{
+	struct v4l2_fd_map *map = __atomic_load_n(&v4l2_fd_map,
+						  __ATOMIC_ACQUIRE);
+
+	/* We never handle fd -1 */
+	if (!map || fd < 0 || fd >= map->size)
+		return -1;
+
+	return __atomic_load_n(&map->index[fd], __ATOMIC_ACQUIRE) - 1;
+}
+
+/* Set the fd -> slot map entry for fd in all copies of the map, called with
+   v4l2_open_mutex held */
+static void v4l2_set_index(int fd, int index)
+{
+	struct v4l2_fd_map *map;
+
+	for (map = v4l2_fd_map; map && fd < map->size; map = map->prev)
+		__atomic_store_n(&map->index[fd], index + 1, __ATOMIC_RELEASE);
+}
+
+/* Claim a free device slot for fd and map fd to it, called with
+   v4l2_open_mutex held, returns -1 if out of memory */
+static int v4l2_alloc_index(int fd)
+{
+	struct v4l2_fd_map *map = v4l2_fd_map;
+	int index;
+
+	if (!map || fd >= map->size) {
+		int size = map ? map->size : 64;
+
+		while (size <= fd)
+			size *= 2;
+		map = calloc(1, sizeof(*map) + size * sizeof(map->index[0]));
+		if (!map)
+			return -1;
+		map->size = size;
+		map->prev = v4l2_fd_map;
+		if (map->prev)
+			memcpy(map->index, map->prev->index,
+			       map->prev->size * sizeof(map->index[0]));
+		__atomic_store_n(&v4l2_fd_map, map, __ATOMIC_RELEASE);
+	}
+
+	for (index = 0; index < devices_used; index++)
+		if (devices[index]->fd == -1)
+			break;
+
+	if (index == devices_used) {
+		struct v4l2_dev_info *dev;
+
+		if (devices_used == devices_size) {
+			int size = devices_size ? devices_size * 2 : 16;
+			struct v4l2_dev_info **new_devices;
+
+			new_devices = malloc(size * sizeof(*new_devices));
+			if (!new_devices)
+				return -1;
+			if (devices_used)
+				memcpy(new_devices, devices,
+				       devices_used * sizeof(*new_devices));
+			__atomic_store_n(&devices, new_devices,
+					 __ATOMIC_RELEASE);
+			devices_size = size;
+		}
+		dev = calloc(1, sizeof(*dev));
+		if (!dev)
+			return -1;
+		devices[index] = dev;
+		/* Publish the slot after the pointer to it */
+		__atomic_store_n(&devices_used, index + 1, __ATOMIC_RELEASE);
+	}
+
+	devices[index]->fd = fd;
+	v4l2_set_index(fd, index);
+
+	return index;
+}
+
 int v4l2_fd_open(int fd, int v4l2_flags)
 {
-	int i, index;
-	char *lfname;
+	int index;
+	char *lfname, *s;
 	struct v4l2_capability cap;
 	struct v4l2_format fmt = { 0, };
 	struct v4l2_streamparm parm = { 0, };
@@ -731,67 +1380,68 @@ int v4l2_fd_open(int fd, int v4l2_flags)
 no_capture:
 	/* So we have a v4l2 capture device, register it in our devices array */
 	pthread_mutex_lock(&v4l2_open_mutex);
-	for (index = 0; index < V4L2_MAX_DEVICES; index++) {
-		if (devices[index].fd == -1) {
-			devices[index].fd = fd;
-			devices[index].plugin_library = plugin_library;
-			devices[index].dev_ops_priv = dev_ops_priv;
-			devices[index].dev_ops = dev_ops;
-			break;
-		}
+	index = v4l2_alloc_index(fd);
+	if (index != -1) {
+		devices[index]->plugin_library = plugin_library;
+		devices[index]->dev_ops_priv = dev_ops_priv;
+		devices[index]->dev_ops = dev_ops;
 	}
 	pthread_mutex_unlock(&v4l2_open_mutex);
 
-	if (index == V4L2_MAX_DEVICES) {
-		V4L2_LOG_ERR("attempting to open more then %d video devices\n",
-				V4L2_MAX_DEVICES);
+	if (index == -1) {
+		V4L2_LOG_ERR("allocating device info: %s\n", strerror(errno));
 		v4l2_plugin_cleanup(plugin_library, dev_ops_priv, dev_ops);
-		errno = EBUSY;
+		v4lconvert_destroy(convert);
+		errno = ENOMEM;
 		return -1;
 	}
 
-	devices[index].flags = v4l2_flags;
+	devices[index]->flags = v4l2_flags;
+	s = getenv("LIBV4L2_CONVERT_THREAD");
+	if (s && atoi(s))
+		devices[index]->flags |= V4L2_CONVERT_THREAD;
+	devices[index]->convert_thread_started = 0;
+	devices[index]->convert_thread_error = 0;
+	devices[index]->done_head = -1;
+	devices[index]->done_tail = -1;
 	if (cap.capabilities & V4L2_CAP_READWRITE)
-		devices[index].flags |= V4L2_SUPPORTS_READ;
+		devices[index]->flags |= V4L2_SUPPORTS_READ;
 	if (!(cap.capabilities & V4L2_CAP_STREAMING)) {
-		devices[index].flags |= V4L2_USE_READ_FOR_READ;
+		devices[index]->flags |= V4L2_USE_READ_FOR_READ;
 		/* This device only supports read so the stream gets started by the
 		   driver on the first read */
-		devices[index].first_frame = V4L2_IGNORE_FIRST_FRAME_ERRORS;
+		devices[index]->first_frame = V4L2_IGNORE_FIRST_FRAME_ERRORS;
 	}
 	if ((parm.type == V4L2_BUF_TYPE_VIDEO_CAPTURE) &&
 	    (parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME))
-		devices[index].flags |= V4L2_SUPPORTS_TIMEPERFRAME;
-	devices[index].open_count = 1;
-	devices[index].page_size = page_size;
-	devices[index].src_fmt  = fmt;
-	devices[index].dest_fmt = fmt;
-	v4l2_set_src_and_dest_format(index, &devices[index].src_fmt,
-				     &devices[index].dest_fmt);
-
-	pthread_mutex_init(&devices[index].stream_lock, NULL);
-
-	devices[index].no_frames = 0;
-	devices[index].nreadbuffers = V4L2_DEFAULT_NREADBUFFERS;
-	devices[index].convert = convert;
-	devices[index].convert_mmap_buf = MAP_FAILED;
-	devices[index].convert_mmap_buf_size = 0;
-	for (i = 0; i < V4L2_MAX_NO_FRAMES; i++) {
-		devices[index].frame_pointers[i] = MAP_FAILED;
-		devices[index].frame_map_count[i] = 0;
-	}
-	devices[index].frame_queued = 0;
-	devices[index].readbuf = NULL;
-	devices[index].readbuf_size = 0;
-
-	if (index >= devices_used)
-		devices_used = index + 1;
+		devices[index]->flags |= V4L2_SUPPORTS_TIMEPERFRAME;
+	devices[index]->open_count = 1;
+	devices[index]->page_size = page_size;
+	devices[index]->plan = NULL;
+	devices[index]->src_fmt  = fmt;
+	devices[index]->dest_fmt = fmt;
+	v4l2_set_src_and_dest_format(index, &devices[index]->src_fmt,
+				     &devices[index]->dest_fmt);
+
+	pthread_mutex_init(&devices[index]->stream_lock, NULL);
+	pthread_mutex_init(&devices[index]->convert_lock, NULL);
+	pthread_cond_init(&devices[index]->convert_cond, NULL);
+
+	devices[index]->no_frames = 0;
+	devices[index]->nreadbuffers = V4L2_DEFAULT_NREADBUFFERS;
+	devices[index]->convert = convert;
+	devices[index]->frames = NULL;
+	devices[index]->frames_size = 0;
+	devices[index]->frames_queued = 0;
+	devices[index]->convert_bufs = 0;
+	devices[index]->readbuf = NULL;
+	devices[index]->readbuf_size = 0;
 
 	/* Note we always tell v4lconvert to optimize src fmt selection for
 	   our default fps, the only exception is the app explicitly selecting
 	   a frame rate using the S_PARM ioctl after a S_FMT */
-	if (devices[index].convert)
-		v4lconvert_set_fps(devices[index].convert, V4L2_DEFAULT_FPS);
+	if (devices[index]->convert)
+		v4lconvert_set_fps(devices[index]->convert, V4L2_DEFAULT_FPS);
 	v4l2_update_fps(index, &parm);
 
 	V4L2_LOG("open: %d\n", fd);
@@ -799,29 +1449,10 @@ no_capture:
 	return fd;
 }
 
-/* Is this an fd for which we are emulating v4l1 ? */
-static int v4l2_get_index(int fd)
-{
-	int index;
-
-	/* We never handle fd -1 */
-	if (fd == -1)
-		return -1;
-
-	for (index = 0; index < devices_used; index++)
-		if (devices[index].fd == fd)
-			break;
-
-	if (index == devices_used)
-		return -1;
-
-	return index;
-}
-
-
 int v4l2_close(int fd)
 {
 	int index, result;
+	unsigned int i;
 
 	index = v4l2_get_index(fd);
 	if (index == -1)
@@ -829,40 +1460,57 @@ int v4l2_close(int fd)
 
 	/* Abuse stream_lock to stop 2 closes from racing and trying to free
 	   the resources twice */
-	pthread_mutex_lock(&devices[index].stream_lock);
-	devices[index].open_count--;
-	result = devices[index].open_count != 0;
-	pthread_mutex_unlock(&devices[index].stream_lock);
+	pthread_mutex_lock(&devices[index]->stream_lock);
+	devices[index]->open_count--;
+	result = devices[index]->open_count != 0;
+	pthread_mutex_unlock(&devices[index]->stream_lock);
 
 	if (result)
 		return 0;
 
-	v4l2_plugin_cleanup(devices[index].plugin_library,
-			devices[index].dev_ops_priv,
-			devices[index].dev_ops);
+	/* The conversion thread uses the dev_ops, so it must be gone before
+	   the plugin gets closed and unloaded */
+	pthread_mutex_lock(&devices[index]->stream_lock);
+	v4l2_stop_convert_thread(index);
+	pthread_mutex_unlock(&devices[index]->stream_lock);
+
+	v4l2_plugin_cleanup(devices[index]->plugin_library,
+			devices[index]->dev_ops_priv,
+			devices[index]->dev_ops);
 
 	/* Free resources */
 	v4l2_unmap_buffers(index);
-	if (devices[index].convert_mmap_buf != MAP_FAILED) {
+	if (devices[index]->convert_bufs) {
 		if (v4l2_buffers_mapped(index)) {
-			if (!devices[index].gone)
+			if (!devices[index]->gone)
 				V4L2_LOG_WARN("v4l2 mmap buffers still mapped on close()\n");
+			/* The mappings stay valid without the memfds */
+			for (i = 0; i < devices[index]->frames_size; i++)
+				if (devices[index]->frames[i].memfd != -1)
+					SYS_CLOSE(devices[index]->frames[i].memfd);
 		} else {
-			SYS_MUNMAP(devices[index].convert_mmap_buf,
-					devices[index].convert_mmap_buf_size);
+			v4l2_free_convert_mmap_bufs(index);
 		}
-		devices[index].convert_mmap_buf = MAP_FAILED;
-		devices[index].convert_mmap_buf_size = 0;
-	}
-	v4lconvert_destroy(devices[index].convert);
-	free(devices[index].readbuf);
-	devices[index].readbuf = NULL;
-	devices[index].readbuf_size = 0;
+		devices[index]->convert_bufs = 0;
+	}
+	free(devices[index]->frames);
+	devices[index]->frames = NULL;
+	devices[index]->frames_size = 0;
+	devices[index]->no_frames = 0;
+	v4lconvert_plan_destroy(devices[index]->plan);
+	devices[index]->plan = NULL;
+	v4lconvert_destroy(devices[index]->convert);
+	free(devices[index]->readbuf);
+	devices[index]->readbuf = NULL;
+	devices[index]->readbuf_size = 0;
 
 	/* Remove the fd from our list of managed fds before closing it, because as
 	   soon as we've done the actual close, the fd maybe returned by an open() in
 	   another thread and we don't want to intercept calls to this new fd. */
-	devices[index].fd = -1;
+	pthread_mutex_lock(&v4l2_open_mutex);
+	v4l2_set_index(fd, -1);
+	devices[index]->fd = -1;
+	pthread_mutex_unlock(&v4l2_open_mutex);
 
 	/* Since we've marked the fd as no longer used, and freed the resources,
 	   redo the close in case it was interrupted */
@@ -882,21 +1530,22 @@ int v4l2_dup(int fd)
 	if (index == -1)
 		return syscall(SYS_dup, fd);
 
-	devices[index].open_count++;
+	devices[index]->open_count++;
 
 	return fd;
 }
 
 static int v4l2_check_buffer_change_ok(int index)
 {
-	devices[index].frame_info_generation++;
+	v4l2_stop_convert_thread(index);
+	devices[index]->frame_info_generation++;
 	v4l2_unmap_buffers(index);
 
 	/* Check if the app itself still is using the stream */
 	if (v4l2_buffers_mapped(index) ||
-			(!(devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) &&
-			 ((devices[index].flags & V4L2_STREAMON) ||
-			  devices[index].frame_queued))) {
+			(!(devices[index]->flags & V4L2_STREAM_CONTROLLED_BY_READ) &&
+			 ((devices[index]->flags & V4L2_STREAMON) ||
+			  devices[index]->frames_queued))) {
 		V4L2_LOG("v4l2_check_buffer_change_ok(): stream busy\n");
 		errno = EBUSY;
 		return -1;
@@ -904,13 +1553,10 @@ static int v4l2_check_buffer_change_ok(int index)
 
 	/* We may change from convert to non conversion mode and
 	   v4l2_unrequest_read_buffers may change the no_frames, so free the
-	   convert mmap buffer */
-	SYS_MUNMAP(devices[index].convert_mmap_buf,
-			devices[index].convert_mmap_buf_size);
-	devices[index].convert_mmap_buf = MAP_FAILED;
-	devices[index].convert_mmap_buf_size = 0;
+	   convert mmap buffers */
+	v4l2_free_convert_mmap_bufs(index);
 
-	if (devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) {
+	if (devices[index]->flags & V4L2_STREAM_CONTROLLED_BY_READ) {
 		V4L2_LOG("deactivating read-stream for settings change\n");
 		return v4l2_deactivate_read_stream(index);
 	}
@@ -970,12 +1616,16 @@ static void v4l2_set_src_and_dest_format(int index,
 	} else
 		v4lconvert_fixup_fmt(dest_fmt);
 
-	devices[index].src_fmt = *src_fmt;
-	devices[index].dest_fmt = *dest_fmt;
+	/* The conversion thread uses the plan */
+	v4l2_stop_convert_thread(index);
+	devices[index]->src_fmt = *src_fmt;
+	devices[index]->dest_fmt = *dest_fmt;
+	v4lconvert_plan_destroy(devices[index]->plan);
+	devices[index]->plan = NULL;
 	/* round up to full page size */
-	devices[index].convert_mmap_frame_size =
-		(((dest_fmt->fmt.pix.sizeimage + devices[index].page_size - 1)
-		/ devices[index].page_size) * devices[index].page_size);
+	devices[index]->convert_mmap_frame_size =
+		(((dest_fmt->fmt.pix.sizeimage + devices[index]->page_size - 1)
+		/ devices[index]->page_size) * devices[index]->page_size);
 }
 
 static int v4l2_s_fmt(int index, struct v4l2_format *dest_fmt)
@@ -994,8 +1644,10 @@ static int v4l2_s_fmt(int index, struct v4l2_format *dest_fmt)
 				pixfmt >> 24);
 	}
 
-	result = v4lconvert_try_format(devices[index].convert,
+	pthread_mutex_lock(&devices[index]->convert_lock);
+	result = v4lconvert_try_format(devices[index]->convert,
 				       dest_fmt, &src_fmt);
+	pthread_mutex_unlock(&devices[index]->convert_lock);
 	if (result) {
 		int saved_err = errno;
 		V4L2_LOG("S_FMT error trying format: %s\n", strerror(errno));
@@ -1018,14 +1670,14 @@ static int v4l2_s_fmt(int index, struct v4l2_format *dest_fmt)
 		return result;
 
 	req_pix_fmt = src_fmt.fmt.pix;
-	result = devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
-					       devices[index].fd,
+	result = devices[index]->dev_ops->ioctl(devices[index]->dev_ops_priv,
+					       devices[index]->fd,
 					       VIDIOC_S_FMT, &src_fmt);
 	if (result) {
 		int saved_err = errno;
 		V4L2_PERROR("setting pixformat");
 		/* Report to the app dest_fmt has not changed */
-		*dest_fmt = devices[index].dest_fmt;
+		*dest_fmt = devices[index]->dest_fmt;
 		errno = saved_err;
 		return result;
 	}
@@ -1042,12 +1694,12 @@ static int v4l2_s_fmt(int index, struct v4l2_format *dest_fmt)
 
 	v4l2_set_src_and_dest_format(index, &src_fmt, dest_fmt);
 
-	if (devices[index].flags & V4L2_SUPPORTS_TIMEPERFRAME) {
+	if (devices[index]->flags & V4L2_SUPPORTS_TIMEPERFRAME) {
 		struct v4l2_streamparm parm = {
 			.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
 		};
-		if (devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
-						  devices[index].fd,
+		if (devices[index]->dev_ops->ioctl(devices[index]->dev_ops_priv,
+						  devices[index]->fd,
 						  VIDIOC_G_PARM, &parm))
 			return 0;
 		v4l2_update_fps(index, &parm);
@@ -1062,6 +1714,7 @@ int v4l2_ioctl(int fd, unsigned long int request, ...)
 	va_list ap;
 	int result, index, saved_err;
 	int is_capture_request = 0, stream_needs_locking = 0;
+	int convert_needs_locking = 0;
 
 	va_start(ap, request);
 	arg = va_arg(ap, void *);
@@ -1076,12 +1729,16 @@ int v4l2_ioctl(int fd, unsigned long int request, ...)
 	   ioctl, causing it to get sign extended, depending upon this behavior */
 	request = (unsigned int)request;
 
-	if (devices[index].convert == NULL)
+	if (devices[index]->convert == NULL)
 		goto no_capture_request;
 
-	/* Is this a capture request and do we need to take the stream lock? */
+	/* Is this a capture request and do we need to take the stream lock?
+	   Requests which are handled by libv4lconvert without the stream lock
+	   need the convert lock, as the conversion thread may be converting. */
 	switch (request) {
 	case VIDIOC_QUERYCAP:
+		is_capture_request = 1;
+		break;
 	case VIDIOC_QUERYCTRL:
 	case VIDIOC_G_CTRL:
 	case VIDIOC_S_CTRL:
@@ -1091,16 +1748,21 @@ int v4l2_ioctl(int fd, unsigned long int request, ...)
 	case VIDIOC_ENUM_FRAMESIZES:
 	case VIDIOC_ENUM_FRAMEINTERVALS:
 		is_capture_request = 1;
+		convert_needs_locking = 1;
 		break;
 	case VIDIOC_ENUM_FMT:
 		if (((struct v4l2_fmtdesc *)arg)->type ==
-				V4L2_BUF_TYPE_VIDEO_CAPTURE)
+				V4L2_BUF_TYPE_VIDEO_CAPTURE) {
 			is_capture_request = 1;
+			convert_needs_locking = 1;
+		}
 		break;
 	case VIDIOC_TRY_FMT:
 		if (((struct v4l2_format *)arg)->type ==
-				V4L2_BUF_TYPE_VIDEO_CAPTURE)
+				V4L2_BUF_TYPE_VIDEO_CAPTURE) {
 			is_capture_request = 1;
+			convert_needs_locking = 1;
+		}
 		break;
 	case VIDIOC_S_FMT:
 	case VIDIOC_G_FMT:
@@ -1126,6 +1788,13 @@ int v4l2_ioctl(int fd, unsigned long int request, ...)
 			stream_needs_locking = 1;
 		}
 		break;
+	case VIDIOC_EXPBUF:
+		if (((struct v4l2_exportbuffer *)arg)->type ==
+				V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+			is_capture_request = 1;
+			stream_needs_locking = 1;
+		}
+		break;
 	case VIDIOC_STREAMON:
 	case VIDIOC_STREAMOFF:
 		if (*((enum v4l2_buf_type *)arg) ==
@@ -1138,7 +1807,7 @@ int v4l2_ioctl(int fd, unsigned long int request, ...)
 		if (((struct v4l2_streamparm *)arg)->type ==
 				V4L2_BUF_TYPE_VIDEO_CAPTURE) {
 			is_capture_request = 1;
-			if (devices[index].flags & V4L2_SUPPORTS_TIMEPERFRAME)
+			if (devices[index]->flags & V4L2_SUPPORTS_TIMEPERFRAME)
 				stream_needs_locking = 1;
 		}
 		break;
@@ -1152,8 +1821,8 @@ int v4l2_ioctl(int fd, unsigned long int request, ...)
 
 	if (!is_capture_request) {
 no_capture_request:
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		result = devices[index]->dev_ops->ioctl(
+				devices[index]->dev_ops_priv,
 				fd, request, arg);
 		saved_err = errno;
 		v4l2_log_ioctl(request, arg, result);
@@ -1163,55 +1832,58 @@ no_capture_request:
 
 
 	if (stream_needs_locking) {
-		pthread_mutex_lock(&devices[index].stream_lock);
+		pthread_mutex_lock(&devices[index]->stream_lock);
 		/* If this is the first stream-related ioctl, and we should only allow
 		   libv4lconvert supported destination formats (so that it can do flipping,
 		   processing, etc.) and the current destination format is not supported,
 		   try setting the format to RGB24 (which is a supported dest. format). */
-		if (!(devices[index].flags & V4L2_STREAM_TOUCHED) &&
-				v4lconvert_supported_dst_fmt_only(devices[index].convert) &&
+		if (!(devices[index]->flags & V4L2_STREAM_TOUCHED) &&
+				v4lconvert_supported_dst_fmt_only(devices[index]->convert) &&
 				!v4lconvert_supported_dst_format(
-					devices[index].dest_fmt.fmt.pix.pixelformat)) {
-			struct v4l2_format fmt = devices[index].dest_fmt;
+					devices[index]->dest_fmt.fmt.pix.pixelformat)) {
+			struct v4l2_format fmt = devices[index]->dest_fmt;
 
 			V4L2_LOG("Setting pixelformat to RGB24 (supported_dst_fmt_only)");
 			fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_RGB24;
 			v4l2_s_fmt(index, &fmt);
 			V4L2_LOG("Done setting pixelformat (supported_dst_fmt_only)");
 		}
-		devices[index].flags |= V4L2_STREAM_TOUCHED;
+		devices[index]->flags |= V4L2_STREAM_TOUCHED;
 	}
 
+	if (convert_needs_locking)
+		pthread_mutex_lock(&devices[index]->convert_lock);
+
 	switch (request) {
 	case VIDIOC_QUERYCTRL:
-		result = v4lconvert_vidioc_queryctrl(devices[index].convert, arg);
+		result = v4lconvert_vidioc_queryctrl(devices[index]->convert, arg);
 		break;
 
 	case VIDIOC_G_CTRL:
-		result = v4lconvert_vidioc_g_ctrl(devices[index].convert, arg);
+		result = v4lconvert_vidioc_g_ctrl(devices[index]->convert, arg);
 		break;
 
 	case VIDIOC_S_CTRL:
-		result = v4lconvert_vidioc_s_ctrl(devices[index].convert, arg);
+		result = v4lconvert_vidioc_s_ctrl(devices[index]->convert, arg);
 		break;
 
 	case VIDIOC_G_EXT_CTRLS:
-		result = v4lconvert_vidioc_g_ext_ctrls(devices[index].convert, arg);
+		result = v4lconvert_vidioc_g_ext_ctrls(devices[index]->convert, arg);
 		break;
 
 	case VIDIOC_TRY_EXT_CTRLS:
-		result = v4lconvert_vidioc_try_ext_ctrls(devices[index].convert, arg);
+		result = v4lconvert_vidioc_try_ext_ctrls(devices[index]->convert, arg);
 		break;
 
 	case VIDIOC_S_EXT_CTRLS:
-		result = v4lconvert_vidioc_s_ext_ctrls(devices[index].convert, arg);
+		result = v4lconvert_vidioc_s_ext_ctrls(devices[index]->convert, arg);
 		break;
 
 	case VIDIOC_QUERYCAP: {
 		struct v4l2_capability *cap = arg;
 
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		result = devices[index]->dev_ops->ioctl(
+				devices[index]->dev_ops_priv,
 				fd, VIDIOC_QUERYCAP, cap);
 		if (result == 0) {
 			/* We always support read() as we fake it using mmap mode */
@@ -1222,22 +1894,22 @@ no_capture_request:
 	}
 
 	case VIDIOC_ENUM_FMT:
-		result = v4lconvert_enum_fmt(devices[index].convert, arg);
+		result = v4lconvert_enum_fmt(devices[index]->convert, arg);
 		break;
 
 	case VIDIOC_ENUM_FRAMESIZES:
-		result = v4lconvert_enum_framesizes(devices[index].convert, arg);
+		result = v4lconvert_enum_framesizes(devices[index]->convert, arg);
 		break;
 
 	case VIDIOC_ENUM_FRAMEINTERVALS:
-		result = v4lconvert_enum_frameintervals(devices[index].convert, arg);
+		result = v4lconvert_enum_frameintervals(devices[index]->convert, arg);
 		if (result)
 			V4L2_LOG("ENUM_FRAMEINTERVALS Error: %s",
-					v4lconvert_get_error_message(devices[index].convert));
+					v4lconvert_get_error_message(devices[index]->convert));
 		break;
 
 	case VIDIOC_TRY_FMT:
-		result = v4lconvert_try_format(devices[index].convert,
+		result = v4lconvert_try_format(devices[index]->convert,
 					       arg, NULL);
 		break;
 
@@ -1248,7 +1920,7 @@ no_capture_request:
 	case VIDIOC_G_FMT: {
 		struct v4l2_format *fmt = arg;
 
-		*fmt = devices[index].dest_fmt;
+		*fmt = devices[index]->dest_fmt;
 		result = 0;
 		break;
 	}
@@ -1258,18 +1930,18 @@ no_capture_request:
 	case VIDIOC_S_DV_TIMINGS: {
 		struct v4l2_format src_fmt = { 0 };
 		unsigned int orig_dest_pixelformat =
-			devices[index].dest_fmt.fmt.pix.pixelformat;
+			devices[index]->dest_fmt.fmt.pix.pixelformat;
 
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		result = devices[index]->dev_ops->ioctl(
+				devices[index]->dev_ops_priv,
 				fd, request, arg);
 		if (result)
 			break;
 
 		/* These ioctls may have changed the device's fmt */
 		src_fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		result = devices[index]->dev_ops->ioctl(
+				devices[index]->dev_ops_priv,
 				fd, VIDIOC_G_FMT, &src_fmt);
 		if (result) {
 			V4L2_PERROR("getting pixformat after %s",
@@ -1278,17 +1950,17 @@ no_capture_request:
 			break;
 		}
 
-		if (v4l2_pix_fmt_compat(&devices[index].src_fmt, &src_fmt)) {
+		if (v4l2_pix_fmt_compat(&devices[index]->src_fmt, &src_fmt)) {
 			v4l2_set_src_and_dest_format(index, &src_fmt,
-						     &devices[index].dest_fmt);
+						     &devices[index]->dest_fmt);
 			break;
 		}
 
 		/* The fmt has been changed, remember the new format ... */
-		devices[index].src_fmt  = src_fmt;
-		devices[index].dest_fmt = src_fmt;
-		v4l2_set_src_and_dest_format(index, &devices[index].src_fmt,
-					     &devices[index].dest_fmt);
+		devices[index]->src_fmt  = src_fmt;
+		devices[index]->dest_fmt = src_fmt;
+		v4l2_set_src_and_dest_format(index, &devices[index]->src_fmt,
+					     &devices[index]->dest_fmt);
 		/* and try to restore the last set destination pixelformat. */
 		src_fmt.fmt.pix.pixelformat = orig_dest_pixelformat;
 		result = v4l2_s_fmt(index, &src_fmt);
@@ -1319,22 +1991,23 @@ no_capture_request:
 		if (req->count > V4L2_MAX_NO_FRAMES)
 			req->count = V4L2_MAX_NO_FRAMES;
 
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		result = devices[index]->dev_ops->ioctl(
+				devices[index]->dev_ops_priv,
 				fd, VIDIOC_REQBUFS, req);
 		if (result < 0)
 			break;
 		result = 0; /* some drivers return the number of buffers on success */
 
-		devices[index].no_frames = MIN(req->count, V4L2_MAX_NO_FRAMES);
-		devices[index].flags &= ~V4L2_BUFFERS_REQUESTED_BY_READ;
+		result = v4l2_set_no_frames(index,
+				MIN(req->count, V4L2_MAX_NO_FRAMES));
+		devices[index]->flags &= ~V4L2_BUFFERS_REQUESTED_BY_READ;
 		break;
 	}
 
 	case VIDIOC_QUERYBUF: {
 		struct v4l2_buffer *buf = arg;
 
-		if (devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) {
+		if (devices[index]->flags & V4L2_STREAM_CONTROLLED_BY_READ) {
 			result = v4l2_deactivate_read_stream(index);
 			if (result)
 				break;
@@ -1342,18 +2015,38 @@ no_capture_request:
 
 		/* Do a real query even when converting to let the driver fill in
 		   things like buf->field */
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		result = devices[index]->dev_ops->ioctl(
+				devices[index]->dev_ops_priv,
 				fd, VIDIOC_QUERYBUF, buf);
 
 		v4l2_set_conversion_buf_params(index, buf);
 		break;
 	}
 
+	case VIDIOC_EXPBUF: {
+		struct v4l2_exportbuffer *exp = arg;
+
+		if (devices[index]->flags & V4L2_STREAM_CONTROLLED_BY_READ) {
+			result = v4l2_deactivate_read_stream(index);
+			if (result)
+				break;
+		}
+
+		if (!v4l2_needs_conversion(index)) {
+			result = devices[index]->dev_ops->ioctl(
+					devices[index]->dev_ops_priv,
+					fd, VIDIOC_EXPBUF, exp);
+			break;
+		}
+
+		result = v4l2_export_convert_mmap_buf(index, exp);
+		break;
+	}
+
 	case VIDIOC_QBUF: {
 		struct v4l2_buffer *buf = arg;
 
-		if (devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) {
+		if (devices[index]->flags & V4L2_STREAM_CONTROLLED_BY_READ) {
 			result = v4l2_deactivate_read_stream(index);
 			if (result)
 				break;
@@ -1366,8 +2059,8 @@ no_capture_request:
 				break;
 		}
 
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		result = devices[index]->dev_ops->ioctl(
+				devices[index]->dev_ops_priv,
 				fd, VIDIOC_QBUF, arg);
 
 		v4l2_set_conversion_buf_params(index, buf);
@@ -1377,18 +2070,18 @@ no_capture_request:
 	case VIDIOC_DQBUF: {
 		struct v4l2_buffer *buf = arg;
 
-		if (devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) {
+		if (devices[index]->flags & V4L2_STREAM_CONTROLLED_BY_READ) {
 			result = v4l2_deactivate_read_stream(index);
 			if (result)
 				break;
 		}
 
 		if (!v4l2_needs_conversion(index)) {
-			pthread_mutex_unlock(&devices[index].stream_lock);
-			result = devices[index].dev_ops->ioctl(
-					devices[index].dev_ops_priv,
+			pthread_mutex_unlock(&devices[index]->stream_lock);
+			result = devices[index]->dev_ops->ioctl(
+					devices[index]->dev_ops_priv,
 					fd, VIDIOC_DQBUF, buf);
-			pthread_mutex_lock(&devices[index].stream_lock);
+			pthread_mutex_lock(&devices[index]->stream_lock);
 			if (result) {
 				saved_err = errno;
 				V4L2_PERROR("dequeuing buf");
@@ -1397,15 +2090,11 @@ no_capture_request:
 			break;
 		}
 
-		/* An application can do a DQBUF before mmap-ing in the buffer,
-		   but we need the buffer _now_ to write our converted data
-		   to it! */
-		result = v4l2_ensure_convert_mmap_buf(index);
-		if (result)
-			break;
-
-		result = v4l2_dequeue_and_convert(index, buf, 0,
-				devices[index].convert_mmap_frame_size);
+		if (devices[index]->flags & V4L2_CONVERT_THREAD)
+			result = v4l2_dequeue_converted(index, buf);
+		else
+			result = v4l2_dequeue_and_convert(index, buf, 0,
+					devices[index]->convert_mmap_frame_size);
 		if (result >= 0) {
 			buf->bytesused = result;
 			result = 0;
@@ -1417,7 +2106,7 @@ no_capture_request:
 
 	case VIDIOC_STREAMON:
 	case VIDIOC_STREAMOFF:
-		if (devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) {
+		if (devices[index]->flags & V4L2_STREAM_CONTROLLED_BY_READ) {
 			result = v4l2_deactivate_read_stream(index);
 			if (result)
 				break;
@@ -1434,7 +2123,7 @@ no_capture_request:
 
 		/* See if libv4lconvert wishes to use a different src_fmt
 		   for the new frame rate and set that first */
-		if ((devices[index].flags & V4L2_SUPPORTS_TIMEPERFRAME) &&
+		if ((devices[index]->flags & V4L2_SUPPORTS_TIMEPERFRAME) &&
 		    parm->parm.capture.timeperframe.numerator != 0) {
 			int fps = parm->parm.capture.timeperframe.denominator;
 			fps += parm->parm.capture.timeperframe.numerator - 1;
@@ -1442,8 +2131,8 @@ no_capture_request:
 			v4l2_adjust_src_fmt_to_fps(index, fps);
 		}
 
-		result = devices[index].dev_ops->ioctl(
-						devices[index].dev_ops_priv,
+		result = devices[index]->dev_ops->ioctl(
+						devices[index]->dev_ops_priv,
 						fd, VIDIOC_S_PARM, parm);
 		if (result)
 			break;
@@ -1453,14 +2142,17 @@ no_capture_request:
 	}
 
 	default:
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		result = devices[index]->dev_ops->ioctl(
+				devices[index]->dev_ops_priv,
 				fd, request, arg);
 		break;
 	}
 
+	if (convert_needs_locking)
+		pthread_mutex_unlock(&devices[index]->convert_lock);
+
 	if (stream_needs_locking)
-		pthread_mutex_unlock(&devices[index].stream_lock);
+		pthread_mutex_unlock(&devices[index]->stream_lock);
 
 	saved_err = errno;
 	v4l2_log_ioctl(request, arg, result);
@@ -1473,20 +2165,22 @@ static void v4l2_adjust_src_fmt_to_fps(int index, int fps)
 {
 	struct v4l2_pix_format req_pix_fmt;
 	struct v4l2_format src_fmt;
-	struct v4l2_format dest_fmt = devices[index].dest_fmt;
-	struct v4l2_format orig_src_fmt = devices[index].src_fmt;
-	struct v4l2_format orig_dest_fmt = devices[index].dest_fmt;
+	struct v4l2_format dest_fmt = devices[index]->dest_fmt;
+	struct v4l2_format orig_src_fmt = devices[index]->src_fmt;
+	struct v4l2_format orig_dest_fmt = devices[index]->dest_fmt;
 	int r;
 
-	if (fps == devices[index].fps)
+	if (fps == devices[index]->fps)
 		return;
 
 	if (v4l2_check_buffer_change_ok(index))
 		return;
 
-	v4lconvert_set_fps(devices[index].convert, fps);
-	r = v4lconvert_try_format(devices[index].convert, &dest_fmt, &src_fmt);
-	v4lconvert_set_fps(devices[index].convert, V4L2_DEFAULT_FPS);
+	pthread_mutex_lock(&devices[index]->convert_lock);
+	v4lconvert_set_fps(devices[index]->convert, fps);
+	r = v4lconvert_try_format(devices[index]->convert, &dest_fmt, &src_fmt);
+	v4lconvert_set_fps(devices[index]->convert, V4L2_DEFAULT_FPS);
+	pthread_mutex_unlock(&devices[index]->convert_lock);
 	if (r)
 		return;
 
@@ -1495,8 +2189,8 @@ static void v4l2_adjust_src_fmt_to_fps(int index, int fps)
 		return;
 
 	req_pix_fmt = src_fmt.fmt.pix;
-	if (devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
-			devices[index].fd, VIDIOC_S_FMT, &src_fmt))
+	if (devices[index]->dev_ops->ioctl(devices[index]->dev_ops_priv,
+			devices[index]->fd, VIDIOC_S_FMT, &src_fmt))
 		return;
 
 	v4l2_set_src_and_dest_format(index, &src_fmt, &dest_fmt);
@@ -1523,8 +2217,8 @@ static void v4l2_adjust_src_fmt_to_fps(int index, int fps)
 	src_fmt = orig_src_fmt;
 	dest_fmt = orig_dest_fmt;
 	req_pix_fmt = src_fmt.fmt.pix;
-	if (devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
-			devices[index].fd, VIDIOC_S_FMT, &src_fmt)) {
+	if (devices[index]->dev_ops->ioctl(devices[index]->dev_ops_priv,
+			devices[index]->fd, VIDIOC_S_FMT, &src_fmt)) {
 		V4L2_PERROR("restoring src fmt");
 		return;
 	}
@@ -1545,20 +2239,20 @@ ssize_t v4l2_read(int fd, void *dest, size_t n)
 	if (index == -1)
 		return SYS_READ(fd, dest, n);
 
-	if (!devices[index].dev_ops->read) {
+	if (!devices[index]->dev_ops->read) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	pthread_mutex_lock(&devices[index].stream_lock);
+	pthread_mutex_lock(&devices[index]->stream_lock);
 
 	/* When not converting and the device supports read(), let the kernel handle
 	   it */
-	if (devices[index].convert == NULL ||
-	    ((devices[index].flags & V4L2_SUPPORTS_READ) &&
+	if (devices[index]->convert == NULL ||
+	    ((devices[index]->flags & V4L2_SUPPORTS_READ) &&
 			!v4l2_needs_conversion(index))) {
-		result = devices[index].dev_ops->read(
-				devices[index].dev_ops_priv,
+		result = devices[index]->dev_ops->read(
+				devices[index]->dev_ops_priv,
 				fd, dest, n);
 		goto leave;
 	}
@@ -1571,18 +2265,18 @@ ssize_t v4l2_read(int fd, void *dest, size_t n)
 	   select or poll() is done before any buffers are requested. So using mmap
 	   mode under the hood will fail if a select() or poll() is done before the
 	   first emulated read() call. */
-	if (!(devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) &&
-			!(devices[index].flags & V4L2_USE_READ_FOR_READ)) {
+	if (!(devices[index]->flags & V4L2_STREAM_CONTROLLED_BY_READ) &&
+			!(devices[index]->flags & V4L2_USE_READ_FOR_READ)) {
 		result = v4l2_activate_read_stream(index);
 		if (result) {
 			/* Activating mmap mode failed, use read() instead */
-			devices[index].flags |= V4L2_USE_READ_FOR_READ;
+			devices[index]->flags |= V4L2_USE_READ_FOR_READ;
 			/* The read call done by v4l2_read_and_convert will start the stream */
-			devices[index].first_frame = V4L2_IGNORE_FIRST_FRAME_ERRORS;
+			devices[index]->first_frame = V4L2_IGNORE_FIRST_FRAME_ERRORS;
 		}
 	}
 
-	if (devices[index].flags & V4L2_USE_READ_FOR_READ) {
+	if (devices[index]->flags & V4L2_USE_READ_FOR_READ) {
 		result = v4l2_read_and_convert(index, dest, n);
 	} else {
 		struct v4l2_buffer buf;
@@ -1597,7 +2291,7 @@ ssize_t v4l2_read(int fd, void *dest, size_t n)
 
 leave:
 	saved_errno = errno;
-	pthread_mutex_unlock(&devices[index].stream_lock);
+	pthread_mutex_unlock(&devices[index]->stream_lock);
 	errno = saved_errno;
 
 	return result;
@@ -1610,13 +2304,13 @@ ssize_t v4l2_write(int fd, const void *buffer, size_t n)
 	if (index == -1)
 		return SYS_WRITE(fd, buffer, n);
 
-	if (!devices[index].dev_ops->write) {
+	if (!devices[index]->dev_ops->write) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	return devices[index].dev_ops->write(
-			devices[index].dev_ops_priv, fd, buffer, n);
+	return devices[index]->dev_ops->write(
+			devices[index]->dev_ops_priv, fd, buffer, n);
 }
 
 void *v4l2_mmap(void *start, size_t length, int prot, int flags, int fd,
@@ -1630,8 +2324,9 @@ void *v4l2_mmap(void *start, size_t length, int prot, int flags, int fd,
 	if (index == -1 ||
 			/* Check if the mmap data matches our answer to QUERY_BUF. If it doesn't,
 			   let the kernel handle it (to allow for mmap-based non capture use) */
-			start || length != devices[index].convert_mmap_frame_size ||
-			((unsigned int)offset & ~0xFFu) != V4L2_MMAP_OFFSET_MAGIC) {
+			start || length != devices[index]->convert_mmap_frame_size ||
+			((unsigned int)offset & ~V4L2_MMAP_OFFSET_INDEX_MASK) !=
+				V4L2_MMAP_OFFSET_MAGIC) {
 		if (index != -1)
 			V4L2_LOG("Passing mmap(%p, %d, ..., %x, through to the driver\n",
 					start, (int)length, (int)offset);
@@ -1644,10 +2339,11 @@ void *v4l2_mmap(void *start, size_t length, int prot, int flags, int fd,
 		return (void *)SYS_MMAP(start, length, prot, flags, fd, offset);
 	}
 
-	pthread_mutex_lock(&devices[index].stream_lock);
+	pthread_mutex_lock(&devices[index]->stream_lock);
 
-	buffer_index = offset & 0xff;
-	if (buffer_index >= devices[index].no_frames ||
+	buffer_index = (offset & V4L2_MMAP_OFFSET_INDEX_MASK) >>
+		V4L2_MMAP_OFFSET_INDEX_SHIFT;
+	if (buffer_index >= devices[index]->no_frames ||
 			/* Got magic offset and not converting ?? */
 			!v4l2_needs_conversion(index)) {
 		errno = EINVAL;
@@ -1655,22 +2351,21 @@ void *v4l2_mmap(void *start, size_t length, int prot, int flags, int fd,
 		goto leave;
 	}
 
-	if (v4l2_ensure_convert_mmap_buf(index)) {
+	if (v4l2_ensure_convert_mmap_buf(index, buffer_index)) {
 		errno = EINVAL;
 		result = MAP_FAILED;
 		goto leave;
 	}
 
-	devices[index].frame_map_count[buffer_index]++;
+	devices[index]->frames[buffer_index].map_count++;
 
-	result = devices[index].convert_mmap_buf +
-		buffer_index * devices[index].convert_mmap_frame_size;
+	result = devices[index]->frames[buffer_index].convert_buf;
 
 	V4L2_LOG("Fake (conversion) mmap buf %u, seen by app at: %p\n",
 			buffer_index, result);
 
 leave:
-	pthread_mutex_unlock(&devices[index].stream_lock);
+	pthread_mutex_unlock(&devices[index]->stream_lock);
 
 	return result;
 }
@@ -1681,35 +2376,37 @@ int v4l2_munmap(void *_start, size_t length)
 	unsigned int buffer_index;
 	unsigned char *start = _start;
 
-	/* Is this memory ours? */
+	/* Is this memory ours? Only devices which have fake buffers of this
+	   size get locked and have their buffers checked */
 	if (start != MAP_FAILED) {
-		for (index = 0; index < devices_used; index++)
-			if (devices[index].fd != -1 &&
-					devices[index].convert_mmap_buf != MAP_FAILED &&
-					length == devices[index].convert_mmap_frame_size &&
-					start >= devices[index].convert_mmap_buf &&
-					(start - devices[index].convert_mmap_buf) % length == 0)
-				break;
+		int used = __atomic_load_n(&devices_used, __ATOMIC_ACQUIRE);
 
-		if (index != devices_used) {
+		for (index = 0; index < used; index++) {
 			int unmapped = 0;
 
-			pthread_mutex_lock(&devices[index].stream_lock);
-
-			buffer_index = (start - devices[index].convert_mmap_buf) / length;
+			if (devices[index]->fd == -1 ||
+					!devices[index]->convert_bufs ||
+					length != devices[index]->convert_mmap_frame_size)
+				continue;
 
-			/* Re-do our checks now that we have the lock, things may have changed */
-			if (devices[index].convert_mmap_buf != MAP_FAILED &&
-					length == devices[index].convert_mmap_frame_size &&
-					start >= devices[index].convert_mmap_buf &&
-					(start - devices[index].convert_mmap_buf) % length == 0 &&
-					buffer_index < devices[index].no_frames) {
-				if (devices[index].frame_map_count[buffer_index] > 0)
-					devices[index].frame_map_count[buffer_index]--;
-				unmapped = 1;
+			pthread_mutex_lock(&devices[index]->stream_lock);
+
+			for (buffer_index = 0;
+			     buffer_index < devices[index]->no_frames;
+			     buffer_index++) {
+				struct v4l2_frame *frame =
+					&devices[index]->frames[buffer_index];
+
+				if (frame->convert_buf == start &&
+						frame->convert_buf_size == length) {
+					if (frame->map_count > 0)
+						frame->map_count--;
+					unmapped = 1;
+					break;
+				}
 			}
 
-			pthread_mutex_unlock(&devices[index].stream_lock);
+			pthread_mutex_unlock(&devices[index]->stream_lock);
 
 			if (unmapped) {
 				V4L2_LOG("v4l2 fake buffer munmap %p, %d\n", start, (int)length);
@@ -1731,15 +2428,16 @@ int v4l2_set_control(int fd, int cid, int value)
 	int index, result;
 
 	index = v4l2_get_index(fd);
-	if (index == -1 || devices[index].convert == NULL) {
+	if (index == -1 || devices[index]->convert == NULL) {
 		V4L2_LOG_ERR("v4l2_set_control called with invalid fd: %d\n", fd);
 		errno = EBADF;
 		return -1;
 	}
 
-	result = v4lconvert_vidioc_queryctrl(devices[index].convert, &qctrl);
+	pthread_mutex_lock(&devices[index]->convert_lock);
+	result = v4lconvert_vidioc_queryctrl(devices[index]->convert, &qctrl);
 	if (result)
-		return result;
+		goto leave;
 
 	if (!(qctrl.flags & V4L2_CTRL_FLAG_DISABLED) &&
 			!(qctrl.flags & V4L2_CTRL_FLAG_GRABBED)) {
@@ -1749,9 +2447,11 @@ int v4l2_set_control(int fd, int cid, int value)
 			ctrl.value = ((long long) value * (qctrl.maximum - qctrl.minimum) + 32767) / 65535 +
 				qctrl.minimum;
 
-		result = v4lconvert_vidioc_s_ctrl(devices[index].convert, &ctrl);
+		result = v4lconvert_vidioc_s_ctrl(devices[index]->convert, &ctrl);
 	}
 
+leave:
+	pthread_mutex_unlock(&devices[index]->convert_lock);
 	return result;
 }
 
@@ -1760,22 +2460,25 @@ int v4l2_get_control(int fd, int cid)
 	struct v4l2_queryctrl qctrl = { .id = cid };
 	struct v4l2_control ctrl = { .id = cid };
 	int index = v4l2_get_index(fd);
+	int result;
 
-	if (index == -1 || devices[index].convert == NULL) {
+	if (index == -1 || devices[index]->convert == NULL) {
 		V4L2_LOG_ERR("v4l2_set_control called with invalid fd: %d\n", fd);
 		errno = EBADF;
 		return -1;
 	}
 
-	if (v4lconvert_vidioc_queryctrl(devices[index].convert, &qctrl))
-		return -1;
-
-	if (qctrl.flags & V4L2_CTRL_FLAG_DISABLED) {
+	pthread_mutex_lock(&devices[index]->convert_lock);
+	result = v4lconvert_vidioc_queryctrl(devices[index]->convert, &qctrl);
+	if (!result && (qctrl.flags & V4L2_CTRL_FLAG_DISABLED)) {
 		errno = EINVAL;
-		return -1;
+		result = -1;
 	}
-
-	if (v4lconvert_vidioc_g_ctrl(devices[index].convert, &ctrl))
+	if (!result)
+		result = v4lconvert_vidioc_g_ctrl(devices[index]->convert,
+						  &ctrl);
+	pthread_mutex_unlock(&devices[index]->convert_lock);
+	if (result)
 		return -1;
 
 	return (((long long) ctrl.value - qctrl.minimum) * 65535 +
@@ -4,12 +4,17 @@ include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := \
     bayer.c \
+    cache.c \
+    costmodel.c \
     cpia1.c \
     crop.c \
     flip.c \
+    fused.c \
     helper.c \
     hm12.c \
     jidctflt.c \
+    jidctfst.c \
+    jidctred.c \
     jl2005bcd.c \
     jpeg.c \
     jpeg_memsrcdest.c \
@@ -18,6 +23,7 @@ LOCAL_SRC_FILES := \
     mr97310a.c \
     pac207.c \
     rgbyuv.c \
+    rgbyuv-simd.c \
     se401.c \
     sn9c10x.c \
     sn9c2028-decomp.c \
@@ -26,6 +32,7 @@ LOCAL_SRC_FILES := \
     spca561-decompress.c \
     sq905c.c \
     stv0680.c \
+    threads.c \
     tinyjpeg.c \
     control/libv4lcontrol.c \
     processing/autogain.c  \
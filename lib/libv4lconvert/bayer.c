@@ -162,172 +162,338 @@ static void v4lconvert_border_bayer_line_to_bgr24(
 	}
 }
 
-/* From libdc1394, which on turn was based on OpenCV's Bayer decoding */
-static void bayer_to_rgbbgr24(const unsigned char *bayer,
-		unsigned char *bgr, int width, int height, const unsigned int stride, unsigned int pixfmt,
-		int start_with_green, int blue_line)
+/* Bayer formats with more than 8 bits per pixel, these get demosaiced using
+   only the 8 most significant bits of each pixel, like the 8 bit format with
+   the same pattern */
+static const struct v4lconvert_bayer_fmt {
+	unsigned int pixfmt;
+	unsigned int pixfmt8;	/* The 8 bit format with the same pattern */
+	int bits;		/* Significant bits per pixel */
+	int packed;		/* MIPI CSI-2 packed instead of 16 bit LE words */
+} v4lconvert_bayer_fmts[] = {
+	{ V4L2_PIX_FMT_SBGGR8,   V4L2_PIX_FMT_SBGGR8,  8, 0 },
+	{ V4L2_PIX_FMT_SGBRG8,   V4L2_PIX_FMT_SGBRG8,  8, 0 },
+	{ V4L2_PIX_FMT_SGRBG8,   V4L2_PIX_FMT_SGRBG8,  8, 0 },
+	{ V4L2_PIX_FMT_SRGGB8,   V4L2_PIX_FMT_SRGGB8,  8, 0 },
+	{ V4L2_PIX_FMT_SBGGR10,  V4L2_PIX_FMT_SBGGR8, 10, 0 },
+	{ V4L2_PIX_FMT_SGBRG10,  V4L2_PIX_FMT_SGBRG8, 10, 0 },
+	{ V4L2_PIX_FMT_SGRBG10,  V4L2_PIX_FMT_SGRBG8, 10, 0 },
+	{ V4L2_PIX_FMT_SRGGB10,  V4L2_PIX_FMT_SRGGB8, 10, 0 },
+	{ V4L2_PIX_FMT_SBGGR12,  V4L2_PIX_FMT_SBGGR8, 12, 0 },
+	{ V4L2_PIX_FMT_SGBRG12,  V4L2_PIX_FMT_SGBRG8, 12, 0 },
+	{ V4L2_PIX_FMT_SGRBG12,  V4L2_PIX_FMT_SGRBG8, 12, 0 },
+	{ V4L2_PIX_FMT_SRGGB12,  V4L2_PIX_FMT_SRGGB8, 12, 0 },
+	{ V4L2_PIX_FMT_SBGGR16,  V4L2_PIX_FMT_SBGGR8, 16, 0 },
+	{ V4L2_PIX_FMT_SGBRG16,  V4L2_PIX_FMT_SGBRG8, 16, 0 },
+	{ V4L2_PIX_FMT_SGRBG16,  V4L2_PIX_FMT_SGRBG8, 16, 0 },
+	{ V4L2_PIX_FMT_SRGGB16,  V4L2_PIX_FMT_SRGGB8, 16, 0 },
+	{ V4L2_PIX_FMT_SBGGR10P, V4L2_PIX_FMT_SBGGR8, 10, 1 },
+	{ V4L2_PIX_FMT_SGBRG10P, V4L2_PIX_FMT_SGBRG8, 10, 1 },
+	{ V4L2_PIX_FMT_SGRBG10P, V4L2_PIX_FMT_SGRBG8, 10, 1 },
+	{ V4L2_PIX_FMT_SRGGB10P, V4L2_PIX_FMT_SRGGB8, 10, 1 },
+	{ V4L2_PIX_FMT_SBGGR12P, V4L2_PIX_FMT_SBGGR8, 12, 1 },
+	{ V4L2_PIX_FMT_SGBRG12P, V4L2_PIX_FMT_SGBRG8, 12, 1 },
+	{ V4L2_PIX_FMT_SGRBG12P, V4L2_PIX_FMT_SGRBG8, 12, 1 },
+	{ V4L2_PIX_FMT_SRGGB12P, V4L2_PIX_FMT_SRGGB8, 12, 1 },
+};
+
+static const struct v4lconvert_bayer_fmt *v4lconvert_get_bayer_fmt(
+		unsigned int pixfmt)
 {
-	/* render the first line */
-	v4lconvert_border_bayer_line_to_bgr24(bayer, bayer + stride, bgr, width,
-			start_with_green, blue_line);
-	bgr += width * 3;
-
-	/* reduce height by 2 because of the special case top/bottom line */
-	for (height -= 2; height; height--) {
-		int t0, t1;
-		/* (width - 2) because of the border */
-		const unsigned char *bayer_end = bayer + (width - 2);
-
-		if (start_with_green) {
-
-			t0 = (bayer[1] + bayer[stride * 2 + 1] + 1) >> 1;
-			/* Write first pixel */
-			t1 = (bayer[0] + bayer[stride * 2] + bayer[stride + 1] + 1) / 3;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = t1;
-				*bgr++ = bayer[stride];
-			} else {
-				*bgr++ = bayer[stride];
-				*bgr++ = t1;
-				*bgr++ = t0;
-			}
-
-			/* Write second pixel */
-			t1 = (bayer[stride] + bayer[stride + 2] + 1) >> 1;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = t1;
-			} else {
-				*bgr++ = t1;
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = t0;
-			}
-			bayer++;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(v4lconvert_bayer_fmts); i++)
+		if (v4lconvert_bayer_fmts[i].pixfmt == pixfmt)
+			return &v4lconvert_bayer_fmts[i];
+
+	return NULL;
+}
+
+int v4lconvert_bayer_line_size(unsigned int pixfmt, int width)
+{
+	const struct v4lconvert_bayer_fmt *fmt = v4lconvert_get_bayer_fmt(pixfmt);
+
+	if (!fmt)
+		return 0;
+	if (fmt->bits == 8)
+		return width;
+	if (!fmt->packed)
+		return width * 2;
+	if (fmt->bits == 10)
+		return (width * 5 + 3) / 4;
+	return (width * 3 + 1) / 2;
+}
+
+/* Get the 8 most significant bits of each pixel of a line */
+static void bayer_unpack_line(const unsigned char *src, unsigned char *dst,
+		int width, const struct v4lconvert_bayer_fmt *fmt)
+{
+	int x, shift = fmt->bits - 8;
+
+	if (fmt->packed && fmt->bits == 10) {
+		/* 4 pixels in 5 bytes, the first 4 are the msb-s */
+		for (x = 0; x + 3 < width; x += 4) {
+			memcpy(dst + x, src, 4);
+			src += 5;
+		}
+		for (; x < width; x++)
+			dst[x] = src[x & 3];
+	} else if (fmt->packed) {
+		/* 2 pixels in 3 bytes, the first 2 are the msb-s */
+		for (x = 0; x + 1 < width; x += 2) {
+			dst[x] = src[0];
+			dst[x + 1] = src[1];
+			src += 3;
+		}
+		if (x < width)
+			dst[x] = src[0];
+	} else {
+		/* Little endian 16 bit words */
+		for (x = 0; x < width; x++)
+			dst[x] = (src[2 * x] | (src[2 * x + 1] << 8)) >> shift;
+	}
+}
+
+/* Line access for the demosaic functions. 8 bit lines are used in place,
+   other lines are unpacked to 8 bit into a ring of 3 line buffers, so that
+   each line gets unpacked only once and stays in the cache while it is being
+   used, instead of unpacking the whole frame into a temp buffer first */
+struct bayer_lines {
+	const unsigned char *src;
+	unsigned int stride;
+	int width;
+	const struct v4lconvert_bayer_fmt *fmt;
+	unsigned char *buf;
+	int y[3];
+};
+
+static void bayer_lines_init(struct bayer_lines *lines,
+		const unsigned char *src, int width, unsigned int stride,
+		const struct v4lconvert_bayer_fmt *fmt, unsigned char *buf)
+{
+	lines->src = src;
+	lines->stride = stride;
+	lines->width = width;
+	lines->fmt = fmt;
+	lines->buf = buf;
+	lines->y[0] = lines->y[1] = lines->y[2] = -1;
+}
+
+static const unsigned char *bayer_get_line(struct bayer_lines *lines, int y)
+{
+	const unsigned char *src = lines->src + y * lines->stride;
+	unsigned char *dst;
+
+	if (lines->fmt->bits == 8)
+		return src;
+
+	dst = lines->buf + (y % 3) * lines->width;
+	if (lines->y[y % 3] != y) {
+		bayer_unpack_line(src, dst, lines->width, lines->fmt);
+		lines->y[y % 3] = y;
+	}
+	return dst;
+}
+
+/* From libdc1394, which on turn was based on OpenCV's Bayer decoding.
+   Renders line cur, start_with_green and blue_line are for line prev */
+static void bayer_line_to_rgbbgr24(const unsigned char *prev,
+		const unsigned char *cur, const unsigned char *next,
+		unsigned char *bgr, int width, int start_with_green, int blue_line)
+{
+	int t0, t1;
+	/* (width - 2) because of the border */
+	const unsigned char *prev_end = prev + (width - 2);
+
+	if (start_with_green) {
+
+		t0 = (prev[1] + next[1] + 1) >> 1;
+		/* Write first pixel */
+		t1 = (prev[0] + next[0] + cur[1] + 1) / 3;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = t1;
+			*bgr++ = cur[0];
 		} else {
-			/* Write first pixel */
-			t0 = (bayer[0] + bayer[stride * 2] + 1) >> 1;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = bayer[stride];
-				*bgr++ = bayer[stride + 1];
-			} else {
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = bayer[stride];
-				*bgr++ = t0;
-			}
+			*bgr++ = cur[0];
+			*bgr++ = t1;
+			*bgr++ = t0;
 		}
 
+		/* Write second pixel */
+		t1 = (cur[0] + cur[2] + 1) >> 1;
 		if (blue_line) {
-			for (; bayer <= bayer_end - 2; bayer += 2) {
-				t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
-					bayer[stride * 2 + 2] + 2) >> 2;
-				t1 = (bayer[1] + bayer[stride] + bayer[stride + 2] +
-					bayer[stride * 2 + 1] + 2) >> 2;
-				*bgr++ = t0;
-				*bgr++ = t1;
-				*bgr++ = bayer[stride + 1];
-
-				t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
-				t1 = (bayer[stride + 1] + bayer[stride + 3] + 1) >> 1;
-				*bgr++ = t0;
-				*bgr++ = bayer[stride + 2];
-				*bgr++ = t1;
-			}
+			*bgr++ = t0;
+			*bgr++ = cur[1];
+			*bgr++ = t1;
 		} else {
-			for (; bayer <= bayer_end - 2; bayer += 2) {
-				t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
-					bayer[stride * 2 + 2] + 2) >> 2;
-				t1 = (bayer[1] + bayer[stride] + bayer[stride + 2] +
-					bayer[stride * 2 + 1] + 2) >> 2;
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = t1;
-				*bgr++ = t0;
-
-				t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
-				t1 = (bayer[stride + 1] + bayer[stride + 3] + 1) >> 1;
-				*bgr++ = t1;
-				*bgr++ = bayer[stride + 2];
-				*bgr++ = t0;
-			}
+			*bgr++ = t1;
+			*bgr++ = cur[1];
+			*bgr++ = t0;
 		}
+		prev++;
+		cur++;
+		next++;
+	} else {
+		/* Write first pixel */
+		t0 = (prev[0] + next[0] + 1) >> 1;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = cur[0];
+			*bgr++ = cur[1];
+		} else {
+			*bgr++ = cur[1];
+			*bgr++ = cur[0];
+			*bgr++ = t0;
+		}
+	}
 
-		if (bayer < bayer_end) {
-			/* write second to last pixel */
-			t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
-				bayer[stride * 2 + 2] + 2) >> 2;
-			t1 = (bayer[1] + bayer[stride] + bayer[stride + 2] +
-				bayer[stride * 2 + 1] + 2) >> 2;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = t1;
-				*bgr++ = bayer[stride + 1];
-			} else {
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = t1;
-				*bgr++ = t0;
-			}
-			/* write last pixel */
-			t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = bayer[stride + 2];
-				*bgr++ = bayer[stride + 1];
-			} else {
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = bayer[stride + 2];
-				*bgr++ = t0;
-			}
+	if (v4lconvert_simd.bayer_to_rgb24_pairs && prev <= prev_end - 2) {
+		int pairs = ((prev_end - 2 - prev) / 2 + 1) & ~7;
 
-			bayer++;
+		v4lconvert_simd.bayer_to_rgb24_pairs(prev, cur, next, bgr,
+						     pairs, blue_line);
+		prev += 2 * pairs;
+		cur += 2 * pairs;
+		next += 2 * pairs;
+		bgr += 6 * pairs;
+	}
 
-		} else {
-			/* write last pixel */
-			t0 = (bayer[0] + bayer[stride * 2] + 1) >> 1;
-			t1 = (bayer[1] + bayer[stride * 2 + 1] + bayer[stride] + 1) / 3;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = t1;
-				*bgr++ = bayer[stride + 1];
-			} else {
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = t1;
-				*bgr++ = t0;
-			}
+	if (blue_line) {
+		for (; prev <= prev_end - 2; prev += 2, cur += 2, next += 2) {
+			t0 = (prev[0] + prev[2] + next[0] + next[2] + 2) >> 2;
+			t1 = (prev[1] + cur[0] + cur[2] + next[1] + 2) >> 2;
+			*bgr++ = t0;
+			*bgr++ = t1;
+			*bgr++ = cur[1];
 
+			t0 = (prev[2] + next[2] + 1) >> 1;
+			t1 = (cur[1] + cur[3] + 1) >> 1;
+			*bgr++ = t0;
+			*bgr++ = cur[2];
+			*bgr++ = t1;
 		}
+	} else {
+		for (; prev <= prev_end - 2; prev += 2, cur += 2, next += 2) {
+			t0 = (prev[0] + prev[2] + next[0] + next[2] + 2) >> 2;
+			t1 = (prev[1] + cur[0] + cur[2] + next[1] + 2) >> 2;
+			*bgr++ = cur[1];
+			*bgr++ = t1;
+			*bgr++ = t0;
 
-		/* skip 2 border pixels and padding */
-		bayer += (stride - width) + 2;
+			t0 = (prev[2] + next[2] + 1) >> 1;
+			t1 = (cur[1] + cur[3] + 1) >> 1;
+			*bgr++ = t1;
+			*bgr++ = cur[2];
+			*bgr++ = t0;
+		}
+	}
 
-		blue_line = !blue_line;
-		start_with_green = !start_with_green;
+	if (prev < prev_end) {
+		/* write second to last pixel */
+		t0 = (prev[0] + prev[2] + next[0] + next[2] + 2) >> 2;
+		t1 = (prev[1] + cur[0] + cur[2] + next[1] + 2) >> 2;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = t1;
+			*bgr++ = cur[1];
+		} else {
+			*bgr++ = cur[1];
+			*bgr++ = t1;
+			*bgr++ = t0;
+		}
+		/* write last pixel */
+		t0 = (prev[2] + next[2] + 1) >> 1;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = cur[2];
+			*bgr++ = cur[1];
+		} else {
+			*bgr++ = cur[1];
+			*bgr++ = cur[2];
+			*bgr++ = t0;
+		}
+	} else {
+		/* write last pixel */
+		t0 = (prev[0] + next[0] + 1) >> 1;
+		t1 = (prev[1] + next[1] + cur[0] + 1) / 3;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = t1;
+			*bgr++ = cur[1];
+		} else {
+			*bgr++ = cur[1];
+			*bgr++ = t1;
+			*bgr++ = t0;
+		}
 	}
+}
 
-	/* render the last line */
-	v4lconvert_border_bayer_line_to_bgr24(bayer + stride, bayer, bgr, width,
-			!start_with_green, !blue_line);
+/* Render lines first to last - 1, the flags are for the first line of the
+   frame */
+static void bayer_to_rgbbgr24(const unsigned char *bayer,
+		unsigned char *bgr, int width, int height, const unsigned int stride,
+		const struct v4lconvert_bayer_fmt *fmt, int start_with_green,
+		int blue_line, unsigned char *line_buf, int first, int last)
+{
+	struct bayer_lines lines;
+	int y;
+
+	bayer_lines_init(&lines, bayer, width, stride, fmt, line_buf);
+	bgr += first * width * 3;
+
+	for (y = first; y < last; y++) {
+		int odd = y & 1;
+
+		if (y == 0)
+			/* render the first line */
+			v4lconvert_border_bayer_line_to_bgr24(
+				bayer_get_line(&lines, 0),
+				bayer_get_line(&lines, 1), bgr, width,
+				start_with_green, blue_line);
+		else if (y == height - 1)
+			/* render the last line */
+			v4lconvert_border_bayer_line_to_bgr24(
+				bayer_get_line(&lines, y),
+				bayer_get_line(&lines, y - 1), bgr, width,
+				start_with_green ^ odd, blue_line ^ odd);
+		else
+			bayer_line_to_rgbbgr24(bayer_get_line(&lines, y - 1),
+				bayer_get_line(&lines, y),
+				bayer_get_line(&lines, y + 1), bgr, width,
+				start_with_green ^ !odd, blue_line ^ !odd);
+		bgr += width * 3;
+	}
 }
 
 void v4lconvert_bayer_to_rgb24(const unsigned char *bayer,
-		unsigned char *bgr, int width, int height, const unsigned int stride, unsigned int pixfmt)
+		unsigned char *bgr, int width, int height, const unsigned int stride,
+		unsigned int pixfmt, unsigned char *line_buf, int first, int last)
 {
-	bayer_to_rgbbgr24(bayer, bgr, width, height, stride, pixfmt,
+	const struct v4lconvert_bayer_fmt *fmt = v4lconvert_get_bayer_fmt(pixfmt);
+
+	pixfmt = fmt->pixfmt8;
+	bayer_to_rgbbgr24(bayer, bgr, width, height, stride, fmt,
 			pixfmt == V4L2_PIX_FMT_SGBRG8		/* start with green */
 			|| pixfmt == V4L2_PIX_FMT_SGRBG8,
 			pixfmt != V4L2_PIX_FMT_SBGGR8		/* blue line */
-			&& pixfmt != V4L2_PIX_FMT_SGBRG8);
+			&& pixfmt != V4L2_PIX_FMT_SGBRG8,
+			line_buf, first, last);
 }
 
 void v4lconvert_bayer_to_bgr24(const unsigned char *bayer,
-		unsigned char *bgr, int width, int height, const unsigned int stride, unsigned int pixfmt)
+		unsigned char *bgr, int width, int height, const unsigned int stride,
+		unsigned int pixfmt, unsigned char *line_buf, int first, int last)
 {
-	bayer_to_rgbbgr24(bayer, bgr, width, height, stride, pixfmt,
+	const struct v4lconvert_bayer_fmt *fmt = v4lconvert_get_bayer_fmt(pixfmt);
+
+	pixfmt = fmt->pixfmt8;
+	bayer_to_rgbbgr24(bayer, bgr, width, height, stride, fmt,
 			pixfmt == V4L2_PIX_FMT_SGBRG8		/* start with green */
 			|| pixfmt == V4L2_PIX_FMT_SGRBG8,
 			pixfmt == V4L2_PIX_FMT_SBGGR8		/* blue line */
-			|| pixfmt == V4L2_PIX_FMT_SGBRG8);
+			|| pixfmt == V4L2_PIX_FMT_SGBRG8,
+			line_buf, first, last);
 }
 
 static void v4lconvert_border_bayer_line_to_y(
@@ -429,205 +595,217 @@ static void v4lconvert_border_bayer_line_to_y(
 	}
 }
 
-void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
-		int width, int height, const unsigned int stride, unsigned int src_pixfmt, int yvu)
+/* Renders the y values of line cur, the flags are for line prev */
+static void bayer_line_to_y(const unsigned char *prev,
+		const unsigned char *cur, const unsigned char *next,
+		unsigned char *ydst, int width, int start_with_green, int blue_line)
 {
-	int blue_line = 0, start_with_green = 0, x, y;
-	unsigned char *ydst = yuv;
-	unsigned char *udst, *vdst;
+	int t0, t1;
+	/* (width - 2) because of the border */
+	const unsigned char *prev_end = prev + (width - 2);
 
-	if (yvu) {
-		vdst = yuv + width * height;
-		udst = vdst + width * height / 4;
+	if (start_with_green) {
+		t0 = prev[1] + next[1];
+		/* Write first pixel */
+		t1 = prev[0] + next[0] + cur[1];
+		if (blue_line)
+			*ydst++ = (8453 * cur[0] + 5516 * t1 +
+					1661 * t0 + 524288) >> 15;
+		else
+			*ydst++ = (4226 * t0 + 5516 * t1 +
+					3223 * cur[0] + 524288) >> 15;
+
+		/* Write second pixel */
+		t1 = cur[0] + cur[2];
+		if (blue_line)
+			*ydst++ = (4226 * t1 + 16594 * cur[1] +
+					1611 * t0 + 524288) >> 15;
+		else
+			*ydst++ = (4226 * t0 + 16594 * cur[1] +
+					1611 * t1 + 524288) >> 15;
+		prev++;
+		cur++;
+		next++;
 	} else {
-		udst = yuv + width * height;
-		vdst = udst + width * height / 4;
+		/* Write first pixel */
+		t0 = prev[0] + next[0];
+		if (blue_line) {
+			*ydst++ = (8453 * cur[1] + 16594 * cur[0] +
+					1661 * t0 + 524288) >> 15;
+		} else {
+			*ydst++ = (4226 * t0 + 16594 * cur[0] +
+					3223 * cur[1] + 524288) >> 15;
+		}
 	}
 
-	/* First calculate the u and v planes 2x2 pixels at a time */
-	switch (src_pixfmt) {
-	case V4L2_PIX_FMT_SBGGR8:
-		for (y = 0; y < height; y += 2) {
-			for (x = 0; x < width; x += 2) {
-				int b, g, r;
-
-				b  = bayer[x];
-				g  = bayer[x + 1];
-				g += bayer[x + stride];
-				r  = bayer[x + stride + 1];
-				*udst++ = (-4878 * r - 4789 * g + 14456 * b + 4210688) >> 15;
-				*vdst++ = (14456 * r - 6052 * g -  2351 * b + 4210688) >> 15;
-			}
-			bayer += 2 * stride;
-		}
-		blue_line = 1;
-		break;
+	if (v4lconvert_simd.bayer_to_y_pairs && prev <= prev_end - 2) {
+		int pairs = ((prev_end - 2 - prev) / 2 + 1) & ~7;
 
-	case V4L2_PIX_FMT_SRGGB8:
-		for (y = 0; y < height; y += 2) {
-			for (x = 0; x < width; x += 2) {
-				int b, g, r;
-
-				r  = bayer[x];
-				g  = bayer[x + 1];
-				g += bayer[x + stride];
-				b  = bayer[x + stride + 1];
-				*udst++ = (-4878 * r - 4789 * g + 14456 * b + 4210688) >> 15;
-				*vdst++ = (14456 * r - 6052 * g -  2351 * b + 4210688) >> 15;
-			}
-			bayer += 2 * stride;
-		}
-		break;
+		v4lconvert_simd.bayer_to_y_pairs(prev, cur, next, ydst,
+						 pairs, blue_line);
+		prev += 2 * pairs;
+		cur += 2 * pairs;
+		next += 2 * pairs;
+		ydst += 2 * pairs;
+	}
 
-	case V4L2_PIX_FMT_SGBRG8:
-		for (y = 0; y < height; y += 2) {
-			for (x = 0; x < width; x += 2) {
-				int b, g, r;
-
-				g  = bayer[x];
-				b  = bayer[x + 1];
-				r  = bayer[x + stride];
-				g += bayer[x + stride + 1];
-				*udst++ = (-4878 * r - 4789 * g + 14456 * b + 4210688) >> 15;
-				*vdst++ = (14456 * r - 6052 * g -  2351 * b + 4210688) >> 15;
-			}
-			bayer += 2 * stride;
+	if (blue_line) {
+		for (; prev <= prev_end - 2; prev += 2, cur += 2, next += 2) {
+			t0 = prev[0] + prev[2] + next[0] + next[2];
+			t1 = prev[1] + cur[0] + cur[2] + next[1];
+			*ydst++ = (8453 * cur[1] + 4148 * t1 +
+					806 * t0 + 524288) >> 15;
+
+			t0 = prev[2] + next[2];
+			t1 = cur[1] + cur[3];
+			*ydst++ = (4226 * t1 + 16594 * cur[2] +
+					1611 * t0 + 524288) >> 15;
 		}
-		blue_line = 1;
-		start_with_green = 1;
-		break;
-
-	case V4L2_PIX_FMT_SGRBG8:
-		for (y = 0; y < height; y += 2) {
-			for (x = 0; x < width; x += 2) {
-				int b, g, r;
-
-				g  = bayer[x];
-				r  = bayer[x + 1];
-				b  = bayer[x + stride];
-				g += bayer[x + stride + 1];
-				*udst++ = (-4878 * r - 4789 * g + 14456 * b + 4210688) >> 15;
-				*vdst++ = (14456 * r - 6052 * g -  2351 * b + 4210688) >> 15;
-			}
-			bayer += 2 * stride;
+	} else {
+		for (; prev <= prev_end - 2; prev += 2, cur += 2, next += 2) {
+			t0 = prev[0] + prev[2] + next[0] + next[2];
+			t1 = prev[1] + cur[0] + cur[2] + next[1];
+			*ydst++ = (2113 * t0 + 4148 * t1 +
+					3223 * cur[1] + 524288) >> 15;
+
+			t0 = prev[2] + next[2];
+			t1 = cur[1] + cur[3];
+			*ydst++ = (4226 * t0 + 16594 * cur[2] +
+					1611 * t1 + 524288) >> 15;
 		}
-		start_with_green = 1;
-		break;
 	}
 
-	/* Point bayer back to start of frame */
-	bayer -= stride * height;
-
-	/* render the first line */
-	v4lconvert_border_bayer_line_to_y(bayer, bayer + stride, ydst, width,
-			start_with_green, blue_line);
-	ydst += width;
-
-	/* reduce height by 2 because of the border */
-	for (height -= 2; height; height--) {
-		int t0, t1;
-		/* (width - 2) because of the border */
-		const unsigned char *bayer_end = bayer + (width - 2);
-
-		if (start_with_green) {
-			t0 = bayer[1] + bayer[stride * 2 + 1];
-			/* Write first pixel */
-			t1 = bayer[0] + bayer[stride * 2] + bayer[stride + 1];
-			if (blue_line)
-				*ydst++ = (8453 * bayer[stride] + 5516 * t1 +
-						1661 * t0 + 524288) >> 15;
-			else
-				*ydst++ = (4226 * t0 + 5516 * t1 +
-						3223 * bayer[stride] + 524288) >> 15;
-
-			/* Write second pixel */
-			t1 = bayer[stride] + bayer[stride + 2];
-			if (blue_line)
-				*ydst++ = (4226 * t1 + 16594 * bayer[stride + 1] +
-						1611 * t0 + 524288) >> 15;
-			else
-				*ydst++ = (4226 * t0 + 16594 * bayer[stride + 1] +
-						1611 * t1 + 524288) >> 15;
-			bayer++;
-		} else {
-			/* Write first pixel */
-			t0 = bayer[0] + bayer[stride * 2];
-			if (blue_line) {
-				*ydst++ = (8453 * bayer[stride + 1] + 16594 * bayer[stride] +
-						1661 * t0 + 524288) >> 15;
-			} else {
-				*ydst++ = (4226 * t0 + 16594 * bayer[stride] +
-						3223 * bayer[stride + 1] + 524288) >> 15;
-			}
-		}
+	if (prev < prev_end) {
+		/* Write second to last pixel */
+		t0 = prev[0] + prev[2] + next[0] + next[2];
+		t1 = prev[1] + cur[0] + cur[2] + next[1];
+		if (blue_line)
+			*ydst++ = (8453 * cur[1] + 4148 * t1 +
+					806 * t0 + 524288) >> 15;
+		else
+			*ydst++ = (2113 * t0 + 4148 * t1 +
+					3223 * cur[1] + 524288) >> 15;
 
+		/* write last pixel */
+		t0 = prev[2] + next[2];
 		if (blue_line) {
-			for (; bayer <= bayer_end - 2; bayer += 2) {
-				t0 = bayer[0] + bayer[2] + bayer[stride * 2] + bayer[stride * 2 + 2];
-				t1 = bayer[1] + bayer[stride] + bayer[stride + 2] + bayer[stride * 2 + 1];
-				*ydst++ = (8453 * bayer[stride + 1] + 4148 * t1 +
-						806 * t0 + 524288) >> 15;
-
-				t0 = bayer[2] + bayer[stride * 2 + 2];
-				t1 = bayer[stride + 1] + bayer[stride + 3];
-				*ydst++ = (4226 * t1 + 16594 * bayer[stride + 2] +
-						1611 * t0 + 524288) >> 15;
-			}
+			*ydst++ = (8453 * cur[1] + 16594 * cur[2] +
+					1661 * t0 + 524288) >> 15;
 		} else {
-			for (; bayer <= bayer_end - 2; bayer += 2) {
-				t0 = bayer[0] + bayer[2] + bayer[stride * 2] + bayer[stride * 2 + 2];
-				t1 = bayer[1] + bayer[stride] + bayer[stride + 2] + bayer[stride * 2 + 1];
-				*ydst++ = (2113 * t0 + 4148 * t1 +
-						3223 * bayer[stride + 1] + 524288) >> 15;
-
-				t0 = bayer[2] + bayer[stride * 2 + 2];
-				t1 = bayer[stride + 1] + bayer[stride + 3];
-				*ydst++ = (4226 * t0 + 16594 * bayer[stride + 2] +
-						1611 * t1 + 524288) >> 15;
-			}
+			*ydst++ = (4226 * t0 + 16594 * cur[2] +
+					3223 * cur[1] + 524288) >> 15;
 		}
+	} else {
+		/* write last pixel */
+		t0 = prev[0] + next[0];
+		t1 = prev[1] + next[1] + cur[0];
+		if (blue_line)
+			*ydst++ = (8453 * cur[1] + 5516 * t1 +
+					1661 * t0 + 524288) >> 15;
+		else
+			*ydst++ = (4226 * t0 + 5516 * t1 +
+					3223 * cur[1] + 524288) >> 15;
+	}
+}
 
-		if (bayer < bayer_end) {
-			/* Write second to last pixel */
-			t0 = bayer[0] + bayer[2] + bayer[stride * 2] + bayer[stride * 2 + 2];
-			t1 = bayer[1] + bayer[stride] + bayer[stride + 2] + bayer[stride * 2 + 1];
-			if (blue_line)
-				*ydst++ = (8453 * bayer[stride + 1] + 4148 * t1 +
-						806 * t0 + 524288) >> 15;
-			else
-				*ydst++ = (2113 * t0 + 4148 * t1 +
-						3223 * bayer[stride + 1] + 524288) >> 15;
-
-			/* write last pixel */
-			t0 = bayer[2] + bayer[stride * 2 + 2];
-			if (blue_line) {
-				*ydst++ = (8453 * bayer[stride + 1] + 16594 * bayer[stride + 2] +
-						1661 * t0 + 524288) >> 15;
-			} else {
-				*ydst++ = (4226 * t0 + 16594 * bayer[stride + 2] +
-						3223 * bayer[stride + 1] + 524288) >> 15;
-			}
-			bayer++;
-		} else {
-			/* write last pixel */
-			t0 = bayer[0] + bayer[stride * 2];
-			t1 = bayer[1] + bayer[stride * 2 + 1] + bayer[stride];
-			if (blue_line)
-				*ydst++ = (8453 * bayer[stride + 1] + 5516 * t1 +
-						1661 * t0 + 524288) >> 15;
-			else
-				*ydst++ = (4226 * t0 + 5516 * t1 +
-						3223 * bayer[stride + 1] + 524288) >> 15;
-		}
+/* Calculate the u and v values of 2 lines 2x2 pixels at a time */
+static void bayer_lines_to_uv(const unsigned char *line0,
+		const unsigned char *line1, unsigned char *udst,
+		unsigned char *vdst, int width, unsigned int pixfmt)
+{
+	const unsigned char *r, *g0, *g1, *b;
+	int x;
+
+	switch (pixfmt) {
+	case V4L2_PIX_FMT_SBGGR8:
+		b = line0;
+		g0 = line0 + 1;
+		g1 = line1;
+		r = line1 + 1;
+		break;
+	case V4L2_PIX_FMT_SRGGB8:
+		r = line0;
+		g0 = line0 + 1;
+		g1 = line1;
+		b = line1 + 1;
+		break;
+	case V4L2_PIX_FMT_SGBRG8:
+		g0 = line0;
+		b = line0 + 1;
+		r = line1;
+		g1 = line1 + 1;
+		break;
+	default: /* V4L2_PIX_FMT_SGRBG8 */
+		g0 = line0;
+		r = line0 + 1;
+		b = line1;
+		g1 = line1 + 1;
+		break;
+	}
 
-		/* skip 2 border pixels and padding */
-		bayer += (stride - width) + 2;
+	for (x = 0; x < width; x += 2) {
+		int g = g0[x] + g1[x];
 
-		blue_line = !blue_line;
-		start_with_green = !start_with_green;
+		*udst++ = (-4878 * r[x] - 4789 * g + 14456 * b[x] + 4210688) >> 15;
+		*vdst++ = (14456 * r[x] - 6052 * g -  2351 * b[x] + 4210688) >> 15;
 	}
+}
+
+/* Render lines first to last - 1, first must be even */
+void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
+		int width, int height, const unsigned int stride, unsigned int src_pixfmt,
+		int yvu, unsigned char *line_buf, int first, int last)
+{
+	const struct v4lconvert_bayer_fmt *fmt = v4lconvert_get_bayer_fmt(src_pixfmt);
+	unsigned int pixfmt = fmt->pixfmt8;
+	int blue_line = pixfmt == V4L2_PIX_FMT_SBGGR8 || pixfmt == V4L2_PIX_FMT_SGBRG8;
+	int start_with_green = pixfmt == V4L2_PIX_FMT_SGBRG8 || pixfmt == V4L2_PIX_FMT_SGRBG8;
+	struct bayer_lines lines;
+	unsigned char *ydst = yuv;
+	unsigned char *udst, *vdst;
+	int y;
 
-	/* render the last line */
-	v4lconvert_border_bayer_line_to_y(bayer + stride, bayer, ydst, width,
-			!start_with_green, !blue_line);
+	if (yvu) {
+		vdst = yuv + width * height;
+		udst = vdst + width * height / 4;
+	} else {
+		udst = yuv + width * height;
+		vdst = udst + width * height / 4;
+	}
+	ydst += first * width;
+	udst += first / 2 * width / 2;
+	vdst += first / 2 * width / 2;
+
+	bayer_lines_init(&lines, bayer, width, stride, fmt, line_buf);
+
+	for (y = first; y < last; y++) {
+		int odd = y & 1;
+
+		if (y == 0)
+			/* render the first line */
+			v4lconvert_border_bayer_line_to_y(
+				bayer_get_line(&lines, 0),
+				bayer_get_line(&lines, 1), ydst, width,
+				start_with_green, blue_line);
+		else if (y == height - 1)
+			/* render the last line */
+			v4lconvert_border_bayer_line_to_y(
+				bayer_get_line(&lines, y),
+				bayer_get_line(&lines, y - 1), ydst, width,
+				start_with_green ^ odd, blue_line ^ odd);
+		else
+			bayer_line_to_y(bayer_get_line(&lines, y - 1),
+				bayer_get_line(&lines, y),
+				bayer_get_line(&lines, y + 1), ydst, width,
+				start_with_green ^ !odd, blue_line ^ !odd);
+		ydst += width;
+
+		if (!odd && y + 1 < height) {
+			bayer_lines_to_uv(bayer_get_line(&lines, y),
+				bayer_get_line(&lines, y + 1), udst, vdst,
+				width, pixfmt);
+			udst += width / 2;
+			vdst += width / 2;
+		}
+	}
 }
@@ -0,0 +1,113 @@
+/*
+# MSB first bit reader for the cam specific compressed bayer decoders
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+ */
+
+#ifndef __LIBV4LCONVERT_BITSTREAM_H
+#define __LIBV4LCONVERT_BITSTREAM_H
+
+#include <stdint.h>
+
+/* The next bits of the stream are kept MSB aligned in a 64 bit buffer,
+   v4lconvert_bits_refill() tops it up to at least 56 bits with a single 8
+   byte load (except near the end of the stream), so that a decoder can
+   peek and consume the bits of one or more codes without checking for more
+   input in between. Reading past the end of the stream gives 0 bits, use
+   v4lconvert_bits_pos() to detect that.
+
+   The refill loads the next 8 bytes even when only some of them fit, the
+   bytes which do not fit get loaded again by the next refill. This keeps
+   the refill free of loops and data dependent branches, and works because
+   the bits below the valid ones in the buffer are either 0 or the same
+   bits the next refill ORs in. */
+struct v4lconvert_bitstream {
+	const unsigned char *data;
+	int size;
+	int next;	/* Offset of the next byte to load */
+	int count;	/* Number of valid bits in buf */
+	uint64_t buf;
+};
+
+static inline void v4lconvert_bits_init(struct v4lconvert_bitstream *bs,
+		const unsigned char *data, int size)
+{
+	bs->data = data;
+	bs->size = size;
+	bs->next = 0;
+	bs->count = 0;
+	bs->buf = 0;
+}
+
+static inline void v4lconvert_bits_refill(struct v4lconvert_bitstream *bs)
+{
+	if (bs->next + 8 <= bs->size) {
+		const unsigned char *p = bs->data + bs->next;
+		/* Compilers turn this into a load + byte swap */
+		uint64_t v = (uint64_t)p[0] << 56 | (uint64_t)p[1] << 48 |
+			     (uint64_t)p[2] << 40 | (uint64_t)p[3] << 32 |
+			     (uint64_t)p[4] << 24 | (uint64_t)p[5] << 16 |
+			     (uint64_t)p[6] << 8 | p[7];
+
+		bs->buf |= v >> bs->count;
+		bs->next += (63 - bs->count) >> 3;
+		bs->count |= 56;
+		return;
+	}
+
+	while (bs->count < 56) {
+		if (bs->next < bs->size)
+			bs->buf |= (uint64_t)bs->data[bs->next] <<
+				   (56 - bs->count);
+		bs->next++;
+		bs->count += 8;
+	}
+}
+
+/* Return the next n (1 - 32) bits without consuming them, there must be at
+   least n bits in the buffer, so the decoder must refill in time */
+static inline unsigned int v4lconvert_bits_peek(
+		const struct v4lconvert_bitstream *bs, int n)
+{
+	return bs->buf >> (64 - n);
+}
+
+static inline void v4lconvert_bits_skip(struct v4lconvert_bitstream *bs,
+		int n)
+{
+	bs->buf <<= n;
+	bs->count -= n;
+}
+
+/* Refill, then peek and consume n (1 - 32) bits */
+static inline unsigned int v4lconvert_bits_get(struct v4lconvert_bitstream *bs,
+		int n)
+{
+	unsigned int v;
+
+	v4lconvert_bits_refill(bs);
+	v = v4lconvert_bits_peek(bs, n);
+	v4lconvert_bits_skip(bs, n);
+	return v;
+}
+
+/* Number of bits consumed so far, larger than size * 8 after reading past
+   the end of the stream */
+static inline int v4lconvert_bits_pos(const struct v4lconvert_bitstream *bs)
+{
+	return bs->next * 8 - bs->count;
+}
+
+#endif
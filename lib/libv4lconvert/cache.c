@@ -0,0 +1,403 @@
+/*
+# On disk caches: the results of enumerating a device's formats and frame
+# sizes, and helpers for storing cache files
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+ */
+
+/*
+ * Enumerating all formats and frame sizes on each open costs a lot of ioctls,
+ * which on some devices (and through some dev_ops plugins) are slow. When the
+ * LIBV4LCONVERT_ENUM_CACHE environment variable is set v4lconvert_create
+ * stores the results in a per device file, and replays them from there on
+ * the next open of the same device. The file is only used when the driver,
+ * card, bus info and driver version reported by QUERYCAP, and the USB vendor
+ * and product id (if any) of the device are unchanged.
+ *
+ * LIBV4LCONVERT_ENUM_CACHE=1 stores the files in $XDG_CACHE_HOME/libv4l (or
+ * ~/.cache/libv4l), any other value (except 0) is used as the directory to
+ * store them in.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include "libv4lconvert-priv.h"
+
+#define ENUM_CACHE_VERSION	1
+
+struct v4lconvert_enum_cache {
+	char *path;
+	char *key;
+	int loaded;	/* Replaying from the file, else recording */
+	int failed;	/* Recording is incomplete, do not store it */
+	struct v4l2_fmtdesc *fmts;
+	int no_fmts;
+	struct v4l2_frmsizeenum *sizes;
+	int no_sizes;
+};
+
+char *v4lconvert_cache_path(const char *name)
+{
+	const char *dir = getenv("XDG_CACHE_HOME");
+	const char *sub = "libv4l";
+	char *path;
+
+	if (!dir || dir[0] != '/') {
+		dir = getenv("HOME");
+		sub = ".cache/libv4l";
+		if (!dir || dir[0] != '/')
+			return NULL;
+	}
+
+	if (asprintf(&path, "%s/%s/%s", dir, sub, name) < 0)
+		return NULL;
+
+	return path;
+}
+
+FILE *v4lconvert_cache_create(const char *path, char **tmp_path)
+{
+	char *p;
+	FILE *f;
+	int fd;
+
+	if (asprintf(tmp_path, "%s.XXXXXX", path) < 0)
+		return NULL;
+
+	/* Create the parent directories */
+	for (p = strchr(*tmp_path + 1, '/'); p; p = strchr(p + 1, '/')) {
+		*p = 0;
+		if (mkdir(*tmp_path, 0755) && errno != EEXIST) {
+			*p = '/';
+			break;
+		}
+		*p = '/';
+	}
+
+	fd = mkstemp(*tmp_path);
+	if (fd == -1) {
+		free(*tmp_path);
+		return NULL;
+	}
+
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		unlink(*tmp_path);
+		free(*tmp_path);
+	}
+	return f;
+}
+
+void v4lconvert_cache_commit(FILE *f, char *tmp_path, const char *path)
+{
+	/* Replace the old file atomically, so that concurrent users never see
+	   a partial file */
+	if (fclose(f) || rename(tmp_path, path))
+		unlink(tmp_path);
+	free(tmp_path);
+}
+
+/* Strip the trailing newline, returns 0 if there was none (line too long) */
+static int v4lconvert_cache_chomp(char *line)
+{
+	int len = strlen(line);
+
+	if (!len || line[len - 1] != '\n')
+		return 0;
+
+	line[len - 1] = 0;
+	return 1;
+}
+
+static int v4lconvert_enum_cache_load(struct v4lconvert_enum_cache *cache)
+{
+	char line[512];
+	int ret = -1;
+	FILE *f;
+
+	f = fopen(cache->path, "r");
+	if (!f)
+		return -1;
+
+	if (!fgets(line, sizeof(line), f) || !v4lconvert_cache_chomp(line) ||
+	    strcmp(line, cache->key))
+		goto leave;
+
+	while (fgets(line, sizeof(line), f)) {
+		struct v4l2_fmtdesc fmt = { .type = V4L2_BUF_TYPE_VIDEO_CAPTURE };
+		struct v4l2_frmsizeenum size = { .index = 0 };
+		unsigned int v[6];
+		void *new_mem;
+		int n;
+
+		if (!v4lconvert_cache_chomp(line))
+			goto leave;
+
+		if (sscanf(line, "fmt %x %x %n", &fmt.pixelformat, &fmt.flags,
+			   &n) == 2) {
+			strncpy((char *)fmt.description, line + n,
+				sizeof(fmt.description) - 1);
+			fmt.index = cache->no_fmts;
+			new_mem = realloc(cache->fmts,
+				(cache->no_fmts + 1) * sizeof(fmt));
+			if (!new_mem)
+				goto leave;
+			cache->fmts = new_mem;
+			cache->fmts[cache->no_fmts++] = fmt;
+		} else if (sscanf(line, "size %x %u %u %u %u %u %u %u",
+				  &size.pixel_format, &size.type, &v[0], &v[1],
+				  &v[2], &v[3], &v[4], &v[5]) == 8) {
+			if (size.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+				size.discrete.width = v[0];
+				size.discrete.height = v[1];
+			} else {
+				size.stepwise.min_width = v[0];
+				size.stepwise.max_width = v[1];
+				size.stepwise.step_width = v[2];
+				size.stepwise.min_height = v[3];
+				size.stepwise.max_height = v[4];
+				size.stepwise.step_height = v[5];
+			}
+			new_mem = realloc(cache->sizes,
+				(cache->no_sizes + 1) * sizeof(size));
+			if (!new_mem)
+				goto leave;
+			cache->sizes = new_mem;
+			cache->sizes[cache->no_sizes++] = size;
+		} else
+			goto leave;
+	}
+	ret = 0;
+
+leave:
+	fclose(f);
+	if (ret) {
+		/* Start over, recording from the device */
+		free(cache->fmts);
+		free(cache->sizes);
+		cache->fmts = NULL;
+		cache->sizes = NULL;
+		cache->no_fmts = 0;
+		cache->no_sizes = 0;
+	}
+	return ret;
+}
+
+static void v4lconvert_enum_cache_save(struct v4lconvert_enum_cache *cache)
+{
+	char *tmp_path;
+	FILE *f;
+	int i;
+
+	f = v4lconvert_cache_create(cache->path, &tmp_path);
+	if (!f)
+		return;
+
+	fprintf(f, "%s\n", cache->key);
+	for (i = 0; i < cache->no_fmts; i++)
+		fprintf(f, "fmt %08x %08x %.32s\n", cache->fmts[i].pixelformat,
+			cache->fmts[i].flags,
+			(char *)cache->fmts[i].description);
+
+	for (i = 0; i < cache->no_sizes; i++) {
+		struct v4l2_frmsizeenum *size = &cache->sizes[i];
+
+		if (size->type == V4L2_FRMSIZE_TYPE_DISCRETE)
+			fprintf(f, "size %08x %u %u %u 0 0 0 0\n",
+				size->pixel_format, size->type,
+				size->discrete.width, size->discrete.height);
+		else
+			fprintf(f, "size %08x %u %u %u %u %u %u %u\n",
+				size->pixel_format, size->type,
+				size->stepwise.min_width,
+				size->stepwise.max_width,
+				size->stepwise.step_width,
+				size->stepwise.min_height,
+				size->stepwise.max_height,
+				size->stepwise.step_height);
+	}
+
+	v4lconvert_cache_commit(f, tmp_path, cache->path);
+}
+
+/* Get the usb vendor and product id of the device, straight from sysfs */
+static void v4lconvert_get_usb_id(int fd, unsigned short *vendor_id,
+		unsigned short *product_id)
+{
+	char sysfs_name[64], buf[32], c;
+	struct stat st;
+	FILE *f;
+
+	*vendor_id = *product_id = 0;
+
+	if (fstat(fd, &st) || !S_ISCHR(st.st_mode))
+		return;
+
+	snprintf(sysfs_name, sizeof(sysfs_name),
+		 "/sys/dev/char/%u:%u/device/modalias",
+		 major(st.st_rdev), minor(st.st_rdev));
+	f = fopen(sysfs_name, "r");
+	if (!f)
+		return;
+
+	if (!fgets(buf, sizeof(buf), f) ||
+	    sscanf(buf, "usb:v%4hxp%4hx%c", vendor_id, product_id, &c) != 3)
+		*vendor_id = *product_id = 0;
+	fclose(f);
+}
+
+static void v4lconvert_cache_sanitize(char *s)
+{
+	for (; *s; s++)
+		if (!((*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z') ||
+		      (*s >= '0' && *s <= '9') || *s == '-' || *s == '.'))
+			*s = '_';
+}
+
+struct v4lconvert_enum_cache *v4lconvert_enum_cache_open(
+		struct v4lconvert_data *data, struct v4l2_capability *cap)
+{
+	const char *env = getenv("LIBV4LCONVERT_ENUM_CACHE");
+	struct v4lconvert_enum_cache *cache;
+	unsigned short vendor_id, product_id;
+	char *name;
+
+	if (!env || !env[0] || !strcmp(env, "0"))
+		return NULL;
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return NULL;
+
+	if (asprintf(&name, "enum-%.16s-%.32s", (char *)cap->driver,
+		     (char *)cap->bus_info) < 0) {
+		free(cache);
+		return NULL;
+	}
+	v4lconvert_cache_sanitize(name);
+
+	if (!strcmp(env, "1"))
+		cache->path = v4lconvert_cache_path(name);
+	else if (asprintf(&cache->path, "%s/%s", env, name) < 0)
+		cache->path = NULL;
+	free(name);
+
+	v4lconvert_get_usb_id(data->fd, &vendor_id, &product_id);
+	if (!cache->path ||
+	    asprintf(&cache->key,
+		     "v4lconvert-enum-cache %d %08x %04x:%04x %.16s|%.32s|%.32s",
+		     ENUM_CACHE_VERSION, cap->version, vendor_id, product_id,
+		     (char *)cap->driver, (char *)cap->card,
+		     (char *)cap->bus_info) < 0) {
+		free(cache->path);
+		free(cache);
+		return NULL;
+	}
+
+	cache->loaded = !v4lconvert_enum_cache_load(cache);
+
+	return cache;
+}
+
+/* Does an enum ioctl, from the cache when it was loaded */
+int v4lconvert_enum_cache_ioctl(struct v4lconvert_enum_cache *cache,
+		struct v4lconvert_data *data, unsigned long request, void *arg)
+{
+	struct v4l2_fmtdesc *fmt = arg;
+	struct v4l2_frmsizeenum *size = arg;
+	void *new_mem;
+	int i, index;
+
+	if (!cache)
+		return data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
+					    request, arg);
+
+	if (cache->loaded) {
+		switch (request) {
+		case VIDIOC_ENUM_FMT:
+			if (fmt->index >= cache->no_fmts)
+				break;
+			*fmt = cache->fmts[fmt->index];
+			return 0;
+		case VIDIOC_ENUM_FRAMESIZES:
+			index = 0;
+			for (i = 0; i < cache->no_sizes; i++) {
+				if (cache->sizes[i].pixel_format !=
+				    size->pixel_format)
+					continue;
+				if (index++ == size->index) {
+					index = size->index;
+					*size = cache->sizes[i];
+					size->index = index;
+					return 0;
+				}
+			}
+			break;
+		}
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (data->dev_ops->ioctl(data->dev_ops_priv, data->fd, request, arg))
+		return -1;
+
+	switch (request) {
+	case VIDIOC_ENUM_FMT:
+		new_mem = realloc(cache->fmts,
+				  (cache->no_fmts + 1) * sizeof(*fmt));
+		if (!new_mem) {
+			cache->failed = 1;
+			return 0;
+		}
+		cache->fmts = new_mem;
+		cache->fmts[cache->no_fmts++] = *fmt;
+		break;
+	case VIDIOC_ENUM_FRAMESIZES:
+		new_mem = realloc(cache->sizes,
+				  (cache->no_sizes + 1) * sizeof(*size));
+		if (!new_mem) {
+			cache->failed = 1;
+			return 0;
+		}
+		cache->sizes = new_mem;
+		cache->sizes[cache->no_sizes++] = *size;
+		break;
+	}
+
+	return 0;
+}
+
+/* Stores the cache if it was recorded from the device, and frees it */
+void v4lconvert_enum_cache_close(struct v4lconvert_enum_cache *cache)
+{
+	if (!cache)
+		return;
+
+	if (!cache->loaded && !cache->failed && cache->no_fmts)
+		v4lconvert_enum_cache_save(cache);
+
+	free(cache->sizes);
+	free(cache->fmts);
+	free(cache->key);
+	free(cache->path);
+	free(cache);
+}
@@ -360,8 +360,8 @@ static int v4lcontrol_get_usb_info(struct v4lcontrol_data *data,
 {
 	FILE *f;
 	int i, minor_dev;
-	struct stat st;
-	char sysfs_name[512];
+	struct stat st, dev_st;
+	char sysfs_name[512], dev_dir[256];
 	char c, *s, buf[32];
 
 	snprintf(sysfs_name, sizeof(sysfs_name),
@@ -374,8 +374,11 @@ static int v4lcontrol_get_usb_info(struct v4lcontrol_data *data,
 	if (fstat(data->fd, &st) || !S_ISCHR(st.st_mode))
 		return 0; /* Should never happen */
 
-	/* <Sigh> find ourselve in sysfs */
-	for (i = 0; i < 256; i++) {
+	/* Find ourselve in sysfs by our device number, with a fallback to
+	   searching all video4linux devices for kernels without /sys/dev */
+	snprintf(dev_dir, sizeof(dev_dir), "%s/sys/dev/char/%u:%u",
+		 sysfs_prefix, major(st.st_rdev), minor(st.st_rdev));
+	for (i = stat(dev_dir, &dev_st) ? 0 : 256; i < 256; i++) {
 		snprintf(sysfs_name, sizeof(sysfs_name),
 			 "%s/sys/class/video4linux/video%d/dev", sysfs_prefix, i);
 		f = fopen(sysfs_name, "r");
@@ -386,15 +389,19 @@ static int v4lcontrol_get_usb_info(struct v4lcontrol_data *data,
 		fclose(f);
 
 		if (s && sscanf(buf, "%*d:%d%c", &minor_dev, &c) == 2 &&
-		    c == '\n' && minor_dev == minor(st.st_rdev))
+		    c == '\n' && minor_dev == minor(st.st_rdev)) {
+			snprintf(dev_dir, sizeof(dev_dir),
+				 "%s/sys/class/video4linux/video%d",
+				 sysfs_prefix, i);
 			break;
+		}
 	}
-	if (i == 256)
+	if (i == 256 && stat(dev_dir, &dev_st))
 		return 0; /* Not found, sysfs not mounted? */
 
 	/* Get vendor and product ID */
 	snprintf(sysfs_name, sizeof(sysfs_name),
-		 "%s/sys/class/video4linux/video%d/device/modalias", sysfs_prefix, i);
+		 "%s/device/modalias", dev_dir);
 	f = fopen(sysfs_name, "r");
 	if (f) {
 		s = fgets(buf, sizeof(buf), f);
@@ -405,7 +412,7 @@ static int v4lcontrol_get_usb_info(struct v4lcontrol_data *data,
 			return 0; /* Not an USB device */
 
 		snprintf(sysfs_name, sizeof(sysfs_name),
-			 "%s/sys/class/video4linux/video%d/device/../speed", sysfs_prefix, i);
+			 "%s/device/../speed", dev_dir);
 	} else {
 		/* Try again assuming the device link points to the usb
 		   device instead of the usb interface (bug in older versions
@@ -413,7 +420,7 @@ static int v4lcontrol_get_usb_info(struct v4lcontrol_data *data,
 
 		/* Get vendor ID */
 		snprintf(sysfs_name, sizeof(sysfs_name),
-			 "%s/sys/class/video4linux/video%d/device/idVendor", sysfs_prefix, i);
+			 "%s/device/idVendor", dev_dir);
 		f = fopen(sysfs_name, "r");
 		if (!f)
 			return 0; /* Not an USB device (or no sysfs) */
@@ -427,7 +434,7 @@ static int v4lcontrol_get_usb_info(struct v4lcontrol_data *data,
 
 		/* Get product ID */
 		snprintf(sysfs_name, sizeof(sysfs_name),
-			 "%s/sys/class/video4linux/video%d/device/idProduct", sysfs_prefix, i);
+			 "%s/device/idProduct", dev_dir);
 		f = fopen(sysfs_name, "r");
 		if (!f)
 			return 0; /* Should never happen */
@@ -440,7 +447,7 @@ static int v4lcontrol_get_usb_info(struct v4lcontrol_data *data,
 			return 0; /* Should never happen */
 
 		snprintf(sysfs_name, sizeof(sysfs_name),
-			 "%s/sys/class/video4linux/video%d/device/speed", sysfs_prefix, i);
+			 "%s/device/speed", dev_dir);
 	}
 
 	f = fopen(sysfs_name, "r");
@@ -820,6 +827,15 @@ static const struct v4l2_queryctrl fake_controls[V4LCONTROL_COUNT] = {
 		.step = 1,
 		.default_value = 1000, /* == 1.0 */
 		.flags = V4L2_CTRL_FLAG_SLIDER
+	}, {
+		.id = V4L2_CID_ROTATE,
+		.type = V4L2_CTRL_TYPE_INTEGER,
+		.name =  "Rotate",
+		.minimum = 0,
+		.maximum = 270,
+		.step = 90,
+		.default_value = 0,
+		.flags = 0
 	}, { /* Dummy place holder for V4LCONTROL_AUTO_ENABLE_COUNT */
 	}, {
 		.id = V4L2_CID_AUTOGAIN,
@@ -990,6 +1006,15 @@ int v4lcontrol_vidioc_g_ext_ctrls(struct v4lcontrol_data *data, void *arg)
 	return 0;
 }
 
+/* Check value against the range and step of fake control i */
+static int v4lcontrol_valid_value(int i, int value)
+{
+	const struct v4l2_queryctrl *ctrl = &fake_controls[i];
+
+	return value >= ctrl->minimum && value <= ctrl->maximum &&
+	       (ctrl->step <= 1 || (value - ctrl->minimum) % ctrl->step == 0);
+}
+
 int v4lcontrol_vidioc_s_ctrl(struct v4lcontrol_data *data, void *arg)
 {
 	int i;
@@ -998,8 +1023,7 @@ int v4lcontrol_vidioc_s_ctrl(struct v4lcontrol_data *data, void *arg)
 	for (i = 0; i < V4LCONTROL_COUNT; i++)
 		if ((data->controls & (1 << i)) &&
 				ctrl->id == fake_controls[i].id) {
-			if (ctrl->value > fake_controls[i].maximum ||
-					ctrl->value < fake_controls[i].minimum) {
+			if (!v4lcontrol_valid_value(i, ctrl->value)) {
 				errno = EINVAL;
 				return -1;
 			}
@@ -1023,8 +1047,8 @@ static int v4lcontrol_validate_ext_ctrls(struct v4lcontrol_data *data,
 		for (j = 0; j < V4LCONTROL_COUNT; j++)
 			if ((data->controls & (1 << j)) &&
 			    ctrls->controls[i].id == fake_controls[j].id) {
-				if (ctrls->controls[i].value > fake_controls[j].maximum ||
-				    ctrls->controls[i].value < fake_controls[j].minimum) {
+				if (!v4lcontrol_valid_value(j,
+						ctrls->controls[i].value)) {
 					ctrls->error_idx = i;
 					errno = EINVAL;
 					return -1;
@@ -1118,6 +1142,20 @@ int v4lcontrol_controls_changed(struct v4lcontrol_data *data)
 	return res;
 }
 
+int v4lcontrol_ctrls_changed_since(struct v4lcontrol_data *data,
+		unsigned int *values)
+{
+	if (!data->controls ||
+	    !memcmp(data->shm_values, values,
+		    V4LCONTROL_COUNT * sizeof(unsigned int)))
+		return 0;
+
+	memcpy(values, data->shm_values,
+		V4LCONTROL_COUNT * sizeof(unsigned int));
+
+	return 1;
+}
+
 /* See the comment about this in libv4lconvert.h */
 int v4lcontrol_needs_conversion(struct v4lcontrol_data *data)
 {
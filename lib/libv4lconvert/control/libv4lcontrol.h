@@ -41,6 +41,7 @@ enum {
 	V4LCONTROL_HFLIP,
 	V4LCONTROL_VFLIP,
 	V4LCONTROL_GAMMA,
+	V4LCONTROL_ROTATE,
 	/* All fake controls above here are auto enabled when not present in hw */
 	V4LCONTROL_AUTO_ENABLE_COUNT,
 	V4LCONTROL_AUTOGAIN,
@@ -62,6 +63,10 @@ int v4lcontrol_get_ctrl(struct v4lcontrol_data *data, int ctrl);
 /* Check if the controls have changed since the last time this function
    was called */
 int v4lcontrol_controls_changed(struct v4lcontrol_data *data);
+/* Like v4lcontrol_controls_changed, but against the caller's own copy of
+   the V4LCONTROL_COUNT control values, which gets updated */
+int v4lcontrol_ctrls_changed_since(struct v4lcontrol_data *data,
+		unsigned int *values);
 /* Check if we must go through the conversion path (and thus alloc conversion
    buffers, etc. in libv4l2). Note this always return 1 if we *may* need
    rotate90 / flipping / processing, as if we actually need this may change
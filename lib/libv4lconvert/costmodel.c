@@ -0,0 +1,386 @@
+/*
+# Calibrated cost model for picking the src format which needs the least
+# cpu time to convert
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+ */
+
+/*
+ * The static ranks in supported_src_pixfmts do not know how fast the
+ * decoders / converters are on the host, which depends on the cpu, the SIMD
+ * code available for it and the jpeg decoder in use. When the
+ * LIBV4LCONVERT_COST_MODEL environment variable is set, each conversion from a
+ * src format we can synthesize frames for to rgb24 and to yuv420 is timed
+ * once, and the resulting cpu time per pixel is stored in a file, so that
+ * this only needs to be done once per host. v4lconvert_get_rank then uses
+ * the predicted cpu time per frame instead of the static ranks.
+ *
+ * LIBV4LCONVERT_COST_MODEL=1 stores the model in
+ * $XDG_CACHE_HOME/libv4l/cost-model (or ~/.cache/libv4l/cost-model), any
+ * other value (except 0) is used as the path of the file to use.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "libv4lconvert-priv.h"
+#ifdef HAVE_JPEG
+#include "jpeg_memsrcdest.h"
+#endif
+
+#define COST_MODEL_VERSION	1
+#define COST_WIDTH		320
+#define COST_HEIGHT		240
+#define COST_RUNS		3
+
+struct v4lconvert_cost {
+	unsigned int fmt;
+	float rgb_ns; /* cpu time per pixel for converting to rgb24 */
+	float yuv_ns; /* cpu time per pixel for converting to yuv420 */
+};
+
+static pthread_mutex_t cost_model_lock = PTHREAD_MUTEX_INITIALIZER;
+static int cost_model_loaded;
+static struct v4lconvert_cost *cost_model;
+static int cost_model_count;
+
+static char *v4lconvert_cost_model_path(void)
+{
+	const char *env = getenv("LIBV4LCONVERT_COST_MODEL");
+
+	if (!env || !env[0] || !strcmp(env, "0"))
+		return NULL;
+
+	if (!strcmp(env, "1"))
+		return v4lconvert_cache_path("cost-model");
+
+	return strdup(env);
+}
+
+/* The model is only valid for the code which was measured */
+static void v4lconvert_cost_model_key(struct v4lconvert_data *data,
+		char *key, int size)
+{
+	snprintf(key, size, "v4lconvert-cost-model %d %s %s",
+		 COST_MODEL_VERSION, v4lconvert_simd.name,
+#ifdef HAVE_JPEG
+		 (data->flags & V4LCONVERT_USE_TINYJPEG) ? "tinyjpeg" : "libjpeg"
+#else
+		 "tinyjpeg"
+#endif
+		);
+}
+
+static int v4lconvert_cost_model_load(const char *path, const char *key)
+{
+	char line[128];
+	struct v4lconvert_cost cost, *costs = NULL;
+	int count = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+
+	if (!fgets(line, sizeof(line), f) || strncmp(line, key, strlen(key)) ||
+	    line[strlen(key)] != '\n') {
+		fclose(f);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		struct v4lconvert_cost *new_costs;
+
+		if (sscanf(line, "%x %f %f", &cost.fmt, &cost.rgb_ns,
+			   &cost.yuv_ns) != 3)
+			continue;
+
+		new_costs = realloc(costs, (count + 1) * sizeof(*costs));
+		if (!new_costs)
+			break;
+		costs = new_costs;
+		costs[count++] = cost;
+	}
+	fclose(f);
+
+	cost_model = costs;
+	cost_model_count = count;
+	return 0;
+}
+
+static void v4lconvert_cost_model_save(const char *path, const char *key)
+{
+	char *tmp_path;
+	FILE *f;
+	int i;
+
+	f = v4lconvert_cache_create(path, &tmp_path);
+	if (!f)
+		return;
+
+	fprintf(f, "%s\n", key);
+	for (i = 0; i < cost_model_count; i++)
+		fprintf(f, "%08x %.3f %.3f\n", cost_model[i].fmt,
+			cost_model[i].rgb_ns, cost_model[i].yuv_ns);
+
+	v4lconvert_cache_commit(f, tmp_path, path);
+}
+
+static double v4lconvert_cost_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int v4lconvert_cost_bytesperline(unsigned int fmt, int bpp, int width)
+{
+	switch (fmt) {
+	case V4L2_PIX_FMT_SBGGR12P:
+	case V4L2_PIX_FMT_SGBRG12P:
+	case V4L2_PIX_FMT_SGRBG12P:
+	case V4L2_PIX_FMT_SRGGB12P:
+		break;
+	case V4L2_PIX_FMT_NV16:
+	case V4L2_PIX_FMT_NV61:
+		return width;
+	default:
+		/* The planar 4:2:0 formats */
+		if (bpp == 12)
+			return width;
+	}
+	return width * bpp / 8;
+}
+
+#ifdef HAVE_JPEG
+/* Encode a 4:2:2 jpeg, like most cams produce, of a smooth gradient with
+   some noise, as we have no real frame to calibrate with */
+static unsigned char *v4lconvert_cost_make_jpeg(const unsigned char *noise,
+		int *size)
+{
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+	unsigned char *jpeg = NULL;
+	unsigned long jpeg_size = 0;
+	JSAMPLE row[COST_WIDTH * 3];
+	JSAMPROW row_pointer[1] = { row };
+	int x;
+
+	cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_compress(&cinfo);
+	jpeg_mem_dest(&cinfo, &jpeg, &jpeg_size);
+	cinfo.image_width = COST_WIDTH;
+	cinfo.image_height = COST_HEIGHT;
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, 85, TRUE);
+	cinfo.comp_info[0].h_samp_factor = 2;
+	cinfo.comp_info[0].v_samp_factor = 1;
+
+	jpeg_start_compress(&cinfo, TRUE);
+	while (cinfo.next_scanline < cinfo.image_height) {
+		int y = cinfo.next_scanline;
+
+		for (x = 0; x < COST_WIDTH; x++) {
+			const unsigned char *n = noise + (y * COST_WIDTH + x) * 3;
+
+			row[x * 3 + 0] = x * 255 / COST_WIDTH / 2 + n[0] / 2;
+			row[x * 3 + 1] = y * 255 / COST_HEIGHT / 2 + n[1] / 2;
+			row[x * 3 + 2] = (x + y) * 255 / (COST_WIDTH + COST_HEIGHT) / 2 +
+					 n[2] / 2;
+		}
+		jpeg_write_scanlines(&cinfo, row_pointer, 1);
+	}
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+
+	*size = jpeg_size;
+	return jpeg;
+}
+#endif
+
+/* Returns the cpu time per pixel, or 0 if the conversion failed */
+static float v4lconvert_cost_measure(struct v4lconvert_data *data,
+		unsigned int src_pixfmt, int bytesperline,
+		unsigned char *src, int src_size,
+		unsigned int dest_pixfmt, unsigned char *dest, int dest_size)
+{
+	struct v4l2_format fmt = { .type = V4L2_BUF_TYPE_VIDEO_CAPTURE };
+	double start, elapsed, best = 0;
+	int i;
+
+	/* The first run is a warm up run, which also allocates the buffers */
+	for (i = 0; i <= COST_RUNS; i++) {
+		fmt.fmt.pix.width = COST_WIDTH;
+		fmt.fmt.pix.height = COST_HEIGHT;
+		fmt.fmt.pix.pixelformat = src_pixfmt;
+		fmt.fmt.pix.field = V4L2_FIELD_NONE;
+		fmt.fmt.pix.bytesperline = bytesperline;
+		fmt.fmt.pix.sizeimage = src_size;
+
+		start = v4lconvert_cost_now();
+		if (v4lconvert_convert_pixfmt(data, src, src_size, dest,
+					      dest_size, &fmt, dest_pixfmt))
+			return 0;
+		elapsed = v4lconvert_cost_now() - start;
+
+		if (i && (!best || elapsed < best))
+			best = elapsed;
+	}
+
+	/* Never 0, as that means unknown */
+	return best / (COST_WIDTH * COST_HEIGHT) + 0.001;
+}
+
+static void v4lconvert_cost_model_calibrate(struct v4lconvert_data *data,
+		const struct v4lconvert_pixfmt *pixfmts, int count)
+{
+	struct v4lconvert_workspace *ws;
+	struct v4lconvert_data *ws_data;
+	int i, src_size, dest_size = COST_WIDTH * COST_HEIGHT * 3;
+	unsigned char *noise, *dest;
+	unsigned int seed = 1;
+
+	cost_model = calloc(count, sizeof(*cost_model));
+	/* Enough for all raw formats, also with bytesperline padding */
+	src_size = COST_WIDTH * COST_HEIGHT * 4;
+	noise = malloc(src_size);
+	dest = malloc(dest_size);
+	/* Measure in a workspace, so that this is the single threaded cpu time
+	   and the device's conversion state is left alone */
+	ws = v4lconvert_workspace_create(data);
+	if (!cost_model || !noise || !dest || !ws)
+		goto leave;
+	ws_data = &ws->data;
+
+	for (i = 0; i < src_size; i++) {
+		seed = seed * 1103515245 + 12345;
+		noise[i] = seed >> 16;
+	}
+
+	for (i = 0; i < count; i++) {
+		const struct v4lconvert_pixfmt *p = &pixfmts[i];
+		unsigned char *src = noise;
+		int size = src_size, bpl = 0;
+		struct v4lconvert_cost *cost = &cost_model[cost_model_count];
+
+		if (p->bpp) {
+			bpl = v4lconvert_cost_bytesperline(p->fmt, p->bpp,
+							  COST_WIDTH);
+			size = bpl * COST_HEIGHT;
+			/* Planar formats store their chroma after the luma */
+			if (bpl == COST_WIDTH)
+				size = COST_WIDTH * COST_HEIGHT * p->bpp / 8;
+		}
+#ifdef HAVE_JPEG
+		else if (p->fmt == V4L2_PIX_FMT_MJPEG ||
+			 p->fmt == V4L2_PIX_FMT_JPEG) {
+			src = v4lconvert_cost_make_jpeg(noise, &size);
+			if (!src)
+				continue;
+		}
+#endif
+		else
+			continue; /* No way to synthesize cam specific frames */
+
+		cost->fmt = p->fmt;
+		cost->rgb_ns = v4lconvert_cost_measure(ws_data, p->fmt, bpl,
+					src, size, V4L2_PIX_FMT_RGB24,
+					dest, dest_size);
+		cost->yuv_ns = v4lconvert_cost_measure(ws_data, p->fmt, bpl,
+					src, size, V4L2_PIX_FMT_YUV420,
+					dest, dest_size);
+		if (cost->rgb_ns || cost->yuv_ns)
+			cost_model_count++;
+
+		if (src != noise)
+			free(src);
+	}
+
+leave:
+	v4lconvert_workspace_destroy(ws);
+	free(dest);
+	free(noise);
+}
+
+/* Load (or calibrate and store) the cost model, returns 0 if it is used */
+static int v4lconvert_cost_model_init(struct v4lconvert_data *data,
+		const struct v4lconvert_pixfmt *pixfmts, int count)
+{
+	char key[128], *path;
+
+	pthread_mutex_lock(&cost_model_lock);
+	if (cost_model_loaded) {
+		pthread_mutex_unlock(&cost_model_lock);
+		return cost_model ? 0 : -1;
+	}
+	cost_model_loaded = 1;
+
+	path = v4lconvert_cost_model_path();
+	if (path) {
+		v4lconvert_cost_model_key(data, key, sizeof(key));
+		if (v4lconvert_cost_model_load(path, key)) {
+			v4lconvert_cost_model_calibrate(data, pixfmts, count);
+			if (cost_model)
+				v4lconvert_cost_model_save(path, key);
+		}
+		free(path);
+	}
+	pthread_mutex_unlock(&cost_model_lock);
+
+	return cost_model ? 0 : -1;
+}
+
+int v4lconvert_cost_model_predict(struct v4lconvert_data *data,
+		const struct v4lconvert_pixfmt *pixfmts, int count,
+		unsigned int src_pixfmt, unsigned int dest_pixfmt,
+		int width, int height)
+{
+	float ns = 0;
+	int i;
+
+	if (v4lconvert_cost_model_init(data, pixfmts, count))
+		return -1;
+
+	if (src_pixfmt == dest_pixfmt)
+		return 0;
+
+	for (i = 0; i < cost_model_count; i++) {
+		if (cost_model[i].fmt != src_pixfmt)
+			continue;
+
+		switch (dest_pixfmt) {
+		case V4L2_PIX_FMT_RGB24:
+		case V4L2_PIX_FMT_BGR24:
+		case V4L2_PIX_FMT_XRGB32:
+		case V4L2_PIX_FMT_XBGR32:
+			ns = cost_model[i].rgb_ns;
+			break;
+		default:
+			ns = cost_model[i].yuv_ns;
+			break;
+		}
+		break;
+	}
+
+	if (!ns)
+		return -1;
+
+	return ns * width * height;
+}
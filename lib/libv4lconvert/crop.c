@@ -1,6 +1,6 @@
 /*
 
-# RGB and YUV crop routines
+# RGB and YUV crop / scale routines
 
 #             (C) 2008 Hans de Goede <hdegoede@redhat.com>
 
@@ -23,89 +23,240 @@
 #include <string.h>
 #include "libv4lconvert-priv.h"
 
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
 
-static void v4lconvert_reduceandcrop_rgbbgr24(
-		unsigned char *src, unsigned char *dest,
-		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt)
+/*
+ * The scaler does area averaging: dest pixel i is the average of the src
+ * pixels in [i * src_size / dest_size, (i + 1) * src_size / dest_size), with
+ * the partially covered src pixels at both ends weighing in with the covered
+ * part. This is a box filter for downscaling, and becomes linear
+ * interpolation between the 2 nearest src pixels when upscaling.
+ *
+ * It is separable and works line by line: the src lines a dest line is made
+ * of are summed (weighted) into a line of 16 bit accumulators, from which the
+ * dest line gets calculated with the horizontal weights. So besides the
+ * horizontal weights table it only needs a single line of accumulators, and
+ * each src line can be converted just before it gets accumulated, see fused.c.
+ *
+ * The weights are 8 bit fixed point, rounded so that the weights of a dest
+ * pixel always add up to exactly 256, so that flat areas stay exactly the
+ * same.
+ */
+
+/* Returns the first src pixel dest pixel i covers, *end is set to one past
+   the last one */
+int v4lconvert_scale_span(int i, int src_size, int dest_size, int *end)
 {
-	int x, y;
-	int startx = src_fmt->fmt.pix.width / 2 - dest_fmt->fmt.pix.width;
-	int starty = src_fmt->fmt.pix.height / 2 - dest_fmt->fmt.pix.height;
+	*end = ((i + 1) * src_size + dest_size - 1) / dest_size;
+	return i * src_size / dest_size;
+}
 
-	src += starty * src_fmt->fmt.pix.bytesperline + 3 * startx;
+/* Returns the weight (out of 256) of src pixel k in dest pixel i, 0 when
+   dest pixel i does not cover src pixel k */
+int v4lconvert_scale_weight(int i, int k, int src_size, int dest_size)
+{
+	int start = i * src_size;
+	int from = MAX(start, k * dest_size) - start;
+	int to = MIN(start + src_size, (k + 1) * dest_size) - start;
+
+	if (to <= from)
+		return 0;
+
+	return to * 256 / src_size - from * 256 / src_size;
+}
+
+/* Number of entries of the horizontal weights table */
+int v4lconvert_scale_table_size(int src_width, int dest_width)
+{
+	return src_width + 3 * dest_width;
+}
+
+/* For each dest pixel the table holds its first src pixel, the number of
+   src pixels and their weights */
+void v4lconvert_scale_init_table(unsigned int *table, int src_width,
+		int dest_width)
+{
+	int i, k, end;
+
+	for (i = 0; i < dest_width; i++) {
+		k = v4lconvert_scale_span(i, src_width, dest_width, &end);
+		*table++ = k;
+		*table++ = end - k;
+		for (; k < end; k++)
+			*table++ = v4lconvert_scale_weight(i, k, src_width,
+							   dest_width);
+	}
+}
+
+/* acc[i] += src[i] * weight for n bytes */
+void v4lconvert_scale_accumulate(const unsigned char *src,
+		unsigned short *acc, int n, int weight)
+{
+	int i = 0;
+
+	if (v4lconvert_simd.scale_accumulate) {
+		i = n & ~15;
+		v4lconvert_simd.scale_accumulate(src, acc, i, weight);
+	}
+
+	for (; i < n; i++)
+		acc[i] += src[i] * weight;
+}
 
-	for (y = 0; y < dest_fmt->fmt.pix.height; y++) {
-		unsigned char *mysrc = src;
-		for (x = 0; x < dest_fmt->fmt.pix.width; x++) {
-			*(dest++) = *(mysrc++);
-			*(dest++) = *(mysrc++);
-			*(dest++) = *(mysrc++);
-			mysrc += 3; /* skip one pixel */
+/* Calculate dest_width pixels of bpp (1 or 3) bytes from a line of
+   accumulators, using the horizontal weights table */
+void v4lconvert_scale_line(const unsigned short *acc, unsigned char *dest,
+		const unsigned int *table, int dest_width, int bpp)
+{
+	int i, k, n;
+
+	for (i = 0; i < dest_width; i++) {
+		const unsigned short *a = acc + *table++ * bpp;
+
+		n = *table++;
+		if (bpp == 3) {
+			unsigned int r = 32768, g = 32768, b = 32768;
+
+			for (k = 0; k < n; k++) {
+				r += a[0] * table[k];
+				g += a[1] * table[k];
+				b += a[2] * table[k];
+				a += 3;
+			}
+			*dest++ = r >> 16;
+			*dest++ = g >> 16;
+			*dest++ = b >> 16;
+		} else {
+			unsigned int sum = 32768;
+
+			for (k = 0; k < n; k++)
+				sum += a[k] * table[k];
+			*dest++ = sum >> 16;
 		}
-		src += 2 * src_fmt->fmt.pix.bytesperline; /* skip one line */
+		table += n;
 	}
 }
 
-static void v4lconvert_crop_rgbbgr24(unsigned char *src, unsigned char *dest,
-		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt)
+/* Returns 1 when v4lconvert_crop makes a dest_width x dest_height frame out
+   of a width x height frame by scaling the centered win_width x win_height
+   window of it, 0 when it only crops or adds a border */
+int v4lconvert_scale_window(int width, int height, int dest_width,
+		int dest_height, int *win_width, int *win_height)
 {
-	int x;
-	int startx = (src_fmt->fmt.pix.width - dest_fmt->fmt.pix.width) / 2;
-	int starty = (src_fmt->fmt.pix.height - dest_fmt->fmt.pix.height) / 2;
+	/* Adding a border, or cropping off at most 20% of the width / height,
+	   see v4lconvert_try_format */
+	if ((width <= dest_width && height <= dest_height) ||
+	    (width >= dest_width && height >= dest_height &&
+	     width * 4 <= dest_width * 5 && height * 4 <= dest_height * 5))
+		return 0;
+
+	/* Downscale 2x + cropping off at most 20% */
+	if (width >= 2 * dest_width && height >= 2 * dest_height &&
+	    width * 2 <= dest_width * 5 && height * 2 <= dest_height * 5) {
+		*win_width = 2 * dest_width;
+		*win_height = 2 * dest_height;
+		return 1;
+	}
 
-	src += starty * src_fmt->fmt.pix.bytesperline + 3 * startx;
+	/* Otherwise the largest window with the aspect ratio of the dest */
+	if (dest_width * height > dest_height * width) {
+		*win_width = width;
+		*win_height = MAX(dest_height * width / dest_width, 2) & ~1;
+	} else {
+		*win_width = MAX(dest_width * height / dest_height, 2) & ~1;
+		*win_height = height;
+	}
+	return 1;
+}
 
-	for (x = 0; x < dest_fmt->fmt.pix.height; x++) {
-		memcpy(dest, src, dest_fmt->fmt.pix.width * 3);
-		src += src_fmt->fmt.pix.bytesperline;
-		dest += dest_fmt->fmt.pix.bytesperline;
+static void v4lconvert_scale_plane(const unsigned char *src, int src_stride,
+		int src_width, int src_height, unsigned char *dest,
+		int dest_stride, int dest_width, int dest_height, int bpp,
+		unsigned char *buf)
+{
+	unsigned int *table = (unsigned int *)buf;
+	unsigned short *acc = (unsigned short *)(table +
+		v4lconvert_scale_table_size(src_width, dest_width));
+	int y, k, end;
+
+	v4lconvert_scale_init_table(table, src_width, dest_width);
+
+	for (y = 0; y < dest_height; y++) {
+		memset(acc, 0, src_width * bpp * sizeof(*acc));
+		k = v4lconvert_scale_span(y, src_height, dest_height, &end);
+		for (; k < end; k++)
+			v4lconvert_scale_accumulate(src + k * src_stride, acc,
+				src_width * bpp, v4lconvert_scale_weight(y, k,
+						src_height, dest_height));
+		v4lconvert_scale_line(acc, dest, table, dest_width, bpp);
+		dest += dest_stride;
 	}
 }
 
-static void v4lconvert_reduceandcrop_yuv420(
-		unsigned char *src, unsigned char *dest,
-		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt)
+static void v4lconvert_scale_rgbbgr24(unsigned char *src, unsigned char *dest,
+		const struct v4l2_format *src_fmt,
+		const struct v4l2_format *dest_fmt, int win_width,
+		int win_height, unsigned char *buf)
 {
-	int x, y;
-	int dest_height_half = dest_fmt->fmt.pix.height / 2;
-	int dest_width_half = dest_fmt->fmt.pix.width / 2;
-	int startx = (src_fmt->fmt.pix.width / 2 - dest_fmt->fmt.pix.width) & ~1;
-	int starty = (src_fmt->fmt.pix.height / 2 - dest_fmt->fmt.pix.height) & ~1;
-	unsigned char *mysrc, *mysrc2;
+	int startx = (src_fmt->fmt.pix.width - win_width) / 2;
+	int starty = (src_fmt->fmt.pix.height - win_height) / 2;
+
+	src += starty * src_fmt->fmt.pix.bytesperline + 3 * startx;
+	v4lconvert_scale_plane(src, src_fmt->fmt.pix.bytesperline,
+			win_width, win_height, dest,
+			dest_fmt->fmt.pix.bytesperline, dest_fmt->fmt.pix.width,
+			dest_fmt->fmt.pix.height, 3, buf);
+}
+
+static void v4lconvert_scale_yuv420(unsigned char *src, unsigned char *dest,
+		const struct v4l2_format *src_fmt,
+		const struct v4l2_format *dest_fmt, int win_width,
+		int win_height, unsigned char *buf)
+{
+	int startx = ((src_fmt->fmt.pix.width - win_width) / 2) & ~1;
+	int starty = ((src_fmt->fmt.pix.height - win_height) / 2) & ~1;
+	int src_bpl = src_fmt->fmt.pix.bytesperline;
+	int dest_bpl = dest_fmt->fmt.pix.bytesperline;
+	int dest_width = dest_fmt->fmt.pix.width;
+	int dest_height = dest_fmt->fmt.pix.height;
+	unsigned char *mysrc;
 
 	/* Y */
-	mysrc = src + starty * src_fmt->fmt.pix.bytesperline + startx;
-	for (y = 0; y < dest_fmt->fmt.pix.height; y++) {
-		mysrc2 = mysrc;
-		for (x = 0; x < dest_fmt->fmt.pix.width; x++) {
-			*(dest++) = *mysrc2;
-			mysrc2 += 2; /* skip one pixel */
-		}
-		mysrc += 2 * src_fmt->fmt.pix.bytesperline; /* skip one line */
-	}
+	mysrc = src + starty * src_bpl + startx;
+	v4lconvert_scale_plane(mysrc, src_bpl, win_width, win_height,
+			dest, dest_bpl, dest_width, dest_height, 1, buf);
+	dest += dest_height * dest_bpl;
 
 	/* U */
-	mysrc = src + src_fmt->fmt.pix.height * src_fmt->fmt.pix.bytesperline +
-		(starty / 2) * src_fmt->fmt.pix.bytesperline / 2 + startx / 2;
-	for (y = 0; y < dest_height_half; y++) {
-		mysrc2 = mysrc;
-		for (x = 0; x < dest_width_half; x++) {
-			*(dest++) = *mysrc2;
-			mysrc2 += 2; /* skip one pixel */
-		}
-		mysrc += src_fmt->fmt.pix.bytesperline ; /* skip one line */
-	}
+	mysrc = src + src_fmt->fmt.pix.height * src_bpl +
+		(starty / 2) * src_bpl / 2 + startx / 2;
+	v4lconvert_scale_plane(mysrc, src_bpl / 2, win_width / 2,
+			win_height / 2, dest, dest_bpl / 2, dest_width / 2,
+			dest_height / 2, 1, buf);
+	dest += dest_height / 2 * dest_bpl / 2;
 
 	/* V */
-	mysrc = src + src_fmt->fmt.pix.height * src_fmt->fmt.pix.bytesperline * 5 / 4
-		+ (starty / 2) * src_fmt->fmt.pix.bytesperline / 2 + startx / 2;
-	for (y = 0; y < dest_height_half; y++) {
-		mysrc2 = mysrc;
-		for (x = 0; x < dest_width_half; x++) {
-			*(dest++) = *mysrc2;
-			mysrc2 += 2; /* skip one pixel */
-		}
-		mysrc += src_fmt->fmt.pix.bytesperline ; /* skip one line */
+	mysrc = src + src_fmt->fmt.pix.height * src_bpl * 5 / 4 +
+		(starty / 2) * src_bpl / 2 + startx / 2;
+	v4lconvert_scale_plane(mysrc, src_bpl / 2, win_width / 2,
+			win_height / 2, dest, dest_bpl / 2, dest_width / 2,
+			dest_height / 2, 1, buf);
+}
+
+static void v4lconvert_crop_rgbbgr24(unsigned char *src, unsigned char *dest,
+		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt)
+{
+	int x;
+	int startx = (src_fmt->fmt.pix.width - dest_fmt->fmt.pix.width) / 2;
+	int starty = (src_fmt->fmt.pix.height - dest_fmt->fmt.pix.height) / 2;
+
+	src += starty * src_fmt->fmt.pix.bytesperline + 3 * startx;
+
+	for (x = 0; x < dest_fmt->fmt.pix.height; x++) {
+		memcpy(dest, src, dest_fmt->fmt.pix.width * 3);
+		src += src_fmt->fmt.pix.bytesperline;
+		dest += dest_fmt->fmt.pix.bytesperline;
 	}
 }
 
@@ -257,30 +408,59 @@ static void v4lconvert_add_border_yuv420(
 	}
 }
 
+/* Returns the size of the buffer v4lconvert_crop needs, 0 if it needs none */
+int v4lconvert_crop_buf_size(const struct v4l2_format *src_fmt,
+		const struct v4l2_format *dest_fmt)
+{
+	int win_width, win_height, bpp = 1;
+
+	if (!v4lconvert_scale_window(src_fmt->fmt.pix.width,
+			src_fmt->fmt.pix.height, dest_fmt->fmt.pix.width,
+			dest_fmt->fmt.pix.height, &win_width, &win_height))
+		return 0;
+
+	switch (dest_fmt->fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24:
+		bpp = 3;
+		break;
+	}
+
+	return v4lconvert_scale_table_size(win_width, dest_fmt->fmt.pix.width) *
+		sizeof(unsigned int) + win_width * bpp * sizeof(unsigned short);
+}
+
+/* buf must be (at least) v4lconvert_crop_buf_size() bytes */
 void v4lconvert_crop(unsigned char *src, unsigned char *dest,
-		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt)
+		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt,
+		unsigned char *buf)
 {
+	int win_width, win_height;
+	int scale = v4lconvert_scale_window(src_fmt->fmt.pix.width,
+			src_fmt->fmt.pix.height, dest_fmt->fmt.pix.width,
+			dest_fmt->fmt.pix.height, &win_width, &win_height);
+
 	switch (dest_fmt->fmt.pix.pixelformat) {
 	case V4L2_PIX_FMT_RGB24:
 	case V4L2_PIX_FMT_BGR24:
-		if (src_fmt->fmt.pix.width  <= dest_fmt->fmt.pix.width &&
+		if (scale)
+			v4lconvert_scale_rgbbgr24(src, dest, src_fmt, dest_fmt,
+					win_width, win_height, buf);
+		else if (src_fmt->fmt.pix.width  <= dest_fmt->fmt.pix.width &&
 				src_fmt->fmt.pix.height <= dest_fmt->fmt.pix.height)
 			v4lconvert_add_border_rgbbgr24(src, dest, src_fmt, dest_fmt);
-		else if (src_fmt->fmt.pix.width  >= 2 * dest_fmt->fmt.pix.width &&
-				src_fmt->fmt.pix.height >= 2 * dest_fmt->fmt.pix.height)
-			v4lconvert_reduceandcrop_rgbbgr24(src, dest, src_fmt, dest_fmt);
 		else
 			v4lconvert_crop_rgbbgr24(src, dest, src_fmt, dest_fmt);
 		break;
 
 	case V4L2_PIX_FMT_YUV420:
 	case V4L2_PIX_FMT_YVU420:
-		if (src_fmt->fmt.pix.width  <= dest_fmt->fmt.pix.width &&
+		if (scale)
+			v4lconvert_scale_yuv420(src, dest, src_fmt, dest_fmt,
+					win_width, win_height, buf);
+		else if (src_fmt->fmt.pix.width  <= dest_fmt->fmt.pix.width &&
 				src_fmt->fmt.pix.height <= dest_fmt->fmt.pix.height)
 			v4lconvert_add_border_yuv420(src, dest, src_fmt, dest_fmt);
-		else if (src_fmt->fmt.pix.width  >= 2 * dest_fmt->fmt.pix.width &&
-				src_fmt->fmt.pix.height >= 2 * dest_fmt->fmt.pix.height)
-			v4lconvert_reduceandcrop_yuv420(src, dest, src_fmt, dest_fmt);
 		else
 			v4lconvert_crop_yuv420(src, dest, src_fmt, dest_fmt);
 		break;
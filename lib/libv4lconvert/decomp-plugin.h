@@ -0,0 +1,81 @@
+/* Interface between libv4lconvert and its (GPL licensed) decompressors
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __DECOMP_PLUGIN_H
+#define __DECOMP_PLUGIN_H
+
+/* A decompressor can be used by libv4lconvert in 2 ways:
+
+   1) In process, only when configured with --enable-gpl-decomp-modules (as
+   this loads GPL code into the application): the decompressor is build as a
+   loadable module, installed next to the helper executable as <helper>.so,
+   which exports a struct v4lconvert_decomp_plugin named
+   v4lconvert_decomp_plugin. This struct is the stable ABI between
+   libv4lconvert and the module, new members may only be added at the end and
+   only together with an abi_version bump.
+
+   2) Out of process: the helper executable is started with "--shm" as its
+   only argument and a shared memory object on fd V4LCONVERT_SHM_FD. For each
+   frame libv4lconvert fills in the struct v4lconvert_shm_frame at the start
+   of the shared memory and the src data after it, and writes a single int
+   (the frame sequence number) to the helper's stdin. The helper decompresses
+   the frame into the dest area, sets dest_size (-1 on error) and echoes the
+   sequence number on its stdout. So only 2 ints go through the pipes per
+   frame. When the helper is started without arguments it uses the old
+   protocol where all frame data goes through the pipes (see helper.c). */
+
+#define V4LCONVERT_DECOMP_ABI_VERSION	1
+#define V4LCONVERT_DECOMP_PLUGIN_SYM	"v4lconvert_decomp_plugin"
+
+struct v4lconvert_decomp_plugin {
+	int abi_version;	/* V4LCONVERT_DECOMP_ABI_VERSION */
+	unsigned int pixelformat;
+	/* Decompress src_size bytes of src into planar yuv420 (yvu420 if yvu is
+	   set) at dest. src is a private copy of the frame which the decompressor
+	   may modify. Must be reentrant. Returns 0 on success, -1 when the frame
+	   is corrupt or does not fit in dest_size. */
+	int (*decompress)(unsigned char *src, int src_size, unsigned char *dest,
+			int dest_size, int width, int height, int yvu);
+};
+
+#define V4LCONVERT_SHM_FD		3
+#define V4LCONVERT_SHM_ALIGN		64
+
+struct v4lconvert_shm_frame {
+	int width;
+	int height;
+	int flags;
+	int src_size;
+	int src_max;	/* Room for src data, the dest area starts after it */
+	int dest_max;	/* Room for dest data */
+	int dest_size;	/* Set by the helper, -1 in case of an error */
+	int reserved;
+};
+
+/* The src area starts at V4LCONVERT_SHM_SRC_OFFSET, the dest area at
+   V4LCONVERT_SHM_SRC_OFFSET + src_max, src_max is a multiple of
+   V4LCONVERT_SHM_ALIGN */
+#define V4LCONVERT_SHM_SRC_OFFSET	V4LCONVERT_SHM_ALIGN
+
+#endif
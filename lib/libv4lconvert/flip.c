@@ -151,51 +151,100 @@ static void v4lconvert_rotate180_yuv420(const unsigned char *src,
 		*dst++ = *src--;
 }
 
-static void v4lconvert_rotate90_rgbbgr24(const unsigned char *src,
-		unsigned char *dst, int destwidth, int destheight)
+/* Rotating reads the src column wise, which without blocking touches a new
+   cache line, and for large frames a new page, for every pixel. So the frame
+   gets rotated in tiles of ROTATE_TILE x ROTATE_TILE pixels, the src and dest
+   lines of which stay in the cache while the tile is being rotated. Within a
+   tile the rotation is done as a transpose of 16 x 16 pixel blocks reading
+   the src bottom up, with SIMD when available. */
+#define ROTATE_TILE 64
+
+/* Rotate the tile with dest pixels x0 - x1, y0 - y1 in C, bpp is 1 or 3 */
+static inline void v4lconvert_rotate90_tile(const unsigned char *src,
+		unsigned char *dst, int destwidth, int destheight,
+		int x0, int y0, int x1, int y1, int bpp)
 {
 	int x, y;
 #define srcwidth destheight
 #define srcheight destwidth
 
-	for (y = 0; y < destheight; y++)
-		for (x = 0; x < destwidth; x++) {
-			int offset = ((srcheight - x - 1) * srcwidth + y) * 3;
-			*dst++ = src[offset++];
-			*dst++ = src[offset++];
-			*dst++ = src[offset];
+	for (y = y0; y < y1; y++) {
+		const unsigned char *s =
+			src + ((srcheight - x0 - 1) * srcwidth + y) * bpp;
+		unsigned char *d = dst + (y * destwidth + x0) * bpp;
+
+		for (x = x0; x < x1; x++) {
+			d[0] = s[0];
+			if (bpp == 3) {
+				d[1] = s[1];
+				d[2] = s[2];
+			}
+			d += bpp;
+			s -= srcwidth * bpp;
 		}
+	}
 }
 
-static void v4lconvert_rotate90_yuv420(const unsigned char *src,
+static inline void v4lconvert_rotate90_plane(const unsigned char *src,
+		unsigned char *dst, int destwidth, int destheight, int bpp)
+{
+	void (*transpose)(const unsigned char *src, int src_stride,
+			unsigned char *dst, int dst_stride) = (bpp == 3) ?
+		v4lconvert_simd.transpose_rgb24_16x16 :
+		v4lconvert_simd.transpose_16x16;
+	int x, y, x0, y0, x1, y1;
+
+	for (y0 = 0; y0 < destheight; y0 += ROTATE_TILE) {
+		y1 = y0 + ROTATE_TILE;
+		if (y1 > destheight)
+			y1 = destheight;
+
+		for (x0 = 0; x0 < destwidth; x0 += ROTATE_TILE) {
+			x1 = x0 + ROTATE_TILE;
+			if (x1 > destwidth)
+				x1 = destwidth;
+
+			if (!transpose || (x1 - x0) % 16 || (y1 - y0) % 16) {
+				v4lconvert_rotate90_tile(src, dst, destwidth,
+						destheight, x0, y0, x1, y1, bpp);
+				continue;
+			}
+
+			/* dest pixel (x, y) is src pixel (y, srcheight - x - 1) */
+			for (y = y0; y < y1; y += 16)
+				for (x = x0; x < x1; x += 16)
+					transpose(src + ((srcheight - x - 1) *
+							 srcwidth + y) * bpp,
+						  -srcwidth * bpp,
+						  dst + (y * destwidth + x) * bpp,
+						  destwidth * bpp);
+		}
+	}
+#undef srcwidth
+#undef srcheight
+}
+
+static void v4lconvert_rotate90_rgbbgr24(const unsigned char *src,
 		unsigned char *dst, int destwidth, int destheight)
 {
-	int x, y;
+	v4lconvert_rotate90_plane(src, dst, destwidth, destheight, 3);
+}
 
+static void v4lconvert_rotate90_yuv420(const unsigned char *src,
+		unsigned char *dst, int destwidth, int destheight)
+{
 	/* Y-plane */
-	for (y = 0; y < destheight; y++)
-		for (x = 0; x < destwidth; x++) {
-			int offset = (srcheight - x - 1) * srcwidth + y;
-			*dst++ = src[offset];
-		}
+	v4lconvert_rotate90_plane(src, dst, destwidth, destheight, 1);
+	src += destwidth * destheight;
+	dst += destwidth * destheight;
 
 	/* U-plane */
-	src += srcwidth * srcheight;
-	destwidth /= 2;
-	destheight /= 2;
-	for (y = 0; y < destheight; y++)
-		for (x = 0; x < destwidth; x++) {
-			int offset = (srcheight - x - 1) * srcwidth + y;
-			*dst++ = src[offset];
-		}
+	v4lconvert_rotate90_plane(src, dst, destwidth / 2, destheight / 2, 1);
+	src += destwidth * destheight / 4;
+	dst += destwidth * destheight / 4;
 
 	/* V-plane */
-	src += srcwidth * srcheight;
-	for (y = 0; y < destheight; y++)
-		for (x = 0; x < destwidth; x++) {
-			int offset = (srcheight - x - 1) * srcwidth + y;
-			*dst++ = src[offset];
-		}
+	v4lconvert_rotate90_plane(src, dst, destwidth / 2, destheight / 2, 1);
 }
 
 void v4lconvert_rotate90(unsigned char *src, unsigned char *dest,
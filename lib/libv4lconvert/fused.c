@@ -0,0 +1,874 @@
+/*
+# Single pass pixel format conversion + flipping + cropping
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+ */
+
+/*
+ * v4lconvert_convert normally does convert -> flip -> crop as separate steps,
+ * each going through a full frame intermediate buffer. For the common cases
+ * this file instead produces the destination line by line: each needed source
+ * line is converted into a small (cache resident) line buffer, from which the
+ * cropped, optionally mirrored, part is written to its (optionally vflipped)
+ * place in the destination. The result is identical to the multi step path.
+ *
+ * When the crop step would scale (see v4lconvert_scale_window), the src lines
+ * get converted one at a time and summed into the scaler's line of
+ * accumulators instead, so that scaling also does not need a full frame
+ * intermediate buffer.
+ *
+ * This is also used to directly produce the destination formats which the
+ * multi step path can only produce by repacking a full rgb24 / yuv420 frame
+ * (nv12, nv21, yuyv, xrgb32 and xbgr32). The only difference with the multi
+ * step path is that packed yuv 4:2:2 -> yuyv keeps the full chroma resolution,
+ * instead of going through yuv420.
+ */
+
+#include <string.h>
+#include "libv4lconvert-priv.h"
+
+enum v4lconvert_fused_dest {
+	V4LCONVERT_FUSED_RGB24,
+	V4LCONVERT_FUSED_RGB32,
+	V4LCONVERT_FUSED_YUV420,
+	V4LCONVERT_FUSED_NV12,
+	V4LCONVERT_FUSED_YUYV,
+};
+
+struct v4lconvert_fused_args {
+	/* Source, for planar sources src is the Y plane */
+	const unsigned char *src;
+	const unsigned char *usrc;
+	const unsigned char *vsrc;
+	int src_stride;
+	int src_uv_stride;
+	/* Destination, for planar destinations dest is the Y plane, for nv12
+	   udest is the interleaved chroma plane */
+	unsigned char *dest;
+	unsigned char *udest;
+	unsigned char *vdest;
+	int dest_type;
+	int dest_swap; /* xbgr32 instead of xrgb32, nv21 instead of nv12 */
+	int src_bgr; /* Only used for rgb24 / bgr24 -> rgb32 */
+	/* Size of the (flipped) frame and of the cropped window in it */
+	int width;
+	int height;
+	int dest_width;
+	int dest_height;
+	int startx;
+	int starty;
+	int hflip;
+	int vflip;
+	/* When scaling, the window at startx, starty gets scaled to the dest
+	   size. The tables are the horizontal weights for the luma / rgb24 and
+	   the chroma lines */
+	int scale;
+	int win_width;
+	int win_height;
+	const unsigned int *table;
+	const unsigned int *uv_table;
+	/* Line buffers, buf_size bytes per slice */
+	unsigned char *buf;
+	int buf_size;
+	/* The conversion, none set means a plain copy (or swap_rgb) */
+	int swap_rgb;
+	int swap_uv; /* Only used for packed -> planar */
+	/* Only used for packed -> yuyv, offsets in the 4 byte macropixel */
+	int yoff;
+	int uoff;
+	int voff;
+	void (*packed_to_rgb24)(const unsigned char *src, unsigned char *dst,
+		int width, int height, int stride);
+	void (*packed_to_yuv420)(const unsigned char *src, unsigned char *ydst,
+		unsigned char *udst, unsigned char *vdst,
+		int width, int height, int stride);
+	void (*yuv420_to_rgb24)(const unsigned char *ysrc,
+		const unsigned char *usrc, const unsigned char *vsrc,
+		unsigned char *dst, int width, int height);
+};
+
+/* Write width pixels starting at pixel x of a width pixels wide line, when
+   mirroring x counts from the end of the line */
+static void v4lconvert_fused_put_line(const unsigned char *src,
+		unsigned char *dest, int src_width, int x, int width, int bpp,
+		int hflip)
+{
+	int i;
+
+	if (!hflip) {
+		memcpy(dest, src + x * bpp, width * bpp);
+		return;
+	}
+
+	src += (src_width - 1 - x) * bpp;
+	if (bpp == 3) {
+		for (i = 0; i < width; i++) {
+			dest[0] = src[0];
+			dest[1] = src[1];
+			dest[2] = src[2];
+			dest += 3;
+			src -= 3;
+		}
+	} else {
+		for (i = 0; i < width; i++)
+			*dest++ = *src--;
+	}
+}
+
+/* Like v4lconvert_fused_put_line for an rgb24 (or bgr24) source line,
+   writing xrgb32 (or xbgr32) */
+static void v4lconvert_fused_put_rgb32(const unsigned char *src,
+		unsigned char *dest, int src_width, int x, int width, int hflip,
+		int src_bgr, int dest_bgr)
+{
+	int i, step = 3;
+	int r = src_bgr ? 2 : 0;
+	int b = src_bgr ? 0 : 2;
+
+	if (hflip) {
+		src += (src_width - 1 - x) * 3;
+		step = -3;
+	} else
+		src += x * 3;
+
+	for (i = 0; i < width; i++) {
+		if (dest_bgr) {
+			dest[0] = src[b];
+			dest[1] = src[1];
+			dest[2] = src[r];
+			dest[3] = 0xff;
+		} else {
+			dest[0] = 0xff;
+			dest[1] = src[r];
+			dest[2] = src[1];
+			dest[3] = src[b];
+		}
+		dest += 4;
+		src += step;
+	}
+}
+
+/* Like v4lconvert_fused_put_line for 2 chroma lines, interleaving them */
+static void v4lconvert_fused_put_uv(const unsigned char *src1,
+		const unsigned char *src2, unsigned char *dest, int src_width,
+		int x, int width, int hflip)
+{
+	int i, step = 1;
+
+	if (hflip) {
+		x = src_width - 1 - x;
+		step = -1;
+	}
+	src1 += x;
+	src2 += x;
+
+	for (i = 0; i < width; i++) {
+		*dest++ = *src1;
+		*dest++ = *src2;
+		src1 += step;
+		src2 += step;
+	}
+}
+
+/* Write width pixels starting at (even) pixel x of a line as yuyv. The source
+   luma samples are ystep bytes apart, the chroma samples uvstep bytes */
+static void v4lconvert_fused_put_yuyv(const unsigned char *ysrc, int ystep,
+		const unsigned char *usrc, const unsigned char *vsrc, int uvstep,
+		unsigned char *dest, int src_width, int x, int width, int hflip)
+{
+	int i;
+
+	if (!hflip) {
+		ysrc += x * ystep;
+		usrc += x / 2 * uvstep;
+		vsrc += x / 2 * uvstep;
+		for (i = 0; i < width; i += 2) {
+			dest[0] = ysrc[0];
+			dest[1] = *usrc;
+			dest[2] = ysrc[ystep];
+			dest[3] = *vsrc;
+			dest += 4;
+			ysrc += 2 * ystep;
+			usrc += uvstep;
+			vsrc += uvstep;
+		}
+		return;
+	}
+
+	/* Mirrored, walk the macropixels backwards swapping their 2 lumas */
+	x = src_width - 2 - x;
+	ysrc += x * ystep;
+	usrc += x / 2 * uvstep;
+	vsrc += x / 2 * uvstep;
+	for (i = 0; i < width; i += 2) {
+		dest[0] = ysrc[ystep];
+		dest[1] = *usrc;
+		dest[2] = ysrc[0];
+		dest[3] = *vsrc;
+		dest += 4;
+		ysrc -= 2 * ystep;
+		usrc -= uvstep;
+		vsrc -= uvstep;
+	}
+}
+
+/* Convert src line sy to rgb24 (or bgr24) into conv, returns the converted
+   line, or the src line itself when no conversion is needed */
+static const unsigned char *v4lconvert_fused_rgb24_line(
+		struct v4lconvert_fused_args *args, int sy, unsigned char *conv)
+{
+	const unsigned char *src = args->src + sy * args->src_stride;
+	int width = args->width;
+
+	if (args->packed_to_rgb24)
+		args->packed_to_rgb24(src, conv, width, 1, args->src_stride);
+	else if (args->yuv420_to_rgb24)
+		args->yuv420_to_rgb24(src,
+				args->usrc + sy / 2 * args->src_uv_stride,
+				args->vsrc + sy / 2 * args->src_uv_stride,
+				conv, width, 1);
+	else if (args->swap_rgb)
+		v4lconvert_swap_rgb(src, conv, width, 1);
+	else
+		return src;
+
+	return conv;
+}
+
+/* Is the line v4lconvert_fused_rgb24_line returns bgr24 ? Only used for
+   rgb32 destinations, which never need swap_rgb */
+static int v4lconvert_fused_line_bgr(struct v4lconvert_fused_args *args)
+{
+	if (args->packed_to_rgb24 || args->yuv420_to_rgb24)
+		return 0;
+
+	return args->src_bgr;
+}
+
+static void v4lconvert_fused_rgb24(struct v4lconvert_fused_args *args,
+		unsigned char *buf, int first, int last)
+{
+	int y, width = args->width;
+
+	for (y = first; y < last; y++) {
+		int sy = args->starty + y;
+		const unsigned char *line;
+		unsigned char *dest;
+		unsigned char *conv;
+
+		if (args->vflip)
+			sy = args->height - 1 - sy;
+
+		if (args->dest_type == V4LCONVERT_FUSED_RGB32)
+			dest = args->dest + y * args->dest_width * 4;
+		else
+			dest = args->dest + y * args->dest_width * 3;
+
+		/* Convert straight into the destination when possible */
+		if (args->dest_type == V4LCONVERT_FUSED_RGB24 &&
+		    !args->hflip && args->dest_width == width)
+			conv = dest;
+		else
+			conv = buf;
+
+		line = v4lconvert_fused_rgb24_line(args, sy, conv);
+		if (args->dest_type == V4LCONVERT_FUSED_RGB32)
+			v4lconvert_fused_put_rgb32(line, dest, width,
+					args->startx, args->dest_width,
+					args->hflip,
+					v4lconvert_fused_line_bgr(args),
+					args->dest_swap);
+		else if (line != dest)
+			v4lconvert_fused_put_line(line, dest, width, args->startx,
+					args->dest_width, 3, args->hflip);
+	}
+}
+
+/* Mirror a line of width pixels of bpp (1 or 3) accumulators */
+static void v4lconvert_fused_mirror_acc(unsigned short *acc, int width,
+		int bpp)
+{
+	unsigned short *end = acc + (width - 1) * bpp;
+	unsigned short tmp;
+	int i;
+
+	while (acc < end) {
+		for (i = 0; i < bpp; i++) {
+			tmp = acc[i];
+			acc[i] = end[i];
+			end[i] = tmp;
+		}
+		acc += bpp;
+		end -= bpp;
+	}
+}
+
+/* The src window x position of the (hflipped) window at startx */
+static int v4lconvert_fused_win_x(struct v4lconvert_fused_args *args)
+{
+	if (args->hflip)
+		return args->width - args->startx - args->win_width;
+
+	return args->startx;
+}
+
+/* The scaling version of v4lconvert_fused_rgb24. The last converted line is
+   kept, as the src lines at the boundaries are used for 2 dest lines. To get
+   the same result as the multi step path, which flips before scaling, the
+   accumulators get mirrored instead of the scaled line */
+static void v4lconvert_fused_rgb24_scaled(struct v4lconvert_fused_args *args,
+		unsigned char *buf, int first, int last)
+{
+	int y, k, end, dest_width = args->dest_width;
+	int n = args->win_width * 3;
+	unsigned short *acc = (unsigned short *)buf;
+	unsigned char *conv = buf + n * sizeof(*acc);
+	unsigned char *out = conv + args->width * 3;
+	const unsigned char *line = NULL;
+	int line_y = -1, x = v4lconvert_fused_win_x(args);
+
+	for (y = first; y < last; y++) {
+		unsigned char *dest;
+
+		memset(acc, 0, n * sizeof(*acc));
+		k = v4lconvert_scale_span(y, args->win_height,
+					  args->dest_height, &end);
+		for (; k < end; k++) {
+			int weight = v4lconvert_scale_weight(y, k,
+					args->win_height, args->dest_height);
+			int sy = args->starty + k;
+
+			if (!weight)
+				continue;
+			if (args->vflip)
+				sy = args->height - 1 - sy;
+			if (sy != line_y) {
+				line = v4lconvert_fused_rgb24_line(args, sy,
+								   conv);
+				line_y = sy;
+			}
+			v4lconvert_scale_accumulate(line + x * 3, acc, n,
+						    weight);
+		}
+		if (args->hflip)
+			v4lconvert_fused_mirror_acc(acc, args->win_width, 3);
+
+		if (args->dest_type == V4LCONVERT_FUSED_RGB32) {
+			dest = args->dest + y * dest_width * 4;
+			v4lconvert_scale_line(acc, out, args->table,
+					      dest_width, 3);
+			v4lconvert_fused_put_rgb32(out, dest, dest_width, 0,
+					dest_width, 0,
+					v4lconvert_fused_line_bgr(args),
+					args->dest_swap);
+		} else {
+			dest = args->dest + y * dest_width * 3;
+			v4lconvert_scale_line(acc, dest, args->table,
+					      dest_width, 3);
+		}
+	}
+}
+
+/* Get src line pair sy, sy + 1 and its chroma line, converting them into buf
+   when necessary */
+static void v4lconvert_fused_yuv420_pair(struct v4lconvert_fused_args *args,
+		unsigned char *buf, int sy, const unsigned char **ysrc,
+		const unsigned char **usrc, const unsigned char **vsrc)
+{
+	int width = args->width;
+
+	if (args->packed_to_yuv420) {
+		unsigned char *ubuf = buf + 2 * width;
+		unsigned char *vbuf = ubuf + width / 2;
+
+		if (args->swap_uv)
+			args->packed_to_yuv420(args->src + sy * args->src_stride,
+					buf, vbuf, ubuf, width, 2,
+					args->src_stride);
+		else
+			args->packed_to_yuv420(args->src + sy * args->src_stride,
+					buf, ubuf, vbuf, width, 2,
+					args->src_stride);
+		ysrc[0] = buf;
+		ysrc[1] = buf + width;
+		*usrc = ubuf;
+		*vsrc = vbuf;
+	} else {
+		ysrc[0] = args->src + sy * args->src_stride;
+		ysrc[1] = ysrc[0] + args->src_stride;
+		*usrc = args->usrc + sy / 2 * args->src_uv_stride;
+		*vsrc = args->vsrc + sy / 2 * args->src_uv_stride;
+	}
+}
+
+/* Write dest lines y and y + 1 and their chroma, taking width pixels starting
+   at pixel x of the y0, y1, usrc and vsrc lines */
+static void v4lconvert_fused_put_yuv420(struct v4lconvert_fused_args *args,
+		int y, const unsigned char *y0, const unsigned char *y1,
+		const unsigned char *usrc, const unsigned char *vsrc,
+		int width, int x, int hflip)
+{
+	int dest_width = args->dest_width;
+
+	if (args->dest_type == V4LCONVERT_FUSED_YUYV) {
+		v4lconvert_fused_put_yuyv(y0, 1, usrc, vsrc, 1,
+				args->dest + y * dest_width * 2, width,
+				x, dest_width, hflip);
+		v4lconvert_fused_put_yuyv(y1, 1, usrc, vsrc, 1,
+				args->dest + (y + 1) * dest_width * 2,
+				width, x, dest_width, hflip);
+		return;
+	}
+
+	v4lconvert_fused_put_line(y0, args->dest + y * dest_width, width,
+			x, dest_width, 1, hflip);
+	v4lconvert_fused_put_line(y1, args->dest + (y + 1) * dest_width, width,
+			x, dest_width, 1, hflip);
+	if (args->dest_type == V4LCONVERT_FUSED_NV12) {
+		v4lconvert_fused_put_uv(args->dest_swap ? vsrc : usrc,
+				args->dest_swap ? usrc : vsrc,
+				args->udest + y / 2 * dest_width,
+				width / 2, x / 2, dest_width / 2, hflip);
+		return;
+	}
+	v4lconvert_fused_put_line(usrc, args->udest + y / 2 * dest_width / 2,
+			width / 2, x / 2, dest_width / 2, 1, hflip);
+	v4lconvert_fused_put_line(vsrc, args->vdest + y / 2 * dest_width / 2,
+			width / 2, x / 2, dest_width / 2, 1, hflip);
+}
+
+static void v4lconvert_fused_yuv420(struct v4lconvert_fused_args *args,
+		unsigned char *buf, int first, int last)
+{
+	int y;
+
+	for (y = first; y < last; y += 2) {
+		int sy = args->starty + y;
+		const unsigned char *ysrc[2], *usrc, *vsrc;
+
+		/* A vflipped line pair still is a line pair sharing the same
+		   chroma line, only its 2 luma lines get swapped */
+		if (args->vflip)
+			sy = args->height - 2 - sy;
+
+		v4lconvert_fused_yuv420_pair(args, buf, sy, ysrc, &usrc, &vsrc);
+		v4lconvert_fused_put_yuv420(args, y, ysrc[args->vflip],
+				ysrc[!args->vflip], usrc, vsrc, args->width,
+				args->startx, args->hflip);
+	}
+}
+
+/* The scaling version of v4lconvert_fused_yuv420. The src line pairs covered
+   by dest line pair y get accumulated into dest lines y and y + 1, and the
+   chroma lines into chroma line y / 2. The last converted line pair is kept,
+   as the line pairs at the boundaries are used for 2 dest line pairs */
+static void v4lconvert_fused_yuv420_scaled(struct v4lconvert_fused_args *args,
+		unsigned char *buf, int first, int last)
+{
+	int y, i, k, end, dest_width = args->dest_width;
+	int win_width = args->win_width;
+	int win_height = args->win_height;
+	int dest_height = args->dest_height;
+	unsigned short *acc[4];
+	unsigned char *conv = buf + win_width * 3 * sizeof(unsigned short);
+	unsigned char *out = conv + args->width * 3;
+	const unsigned char *ysrc[2], *usrc = NULL, *vsrc = NULL;
+	int pair_y = -1, x = v4lconvert_fused_win_x(args);
+
+	/* Luma lines y, y + 1, and the u and v lines */
+	acc[0] = (unsigned short *)buf;
+	acc[1] = acc[0] + win_width;
+	acc[2] = acc[1] + win_width;
+	acc[3] = acc[2] + win_width / 2;
+
+	for (y = first; y < last; y += 2) {
+		memset(acc[0], 0, win_width * 3 * sizeof(unsigned short));
+		k = v4lconvert_scale_span(y, win_height, dest_height, &end) & ~1;
+		v4lconvert_scale_span(y + 1, win_height, dest_height, &end);
+		for (; k < end; k += 2) {
+			int sy = args->starty + k;
+			int weight;
+
+			if (args->vflip)
+				sy = args->height - 2 - sy;
+			if (sy != pair_y) {
+				v4lconvert_fused_yuv420_pair(args, conv, sy,
+						ysrc, &usrc, &vsrc);
+				pair_y = sy;
+			}
+
+			for (i = 0; i < 4; i++) {
+				/* Line k + i / 2 into dest line y + i % 2 */
+				weight = v4lconvert_scale_weight(y + i % 2,
+						k + i / 2, win_height,
+						dest_height);
+				if (weight)
+					v4lconvert_scale_accumulate(
+						ysrc[(i / 2) ^ args->vflip] + x,
+						acc[i % 2], win_width, weight);
+			}
+
+			weight = v4lconvert_scale_weight(y / 2, k / 2,
+					win_height / 2, dest_height / 2);
+			if (!weight)
+				continue;
+			v4lconvert_scale_accumulate(usrc + x / 2, acc[2],
+					win_width / 2, weight);
+			v4lconvert_scale_accumulate(vsrc + x / 2, acc[3],
+					win_width / 2, weight);
+		}
+		if (args->hflip) {
+			for (i = 0; i < 2; i++)
+				v4lconvert_fused_mirror_acc(acc[i], win_width,
+							    1);
+			for (i = 2; i < 4; i++)
+				v4lconvert_fused_mirror_acc(acc[i],
+							    win_width / 2, 1);
+		}
+
+		v4lconvert_scale_line(acc[0], out, args->table, dest_width, 1);
+		v4lconvert_scale_line(acc[1], out + dest_width, args->table,
+				      dest_width, 1);
+		v4lconvert_scale_line(acc[2], out + 2 * dest_width,
+				      args->uv_table, dest_width / 2, 1);
+		v4lconvert_scale_line(acc[3], out + 5 * dest_width / 2,
+				      args->uv_table, dest_width / 2, 1);
+		v4lconvert_fused_put_yuv420(args, y, out, out + dest_width,
+				out + 2 * dest_width, out + 5 * dest_width / 2,
+				dest_width, 0, 0);
+	}
+}
+
+/* packed yuv 4:2:2 -> yuyv, this is done per line so that no chroma
+   resolution gets lost */
+static void v4lconvert_fused_yuyv(struct v4lconvert_fused_args *args,
+		int first, int last)
+{
+	int y;
+
+	for (y = first; y < last; y++) {
+		int sy = args->starty + y;
+		const unsigned char *src;
+
+		if (args->vflip)
+			sy = args->height - 1 - sy;
+		src = args->src + sy * args->src_stride;
+
+		v4lconvert_fused_put_yuyv(src + args->yoff, 2,
+				src + args->uoff, src + args->voff, 4,
+				args->dest + y * args->dest_width * 2,
+				args->width, args->startx, args->dest_width,
+				args->hflip);
+	}
+}
+
+static void v4lconvert_fused_slice(void *arg, int slice, int first, int last)
+{
+	struct v4lconvert_fused_args *args = arg;
+	unsigned char *buf = args->buf + slice * args->buf_size;
+
+	if (args->scale) {
+		if (args->dest_type >= V4LCONVERT_FUSED_YUV420)
+			v4lconvert_fused_yuv420_scaled(args, buf, first, last);
+		else
+			v4lconvert_fused_rgb24_scaled(args, buf, first, last);
+		return;
+	}
+
+	switch (args->dest_type) {
+	case V4LCONVERT_FUSED_RGB24:
+	case V4LCONVERT_FUSED_RGB32:
+		v4lconvert_fused_rgb24(args, buf, first, last);
+		break;
+	case V4LCONVERT_FUSED_YUYV:
+		/* Planar 4:2:0 sources go through the yuv420 code */
+		if (!args->usrc) {
+			v4lconvert_fused_yuyv(args, first, last);
+			break;
+		}
+		/* Fall through */
+	default:
+		v4lconvert_fused_yuv420(args, buf, first, last);
+		break;
+	}
+}
+
+static int v4lconvert_is_yuv420(unsigned int pixelformat)
+{
+	return pixelformat == V4L2_PIX_FMT_YUV420 ||
+	       pixelformat == V4L2_PIX_FMT_YVU420;
+}
+
+/* Returns 0 when the conversion has been done, -1 if this combination of
+   formats / sizes is not handled here, in which case the caller must use
+   the multi step path (which will also report any errors) */
+int v4lconvert_fused_convert(struct v4lconvert_data *data,
+		unsigned char *src, int src_size,
+		const struct v4l2_format *src_fmt, unsigned char *dest,
+		const struct v4l2_format *dest_fmt, int hflip, int vflip)
+{
+	unsigned int src_pix_fmt = src_fmt->fmt.pix.pixelformat;
+	unsigned int dest_pix_fmt = dest_fmt->fmt.pix.pixelformat;
+	unsigned int base_pix_fmt;
+	int width = src_fmt->fmt.pix.width;
+	int height = src_fmt->fmt.pix.height;
+	int dest_width = dest_fmt->fmt.pix.width;
+	int dest_height = dest_fmt->fmt.pix.height;
+	int bytesperline = src_fmt->fmt.pix.bytesperline;
+	struct v4lconvert_fused_args args = {
+		.src = src,
+		.src_stride = width * 3,
+		.dest = dest,
+		.width = width,
+		.height = height,
+		.dest_width = dest_width,
+		.dest_height = dest_height,
+		.hflip = hflip,
+		.vflip = vflip,
+	};
+	int yuv420_src = v4lconvert_is_yuv420(src_pix_fmt);
+	int yuv_dest, rgb_dest, dest_bpl, slices;
+	int table_size = 0, uv_table_size = 0;
+
+	/* The packed yuv and yuv420 code (and the multi step path) only give
+	   sensible results for even sizes */
+	if ((width & 1) || (height & 1) || (dest_width & 1) || (dest_height & 1))
+		return -1;
+
+	/* Plain cropping or scaling, not the add border variant */
+	args.scale = v4lconvert_scale_window(width, height, dest_width,
+			dest_height, &args.win_width, &args.win_height);
+	if (!args.scale && (dest_width > width || dest_height > height))
+		return -1;
+
+	/* base_pix_fmt is the format the multi step path would convert to,
+	   before repacking into the destination format */
+	switch (dest_pix_fmt) {
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24:
+		args.dest_type = V4LCONVERT_FUSED_RGB24;
+		base_pix_fmt = dest_pix_fmt;
+		dest_bpl = dest_width * 3;
+		break;
+	case V4L2_PIX_FMT_XRGB32:
+	case V4L2_PIX_FMT_XBGR32:
+		args.dest_type = V4LCONVERT_FUSED_RGB32;
+		args.dest_swap = dest_pix_fmt == V4L2_PIX_FMT_XBGR32;
+		base_pix_fmt = V4L2_PIX_FMT_RGB24;
+		dest_bpl = dest_width * 4;
+		break;
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+		args.dest_type = V4LCONVERT_FUSED_YUV420;
+		base_pix_fmt = dest_pix_fmt;
+		dest_bpl = dest_width;
+		if (dest_pix_fmt == V4L2_PIX_FMT_YVU420) {
+			args.vdest = dest + dest_width * dest_height;
+			args.udest = args.vdest + dest_width * dest_height / 4;
+		} else {
+			args.udest = dest + dest_width * dest_height;
+			args.vdest = args.udest + dest_width * dest_height / 4;
+		}
+		break;
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV21:
+		args.dest_type = V4LCONVERT_FUSED_NV12;
+		args.dest_swap = dest_pix_fmt == V4L2_PIX_FMT_NV21;
+		base_pix_fmt = V4L2_PIX_FMT_YUV420;
+		dest_bpl = dest_width;
+		args.udest = dest + dest_width * dest_height;
+		break;
+	case V4L2_PIX_FMT_YUYV:
+		args.dest_type = V4LCONVERT_FUSED_YUYV;
+		base_pix_fmt = V4L2_PIX_FMT_YUV420;
+		dest_bpl = dest_width * 2;
+		break;
+	default:
+		return -1;
+	}
+
+	if (dest_fmt->fmt.pix.bytesperline != dest_bpl)
+		return -1;
+
+	yuv_dest = args.dest_type >= V4LCONVERT_FUSED_YUV420;
+	rgb_dest = base_pix_fmt == V4L2_PIX_FMT_RGB24;
+	if (!args.scale) {
+		args.win_width = dest_width;
+		args.win_height = dest_height;
+	}
+	if (yuv_dest) {
+		args.startx = ((width - args.win_width) / 2) & ~1;
+		args.starty = ((height - args.win_height) / 2) & ~1;
+	} else {
+		args.startx = (width - args.win_width) / 2;
+		args.starty = (height - args.win_height) / 2;
+	}
+
+	switch (src_pix_fmt) {
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_YVYU:
+	case V4L2_PIX_FMT_UYVY:
+		if (bytesperline < width * 2 || src_size < width * height * 2)
+			return -1;
+		args.src_stride = bytesperline;
+		break;
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+		if (src_size < width * height * 3 / 2)
+			return -1;
+		/* Like v4lconvert_convert_pixfmt, the yuv420 -> rgb code
+		   ignores bytesperline, where as flip / crop / swap_uv honor it
+		   (except for rotate180) */
+		if (yuv_dest && !(src_pix_fmt == base_pix_fmt &&
+				  hflip && vflip)) {
+			if (bytesperline < width ||
+			    src_size < height * bytesperline * 3 / 2)
+				return -1;
+			args.src_stride = bytesperline;
+			args.src_uv_stride = bytesperline / 2;
+			args.usrc = src + height * bytesperline;
+			args.vsrc = src + height * bytesperline * 5 / 4;
+		} else {
+			args.src_stride = width;
+			args.src_uv_stride = width / 2;
+			args.usrc = src + width * height;
+			args.vsrc = args.usrc + width * height / 4;
+		}
+		if (src_pix_fmt == V4L2_PIX_FMT_YVU420) {
+			const unsigned char *tmp = args.usrc;
+
+			args.usrc = args.vsrc;
+			args.vsrc = tmp;
+		}
+		break;
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24:
+		if (yuv_dest || src_size < width * height * 3)
+			return -1;
+		/* Without conversion flip / crop work on the source directly,
+		   honoring bytesperline (except for rotate180), the
+		   rgb24 <-> bgr24 swap does not */
+		if (src_pix_fmt == base_pix_fmt && !(hflip && vflip)) {
+			if (bytesperline < width * 3 ||
+			    src_size < height * bytesperline)
+				return -1;
+			args.src_stride = bytesperline;
+		}
+		if (args.dest_type == V4LCONVERT_FUSED_RGB32)
+			args.src_bgr = src_pix_fmt == V4L2_PIX_FMT_BGR24;
+		else if (src_pix_fmt != dest_pix_fmt)
+			args.swap_rgb = 1;
+		break;
+	default:
+		return -1;
+	}
+
+	/* packed yuv 4:2:2 -> yuyv is a plain reshuffle of the samples, when
+	   scaling it goes through yuv420 like the multi step path */
+	if (args.dest_type == V4LCONVERT_FUSED_YUYV && !yuv420_src &&
+	    !args.scale) {
+		switch (src_pix_fmt) {
+		case V4L2_PIX_FMT_YUYV:
+			args.yoff = 0;
+			args.uoff = 1;
+			args.voff = 3;
+			break;
+		case V4L2_PIX_FMT_YVYU:
+			args.yoff = 0;
+			args.uoff = 3;
+			args.voff = 1;
+			break;
+		case V4L2_PIX_FMT_UYVY:
+			args.yoff = 1;
+			args.uoff = 0;
+			args.voff = 2;
+			break;
+		}
+		v4lconvert_threads_run(data->threads, dest_height, 2,
+				       v4lconvert_fused_slice, &args);
+		return 0;
+	}
+
+	switch (src_pix_fmt) {
+	case V4L2_PIX_FMT_YUYV:
+		if (yuv_dest)
+			args.packed_to_yuv420 = v4lconvert_yuyv_to_yuv420_planes;
+		else if (rgb_dest)
+			args.packed_to_rgb24 = v4lconvert_yuyv_to_rgb24;
+		else
+			args.packed_to_rgb24 = v4lconvert_yuyv_to_bgr24;
+		break;
+	case V4L2_PIX_FMT_YVYU:
+		if (yuv_dest) {
+			args.packed_to_yuv420 = v4lconvert_yuyv_to_yuv420_planes;
+			args.swap_uv = 1;
+		} else if (rgb_dest)
+			args.packed_to_rgb24 = v4lconvert_yvyu_to_rgb24;
+		else
+			args.packed_to_rgb24 = v4lconvert_yvyu_to_bgr24;
+		break;
+	case V4L2_PIX_FMT_UYVY:
+		if (yuv_dest)
+			args.packed_to_yuv420 = v4lconvert_uyvy_to_yuv420_planes;
+		else if (rgb_dest)
+			args.packed_to_rgb24 = v4lconvert_uyvy_to_rgb24;
+		else
+			args.packed_to_rgb24 = v4lconvert_uyvy_to_bgr24;
+		break;
+	default:
+		if (yuv420_src && !yuv_dest)
+			args.yuv420_to_rgb24 = rgb_dest ?
+				v4lconvert_yuv420_planes_to_rgb24 :
+				v4lconvert_yuv420_planes_to_bgr24;
+		break;
+	}
+
+	/* Room for a single rgb24 line, or a yuv420 line pair + its chroma.
+	   When scaling also for the accumulators and the scaled lines, followed
+	   by the (shared) horizontal weights tables */
+	args.buf_size = width * 3;
+	if (args.scale) {
+		args.buf_size = (args.win_width * 3 * sizeof(unsigned short) +
+				 width * 3 + dest_width * 3 + 15) & ~15;
+		table_size = v4lconvert_scale_table_size(args.win_width,
+							 dest_width);
+		uv_table_size = v4lconvert_scale_table_size(
+				args.win_width / 2, dest_width / 2);
+	}
+	slices = v4lconvert_threads_count(data->threads);
+	args.buf = v4lconvert_alloc_buffer(args.buf_size * slices +
+			(table_size + uv_table_size) * sizeof(unsigned int),
+			&data->fused_buf, &data->fused_buf_size);
+	if (!args.buf)
+		return -1;
+
+	if (args.scale) {
+		unsigned int *table = (unsigned int *)(args.buf +
+						       args.buf_size * slices);
+
+		v4lconvert_scale_init_table(table, args.win_width, dest_width);
+		args.table = table;
+		if (yuv_dest) {
+			v4lconvert_scale_init_table(table + table_size,
+					args.win_width / 2, dest_width / 2);
+			args.uv_table = table + table_size;
+		}
+	}
+
+	v4lconvert_threads_run(data->threads, dest_height, 2,
+			       v4lconvert_fused_slice, &args);
+
+	return 0;
+}
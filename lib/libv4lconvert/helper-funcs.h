@@ -29,6 +29,10 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "decomp-plugin.h"
 
 static int v4lconvert_helper_write(int fd, const void *b, size_t count,
   char *progname)
@@ -77,3 +81,66 @@ static int v4lconvert_helper_read(int fd, void *b, size_t count,
 
   return 0;
 }
+
+typedef int (*v4lconvert_helper_decompress_func)(unsigned char *src,
+  unsigned char *dest, int width, int height, int yvu, int src_size);
+
+/* Shared memory protocol main loop, see decomp-plugin.h */
+static int v4lconvert_helper_shm_loop(v4lconvert_helper_decompress_func
+  decompress, char *progname)
+{
+  struct v4lconvert_shm_frame *frame = NULL, f;
+  unsigned char *src;
+  size_t mapped = 0;
+  struct stat st;
+  int seq;
+
+  while (1) {
+    if (v4lconvert_helper_read(STDIN_FILENO, &seq, sizeof(int), progname))
+      return 1; /* Erm, no way to recover without loosing sync with libv4l */
+
+    /* libv4lconvert grows the shared memory when it needs more room */
+    if (fstat(V4LCONVERT_SHM_FD, &st)) {
+      fprintf(stderr, "%s: error stat-ing shm: %s\n", progname,
+	      strerror(errno));
+      return 1;
+    }
+    if (st.st_size != mapped) {
+      if (frame)
+	munmap(frame, mapped);
+      frame = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   V4LCONVERT_SHM_FD, 0);
+      if (frame == MAP_FAILED) {
+	fprintf(stderr, "%s: error mapping shm: %s\n", progname,
+		strerror(errno));
+	return 1;
+      }
+      mapped = st.st_size;
+    }
+
+    f = *frame;
+    src = (unsigned char *)frame + V4LCONVERT_SHM_SRC_OFFSET;
+    if (f.width <= 0 || f.width > SHRT_MAX ||
+	f.height <= 0 || f.height > SHRT_MAX) {
+      fprintf(stderr, "%s: error: width or height out of bounds\n", progname);
+      f.dest_size = -1;
+    } else if (f.src_size < 0 || f.src_size > f.src_max || f.dest_max < 0 ||
+	       (size_t)V4LCONVERT_SHM_SRC_OFFSET + f.src_max + f.dest_max >
+	       mapped) {
+      fprintf(stderr, "%s: error: frame does not fit in shm\n", progname);
+      f.dest_size = -1;
+    } else if (f.width * f.height * 3 / 2 > f.dest_max) {
+      fprintf(stderr, "%s: error: dest area too small, need: %d\n",
+	      progname, f.width * f.height * 3 / 2);
+      f.dest_size = -1;
+    } else if (decompress(src, src + f.src_max, f.width, f.height, f.flags,
+			  f.src_size))
+      f.dest_size = -1;
+    else
+      f.dest_size = f.width * f.height * 3 / 2;
+    frame->dest_size = f.dest_size;
+
+    if (v4lconvert_helper_write(STDOUT_FILENO, &seq, sizeof(int), progname))
+      return 1; /* Erm, no way to recover without loosing sync with libv4l */
+  }
+}
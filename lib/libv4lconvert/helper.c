@@ -22,8 +22,16 @@
 #include <errno.h>
 #include <string.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include "libv4lconvert-priv.h"
+#include "decomp-plugin.h"
+#ifdef HAVE_GPL_DECOMP_MODULES
+#include <dlfcn.h>
+#endif
 
 #define READ_END  0
 #define WRITE_END 1
@@ -46,8 +54,128 @@
    From the helper to libv4l the following is send:
    int			data length (-1 in case of a decompression error)
    unsigned char[]	data (not present when a decompression error happened)
+
+   Pushing all frame data through 2 pipes costs 4 copies of it per frame,
+   so when possible the frames are passed through shared memory instead and
+   only a sequence number goes through the pipes, see decomp-plugin.h.
+
+   When configured with --enable-gpl-decomp-modules, the decompressor is
+   also installed as a loadable module, which gets dlopen-ed and called
+   directly, avoiding the helper process altogether. This loads GPL code into
+   the (LGPL) library and so into every application using it, which is why
+   it is off by default, see README.libv4l.
  */
 
+#define V4LCONVERT_SHM_SLACK 32 /* The decompressors read 32 bytes blocks */
+
+#ifdef HAVE_GPL_DECOMP_MODULES
+static void v4lconvert_helper_load_plugin(struct v4lconvert_data *data,
+		const char *helper)
+{
+	const struct v4lconvert_decomp_plugin *plugin;
+	char path[PATH_MAX];
+	void *lib;
+
+	snprintf(path, sizeof(path), "%s.so", helper);
+	lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (!lib)
+		return; /* Not installed, use the helper executable */
+
+	plugin = dlsym(lib, V4LCONVERT_DECOMP_PLUGIN_SYM);
+	if (!plugin || plugin->abi_version != V4LCONVERT_DECOMP_ABI_VERSION ||
+			!plugin->decompress) {
+		dlclose(lib);
+		return;
+	}
+
+	data->decompress_plugin_lib = lib;
+	data->decompress_plugin = plugin;
+}
+
+static int v4lconvert_helper_plugin_decompress(struct v4lconvert_data *data,
+		const unsigned char *src, int src_size, unsigned char *dest,
+		int dest_size, int width, int height, int flags)
+{
+	unsigned char *buf;
+
+	/* The decompressors modify the src data in place */
+	buf = v4lconvert_alloc_buffer(src_size + V4LCONVERT_SHM_SLACK,
+			&data->decompress_src_buf, &data->decompress_src_buf_size);
+	if (!buf)
+		return v4lconvert_oom_error(data);
+
+	memcpy(buf, src, src_size);
+	memset(buf + src_size, 0, V4LCONVERT_SHM_SLACK);
+
+	if (data->decompress_plugin->decompress(buf, src_size, dest, dest_size,
+				width, height, flags)) {
+		V4LCONVERT_ERR("decompressing frame data\n");
+		return -1;
+	}
+
+	return 0;
+}
+#endif
+
+/* Make sure the shared memory has room for src_size bytes of src data and
+   dest_size bytes of decompressed data. It only ever grows, the helper
+   notices this and remaps it. */
+static int v4lconvert_helper_shm_resize(struct v4lconvert_data *data,
+		int src_size, int dest_size)
+{
+	struct v4lconvert_shm_frame *frame = data->decompress_shm;
+	int src_max, dest_max, size;
+
+	src_max = (src_size + V4LCONVERT_SHM_SLACK + V4LCONVERT_SHM_ALIGN - 1) &
+		~(V4LCONVERT_SHM_ALIGN - 1);
+	dest_max = dest_size;
+	if (frame) {
+		if (src_max <= frame->src_max && dest_max <= frame->dest_max)
+			return 0;
+		if (src_max < frame->src_max)
+			src_max = frame->src_max;
+		if (dest_max < frame->dest_max)
+			dest_max = frame->dest_max;
+		munmap(frame, data->decompress_shm_size);
+		data->decompress_shm = NULL;
+	}
+
+	size = V4LCONVERT_SHM_SRC_OFFSET + src_max + dest_max;
+	if (ftruncate(data->decompress_shm_fd, size)) {
+		V4LCONVERT_ERR("resizing helper shm: %s\n", strerror(errno));
+		return -1;
+	}
+
+	frame = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			data->decompress_shm_fd, 0);
+	if (frame == MAP_FAILED) {
+		V4LCONVERT_ERR("mapping helper shm: %s\n", strerror(errno));
+		return -1;
+	}
+
+	frame->src_max = src_max;
+	frame->dest_max = dest_max;
+	data->decompress_shm = frame;
+	data->decompress_shm_size = size;
+
+	return 0;
+}
+
+/* On failure we fall back to the pipe only protocol */
+static void v4lconvert_helper_shm_create(struct v4lconvert_data *data)
+{
+#ifndef ANDROID
+	char name[64];
+
+	snprintf(name, sizeof(name), "/libv4lconvert-helper-%d-%p",
+			(int)getpid(), (void *)data);
+	data->decompress_shm_fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR,
+			S_IRUSR | S_IWUSR);
+	if (data->decompress_shm_fd != -1)
+		shm_unlink(name);
+#endif
+}
+
 static int v4lconvert_helper_start(struct v4lconvert_data *data,
 		const char *helper)
 {
@@ -61,6 +189,8 @@ static int v4lconvert_helper_start(struct v4lconvert_data *data,
 		goto error_close_in_pipe;
 	}
 
+	v4lconvert_helper_shm_create(data);
+
 	data->decompress_pid = fork();
 	if (data->decompress_pid == -1) {
 		V4LCONVERT_ERR("with helper fork: %s\n", strerror(errno));
@@ -84,8 +214,24 @@ static int v4lconvert_helper_start(struct v4lconvert_data *data,
 			exit(1);
 		}
 
+		/* Pass the shm as V4LCONVERT_SHM_FD, shm_open sets FD_CLOEXEC */
+		if (data->decompress_shm_fd == V4LCONVERT_SHM_FD) {
+			if (fcntl(V4LCONVERT_SHM_FD, F_SETFD, 0) == -1) {
+				perror("libv4lconvert: error with helper fcntl");
+				exit(1);
+			}
+		} else if (data->decompress_shm_fd != -1) {
+			if (dup2(data->decompress_shm_fd, V4LCONVERT_SHM_FD) == -1) {
+				perror("libv4lconvert: error with helper dup2");
+				exit(1);
+			}
+		}
+
 		/* And execute the helper */
-		execl(helper, helper, NULL);
+		if (data->decompress_shm_fd != -1)
+			execl(helper, helper, "--shm", NULL);
+		else
+			execl(helper, helper, NULL);
 
 		/* We should never get here */
 		perror("libv4lconvert: error starting helper");
@@ -99,6 +245,10 @@ static int v4lconvert_helper_start(struct v4lconvert_data *data,
 	return 0;
 
 error_close_out_pipe:
+	if (data->decompress_shm_fd != -1) {
+		close(data->decompress_shm_fd);
+		data->decompress_shm_fd = -1;
+	}
 	close(data->decompress_out_pipe[READ_END]);
 	close(data->decompress_out_pipe[WRITE_END]);
 error_close_in_pipe:
@@ -165,17 +315,83 @@ static int v4lconvert_helper_read(struct v4lconvert_data *data, void *b,
 	return 0;
 }
 
+static int v4lconvert_helper_shm_decompress(struct v4lconvert_data *data,
+		const unsigned char *src, int src_size, unsigned char *dest,
+		int dest_size, int width, int height, int flags)
+{
+	struct v4lconvert_shm_frame *frame;
+	unsigned char *shm_src;
+	int seq, r;
+
+	if (v4lconvert_helper_shm_resize(data, src_size, width * height * 3 / 2))
+		return -1;
+
+	frame = data->decompress_shm;
+	frame->width = width;
+	frame->height = height;
+	frame->flags = flags;
+	frame->src_size = src_size;
+	frame->dest_size = -1;
+	shm_src = (unsigned char *)frame + V4LCONVERT_SHM_SRC_OFFSET;
+	memcpy(shm_src, src, src_size);
+	memset(shm_src + src_size, 0, V4LCONVERT_SHM_SLACK);
+
+	seq = ++data->decompress_seq;
+	if (v4lconvert_helper_write(data, &seq, sizeof(int)))
+		return -1;
+
+	if (v4lconvert_helper_read(data, &r, sizeof(int)))
+		return -1;
+
+	if (r != seq) {
+		V4LCONVERT_ERR("helper out of sync\n");
+		return -1;
+	}
+
+	if (frame->dest_size < 0) {
+		V4LCONVERT_ERR("decompressing frame data\n");
+		return -1;
+	}
+
+	if (dest_size < frame->dest_size ||
+			frame->dest_size > frame->dest_max) {
+		V4LCONVERT_ERR("destination buffer to small\n");
+		return -1;
+	}
+
+	memcpy(dest, shm_src + frame->src_max, frame->dest_size);
+	return 0;
+}
+
 int v4lconvert_helper_decompress(struct v4lconvert_data *data,
 		const char *helper, const unsigned char *src, int src_size,
 		unsigned char *dest, int dest_size, int width, int height, int flags)
 {
 	int r;
 
+	if (!data->decompress_helper || strcmp(data->decompress_helper, helper)) {
+		v4lconvert_helper_cleanup(data);
+		data->decompress_helper = helper;
+#ifdef HAVE_GPL_DECOMP_MODULES
+		v4lconvert_helper_load_plugin(data, helper);
+#endif
+	}
+
+#ifdef HAVE_GPL_DECOMP_MODULES
+	if (data->decompress_plugin)
+		return v4lconvert_helper_plugin_decompress(data, src, src_size,
+				dest, dest_size, width, height, flags);
+#endif
+
 	if (data->decompress_pid == -1) {
 		if (v4lconvert_helper_start(data, helper))
 			return -1;
 	}
 
+	if (data->decompress_shm_fd != -1)
+		return v4lconvert_helper_shm_decompress(data, src, src_size,
+				dest, dest_size, width, height, flags);
+
 	if (v4lconvert_helper_write(data, &width, sizeof(int)))
 		return -1;
 
@@ -217,4 +433,23 @@ void v4lconvert_helper_cleanup(struct v4lconvert_data *data)
 		waitpid(data->decompress_pid, &status, 0);
 		data->decompress_pid = -1;
 	}
+	if (data->decompress_shm) {
+		munmap(data->decompress_shm, data->decompress_shm_size);
+		data->decompress_shm = NULL;
+	}
+	if (data->decompress_shm_fd != -1) {
+		close(data->decompress_shm_fd);
+		data->decompress_shm_fd = -1;
+	}
+#ifdef HAVE_GPL_DECOMP_MODULES
+	if (data->decompress_plugin_lib) {
+		dlclose(data->decompress_plugin_lib);
+		data->decompress_plugin_lib = NULL;
+		data->decompress_plugin = NULL;
+	}
+#endif
+	free(data->decompress_src_buf);
+	data->decompress_src_buf = NULL;
+	data->decompress_src_buf_size = 0;
+	data->decompress_helper = NULL;
 }
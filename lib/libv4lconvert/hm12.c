@@ -40,6 +40,105 @@ Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
 
 static const int stride = 720;
 
+/* Copy maxy lines of maxx bytes of a 16 byte wide tile, full tile lines are
+   copied with a single 16 byte (vector) move */
+static void copy_tile(unsigned char *dst, int dst_stride,
+		const unsigned char *src, int maxx, int maxy)
+{
+	int i;
+
+	if (maxx == 16) {
+		for (i = 0; i < maxy; i++) {
+			memcpy(dst, src, 16);
+			dst += dst_stride;
+			src += 16;
+		}
+	} else {
+		for (i = 0; i < maxy; i++) {
+			memcpy(dst, src, maxx);
+			dst += dst_stride;
+			src += 16;
+		}
+	}
+}
+
+static void de_macro_uv(unsigned char *dstu, unsigned char *dstv,
+		const unsigned char *src, int w, int h)
+{
+	unsigned int y, x, i, j;
+
+	for (y = 0; y < h; y += 16) {
+		for (x = 0; x < w; x += 8) {
+			const unsigned char *src_uv = src + y * stride + x * 32;
+			int maxy = (h - y < 16 ? h - y : 16);
+			int maxx = (w - x < 8 ? w - x : 8);
+			int idx = x + y * w;
+
+			if (maxx == 8 && v4lconvert_simd.split_uv_tile) {
+				v4lconvert_simd.split_uv_tile(src_uv,
+						dstu + idx, dstv + idx, w, maxy);
+				continue;
+			}
+
+			for (i = 0; i < maxy; i++) {
+				for (j = 0; j < maxx; j++) {
+					dstu[idx+j] = src_uv[2 * j];
+					dstv[idx+j] = src_uv[2 * j + 1];
+				}
+				src_uv += 16;
+				idx += w;
+			}
+		}
+	}
+}
+
+/* The chroma tiles already hold interleaved u / v pairs, so for nv12 they
+   only need to be de-tiled like the luma, w is in bytes here */
+static void de_macro_nv(unsigned char *dst, const unsigned char *src,
+		int w, int h, int nv21)
+{
+	unsigned int y, x, i, j;
+
+	for (y = 0; y < h; y += 16) {
+		for (x = 0; x < w; x += 16) {
+			const unsigned char *src_uv = src + y * stride + x * 16;
+			unsigned char *d = dst + x + y * w;
+			int maxy = (h - y < 16 ? h - y : 16);
+			int maxx = (w - x < 16 ? w - x : 16);
+
+			if (!nv21) {
+				copy_tile(d, w, src_uv, maxx, maxy);
+				continue;
+			}
+
+			for (i = 0; i < maxy; i++) {
+				for (j = 0; j + 1 < maxx; j += 2) {
+					d[j] = src_uv[j + 1];
+					d[j + 1] = src_uv[j];
+				}
+				src_uv += 16;
+				d += w;
+			}
+		}
+	}
+}
+
+static void de_macro_y(unsigned char *dst, const unsigned char *src,
+		int w, int h)
+{
+	unsigned int y, x;
+
+	for (y = 0; y < h; y += 16) {
+		for (x = 0; x < w; x += 16) {
+			int maxy = (h - y < 16 ? h - y : 16);
+			int maxx = (w - x < 16 ? w - x : 16);
+
+			copy_tile(dst + x + y * w, w, src + y * stride + x * 16,
+					maxx, maxy);
+		}
+	}
+}
+
 static void v4lconvert_hm12_to_rgb(const unsigned char *src, unsigned char *dest,
 		int width, int height, int rgb)
 {
@@ -52,6 +151,32 @@ static void v4lconvert_hm12_to_rgb(const unsigned char *src, unsigned char *dest
 	int r = rgb ? 0 : 2;
 	int b = 2 - r;
 
+	/* De-tile a row of macroblocks at a time and convert that with the
+	   (SIMD) planar yuv420 code, which uses the same formula */
+	if (!(width & 1) && width <= stride) {
+		unsigned char ybuf[720 * 16];
+		unsigned char ubuf[360 * 8], vbuf[360 * 8];
+
+		for (y = 0; y < height; y += 16) {
+			int maxy = (height - y < 16 ? height - y : 16);
+
+			src_uv = uv_base + (y / 32) * 16 * stride;
+			if (y & 0x10)
+				src_uv += mb_size / 2;
+			de_macro_y(ybuf, y_base + y * stride, width, maxy);
+			de_macro_uv(ubuf, vbuf, src_uv, width / 2,
+					(maxy + 1) / 2);
+			if (rgb)
+				v4lconvert_yuv420_planes_to_rgb24(ybuf, ubuf,
+						vbuf, dest, width, maxy);
+			else
+				v4lconvert_yuv420_planes_to_bgr24(ybuf, ubuf,
+						vbuf, dest, width, maxy);
+			dest += width * maxy * 3;
+		}
+		return;
+	}
+
 	for (y = 0; y < height; y += 16) {
 		int mb_y = (y / 16) * (stride / 16);
 		int mb_uv = (y / 32) * (stride / 16);
@@ -103,49 +228,6 @@ void v4lconvert_hm12_to_bgr24(const unsigned char *src, unsigned char *dest,
 	v4lconvert_hm12_to_rgb(src, dest, width, height, 0);
 }
 
-static void de_macro_uv(unsigned char *dstu, unsigned char *dstv,
-		const unsigned char *src, int w, int h)
-{
-	unsigned int y, x, i, j;
-
-	for (y = 0; y < h; y += 16) {
-		for (x = 0; x < w; x += 8) {
-			const unsigned char *src_uv = src + y * stride + x * 32;
-			int maxy = (h - y < 16 ? h - y : 16);
-			int maxx = (w - x < 8 ? w - x : 8);
-
-			for (i = 0; i < maxy; i++) {
-				int idx = x + (y + i) * w;
-
-				for (j = 0; j < maxx; j++) {
-					dstu[idx+j] = src_uv[2 * j];
-					dstv[idx+j] = src_uv[2 * j + 1];
-				}
-				src_uv += 16;
-			}
-		}
-	}
-}
-
-static void de_macro_y(unsigned char *dst, const unsigned char *src,
-		int w, int h)
-{
-	unsigned int y, x, i;
-
-	for (y = 0; y < h; y += 16) {
-		for (x = 0; x < w; x += 16) {
-			const unsigned char *src_y = src + y * stride + x * 16;
-			int maxy = (h - y < 16 ? h - y : 16);
-			int maxx = (w - x < 16 ? w - x : 16);
-
-			for (i = 0; i < maxy; i++) {
-				memcpy(dst + x + (y + i) * w, src_y, maxx);
-				src_y += 16;
-			}
-		}
-	}
-}
-
 void v4lconvert_hm12_to_yuv420(const unsigned char *src, unsigned char *dest,
 		int width, int height, int yvu)
 {
@@ -157,3 +239,11 @@ void v4lconvert_hm12_to_yuv420(const unsigned char *src, unsigned char *dest,
 	else
 		de_macro_uv(dest, dest + width * height / 4, src, width / 2, height / 2);
 }
+
+void v4lconvert_hm12_to_nv12(const unsigned char *src, unsigned char *dest,
+		int width, int height, int nv21)
+{
+	de_macro_y(dest, src, width, height);
+	de_macro_nv(dest + width * height, src + stride * height,
+			width, height / 2, nv21);
+}
@@ -0,0 +1,493 @@
+/*
+ * jidctfst.c
+ *
+ * Copyright (C) 1994-1998, Thomas G. Lane.
+ * This file is part of the Independent JPEG Group's software.
+ *
+ * The authors make NO WARRANTY or representation, either express or implied,
+ * with respect to this software, its quality, accuracy, merchantability, or
+ * fitness for a particular purpose.  This software is provided "AS IS", and you,
+ * its user, assume the entire risk as to its quality and accuracy.
+ *
+ * This software is copyright (C) 1991-1998, Thomas G. Lane.
+ * All Rights Reserved except as specified below.
+ *
+ * Permission is hereby granted to use, copy, modify, and distribute this
+ * software (or portions thereof) for any purpose, without fee, subject to these
+ * conditions:
+ * (1) If any part of the source code for this software is distributed, then this
+ * README file must be included, with this copyright and no-warranty notice
+ * unaltered; and any additions, deletions, or changes to the original files
+ * must be clearly indicated in accompanying documentation.
+ * (2) If only executable code is distributed, then the accompanying
+ * documentation must state that "this software is based in part on the work of
+ * the Independent JPEG Group".
+ * (3) Permission for use of this software is granted only if the user accepts
+ * full responsibility for any undesirable consequences; the authors accept
+ * NO LIABILITY for damages of any kind.
+ *
+ * These conditions apply to any software derived from or based on the IJG code,
+ * not just to the unmodified library.  If you use our work, you ought to
+ * acknowledge us.
+ *
+ * Permission is NOT granted for the use of any IJG author's name or company name
+ * in advertising or publicity relating to this software or products derived from
+ * it.  This software may be referred to only as "the Independent JPEG Group's
+ * software".
+ *
+ * We specifically permit and encourage the use of this software as the basis of
+ * commercial products, provided that all warranty or liability claims are
+ * assumed by the product vendor.
+ *
+ * This file contains a fast, not so accurate integer implementation of the
+ * inverse DCT (Discrete Cosine Transform).  In the IJG code, this routine
+ * must also perform dequantization of the input coefficients.
+ *
+ * It is based on the IJG jidctfst.c, changed for tinyjpeg: all intermediate
+ * results are kept in 16 bits, the final descale rounds, and SSE2 / NEON
+ * versions have been added. The 16 bit arithmetic allows the SIMD versions to
+ * do 8 columns / rows at once while giving bit-exact the same output as the
+ * C version.
+ *
+ * This implementation is based on Arai, Agui, and Nakajima's algorithm for
+ * scaled DCT, see jidctflt.c. Most of the multiplies are folded into the
+ * (integer) dequantization table, see build_quantization_table() in
+ * tinyjpeg.c, leaving only 5 multiplies per 1-D IDCT. These are done with
+ * 8 fractional bits, and the dequantized coefficients get 2 extra bits of
+ * precision (PASS1_BITS), which are removed together with the factor 8
+ * scaling of the IDCT at the end of the second pass.
+ */
+
+#include <stdint.h>
+#include "tinyjpeg-internal.h"
+#include "libv4lconvert-priv.h"
+
+/* Also defined by jpeglib.h, which libv4lconvert-priv.h may include */
+#ifndef DCTSIZE
+#define DCTSIZE	   8
+#define DCTSIZE2   (DCTSIZE * DCTSIZE)
+#endif
+
+#define CONST_BITS  8
+#define PASS1_BITS  2
+
+#define FIX_1_082392200  277		/* FIX(1.082392200) */
+#define FIX_1_414213562  362		/* FIX(1.414213562) */
+#define FIX_1_847759065  473		/* FIX(1.847759065) */
+#define FIX_2_613125930  669		/* FIX(2.613125930) */
+
+/* Remove the PASS1_BITS and the factor 8 of the IDCT with rounding, and
+   add the 128 level shift, all in one add + shift */
+#define DESCALE_BITS	(PASS1_BITS + 3)
+#define DESCALE_ADD	((128 << DESCALE_BITS) + (1 << (DESCALE_BITS - 1)))
+
+typedef int16_t DCTELEM;
+
+/* Note the argument gets truncated to 16 bits before multiplying, just like
+   in the SIMD versions */
+#define MULTIPLY(var, const)  ((DCTELEM)(((DCTELEM)(var) * (const)) >> CONST_BITS))
+
+#define DEQUANTIZE(coef, quantval)  ((DCTELEM)((coef) * (quantval)))
+
+static inline uint8_t descale_and_clamp(DCTELEM x)
+{
+	x = (DCTELEM)(x + DESCALE_ADD) >> DESCALE_BITS;
+	if (x > 255)
+		return 255;
+	if (x < 0)
+		return 0;
+	return x;
+}
+
+static void idct_ifast_c(const int16_t *inptr, const int16_t *quantptr,
+		uint8_t *outptr, int stride)
+{
+	DCTELEM tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+	DCTELEM tmp10, tmp11, tmp12, tmp13;
+	DCTELEM z5, z10, z11, z12, z13;
+	DCTELEM *wsptr;
+	int ctr;
+	DCTELEM workspace[DCTSIZE2]; /* buffers data between passes */
+
+	/* Pass 1: process columns from input, store into work array. */
+
+	wsptr = workspace;
+	for (ctr = DCTSIZE; ctr > 0; ctr--) {
+		/* Columns with all AC terms zero are common, and simply
+		 * become the dequantized DC coefficient */
+		if (inptr[DCTSIZE*1] == 0 && inptr[DCTSIZE*2] == 0 &&
+				inptr[DCTSIZE*3] == 0 && inptr[DCTSIZE*4] == 0 &&
+				inptr[DCTSIZE*5] == 0 && inptr[DCTSIZE*6] == 0 &&
+				inptr[DCTSIZE*7] == 0) {
+			DCTELEM dcval = DEQUANTIZE(inptr[DCTSIZE*0], quantptr[DCTSIZE*0]);
+
+			wsptr[DCTSIZE*0] = dcval;
+			wsptr[DCTSIZE*1] = dcval;
+			wsptr[DCTSIZE*2] = dcval;
+			wsptr[DCTSIZE*3] = dcval;
+			wsptr[DCTSIZE*4] = dcval;
+			wsptr[DCTSIZE*5] = dcval;
+			wsptr[DCTSIZE*6] = dcval;
+			wsptr[DCTSIZE*7] = dcval;
+
+			inptr++;			/* advance pointers to next column */
+			quantptr++;
+			wsptr++;
+			continue;
+		}
+
+		/* Even part */
+
+		tmp0 = DEQUANTIZE(inptr[DCTSIZE*0], quantptr[DCTSIZE*0]);
+		tmp1 = DEQUANTIZE(inptr[DCTSIZE*2], quantptr[DCTSIZE*2]);
+		tmp2 = DEQUANTIZE(inptr[DCTSIZE*4], quantptr[DCTSIZE*4]);
+		tmp3 = DEQUANTIZE(inptr[DCTSIZE*6], quantptr[DCTSIZE*6]);
+
+		tmp10 = tmp0 + tmp2;	/* phase 3 */
+		tmp11 = tmp0 - tmp2;
+
+		tmp13 = tmp1 + tmp3;	/* phases 5-3 */
+		tmp12 = MULTIPLY(tmp1 - tmp3, FIX_1_414213562) - tmp13; /* 2*c4 */
+
+		tmp0 = tmp10 + tmp13;	/* phase 2 */
+		tmp3 = tmp10 - tmp13;
+		tmp1 = tmp11 + tmp12;
+		tmp2 = tmp11 - tmp12;
+
+		/* Odd part */
+
+		tmp4 = DEQUANTIZE(inptr[DCTSIZE*1], quantptr[DCTSIZE*1]);
+		tmp5 = DEQUANTIZE(inptr[DCTSIZE*3], quantptr[DCTSIZE*3]);
+		tmp6 = DEQUANTIZE(inptr[DCTSIZE*5], quantptr[DCTSIZE*5]);
+		tmp7 = DEQUANTIZE(inptr[DCTSIZE*7], quantptr[DCTSIZE*7]);
+
+		z13 = tmp6 + tmp5;		/* phase 6 */
+		z10 = tmp6 - tmp5;
+		z11 = tmp4 + tmp7;
+		z12 = tmp4 - tmp7;
+
+		tmp7 = z11 + z13;		/* phase 5 */
+		tmp11 = MULTIPLY(z11 - z13, FIX_1_414213562); /* 2*c4 */
+
+		z5 = MULTIPLY(z10 + z12, FIX_1_847759065); /* 2*c2 */
+		tmp10 = MULTIPLY(z12, FIX_1_082392200) - z5; /* 2*(c2-c6) */
+		tmp12 = MULTIPLY(z10, -FIX_2_613125930) + z5; /* -2*(c2+c6) */
+
+		tmp6 = tmp12 - tmp7;	/* phase 2 */
+		tmp5 = tmp11 - tmp6;
+		tmp4 = tmp10 + tmp5;
+
+		wsptr[DCTSIZE*0] = tmp0 + tmp7;
+		wsptr[DCTSIZE*7] = tmp0 - tmp7;
+		wsptr[DCTSIZE*1] = tmp1 + tmp6;
+		wsptr[DCTSIZE*6] = tmp1 - tmp6;
+		wsptr[DCTSIZE*2] = tmp2 + tmp5;
+		wsptr[DCTSIZE*5] = tmp2 - tmp5;
+		wsptr[DCTSIZE*4] = tmp3 + tmp4;
+		wsptr[DCTSIZE*3] = tmp3 - tmp4;
+
+		inptr++;			/* advance pointers to next column */
+		quantptr++;
+		wsptr++;
+	}
+
+	/* Pass 2: process rows from work array, store into output array. */
+
+	wsptr = workspace;
+	for (ctr = 0; ctr < DCTSIZE; ctr++) {
+		/* Even part */
+
+		tmp10 = wsptr[0] + wsptr[4];
+		tmp11 = wsptr[0] - wsptr[4];
+
+		tmp13 = wsptr[2] + wsptr[6];
+		tmp12 = MULTIPLY(wsptr[2] - wsptr[6], FIX_1_414213562) - tmp13;
+
+		tmp0 = tmp10 + tmp13;
+		tmp3 = tmp10 - tmp13;
+		tmp1 = tmp11 + tmp12;
+		tmp2 = tmp11 - tmp12;
+
+		/* Odd part */
+
+		z13 = wsptr[5] + wsptr[3];
+		z10 = wsptr[5] - wsptr[3];
+		z11 = wsptr[1] + wsptr[7];
+		z12 = wsptr[1] - wsptr[7];
+
+		tmp7 = z11 + z13;
+		tmp11 = MULTIPLY(z11 - z13, FIX_1_414213562);
+
+		z5 = MULTIPLY(z10 + z12, FIX_1_847759065); /* 2*c2 */
+		tmp10 = MULTIPLY(z12, FIX_1_082392200) - z5; /* 2*(c2-c6) */
+		tmp12 = MULTIPLY(z10, -FIX_2_613125930) + z5; /* -2*(c2+c6) */
+
+		tmp6 = tmp12 - tmp7;
+		tmp5 = tmp11 - tmp6;
+		tmp4 = tmp10 + tmp5;
+
+		/* Final output stage: scale down and range-limit */
+
+		outptr[0] = descale_and_clamp(tmp0 + tmp7);
+		outptr[7] = descale_and_clamp(tmp0 - tmp7);
+		outptr[1] = descale_and_clamp(tmp1 + tmp6);
+		outptr[6] = descale_and_clamp(tmp1 - tmp6);
+		outptr[2] = descale_and_clamp(tmp2 + tmp5);
+		outptr[5] = descale_and_clamp(tmp2 - tmp5);
+		outptr[4] = descale_and_clamp(tmp3 + tmp4);
+		outptr[3] = descale_and_clamp(tmp3 - tmp4);
+
+		wsptr += DCTSIZE;		/* advance pointer to next row */
+		outptr += stride;
+	}
+}
+
+/*
+ * The SIMD versions: 8 rows of coefficients are 8 vectors, so doing the 1-D
+ * IDCT across the vectors handles all 8 columns at once. After transposing
+ * the same is done for the rows, and a transpose back gives the output rows.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <immintrin.h>
+
+#define TARGET_SSE2 __attribute__((target("sse2")))
+
+/* Exact (var * c) >> CONST_BITS, as 16 bit result like MULTIPLY */
+static inline TARGET_SSE2 __m128i multiply_sse2(__m128i var, int16_t c)
+{
+	const __m128i k = _mm_set1_epi16(c);
+	__m128i lo = _mm_mullo_epi16(var, k);
+	__m128i hi = _mm_mulhi_epi16(var, k);
+
+	return _mm_or_si128(_mm_slli_epi16(hi, 16 - CONST_BITS),
+			    _mm_srli_epi16(lo, CONST_BITS));
+}
+
+static inline TARGET_SSE2 void idct_1d_sse2(__m128i *v)
+{
+	__m128i tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+	__m128i tmp10, tmp11, tmp12, tmp13;
+	__m128i z5, z10, z11, z12, z13;
+
+	/* Even part */
+	tmp10 = _mm_add_epi16(v[0], v[4]);
+	tmp11 = _mm_sub_epi16(v[0], v[4]);
+	tmp13 = _mm_add_epi16(v[2], v[6]);
+	tmp12 = _mm_sub_epi16(multiply_sse2(_mm_sub_epi16(v[2], v[6]),
+					    FIX_1_414213562), tmp13);
+	tmp0 = _mm_add_epi16(tmp10, tmp13);
+	tmp3 = _mm_sub_epi16(tmp10, tmp13);
+	tmp1 = _mm_add_epi16(tmp11, tmp12);
+	tmp2 = _mm_sub_epi16(tmp11, tmp12);
+
+	/* Odd part */
+	z13 = _mm_add_epi16(v[5], v[3]);
+	z10 = _mm_sub_epi16(v[5], v[3]);
+	z11 = _mm_add_epi16(v[1], v[7]);
+	z12 = _mm_sub_epi16(v[1], v[7]);
+	tmp7 = _mm_add_epi16(z11, z13);
+	tmp11 = multiply_sse2(_mm_sub_epi16(z11, z13), FIX_1_414213562);
+	z5 = multiply_sse2(_mm_add_epi16(z10, z12), FIX_1_847759065);
+	tmp10 = _mm_sub_epi16(multiply_sse2(z12, FIX_1_082392200), z5);
+	tmp12 = _mm_add_epi16(multiply_sse2(z10, -FIX_2_613125930), z5);
+	tmp6 = _mm_sub_epi16(tmp12, tmp7);
+	tmp5 = _mm_sub_epi16(tmp11, tmp6);
+	tmp4 = _mm_add_epi16(tmp10, tmp5);
+
+	v[0] = _mm_add_epi16(tmp0, tmp7);
+	v[7] = _mm_sub_epi16(tmp0, tmp7);
+	v[1] = _mm_add_epi16(tmp1, tmp6);
+	v[6] = _mm_sub_epi16(tmp1, tmp6);
+	v[2] = _mm_add_epi16(tmp2, tmp5);
+	v[5] = _mm_sub_epi16(tmp2, tmp5);
+	v[4] = _mm_add_epi16(tmp3, tmp4);
+	v[3] = _mm_sub_epi16(tmp3, tmp4);
+}
+
+static inline TARGET_SSE2 void transpose_8x8_sse2(__m128i *v)
+{
+	__m128i a0 = _mm_unpacklo_epi16(v[0], v[1]);
+	__m128i a1 = _mm_unpackhi_epi16(v[0], v[1]);
+	__m128i a2 = _mm_unpacklo_epi16(v[2], v[3]);
+	__m128i a3 = _mm_unpackhi_epi16(v[2], v[3]);
+	__m128i a4 = _mm_unpacklo_epi16(v[4], v[5]);
+	__m128i a5 = _mm_unpackhi_epi16(v[4], v[5]);
+	__m128i a6 = _mm_unpacklo_epi16(v[6], v[7]);
+	__m128i a7 = _mm_unpackhi_epi16(v[6], v[7]);
+	__m128i b0 = _mm_unpacklo_epi32(a0, a2);
+	__m128i b1 = _mm_unpackhi_epi32(a0, a2);
+	__m128i b2 = _mm_unpacklo_epi32(a1, a3);
+	__m128i b3 = _mm_unpackhi_epi32(a1, a3);
+	__m128i b4 = _mm_unpacklo_epi32(a4, a6);
+	__m128i b5 = _mm_unpackhi_epi32(a4, a6);
+	__m128i b6 = _mm_unpacklo_epi32(a5, a7);
+	__m128i b7 = _mm_unpackhi_epi32(a5, a7);
+
+	v[0] = _mm_unpacklo_epi64(b0, b4);
+	v[1] = _mm_unpackhi_epi64(b0, b4);
+	v[2] = _mm_unpacklo_epi64(b1, b5);
+	v[3] = _mm_unpackhi_epi64(b1, b5);
+	v[4] = _mm_unpacklo_epi64(b2, b6);
+	v[5] = _mm_unpackhi_epi64(b2, b6);
+	v[6] = _mm_unpacklo_epi64(b3, b7);
+	v[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+TARGET_SSE2 void tinyjpeg_idct_ifast_sse2(const int16_t *coef,
+		const int16_t *qtable, uint8_t *dest, int stride)
+{
+	const __m128i descale_add = _mm_set1_epi16(DESCALE_ADD);
+	__m128i v[DCTSIZE];
+	int i;
+
+	for (i = 0; i < DCTSIZE; i++)
+		v[i] = _mm_mullo_epi16(
+			_mm_loadu_si128((const __m128i *)(coef + i * DCTSIZE)),
+			_mm_loadu_si128((const __m128i *)(qtable + i * DCTSIZE)));
+
+	idct_1d_sse2(v);
+	transpose_8x8_sse2(v);
+	idct_1d_sse2(v);
+	transpose_8x8_sse2(v);
+
+	for (i = 0; i < DCTSIZE; i += 2) {
+		__m128i r0 = _mm_srai_epi16(_mm_add_epi16(v[i], descale_add),
+					    DESCALE_BITS);
+		__m128i r1 = _mm_srai_epi16(_mm_add_epi16(v[i + 1], descale_add),
+					    DESCALE_BITS);
+		__m128i out = _mm_packus_epi16(r0, r1);
+
+		_mm_storel_epi64((__m128i *)dest, out);
+		_mm_storel_epi64((__m128i *)(dest + stride),
+				 _mm_srli_si128(out, 8));
+		dest += 2 * stride;
+	}
+}
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+#include <arm_neon.h>
+
+/* Exact (var * c) >> CONST_BITS, as 16 bit result like MULTIPLY */
+static inline int16x8_t multiply_neon(int16x8_t var, int16_t c)
+{
+	int32x4_t lo = vmull_n_s16(vget_low_s16(var), c);
+	int32x4_t hi = vmull_n_s16(vget_high_s16(var), c);
+
+	return vcombine_s16(vshrn_n_s32(lo, CONST_BITS),
+			    vshrn_n_s32(hi, CONST_BITS));
+}
+
+static inline void idct_1d_neon(int16x8_t *v)
+{
+	int16x8_t tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+	int16x8_t tmp10, tmp11, tmp12, tmp13;
+	int16x8_t z5, z10, z11, z12, z13;
+
+	/* Even part */
+	tmp10 = vaddq_s16(v[0], v[4]);
+	tmp11 = vsubq_s16(v[0], v[4]);
+	tmp13 = vaddq_s16(v[2], v[6]);
+	tmp12 = vsubq_s16(multiply_neon(vsubq_s16(v[2], v[6]),
+					FIX_1_414213562), tmp13);
+	tmp0 = vaddq_s16(tmp10, tmp13);
+	tmp3 = vsubq_s16(tmp10, tmp13);
+	tmp1 = vaddq_s16(tmp11, tmp12);
+	tmp2 = vsubq_s16(tmp11, tmp12);
+
+	/* Odd part */
+	z13 = vaddq_s16(v[5], v[3]);
+	z10 = vsubq_s16(v[5], v[3]);
+	z11 = vaddq_s16(v[1], v[7]);
+	z12 = vsubq_s16(v[1], v[7]);
+	tmp7 = vaddq_s16(z11, z13);
+	tmp11 = multiply_neon(vsubq_s16(z11, z13), FIX_1_414213562);
+	z5 = multiply_neon(vaddq_s16(z10, z12), FIX_1_847759065);
+	tmp10 = vsubq_s16(multiply_neon(z12, FIX_1_082392200), z5);
+	tmp12 = vaddq_s16(multiply_neon(z10, -FIX_2_613125930), z5);
+	tmp6 = vsubq_s16(tmp12, tmp7);
+	tmp5 = vsubq_s16(tmp11, tmp6);
+	tmp4 = vaddq_s16(tmp10, tmp5);
+
+	v[0] = vaddq_s16(tmp0, tmp7);
+	v[7] = vsubq_s16(tmp0, tmp7);
+	v[1] = vaddq_s16(tmp1, tmp6);
+	v[6] = vsubq_s16(tmp1, tmp6);
+	v[2] = vaddq_s16(tmp2, tmp5);
+	v[5] = vsubq_s16(tmp2, tmp5);
+	v[4] = vaddq_s16(tmp3, tmp4);
+	v[3] = vsubq_s16(tmp3, tmp4);
+}
+
+static inline void transpose_8x8_neon(int16x8_t *v)
+{
+	int16x8x2_t t0 = vtrnq_s16(v[0], v[1]);
+	int16x8x2_t t1 = vtrnq_s16(v[2], v[3]);
+	int16x8x2_t t2 = vtrnq_s16(v[4], v[5]);
+	int16x8x2_t t3 = vtrnq_s16(v[6], v[7]);
+	int32x4x2_t u0 = vtrnq_s32(vreinterpretq_s32_s16(t0.val[0]),
+				   vreinterpretq_s32_s16(t1.val[0]));
+	int32x4x2_t u1 = vtrnq_s32(vreinterpretq_s32_s16(t0.val[1]),
+				   vreinterpretq_s32_s16(t1.val[1]));
+	int32x4x2_t u2 = vtrnq_s32(vreinterpretq_s32_s16(t2.val[0]),
+				   vreinterpretq_s32_s16(t3.val[0]));
+	int32x4x2_t u3 = vtrnq_s32(vreinterpretq_s32_s16(t2.val[1]),
+				   vreinterpretq_s32_s16(t3.val[1]));
+
+#define COMBINE(half, a, b) vcombine_s16( \
+		vreinterpret_s16_s32(vget_##half##_s32(a)), \
+		vreinterpret_s16_s32(vget_##half##_s32(b)))
+	v[0] = COMBINE(low, u0.val[0], u2.val[0]);
+	v[4] = COMBINE(high, u0.val[0], u2.val[0]);
+	v[2] = COMBINE(low, u0.val[1], u2.val[1]);
+	v[6] = COMBINE(high, u0.val[1], u2.val[1]);
+	v[1] = COMBINE(low, u1.val[0], u3.val[0]);
+	v[5] = COMBINE(high, u1.val[0], u3.val[0]);
+	v[3] = COMBINE(low, u1.val[1], u3.val[1]);
+	v[7] = COMBINE(high, u1.val[1], u3.val[1]);
+#undef COMBINE
+}
+
+void tinyjpeg_idct_ifast_neon(const int16_t *coef, const int16_t *qtable,
+		uint8_t *dest, int stride)
+{
+	const int16x8_t descale_add = vdupq_n_s16(DESCALE_ADD);
+	int16x8_t v[DCTSIZE];
+	int i;
+
+	for (i = 0; i < DCTSIZE; i++)
+		v[i] = vmulq_s16(vld1q_s16(coef + i * DCTSIZE),
+				 vld1q_s16(qtable + i * DCTSIZE));
+
+	idct_1d_neon(v);
+	transpose_8x8_neon(v);
+	idct_1d_neon(v);
+	transpose_8x8_neon(v);
+
+	for (i = 0; i < DCTSIZE; i++) {
+		int16x8_t r = vshrq_n_s16(vaddq_s16(v[i], descale_add),
+					  DESCALE_BITS);
+
+		vst1_u8(dest, vqmovun_s16(r));
+		dest += stride;
+	}
+}
+
+#endif
+
+/*
+ * Perform dequantization and inverse DCT on one block of coefficients.
+ */
+
+void tinyjpeg_idct_ifast(struct component *compptr, uint8_t *output_buf, int stride)
+{
+	if (v4lconvert_simd.jpeg_idct) {
+		v4lconvert_simd.jpeg_idct(compptr->DCT, compptr->IQ_table,
+					  output_buf, stride);
+		return;
+	}
+
+	idct_ifast_c(compptr->DCT, compptr->IQ_table, output_buf, stride);
+}
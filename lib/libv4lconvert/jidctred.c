@@ -0,0 +1,139 @@
+/*
+# Reduced size inverse DCT-s for tinyjpeg, used to decode jpeg-s at 1/2, 1/4
+# and 1/8 of their size directly in the DCT domain
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+ */
+
+/*
+ * Evaluating the 8 point IDCT half way between 2 output pixels gives a 4 point
+ * IDCT of the 4 lowest frequency coefficients (and the same for 2 and 1 points
+ * with 1/4 and 1/8 scale). So we only need the top left 4x4, 2x2 or 1x1
+ * coefficients of each block, and an IDCT of that size.
+ *
+ * The output is written to the top left corner of the 8x8 block at
+ * output_buf, so that the decode_MCU functions do not need to know about
+ * scaling, the scaled colorspace conversion functions know where to look.
+ *
+ * The constants below include the 1/2 * C(u) IDCT normalization and undo the
+ * AA&N scalefactors build_quantization_table() puts in the IQ_table, they are
+ * scaled by 1 << CONST_BITS. IQ_table is scaled by 1 << IQ_BITS itself.
+ */
+
+#include <stdint.h>
+#include "tinyjpeg-internal.h"
+
+#define CONST_BITS	10
+#define IQ_BITS		2
+#define PASS1_BITS	4	/* Extra precision kept after the first pass */
+
+#define FIX_0_353553391	362	/* 1/2 * 1/sqrt(2) */
+#define FIX_0_333040012	341	/* 1/2 * cos(1 * pi / 8) / 1.387039845 */
+#define FIX_0_137949690	141	/* 1/2 * cos(3 * pi / 8) / 1.387039845 */
+#define FIX_0_270598050	277	/* 1/2 * cos(2 * pi / 8) / 1.306562965 */
+#define FIX_0_162722754	167	/* 1/2 * cos(3 * pi / 8) / 1.175875602 */
+#define FIX_0_392847479	402	/* 1/2 * cos(1 * pi / 8) / 1.175875602 */
+#define FIX_0_254897790	261	/* 1/2 * cos(1 * pi / 4) / 1.387039845 */
+
+#define PASS1_SHIFT	(CONST_BITS + IQ_BITS - PASS1_BITS)
+#define PASS2_SHIFT	(CONST_BITS + PASS1_BITS)
+
+#define DESCALE(x, n)	(((x) + (1 << ((n) - 1))) >> (n))
+
+static inline uint8_t descale_and_clamp(int x, int shift)
+{
+	x = (x + (128 << shift) + (1 << (shift - 1))) >> shift;
+	if (x < 0)
+		return 0;
+	if (x > 255)
+		return 255;
+	return x;
+}
+
+/* 4 point IDCT of c0 - c3, the even / odd split of the 8 point one */
+#define IDCT_4(c0, c1, c2, c3, o0, o1, o2, o3) \
+	do { \
+		int e0 = (c0) * FIX_0_353553391 + (c2) * FIX_0_270598050; \
+		int e1 = (c0) * FIX_0_353553391 - (c2) * FIX_0_270598050; \
+		int d0 = (c1) * FIX_0_333040012 + (c3) * FIX_0_162722754; \
+		int d1 = (c1) * FIX_0_137949690 - (c3) * FIX_0_392847479; \
+		o0 = e0 + d0; \
+		o1 = e1 + d1; \
+		o2 = e1 - d1; \
+		o3 = e0 - d0; \
+	} while (0)
+
+void tinyjpeg_idct_4x4(struct component *compptr, uint8_t *output_buf, int stride)
+{
+	const short *coef = compptr->DCT;
+	const int16_t *q = compptr->IQ_table;
+	int ws[4][4];
+	int i, o0, o1, o2, o3;
+
+	/* Pass 1: the top left 4x4 coefficients, row by row */
+	for (i = 0; i < 4; i++) {
+		IDCT_4(coef[0] * q[0], coef[1] * q[1], coef[2] * q[2],
+		       coef[3] * q[3], o0, o1, o2, o3);
+		ws[i][0] = DESCALE(o0, PASS1_SHIFT);
+		ws[i][1] = DESCALE(o1, PASS1_SHIFT);
+		ws[i][2] = DESCALE(o2, PASS1_SHIFT);
+		ws[i][3] = DESCALE(o3, PASS1_SHIFT);
+		coef += 8;
+		q += 8;
+	}
+
+	/* Pass 2: columns */
+	for (i = 0; i < 4; i++) {
+		IDCT_4(ws[0][i], ws[1][i], ws[2][i], ws[3][i], o0, o1, o2, o3);
+		output_buf[0 * stride + i] = descale_and_clamp(o0, PASS2_SHIFT);
+		output_buf[1 * stride + i] = descale_and_clamp(o1, PASS2_SHIFT);
+		output_buf[2 * stride + i] = descale_and_clamp(o2, PASS2_SHIFT);
+		output_buf[3 * stride + i] = descale_and_clamp(o3, PASS2_SHIFT);
+	}
+}
+
+void tinyjpeg_idct_2x2(struct component *compptr, uint8_t *output_buf, int stride)
+{
+	const short *coef = compptr->DCT;
+	const int16_t *q = compptr->IQ_table;
+	int e0, e1, d0, d1, ws[2][2];
+
+	/* Pass 1: the top left 2x2 coefficients, row by row */
+	e0 = coef[0] * q[0] * FIX_0_353553391;
+	d0 = coef[1] * q[1] * FIX_0_254897790;
+	e1 = coef[8] * q[8] * FIX_0_353553391;
+	d1 = coef[9] * q[9] * FIX_0_254897790;
+	ws[0][0] = DESCALE(e0 + d0, PASS1_SHIFT);
+	ws[0][1] = DESCALE(e0 - d0, PASS1_SHIFT);
+	ws[1][0] = DESCALE(e1 + d1, PASS1_SHIFT);
+	ws[1][1] = DESCALE(e1 - d1, PASS1_SHIFT);
+
+	/* Pass 2: columns */
+	e0 = ws[0][0] * FIX_0_353553391;
+	d0 = ws[1][0] * FIX_0_254897790;
+	e1 = ws[0][1] * FIX_0_353553391;
+	d1 = ws[1][1] * FIX_0_254897790;
+	output_buf[0] = descale_and_clamp(e0 + d0, PASS2_SHIFT);
+	output_buf[1] = descale_and_clamp(e1 + d1, PASS2_SHIFT);
+	output_buf[stride] = descale_and_clamp(e0 - d0, PASS2_SHIFT);
+	output_buf[stride + 1] = descale_and_clamp(e1 - d1, PASS2_SHIFT);
+}
+
+void tinyjpeg_idct_1x1(struct component *compptr, uint8_t *output_buf, int stride)
+{
+	/* The DC coefficient / 8, there is no AA&N scaling for DC */
+	*output_buf = descale_and_clamp(compptr->DCT[0] * compptr->IQ_table[0],
+					IQ_BITS + 3);
+}
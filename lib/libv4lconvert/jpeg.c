@@ -28,6 +28,38 @@
 #include "jpeg_memsrcdest.h"
 #endif
 
+/* Subsample the packed YCbCr of a scaled decode to planar yuv420. Like with
+   unscaled decoding to yuv420 this passes on the jpeg YCbCr values as is */
+static void v4lconvert_ycbcr24_to_yuv420(const unsigned char *src,
+	unsigned char *dest, int width, int height, int yvu)
+{
+	int x, y;
+	unsigned char *udest, *vdest;
+
+	for (y = 0; y < width * height; y++)
+		dest[y] = src[3 * y];
+
+	if (yvu) {
+		vdest = dest + width * height;
+		udest = vdest + (width * height) / 4;
+	} else {
+		udest = dest + width * height;
+		vdest = udest + (width * height) / 4;
+	}
+
+	for (y = 0; y + 1 < height; y += 2) {
+		const unsigned char *src1 = src + y * width * 3;
+		const unsigned char *src2 = src1 + width * 3;
+
+		for (x = 0; x < width; x += 2) {
+			*udest++ = (src1[1] + src1[4] + src2[1] + src2[4] + 2) >> 2;
+			*vdest++ = (src1[2] + src1[5] + src2[2] + src2[5] + 2) >> 2;
+			src1 += 6;
+			src2 += 6;
+		}
+	}
+}
+
 int v4lconvert_decode_jpeg_tinyjpeg(struct v4lconvert_data *data,
 	unsigned char *src, int src_size, unsigned char *dest,
 	struct v4l2_format *fmt, unsigned int dest_pix_fmt, int flags)
@@ -37,14 +69,17 @@ int v4lconvert_decode_jpeg_tinyjpeg(struct v4lconvert_data *data,
 	unsigned int header_width, header_height;
 	unsigned int width  = fmt->fmt.pix.width;
 	unsigned int height = fmt->fmt.pix.height;
+	unsigned int scale = data->jpeg_scale;
 
 	if (!data->tinyjpeg) {
 		data->tinyjpeg = tinyjpeg_init();
 		if (!data->tinyjpeg)
 			return v4lconvert_oom_error(data);
+		tinyjpeg_set_threads(data->tinyjpeg, data->threads);
 	}
 	flags |= TINYJPEG_FLAGS_MJPEG_TABLE;
 	tinyjpeg_set_flags(data->tinyjpeg, flags);
+	tinyjpeg_set_scale(data->tinyjpeg, scale);
 	if (tinyjpeg_parse_header(data->tinyjpeg, src, src_size)) {
 		V4LCONVERT_ERR("parsing JPEG header: %s",
 				tinyjpeg_get_errorstring(data->tinyjpeg));
@@ -59,15 +94,16 @@ int v4lconvert_decode_jpeg_tinyjpeg(struct v4lconvert_data *data,
 		height = tmp;
 	}
 
-	if (header_width != width || header_height != height) {
+	if (header_width != width * scale || header_height != height * scale) {
 		V4LCONVERT_ERR("unexpected width / height in JPEG header: "
 			       "expected: %ux%u, header: %ux%u\n",
-			       width, height, header_width, header_height);
+			       width * scale, height * scale, header_width,
+			       header_height);
 		errno = EIO;
 		return -1;
 	}
-	fmt->fmt.pix.width = header_width;
-	fmt->fmt.pix.height = header_height;
+	fmt->fmt.pix.width = header_width / scale;
+	fmt->fmt.pix.height = header_height / scale;
 
 	components[0] = dest;
 
@@ -81,14 +117,32 @@ int v4lconvert_decode_jpeg_tinyjpeg(struct v4lconvert_data *data,
 		result = tinyjpeg_decode(data->tinyjpeg, TINYJPEG_FMT_BGR24);
 		break;
 	case V4L2_PIX_FMT_YUV420:
-		components[1] = components[0] + width * height;
-		components[2] = components[1] + width * height / 4;
-		tinyjpeg_set_components(data->tinyjpeg, components, 3);
-		result = tinyjpeg_decode(data->tinyjpeg, TINYJPEG_FMT_YUV420P);
-		break;
 	case V4L2_PIX_FMT_YVU420:
-		components[2] = components[0] + width * height;
-		components[1] = components[2] + width * height / 4;
+		/* Scaled decoding to yuv420 goes through packed YCbCr */
+		if (scale > 1) {
+			components[0] = v4lconvert_alloc_buffer(
+					width * height * 3,
+					&data->convert_pixfmt_buf,
+					&data->convert_pixfmt_buf_size);
+			if (!components[0])
+				return v4lconvert_oom_error(data);
+
+			tinyjpeg_set_components(data->tinyjpeg, components, 1);
+			result = tinyjpeg_decode(data->tinyjpeg,
+						 TINYJPEG_FMT_YCBCR24);
+			if (result == 0)
+				v4lconvert_ycbcr24_to_yuv420(components[0],
+					dest, width, height,
+					dest_pix_fmt == V4L2_PIX_FMT_YVU420);
+			break;
+		}
+		if (dest_pix_fmt == V4L2_PIX_FMT_YVU420) {
+			components[2] = components[0] + width * height;
+			components[1] = components[2] + width * height / 4;
+		} else {
+			components[1] = components[0] + width * height;
+			components[2] = components[1] + width * height / 4;
+		}
 		tinyjpeg_set_components(data->tinyjpeg, components, 3);
 		result = tinyjpeg_decode(data->tinyjpeg, TINYJPEG_FMT_YUV420P);
 		break;
@@ -182,7 +236,7 @@ static int decode_libjpeg_h_samp1(struct v4lconvert_data *data,
 	int v_samp)
 {
 	struct jpeg_decompress_struct *cinfo = &data->cinfo;
-	int x, y;
+	int x, y, next_row;
 	unsigned char *uv_buf;
 	unsigned int width = cinfo->image_width;
 	JSAMPROW y_rows[16], u_rows[8], v_rows[8];
@@ -195,38 +249,37 @@ static int decode_libjpeg_h_samp1(struct v4lconvert_data *data,
 		return v4lconvert_oom_error(data);
 
 	for (y = 0; y < 8; y++) {
-		u_rows[y] = uv_buf;
-		uv_buf += width;
-		v_rows[y] = uv_buf;
-		uv_buf += width;
+		u_rows[y] = uv_buf + y * width;
+		v_rows[y] = uv_buf + (8 + y) * width;
 	}
-	uv_buf -= width * 16;
+
+	/* For v_samp == 1 we get 8 lines of full res u + v per 8 lines of y,
+	   which we average per 2x2 pixels. For v_samp == 2 we get 8 lines per
+	   16 lines of y and only need to average horizontally */
+	next_row = (v_samp == 1) ? 1 : 0;
 
 	while (cinfo->output_scanline < cinfo->image_height) {
 		for (y = 0; y < 8 * v_samp; y++) {
 			y_rows[y] = ydest;
-			ydest += cinfo->image_width;
+			ydest += width;
 		}
 		y = jpeg_read_raw_data(cinfo, rows, 8 * v_samp);
 		if (y != 8 * v_samp)
 			return -1;
 
-		/* For v_samp == 1 skip copying uv vals every other time */
-		if (cinfo->output_scanline % 16)
-			continue;
+		for (y = 0; y < 8; y += next_row + 1) {
+			const unsigned char *u1 = u_rows[y];
+			const unsigned char *u2 = u_rows[y + next_row];
+			const unsigned char *v1 = v_rows[y];
+			const unsigned char *v2 = v_rows[y + next_row];
 
-		/* Copy over every other u + v pixel for 8 lines */
-		for (y = 0; y < 8; y++) {
-			for (x = 0; x < width; x += 2) {
-				*udest++ = *uv_buf++;
-				uv_buf++;
-			}
 			for (x = 0; x < width; x += 2) {
-				*vdest++ = *uv_buf++;
-				uv_buf++;
+				*udest++ = (u1[x] + u1[x + 1] +
+					    u2[x] + u2[x + 1] + 2) >> 2;
+				*vdest++ = (v1[x] + v1[x + 1] +
+					    v2[x] + v2[x + 1] + 2) >> 2;
 			}
 		}
-		uv_buf -= width * 16;
 	}
 	return 0;
 }
@@ -278,13 +331,35 @@ static int decode_libjpeg_h_samp2(struct v4lconvert_data *data,
 	return 0;
 }
 
+/* Check if jpeg_read_raw_data can give us the u + v planes of a jpeg at
+   (or in case of h_samp == 1 at 2 times) the yuv420 resolution */
+static int get_libjpeg_raw_samp(struct jpeg_decompress_struct *cinfo,
+	int *h_samp, int *v_samp)
+{
+	jpeg_component_info *comp = cinfo->cur_comp_info[0];
+	int i;
+
+	for (i = 1; i < 3; i++)
+		if (cinfo->cur_comp_info[i]->h_samp_factor != 1 ||
+		    cinfo->cur_comp_info[i]->v_samp_factor != 1)
+			return -1;
+
+	if (comp->h_samp_factor > 2 || comp->v_samp_factor > 2)
+		return -1;
+
+	*h_samp = comp->h_samp_factor;
+	*v_samp = comp->v_samp_factor;
+	return 0;
+}
+
 int v4lconvert_decode_jpeg_libjpeg(struct v4lconvert_data *data,
 	unsigned char *src, int src_size, unsigned char *dest,
 	struct v4l2_format *fmt, unsigned int dest_pix_fmt)
 {
 	unsigned int width  = fmt->fmt.pix.width;
 	unsigned int height = fmt->fmt.pix.height;
-	int result = 0;
+	unsigned int scale = data->jpeg_scale;
+	int result = 0, raw, h_samp = 0, v_samp = 0;
 
 	/* libjpeg errors before decoding the first line should signal EAGAIN */
 	data->jerr_errno = EAGAIN;
@@ -301,15 +376,17 @@ int v4lconvert_decode_jpeg_libjpeg(struct v4lconvert_data *data,
 	jpeg_mem_src(&data->cinfo, src, src_size);
 	jpeg_read_header(&data->cinfo, TRUE);
 
-	if (data->cinfo.image_width  != width ||
-	    data->cinfo.image_height != height) {
+	if (data->cinfo.image_width  != width * scale ||
+	    data->cinfo.image_height != height * scale) {
 		V4LCONVERT_ERR("unexpected width / height in JPEG header: "
-			       "expected: %ux%u, header: %ux%u\n", width,
-			       height, data->cinfo.image_width,
+			       "expected: %ux%u, header: %ux%u\n", width * scale,
+			       height * scale, data->cinfo.image_width,
 			       data->cinfo.image_height);
 		errno = EIO;
 		return -1;
 	}
+	data->cinfo.scale_num = 1;
+	data->cinfo.scale_denom = scale;
 
 	if (data->cinfo.num_components != 3) {
 		V4LCONVERT_ERR("unexpected no components in JPEG: %d\n",
@@ -318,15 +395,35 @@ int v4lconvert_decode_jpeg_libjpeg(struct v4lconvert_data *data,
 		return -1;
 	}
 
-	if (dest_pix_fmt == V4L2_PIX_FMT_RGB24 ||
-	    dest_pix_fmt == V4L2_PIX_FMT_BGR24) {
+	/* Decode straight to planar yuv420 using raw_data_out when we can,
+	   this skips libjpeg's upsampling and colorspace conversion */
+	raw = (dest_pix_fmt == V4L2_PIX_FMT_YUV420 ||
+	       dest_pix_fmt == V4L2_PIX_FMT_YVU420) && scale == 1 &&
+	      get_libjpeg_raw_samp(&data->cinfo, &h_samp, &v_samp) == 0 &&
+	      /* We don't want any padding as that may overflow our dest */
+	      width % (8 * h_samp) == 0 && height % (8 * v_samp) == 0;
+
+	if (!raw) {
 		JSAMPROW row_pointer[1];
+		unsigned char *buf = dest;
 
 #ifdef JCS_EXTENSIONS
 		if (dest_pix_fmt == V4L2_PIX_FMT_BGR24)
 			data->cinfo.out_color_space = JCS_EXT_BGR;
 #endif
-		row_pointer[0] = dest;
+		/* Scaled decoding to yuv420, and decoding jpeg-s with sampling
+		   factors raw_data_out can't give us yuv420 for, goes through
+		   packed YCbCr */
+		if (dest_pix_fmt == V4L2_PIX_FMT_YUV420 ||
+		    dest_pix_fmt == V4L2_PIX_FMT_YVU420) {
+			buf = v4lconvert_alloc_buffer(width * height * 3,
+					&data->convert_pixfmt_buf,
+					&data->convert_pixfmt_buf_size);
+			if (!buf)
+				return v4lconvert_oom_error(data);
+			data->cinfo.out_color_space = JCS_YCbCr;
+		}
+		row_pointer[0] = buf;
 		jpeg_start_decompress(&data->cinfo);
 		/* Make libjpeg errors report that we've got some data */
 		data->jerr_errno = EPIPE;
@@ -339,64 +436,12 @@ int v4lconvert_decode_jpeg_libjpeg(struct v4lconvert_data *data,
 		if (dest_pix_fmt == V4L2_PIX_FMT_BGR24)
 			v4lconvert_swap_rgb(dest, dest, width, height);
 #endif
+		if (buf != dest)
+			v4lconvert_ycbcr24_to_yuv420(buf, dest, width, height,
+				dest_pix_fmt == V4L2_PIX_FMT_YVU420);
 	} else {
-		int h_samp, v_samp;
 		unsigned char *udest, *vdest;
 
-		if (data->cinfo.max_h_samp_factor == 2 &&
-		    data->cinfo.cur_comp_info[0]->h_samp_factor == 2 &&
-		    data->cinfo.cur_comp_info[1]->h_samp_factor == 1 &&
-		    data->cinfo.cur_comp_info[2]->h_samp_factor == 1) {
-			h_samp = 2;
-#if 0 /* HDG: untested, disable for now */
-		} else if (data->cinfo.max_h_samp_factor == 1 &&
-		    data->cinfo.cur_comp_info[0]->h_samp_factor == 1 &&
-		    data->cinfo.cur_comp_info[1]->h_samp_factor == 1 &&
-		    data->cinfo.cur_comp_info[2]->h_samp_factor == 1) {
-			h_samp = 1;
-#endif
-		} else {
-			fprintf(stderr,
-				"libv4lconvert: unsupported jpeg h-sampling "
-				"factors %d:%d:%d, please report this to "
-				"hdegoede@redhat.com\n",
-				data->cinfo.cur_comp_info[0]->h_samp_factor,
-				data->cinfo.cur_comp_info[1]->h_samp_factor,
-				data->cinfo.cur_comp_info[2]->h_samp_factor);
-			errno = EOPNOTSUPP;
-			return -1;
-		}
-
-		if (data->cinfo.max_v_samp_factor == 2 &&
-		    data->cinfo.cur_comp_info[0]->v_samp_factor == 2 &&
-		    data->cinfo.cur_comp_info[1]->v_samp_factor == 1 &&
-		    data->cinfo.cur_comp_info[2]->v_samp_factor == 1) {
-			v_samp = 2;
-		} else if (data->cinfo.max_v_samp_factor == 1 &&
-		    data->cinfo.cur_comp_info[0]->v_samp_factor == 1 &&
-		    data->cinfo.cur_comp_info[1]->v_samp_factor == 1 &&
-		    data->cinfo.cur_comp_info[2]->v_samp_factor == 1) {
-			v_samp = 1;
-		} else {
-			fprintf(stderr,
-				"libv4lconvert: unsupported jpeg v-sampling "
-				"factors %d:%d:%d, please report this to "
-				"hdegoede@redhat.com\n",
-				data->cinfo.cur_comp_info[0]->v_samp_factor,
-				data->cinfo.cur_comp_info[1]->v_samp_factor,
-				data->cinfo.cur_comp_info[2]->v_samp_factor);
-			errno = EOPNOTSUPP;
-			return -1;
-		}
-
-		/* We don't want any padding as that may overflow our dest */
-		if (width % (8 * h_samp) || height % (8 * v_samp)) {
-			V4LCONVERT_ERR(
-				"resolution is not a multiple of dctsize");
-			errno = EIO;
-			return -1;
-		}
-
 		if (dest_pix_fmt == V4L2_PIX_FMT_YVU420) {
 			vdest = dest + width * height;
 			udest = vdest + (width * height) / 4;
@@ -41,6 +41,10 @@
 
 #define V4LCONVERT_ERROR_MSG_SIZE 256
 #define V4LCONVERT_MAX_FRAMESIZES 256
+/* Bitmaps of supported_src_pixfmts entries (libv4lconvert.c checks that
+   the table fits) */
+#define V4LCONVERT_MAX_SRC_PIXFMTS 128
+#define V4LCONVERT_SRC_PIXFMT_WORDS (V4LCONVERT_MAX_SRC_PIXFMTS / 64)
 
 #define V4LCONVERT_ERR(...) \
 	snprintf(data->error_msg, V4LCONVERT_ERROR_MSG_SIZE, \
@@ -49,15 +53,17 @@
 /* Card flags */
 #define V4LCONVERT_IS_UVC                0x01
 #define V4LCONVERT_USE_TINYJPEG          0x02
+#define V4LCONVERT_SCALE                 0x04
 
 struct v4lconvert_data {
 	int fd;
 	int flags; /* bitfield */
 	int control_flags; /* bitfield */
 	unsigned int no_formats;
-	int64_t supported_src_formats; /* bitfield */
+	uint64_t supported_src_formats[V4LCONVERT_SRC_PIXFMT_WORDS]; /* bitmap */
 	char error_msg[V4LCONVERT_ERROR_MSG_SIZE];
 	struct jdec_private *tinyjpeg;
+	unsigned int jpeg_scale; /* 1, 2, 4 or 8: decode jpeg-s at 1/jpeg_scale */
 #ifdef HAVE_JPEG
 	struct jpeg_error_mgr jerr;
 	int jerr_errno;
@@ -67,22 +73,20 @@ struct v4lconvert_data {
 #endif // HAVE_JPEG
 	struct v4l2_frmsizeenum framesizes[V4LCONVERT_MAX_FRAMESIZES];
 	/* Bitmask of all supported src_formats which can do for a size */
-	int64_t framesize_supported_src_formats[V4LCONVERT_MAX_FRAMESIZES];
+	uint64_t framesize_supported_src_formats[V4LCONVERT_MAX_FRAMESIZES]
+		[V4LCONVERT_SRC_PIXFMT_WORDS];
 	unsigned int no_framesizes;
 	int bandwidth;
 	int fps;
-	int convert1_buf_size;
-	int convert2_buf_size;
-	int rotate90_buf_size;
-	int flip_buf_size;
 	int convert_pixfmt_buf_size;
-	unsigned char *convert1_buf;
-	unsigned char *convert2_buf;
-	unsigned char *rotate90_buf;
-	unsigned char *flip_buf;
+	int fused_buf_size;
 	unsigned char *convert_pixfmt_buf;
+	unsigned char *fused_buf;
+	struct v4lconvert_plan *plan; /* Plan for v4lconvert_convert */
 	struct v4lcontrol_data *control;
 	struct v4lprocessing_data *processing;
+	int do_process; /* Processing of the current frame is still to be done */
+	struct v4lconvert_threads *threads; /* NULL when single threaded */
 	void *dev_ops_priv;
 	const struct libv4l_dev_ops *dev_ops;
 
@@ -90,6 +94,15 @@ struct v4lconvert_data {
 	pid_t decompress_pid;
 	int decompress_in_pipe[2];  /* Data from helper to us */
 	int decompress_out_pipe[2]; /* Data from us to helper */
+	int decompress_shm_fd;      /* -1 when using the old pipe protocol */
+	struct v4lconvert_shm_frame *decompress_shm;
+	int decompress_shm_size;
+	int decompress_seq;
+	const char *decompress_helper; /* Helper the below / above are for */
+	void *decompress_plugin_lib;   /* In process decompressor plugin */
+	const struct v4lconvert_decomp_plugin *decompress_plugin;
+	unsigned char *decompress_src_buf;
+	int decompress_src_buf_size;
 
 	/* For mr97310a decoder */
 	int frames_dropped;
@@ -98,6 +111,117 @@ struct v4lconvert_data {
 	unsigned char *previous_frame;
 };
 
+/* A workspace is a v4lconvert_data of its own, which shares all device
+   state with the v4lconvert_data it was created for, and only owns the
+   decoder state and the buffers used during conversion */
+struct v4lconvert_workspace {
+	struct v4lconvert_data data;
+};
+
+/* Optional SIMD implementations of some of the rgbyuv.c conversions, picked
+   at runtime by v4lconvert_simd_init(), NULL members use the C version */
+struct v4lconvert_simd_funcs {
+	const char *name;
+	void (*yuyv_to_rgb24)(const unsigned char *src, unsigned char *dst,
+		int width, int height, int stride);
+	void (*yuyv_to_bgr24)(const unsigned char *src, unsigned char *dst,
+		int width, int height, int stride);
+	void (*yvyu_to_rgb24)(const unsigned char *src, unsigned char *dst,
+		int width, int height, int stride);
+	void (*yvyu_to_bgr24)(const unsigned char *src, unsigned char *dst,
+		int width, int height, int stride);
+	void (*uyvy_to_rgb24)(const unsigned char *src, unsigned char *dst,
+		int width, int height, int stride);
+	void (*uyvy_to_bgr24)(const unsigned char *src, unsigned char *dst,
+		int width, int height, int stride);
+	void (*yuyv_to_yuv420)(const unsigned char *src, unsigned char *ydst,
+		unsigned char *udst, unsigned char *vdst,
+		int width, int height, int stride);
+	void (*uyvy_to_yuv420)(const unsigned char *src, unsigned char *ydst,
+		unsigned char *udst, unsigned char *vdst,
+		int width, int height, int stride);
+	void (*yuv420_to_rgb24)(const unsigned char *ysrc,
+		const unsigned char *usrc, const unsigned char *vsrc,
+		unsigned char *dst, int width, int height);
+	void (*yuv420_to_bgr24)(const unsigned char *ysrc,
+		const unsigned char *usrc, const unsigned char *vsrc,
+		unsigned char *dst, int width, int height);
+	/* tinyjpeg: dequantize + IDCT one 8x8 block, see jidctfst.c */
+	void (*jpeg_idct)(const int16_t *coef, const int16_t *qtable,
+		uint8_t *dst, int stride);
+	/* tinyjpeg: one line of YCbCr -> rgb24 / bgr24 using the JFIF formula,
+	   width must be a multiple of 8, or of 16 when h_sub is set (chroma
+	   is horizontally subsampled by 2) */
+	void (*jpeg_ycbcr_to_rgb24)(const unsigned char *ysrc,
+		const unsigned char *cbsrc, const unsigned char *crsrc,
+		unsigned char *dst, int width, int h_sub, int bgr);
+	/* bayer.c: demosaic pixel pairs in the middle of line cur, pairs is a
+	   multiple of 8, blue_line is for line prev, see
+	   bayer_line_to_rgbbgr24() and bayer_line_to_y() */
+	void (*bayer_to_rgb24_pairs)(const unsigned char *prev,
+		const unsigned char *cur, const unsigned char *next,
+		unsigned char *dst, int pairs, int blue_line);
+	void (*bayer_to_y_pairs)(const unsigned char *prev,
+		const unsigned char *cur, const unsigned char *next,
+		unsigned char *ydst, int pairs, int blue_line);
+	/* processing: add the sums of the even and of the odd bytes of pairs
+	   byte pairs (a multiple of 8) to even and odd, resp. the sums of each
+	   of the 3 colors of pixels rgb24 pixels (a multiple of 16) to sums */
+	void (*sum_pairs)(const unsigned char *src, int pairs,
+		unsigned int *even, unsigned int *odd);
+	void (*sum_rgb24)(const unsigned char *src, int pixels,
+		unsigned int *sums);
+	/* processing: apply lut0 to the even and lut1 to the odd bytes of
+	   pairs byte pairs (a multiple of 16), resp. lut0, lut1 and lut2 to the
+	   3 colors of pixels rgb24 pixels (a multiple of 16), in place. Only
+	   done with SIMD when the ISA has a 256 entry byte table lookup (tbl),
+	   emulating one with 16 entry pshufb lookups is slower than C */
+	void (*lut_pairs)(unsigned char *buf, int pairs,
+		const unsigned char *lut0, const unsigned char *lut1);
+	void (*lut_rgb24)(unsigned char *buf, int pixels,
+		const unsigned char *lut0, const unsigned char *lut1,
+		const unsigned char *lut2);
+	/* flip.c: transpose a 16 x 16 block of bytes, resp. of rgb24 pixels,
+	   pixel x of dst line y becomes pixel y of src line x. The strides are
+	   in bytes and may be negative */
+	void (*transpose_16x16)(const unsigned char *src, int src_stride,
+		unsigned char *dst, int dst_stride);
+	void (*transpose_rgb24_16x16)(const unsigned char *src, int src_stride,
+		unsigned char *dst, int dst_stride);
+	/* crop.c: acc[i] += src[i] * weight for n (a multiple of 16) bytes,
+	   weight is at most 256 */
+	void (*scale_accumulate)(const unsigned char *src, unsigned short *acc,
+		int n, int weight);
+	/* hm12.c: split rows lines of 8 u / v byte pairs, 16 bytes apart, into
+	   8 byte u and v lines, stride bytes apart */
+	void (*split_uv_tile)(const unsigned char *src, unsigned char *dstu,
+		unsigned char *dstv, int stride, int rows);
+};
+
+extern struct v4lconvert_simd_funcs v4lconvert_simd;
+
+void tinyjpeg_idct_ifast_sse2(const int16_t *coef, const int16_t *qtable,
+		uint8_t *dst, int stride);
+
+void tinyjpeg_idct_ifast_neon(const int16_t *coef, const int16_t *qtable,
+		uint8_t *dst, int stride);
+
+void v4lconvert_simd_init(void);
+
+struct v4lconvert_threads *v4lconvert_threads_create(int count);
+
+void v4lconvert_threads_destroy(struct v4lconvert_threads *threads);
+
+int v4lconvert_threads_count(struct v4lconvert_threads *threads);
+
+/* Call func for consecutive slices of rows, together covering 0 - rows, in
+   parallel, the slice boundaries are a multiple of align. slice is a unique
+   index < v4lconvert_threads_count() which can be used for per slice
+   scratch buffers */
+void v4lconvert_threads_run(struct v4lconvert_threads *threads, int rows,
+		int align, void (*func)(void *arg, int slice, int first, int last),
+		void *arg);
+
 struct v4lconvert_pixfmt {
 	unsigned int fmt;	/* v4l2 fourcc */
 	int bpp;		/* bits per pixel, 0 for compressed formats */
@@ -113,15 +237,54 @@ unsigned char *v4lconvert_alloc_buffer(int needed,
 
 int v4lconvert_oom_error(struct v4lconvert_data *data);
 
+int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
+	unsigned char *src, int src_size, unsigned char *dest, int dest_size,
+	struct v4l2_format *fmt, unsigned int dest_pix_fmt);
+
+/* Returns the malloc-ed path of name in the libv4l cache dir, or NULL */
+char *v4lconvert_cache_path(const char *name);
+
+/* Create a temporary file for atomically replacing path with, through
+   v4lconvert_cache_commit, creating the parent directories when needed */
+FILE *v4lconvert_cache_create(const char *path, char **tmp_path);
+void v4lconvert_cache_commit(FILE *f, char *tmp_path, const char *path);
+
+/* Cache of the ENUM_FMT and ENUM_FRAMESIZES results of a device, NULL when
+   disabled, in which case v4lconvert_enum_cache_ioctl passes through to
+   the device */
+struct v4lconvert_enum_cache;
+
+struct v4lconvert_enum_cache *v4lconvert_enum_cache_open(
+		struct v4lconvert_data *data, struct v4l2_capability *cap);
+int v4lconvert_enum_cache_ioctl(struct v4lconvert_enum_cache *cache,
+		struct v4lconvert_data *data, unsigned long request, void *arg);
+void v4lconvert_enum_cache_close(struct v4lconvert_enum_cache *cache);
+
+/* Returns the predicted cpu time in ns for converting a width x height frame
+   from src_pixfmt to dest_pixfmt according to the measured cost model, or -1
+   if the model is not enabled or has no data for this conversion */
+int v4lconvert_cost_model_predict(struct v4lconvert_data *data,
+		const struct v4lconvert_pixfmt *pixfmts, int count,
+		unsigned int src_pixfmt, unsigned int dest_pixfmt,
+		int width, int height);
+
 void v4lconvert_rgb24_to_yuv420(const unsigned char *src, unsigned char *dest,
 		const struct v4l2_format *src_fmt, int bgr, int yvu, int bpp);
 
 void v4lconvert_yuv420_to_rgb24(const unsigned char *src, unsigned char *dst,
 		int width, int height, int yvu);
 
+void v4lconvert_yuv420_planes_to_rgb24(const unsigned char *ysrc,
+		const unsigned char *usrc, const unsigned char *vsrc,
+		unsigned char *dst, int width, int height);
+
 void v4lconvert_yuv420_to_bgr24(const unsigned char *src, unsigned char *dst,
 		int width, int height, int yvu);
 
+void v4lconvert_yuv420_planes_to_bgr24(const unsigned char *ysrc,
+		const unsigned char *usrc, const unsigned char *vsrc,
+		unsigned char *dst, int width, int height);
+
 void v4lconvert_yuyv_to_rgb24(const unsigned char *src, unsigned char *dst,
 		int width, int height, int stride);
 
@@ -131,6 +294,10 @@ void v4lconvert_yuyv_to_bgr24(const unsigned char *src, unsigned char *dst,
 void v4lconvert_yuyv_to_yuv420(const unsigned char *src, unsigned char *dst,
 		int width, int height, int stride, int yvu);
 
+void v4lconvert_yuyv_to_yuv420_planes(const unsigned char *src,
+		unsigned char *ydst, unsigned char *udst, unsigned char *vdst,
+		int width, int height, int stride);
+
 void v4lconvert_nv16_to_yuyv(const unsigned char *src, unsigned char *dest,
 		int width, int height);
 
@@ -149,12 +316,31 @@ void v4lconvert_uyvy_to_bgr24(const unsigned char *src, unsigned char *dst,
 void v4lconvert_uyvy_to_yuv420(const unsigned char *src, unsigned char *dst,
 		int width, int height, int stride, int yvu);
 
+void v4lconvert_uyvy_to_yuv420_planes(const unsigned char *src,
+		unsigned char *ydst, unsigned char *udst, unsigned char *vdst,
+		int width, int height, int stride);
+
 void v4lconvert_swap_rgb(const unsigned char *src, unsigned char *dst,
 		int width, int height);
 
 void v4lconvert_swap_uv(const unsigned char *src, unsigned char *dst,
 		const struct v4l2_format *src_fmt);
 
+void v4lconvert_nv12_to_rgb24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int bytesperline, int nv21);
+
+void v4lconvert_nv12_to_bgr24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int bytesperline, int nv21);
+
+void v4lconvert_nv12_to_yuv420(const unsigned char *src, unsigned char *dest,
+		int width, int height, int bytesperline, int yvu);
+
+void v4lconvert_yuv420_to_nv12(const unsigned char *src, unsigned char *dest,
+		int width, int height, int nv21);
+
+void v4lconvert_yuv420_to_yuyv(const unsigned char *src, unsigned char *dest,
+		int width, int height);
+
 void v4lconvert_grey_to_rgb24(const unsigned char *src, unsigned char *dest,
 		int width, int height);
 
@@ -170,6 +356,9 @@ void v4lconvert_y16_to_yuv420(const unsigned char *src, unsigned char *dest,
 void v4lconvert_rgb32_to_rgb24(const unsigned char *src, unsigned char *dest,
 		int width, int height, int bgr);
 
+void v4lconvert_rgb24_to_rgb32(const unsigned char *src, unsigned char *dest,
+		int width, int height, int bgr);
+
 int v4lconvert_y10b_to_rgb24(struct v4lconvert_data *data,
 	const unsigned char *src, unsigned char *dest, int width, int height);
 
@@ -231,8 +420,8 @@ int v4lconvert_decode_jpgl(const unsigned char *src, int src_size,
 void v4lconvert_decode_spca561(const unsigned char *src, unsigned char *dst,
 		int width, int height);
 
-void v4lconvert_decode_sn9c10x(const unsigned char *src, unsigned char *dst,
-		int width, int height);
+void v4lconvert_decode_sn9c10x(const unsigned char *src, int src_size,
+		unsigned char *dst, int width, int height);
 
 int v4lconvert_decode_pac207(struct v4lconvert_data *data,
 		const unsigned char *inp, int src_size, unsigned char *outp,
@@ -246,8 +435,8 @@ int v4lconvert_decode_jl2005bcd(struct v4lconvert_data *data,
 		const unsigned char *src, int src_size,
 		unsigned char *dest, int width, int height);
 
-void v4lconvert_decode_sn9c2028(const unsigned char *src, unsigned char *dst,
-		int width, int height);
+void v4lconvert_decode_sn9c2028(const unsigned char *src, int src_size,
+		unsigned char *dst, int width, int height);
 
 void v4lconvert_decode_sq905c(const unsigned char *src, unsigned char *dst,
 		int width, int height);
@@ -255,14 +444,24 @@ void v4lconvert_decode_sq905c(const unsigned char *src, unsigned char *dst,
 void v4lconvert_decode_stv0680(const unsigned char *src, unsigned char *dst,
 		int width, int height);
 
+/* Returns the size of a line of width pixels of a raw bayer format, or 0 if
+   pixfmt is not a raw bayer format */
+int v4lconvert_bayer_line_size(unsigned int pixfmt, int width);
+
+/* These render lines first to last - 1 of the frame (first must be even for
+   yuv420), for raw bayer formats with more than 8 bits per pixel line_buf
+   must point to 3 * width bytes of scratch space */
 void v4lconvert_bayer_to_rgb24(const unsigned char *bayer,
-		unsigned char *rgb, int width, int height, const unsigned int stride, unsigned int pixfmt);
+		unsigned char *rgb, int width, int height, const unsigned int stride,
+		unsigned int pixfmt, unsigned char *line_buf, int first, int last);
 
 void v4lconvert_bayer_to_bgr24(const unsigned char *bayer,
-		unsigned char *rgb, int width, int height, const unsigned int stride, unsigned int pixfmt);
+		unsigned char *rgb, int width, int height, const unsigned int stride,
+		unsigned int pixfmt, unsigned char *line_buf, int first, int last);
 
 void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
-		int width, int height, const unsigned int stride, unsigned int src_pixfmt, int yvu);
+		int width, int height, const unsigned int stride, unsigned int src_pixfmt,
+		int yvu, unsigned char *line_buf, int first, int last);
 
 void v4lconvert_hm12_to_rgb24(const unsigned char *src,
 		unsigned char *dst, int width, int height);
@@ -273,6 +472,9 @@ void v4lconvert_hm12_to_bgr24(const unsigned char *src,
 void v4lconvert_hm12_to_yuv420(const unsigned char *src,
 		unsigned char *dst, int width, int height, int yvu);
 
+void v4lconvert_hm12_to_nv12(const unsigned char *src,
+		unsigned char *dst, int width, int height, int nv21);
+
 void v4lconvert_hsv_to_rgb24(const unsigned char *src, unsigned char *dest,
 		int width, int height, int bgr, int Xin, unsigned char hsv_enc);
 
@@ -282,8 +484,35 @@ void v4lconvert_rotate90(unsigned char *src, unsigned char *dest,
 void v4lconvert_flip(unsigned char *src, unsigned char *dest,
 		struct v4l2_format *fmt, int hflip, int vflip);
 
+int v4lconvert_fused_convert(struct v4lconvert_data *data,
+		unsigned char *src, int src_size,
+		const struct v4l2_format *src_fmt, unsigned char *dest,
+		const struct v4l2_format *dest_fmt, int hflip, int vflip);
+
+int v4lconvert_scale_span(int i, int src_size, int dest_size, int *end);
+
+int v4lconvert_scale_weight(int i, int k, int src_size, int dest_size);
+
+int v4lconvert_scale_table_size(int src_width, int dest_width);
+
+void v4lconvert_scale_init_table(unsigned int *table, int src_width,
+		int dest_width);
+
+void v4lconvert_scale_accumulate(const unsigned char *src,
+		unsigned short *acc, int n, int weight);
+
+void v4lconvert_scale_line(const unsigned short *acc, unsigned char *dest,
+		const unsigned int *table, int dest_width, int bpp);
+
+int v4lconvert_scale_window(int width, int height, int dest_width,
+		int dest_height, int *win_width, int *win_height);
+
+int v4lconvert_crop_buf_size(const struct v4l2_format *src_fmt,
+		const struct v4l2_format *dest_fmt);
+
 void v4lconvert_crop(unsigned char *src, unsigned char *dest,
-		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt);
+		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt,
+		unsigned char *buf);
 
 int v4lconvert_helper_decompress(struct v4lconvert_data *data,
 		const char *helper, const unsigned char *src, int src_size,
@@ -22,6 +22,7 @@
 #include <config.h>
 #endif
 #include <errno.h>
+#include <limits.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -72,7 +73,8 @@ const struct libv4l_dev_ops *v4lconvert_get_default_dev_ops()
 }
 
 static void v4lconvert_get_framesizes(struct v4lconvert_data *data,
-		unsigned int pixelformat, int index);
+		struct v4lconvert_enum_cache *cache, unsigned int pixelformat,
+		int index);
 
 /*
  * Notes:
@@ -89,7 +91,12 @@ static void v4lconvert_get_framesizes(struct v4lconvert_data *data,
 	{ V4L2_PIX_FMT_RGB24,		24,	 1,	 5,	0 }, \
 	{ V4L2_PIX_FMT_BGR24,		24,	 1,	 5,	0 }, \
 	{ V4L2_PIX_FMT_YUV420,		12,	 6,	 1,	0 }, \
-	{ V4L2_PIX_FMT_YVU420,		12,	 6,	 1,	0 }
+	{ V4L2_PIX_FMT_YVU420,		12,	 6,	 1,	0 }, \
+	{ V4L2_PIX_FMT_NV12,		12,	 6,	 1,	0 }, \
+	{ V4L2_PIX_FMT_NV21,		12,	 6,	 1,	0 }, \
+	{ V4L2_PIX_FMT_YUYV,		16,	 5,	 4,	0 }, \
+	{ V4L2_PIX_FMT_XRGB32,		32,	 4,	 6,	0 }, \
+	{ V4L2_PIX_FMT_XBGR32,		32,	 4,	 6,	0 }
 
 static const struct v4lconvert_pixfmt supported_src_pixfmts[] = {
 	SUPPORTED_DST_PIXFMTS,
@@ -97,12 +104,9 @@ static const struct v4lconvert_pixfmt supported_src_pixfmts[] = {
 	{ V4L2_PIX_FMT_RGB565,		16,	 4,	 6,	0 },
 	{ V4L2_PIX_FMT_BGR32,		32,	 4,	 6,	0 },
 	{ V4L2_PIX_FMT_RGB32,		32,	 4,	 6,	0 },
-	{ V4L2_PIX_FMT_XBGR32,		32,	 4,	 6,	0 },
-	{ V4L2_PIX_FMT_XRGB32,		32,	 4,	 6,	0 },
 	{ V4L2_PIX_FMT_ABGR32,		32,	 4,	 6,	0 },
 	{ V4L2_PIX_FMT_ARGB32,		32,	 4,	 6,	0 },
 	/* yuv 4:2:2 formats */
-	{ V4L2_PIX_FMT_YUYV,		16,	 5,	 4,	0 },
 	{ V4L2_PIX_FMT_YVYU,		16,	 5,	 4,	0 },
 	{ V4L2_PIX_FMT_UYVY,		16,	 5,	 4,	0 },
 	{ V4L2_PIX_FMT_NV16,		16,	 5,	 4,	1 },
@@ -132,7 +136,26 @@ static const struct v4lconvert_pixfmt supported_src_pixfmts[] = {
 	{ V4L2_PIX_FMT_SGRBG8,		 8,	 8,	 8,	0 },
 	{ V4L2_PIX_FMT_SRGGB8,		 8,	 8,	 8,	0 },
 	{ V4L2_PIX_FMT_STV0680,		 8,	 8,	 8,	1 },
+	{ V4L2_PIX_FMT_SBGGR10,		16,	 8,	 8,	1 },
+	{ V4L2_PIX_FMT_SGBRG10,		16,	 8,	 8,	1 },
 	{ V4L2_PIX_FMT_SGRBG10,		16,	 8,	 8,	1 },
+	{ V4L2_PIX_FMT_SRGGB10,		16,	 8,	 8,	1 },
+	{ V4L2_PIX_FMT_SBGGR12,		16,	 8,	 8,	1 },
+	{ V4L2_PIX_FMT_SGBRG12,		16,	 8,	 8,	1 },
+	{ V4L2_PIX_FMT_SGRBG12,		16,	 8,	 8,	1 },
+	{ V4L2_PIX_FMT_SRGGB12,		16,	 8,	 8,	1 },
+	{ V4L2_PIX_FMT_SBGGR16,		16,	 8,	 8,	1 },
+	{ V4L2_PIX_FMT_SGBRG16,		16,	 8,	 8,	1 },
+	{ V4L2_PIX_FMT_SGRBG16,		16,	 8,	 8,	1 },
+	{ V4L2_PIX_FMT_SRGGB16,		16,	 8,	 8,	1 },
+	{ V4L2_PIX_FMT_SBGGR10P,	10,	 8,	 8,	1 },
+	{ V4L2_PIX_FMT_SGBRG10P,	10,	 8,	 8,	1 },
+	{ V4L2_PIX_FMT_SGRBG10P,	10,	 8,	 8,	1 },
+	{ V4L2_PIX_FMT_SRGGB10P,	10,	 8,	 8,	1 },
+	{ V4L2_PIX_FMT_SBGGR12P,	12,	 8,	 8,	1 },
+	{ V4L2_PIX_FMT_SGBRG12P,	12,	 8,	 8,	1 },
+	{ V4L2_PIX_FMT_SGRBG12P,	12,	 8,	 8,	1 },
+	{ V4L2_PIX_FMT_SRGGB12P,	12,	 8,	 8,	1 },
 	/* compressed bayer */
 	{ V4L2_PIX_FMT_SPCA561,		 0,	 9,	 9,	1 },
 	{ V4L2_PIX_FMT_SN9C10X,		 0,	 9,	 9,	1 },
@@ -161,6 +184,31 @@ static const struct v4lconvert_pixfmt supported_dst_pixfmts[] = {
 	SUPPORTED_DST_PIXFMTS
 };
 
+_Static_assert(ARRAY_SIZE(supported_src_pixfmts) <= V4LCONVERT_MAX_SRC_PIXFMTS,
+	       "supported_src_pixfmts does not fit in the src format bitmaps");
+
+/* Helpers for the bitmaps of supported_src_pixfmts indexes */
+static void v4lconvert_src_fmts_set(uint64_t *src_formats, int index)
+{
+	src_formats[index / 64] |= 1ULL << (index % 64);
+}
+
+static int v4lconvert_src_fmts_test(const uint64_t *src_formats, int index)
+{
+	return (src_formats[index / 64] >> (index % 64)) & 1;
+}
+
+static int v4lconvert_src_fmts_empty(const uint64_t *src_formats)
+{
+	int i;
+
+	for (i = 0; i < V4LCONVERT_SRC_PIXFMT_WORDS; i++)
+		if (src_formats[i])
+			return 0;
+
+	return 1;
+}
+
 /* List of well known resolutions which we can get by cropping somewhat larger
    resolutions */
 static const int v4lconvert_crop_res[][2] = {
@@ -184,7 +232,10 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 {
 	int i, j;
 	struct v4lconvert_data *data = calloc(1, sizeof(struct v4lconvert_data));
+	struct v4lconvert_enum_cache *cache = NULL;
 	struct v4l2_capability cap;
+	int got_cap;
+	char *s;
 	/*
 	 * This keeps tracks of device-specific formats for which apps most
 	 * likely don't know. If all a driver can offer are proprietary
@@ -203,7 +254,22 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 	data->dev_ops = dev_ops;
 	data->dev_ops_priv = dev_ops_priv;
 	data->decompress_pid = -1;
+	data->decompress_shm_fd = -1;
 	data->fps = 30;
+	data->jpeg_scale = 1;
+
+	/* Pick the fastest conversion routines this CPU supports */
+	v4lconvert_simd_init();
+
+	/* Optionally spread conversions over multiple threads */
+	s = getenv("LIBV4LCONVERT_THREADS");
+	if (s)
+		data->threads = v4lconvert_threads_create(strtol(s, NULL, 0));
+
+	got_cap = data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
+				       VIDIOC_QUERYCAP, &cap) == 0;
+	if (got_cap)
+		cache = v4lconvert_enum_cache_open(data, &cap);
 
 	/* Check supported formats */
 	for (i = 0; ; i++) {
@@ -211,8 +277,8 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 
 		fmt.index = i;
 
-		if (data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
-				VIDIOC_ENUM_FMT, &fmt))
+		if (v4lconvert_enum_cache_ioctl(cache, data, VIDIOC_ENUM_FMT,
+						&fmt))
 			break;
 
 		for (j = 0; j < ARRAY_SIZE(supported_src_pixfmts); j++)
@@ -220,8 +286,9 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 				break;
 
 		if (j < ARRAY_SIZE(supported_src_pixfmts)) {
-			data->supported_src_formats |= 1ULL << j;
-			v4lconvert_get_framesizes(data, fmt.pixelformat, j);
+			v4lconvert_src_fmts_set(data->supported_src_formats, j);
+			v4lconvert_get_framesizes(data, cache, fmt.pixelformat,
+						  j);
 			if (!supported_src_pixfmts[j].needs_conversion)
 				always_needs_conversion = 0;
 		} else
@@ -229,10 +296,10 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 	}
 
 	data->no_formats = i;
+	v4lconvert_enum_cache_close(cache);
 
 	/* Check if this cam has any special flags */
-	if (data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
-			VIDIOC_QUERYCAP, &cap) == 0) {
+	if (got_cap) {
 		if (!strcmp((char *)cap.driver, "uvcvideo"))
 			data->flags |= V4LCONVERT_IS_UVC;
 
@@ -245,6 +312,7 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 	data->control = v4lcontrol_create(fd, dev_ops_priv, dev_ops,
 						always_needs_conversion);
 	if (!data->control) {
+		v4lconvert_threads_destroy(data->threads);
 		free(data);
 		return NULL;
 	}
@@ -252,10 +320,19 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 	data->control_flags = v4lcontrol_get_flags(data->control);
 	if (data->control_flags & V4LCONTROL_FORCE_TINYJPEG)
 		data->flags |= V4LCONVERT_USE_TINYJPEG;
+	/* Allow selecting the jpeg decoder for benchmarking / debugging */
+	s = getenv("LIBV4LCONVERT_USE_TINYJPEG");
+	if (s && strtol(s, NULL, 0))
+		data->flags |= V4LCONVERT_USE_TINYJPEG;
+	/* Optionally offer any smaller resolution, by scaling */
+	s = getenv("LIBV4LCONVERT_SCALE");
+	if (s && strtol(s, NULL, 0))
+		data->flags |= V4LCONVERT_SCALE;
 
 	data->processing = v4lprocessing_create(fd, data->control);
 	if (!data->processing) {
 		v4lcontrol_destroy(data->control);
+		v4lconvert_threads_destroy(data->threads);
 		free(data);
 		return NULL;
 	}
@@ -263,13 +340,9 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 	return data;
 }
 
-void v4lconvert_destroy(struct v4lconvert_data *data)
+/* Free everything a workspace owns */
+static void v4lconvert_destroy_conversion_state(struct v4lconvert_data *data)
 {
-	if (!data)
-		return;
-
-	v4lprocessing_destroy(data->processing);
-	v4lcontrol_destroy(data->control);
 	if (data->tinyjpeg) {
 		unsigned char *comps[3] = { NULL, NULL, NULL };
 
@@ -283,15 +356,76 @@ void v4lconvert_destroy(struct v4lconvert_data *data)
 #ifdef HAVE_LIBV4LCONVERT_HELPERS
 	v4lconvert_helper_cleanup(data);
 #endif
-	free(data->convert1_buf);
-	free(data->convert2_buf);
-	free(data->rotate90_buf);
-	free(data->flip_buf);
+	v4lconvert_plan_destroy(data->plan);
 	free(data->convert_pixfmt_buf);
+	free(data->fused_buf);
 	free(data->previous_frame);
+}
+
+void v4lconvert_destroy(struct v4lconvert_data *data)
+{
+	if (!data)
+		return;
+
+	v4lconvert_threads_destroy(data->threads);
+	v4lprocessing_destroy(data->processing);
+	v4lcontrol_destroy(data->control);
+	v4lconvert_destroy_conversion_state(data);
 	free(data);
 }
 
+struct v4lconvert_workspace *v4lconvert_workspace_create(
+		struct v4lconvert_data *data)
+{
+	struct v4lconvert_workspace *ws = malloc(sizeof(*ws));
+
+	if (!ws) {
+		v4lconvert_oom_error(data);
+		return NULL;
+	}
+
+	ws->data = *data;
+	ws->data.error_msg[0] = 0;
+	ws->data.tinyjpeg = NULL;
+	ws->data.jpeg_scale = 1;
+#ifdef HAVE_JPEG
+	ws->data.cinfo_initialized = 0;
+#endif // HAVE_JPEG
+	/* The caller is the thread pool, the workspace converts frames in
+	   the calling thread only */
+	ws->data.threads = NULL;
+	ws->data.convert_pixfmt_buf_size = 0;
+	ws->data.fused_buf_size = 0;
+	ws->data.convert_pixfmt_buf = NULL;
+	ws->data.fused_buf = NULL;
+	ws->data.plan = NULL;
+	/* Each workspace starts its own decompression helper when needed */
+	ws->data.decompress_pid = -1;
+	ws->data.decompress_shm_fd = -1;
+	ws->data.decompress_shm = NULL;
+	ws->data.decompress_shm_size = 0;
+	ws->data.decompress_seq = 0;
+	ws->data.decompress_helper = NULL;
+	ws->data.decompress_plugin_lib = NULL;
+	ws->data.decompress_plugin = NULL;
+	ws->data.decompress_src_buf = NULL;
+	ws->data.decompress_src_buf_size = 0;
+	ws->data.frames_dropped = 0;
+	ws->data.previous_frame = NULL;
+	ws->data.do_process = 0;
+
+	return ws;
+}
+
+void v4lconvert_workspace_destroy(struct v4lconvert_workspace *ws)
+{
+	if (!ws)
+		return;
+
+	v4lconvert_destroy_conversion_state(&ws->data);
+	free(ws);
+}
+
 int v4lconvert_supported_dst_format(unsigned int pixelformat)
 {
 	int i;
@@ -306,7 +440,7 @@ int v4lconvert_supported_dst_format(unsigned int pixelformat)
 int v4lconvert_supported_dst_fmt_only(struct v4lconvert_data *data)
 {
 	return v4lcontrol_needs_conversion(data->control) &&
-		data->supported_src_formats;
+		!v4lconvert_src_fmts_empty(data->supported_src_formats);
 }
 
 /* See libv4lconvert.h for description of in / out parameters */
@@ -323,7 +457,8 @@ int v4lconvert_enum_fmt(struct v4lconvert_data *data, struct v4l2_fmtdesc *fmt)
 
 	for (i = 0; i < ARRAY_SIZE(supported_dst_pixfmts); i++)
 		if (v4lconvert_supported_dst_fmt_only(data) ||
-				!(data->supported_src_formats & (1ULL << i))) {
+				!v4lconvert_src_fmts_test(
+					data->supported_src_formats, i)) {
 			faked_fmts[no_faked_fmts] = supported_dst_pixfmts[i].fmt;
 			no_faked_fmts++;
 		}
@@ -363,28 +498,60 @@ int v4lconvert_enum_fmt(struct v4lconvert_data *data, struct v4l2_fmtdesc *fmt)
    except when all of them cause this.
    
    Note grey scale formats start at 20 rather then 1-10, because we want to
-   never autoselect them, unless they are the only choice */
+   never autoselect them, unless they are the only choice.
+
+   When use_cost_model is set the base rank is the cpu time in ns for
+   converting a frame as predicted by the measured cost model (see
+   costmodel.c) instead, with penalties which are larger than any predicted
+   time for exceeding the bandwidth or the cpu time available per frame, and
+   for grey formats. */
 static int v4lconvert_get_rank(struct v4lconvert_data *data,
 	int src_index, int src_width, int src_height,
-	unsigned int dest_pixelformat)
+	unsigned int dest_pixelformat, int use_cost_model)
 {
 	int needed, rank = 0;
 
+	if (use_cost_model) {
+		rank = v4lconvert_cost_model_predict(data,
+				supported_src_pixfmts,
+				ARRAY_SIZE(supported_src_pixfmts),
+				supported_src_pixfmts[src_index].fmt,
+				dest_pixelformat, src_width, src_height);
+		if (rank >= (1 << 28))
+			rank = (1 << 28) - 1;
+
+		needed = src_width * src_height * data->fps *
+			 supported_src_pixfmts[src_index].bpp / 8;
+		if ((data->bandwidth && needed > data->bandwidth) ||
+		    (long long)rank * data->fps > 1000000000LL)
+			rank += 1 << 29;
+		if (supported_src_pixfmts[src_index].rgb_rank >= 20)
+			rank += 1 << 30;
+		return rank;
+	}
+
 	switch (dest_pixelformat) {
 	case V4L2_PIX_FMT_RGB24:
 	case V4L2_PIX_FMT_BGR24:
+	case V4L2_PIX_FMT_XRGB32:
+	case V4L2_PIX_FMT_XBGR32:
 		rank = supported_src_pixfmts[src_index].rgb_rank;
 		break;
 	case V4L2_PIX_FMT_YUV420:
 	case V4L2_PIX_FMT_YVU420:
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV21:
+	case V4L2_PIX_FMT_YUYV:
 		rank = supported_src_pixfmts[src_index].yuv_rank;
 		break;
 	}
 
 	/* So that if both rgb32 and bgr32 are supported, or both yuv420 and
-	   yvu420 the right one wins */
+	   yvu420 the right one wins. Not needing any conversion always wins,
+	   also for destination formats which are not the cheapest to
+	   convert to (such as yuyv) */
 	if (supported_src_pixfmts[src_index].fmt == dest_pixelformat)
-		rank--;
+		rank = 0;
 
 	/* check bandwidth needed */
 	needed = src_width * src_height * data->fps *
@@ -402,6 +569,29 @@ static int v4lconvert_get_rank(struct v4lconvert_data *data,
 	return rank;
 }
 
+/* Returns 1 if the measured cost model is enabled and can rank all src
+   formats in src_formats, mixing measured and static ranks is meaningless */
+static int v4lconvert_use_cost_model(struct v4lconvert_data *data,
+		const uint64_t *src_formats, unsigned int dest_pixelformat)
+{
+	int i;
+
+	if (v4lconvert_src_fmts_empty(src_formats))
+		return 0;
+
+	for (i = 0; i < ARRAY_SIZE(supported_src_pixfmts); i++) {
+		if (!v4lconvert_src_fmts_test(src_formats, i))
+			continue;
+
+		if (v4lconvert_cost_model_predict(data, supported_src_pixfmts,
+				ARRAY_SIZE(supported_src_pixfmts),
+				supported_src_pixfmts[i].fmt,
+				dest_pixelformat, 1, 1) < 0)
+			return 0;
+	}
+	return 1;
+}
+
 /* Find out what format to use based on the (cached) results of enum
    framesizes instead of doing a zillion try_fmt calls. This function
    currently is intended for use with UVC cams only. This is esp.
@@ -413,7 +603,8 @@ static int v4lconvert_do_try_format_uvc(struct v4lconvert_data *data,
 	unsigned int closest_fmt_size_diff = -1;
 	int best_framesize = 0;/* Just use the first format if no small enough one */
 	int best_format = 0;
-	int best_rank = 100;
+	int best_rank = INT_MAX;
+	int use_cost_model;
 
 	for (i = 0; i < data->no_framesizes; i++) {
 		if (data->framesizes[i].discrete.width <= dest_fmt->fmt.pix.width &&
@@ -432,10 +623,15 @@ static int v4lconvert_do_try_format_uvc(struct v4lconvert_data *data,
 		}
 	}
 
+	use_cost_model = v4lconvert_use_cost_model(data,
+			data->framesize_supported_src_formats[best_framesize],
+			dest_fmt->fmt.pix.pixelformat);
+
 	for (i = 0; i < ARRAY_SIZE(supported_src_pixfmts); i++) {
 		/* is this format supported? */
-		if (!(data->framesize_supported_src_formats[best_framesize] &
-		      (1ULL << i)))
+		if (!v4lconvert_src_fmts_test(
+			data->framesize_supported_src_formats[best_framesize],
+			i))
 			continue;
 
 		/* Note the hardcoded use of discrete is based on this function
@@ -443,7 +639,7 @@ static int v4lconvert_do_try_format_uvc(struct v4lconvert_data *data,
 		rank = v4lconvert_get_rank(data, i,
 			    data->framesizes[best_framesize].discrete.width,
 			    data->framesizes[best_framesize].discrete.height,
-			    dest_fmt->fmt.pix.pixelformat);
+			    dest_fmt->fmt.pix.pixelformat, use_cost_model);
 		if (rank < best_rank) {
 			best_rank = rank;
 			best_format = supported_src_pixfmts[i].fmt;
@@ -469,7 +665,7 @@ static int v4lconvert_do_try_format_uvc(struct v4lconvert_data *data,
 static int v4lconvert_do_try_format(struct v4lconvert_data *data,
 		struct v4l2_format *dest_fmt, struct v4l2_format *src_fmt)
 {
-	int i, size_x_diff, size_y_diff, rank, best_rank = 0;
+	int i, size_x_diff, size_y_diff, rank, best_rank = 0, use_cost_model;
 	unsigned int size_diff, closest_fmt_size_diff = -1;
 	unsigned int desired_pixfmt = dest_fmt->fmt.pix.pixelformat;
 	struct v4l2_format try_fmt, closest_fmt = { .type = 0 };
@@ -477,9 +673,12 @@ static int v4lconvert_do_try_format(struct v4lconvert_data *data,
 	if (data->flags & V4LCONVERT_IS_UVC)
 		return v4lconvert_do_try_format_uvc(data, dest_fmt, src_fmt);
 
+	use_cost_model = v4lconvert_use_cost_model(data,
+			data->supported_src_formats, desired_pixfmt);
+
 	for (i = 0; i < ARRAY_SIZE(supported_src_pixfmts); i++) {
 		/* is this format supported? */
-		if (!(data->supported_src_formats & (1ULL << i)))
+		if (!v4lconvert_src_fmts_test(data->supported_src_formats, i))
 			continue;
 
 		try_fmt = *dest_fmt;
@@ -503,7 +702,7 @@ static int v4lconvert_do_try_format(struct v4lconvert_data *data,
 		rank = v4lconvert_get_rank(data, i,
 					   try_fmt.fmt.pix.width,
 					   try_fmt.fmt.pix.height,
-					   desired_pixfmt);
+					   desired_pixfmt, use_cost_model);
 		if (size_diff < closest_fmt_size_diff ||
 		    (size_diff == closest_fmt_size_diff && rank < best_rank)) {
 			closest_fmt = try_fmt;
@@ -523,6 +722,56 @@ static int v4lconvert_do_try_format(struct v4lconvert_data *data,
 	return 0;
 }
 
+/* Returns the factor (1, 2, 4 or 8) by which to downscale a jpeg src while
+   decoding it, when converting it to dest_width x dest_height. The jpeg
+   decoders do this in the DCT domain, skipping most of the decoding work.
+   We only do this when the dest is (about) the jpeg size / 2, 4 or 8 (as
+   offered by v4lconvert_try_format), or when v4lconvert_crop would scale down
+   by at least that factor anyways, so that the result is the same apart from
+   being a better quality downscale */
+static unsigned int v4lconvert_jpeg_scale(const struct v4l2_format *src_fmt,
+		unsigned int dest_width, unsigned int dest_height)
+{
+	unsigned int scale;
+	unsigned int width = src_fmt->fmt.pix.width;
+	unsigned int height = src_fmt->fmt.pix.height;
+	int win_width, win_height, w, h, crop_scale;
+
+	crop_scale = v4lconvert_scale_window(width, height, dest_width,
+					     dest_height, &win_width,
+					     &win_height);
+
+	if (src_fmt->fmt.pix.pixelformat != V4L2_PIX_FMT_MJPEG &&
+	    src_fmt->fmt.pix.pixelformat != V4L2_PIX_FMT_JPEG)
+		return 1;
+
+	for (scale = 8; scale > 1; scale /= 2) {
+		if (width % scale || height % scale ||
+		    width / scale < dest_width || height / scale < dest_height)
+			continue;
+
+		/* Only cropping off the try_format rounding ? */
+		if (width / scale < dest_width + 8 &&
+		    height / scale < dest_height + 2)
+			return scale;
+
+		/* Would v4lconvert_crop scale down (about) the same window by
+		   at least scale anyways ? */
+		if (!crop_scale || win_width < scale * dest_width ||
+		    win_height < scale * dest_height)
+			continue;
+		if (!v4lconvert_scale_window(width / scale, height / scale,
+					     dest_width, dest_height, &w, &h)) {
+			w = dest_width;
+			h = dest_height;
+		}
+		if (abs(w * (int)scale - win_width) <= 2 * (int)scale &&
+		    abs(h * (int)scale - win_height) <= 2 * (int)scale)
+			return scale;
+	}
+	return 1;
+}
+
 void v4lconvert_fixup_fmt(struct v4l2_format *fmt)
 {
 	switch (fmt->fmt.pix.pixelformat) {
@@ -533,19 +782,111 @@ void v4lconvert_fixup_fmt(struct v4l2_format *fmt)
 		break;
 	case V4L2_PIX_FMT_YUV420:
 	case V4L2_PIX_FMT_YVU420:
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV21:
 		fmt->fmt.pix.bytesperline = fmt->fmt.pix.width;
 		fmt->fmt.pix.sizeimage = fmt->fmt.pix.width * fmt->fmt.pix.height * 3 / 2;
 		break;
+	case V4L2_PIX_FMT_YUYV:
+		fmt->fmt.pix.bytesperline = fmt->fmt.pix.width * 2;
+		fmt->fmt.pix.sizeimage = fmt->fmt.pix.width * fmt->fmt.pix.height * 2;
+		break;
+	case V4L2_PIX_FMT_XRGB32:
+	case V4L2_PIX_FMT_XBGR32:
+		fmt->fmt.pix.bytesperline = fmt->fmt.pix.width * 4;
+		fmt->fmt.pix.sizeimage = fmt->fmt.pix.width * fmt->fmt.pix.height * 4;
+		break;
 	}
 }
 
+/* The rotation set through the V4L2_CID_ROTATE control, in clockwise quarter
+   turns. With an odd number of quarter turns the src frames get negotiated
+   with width and height swapped */
+static int v4lconvert_get_rotation(struct v4lconvert_data *data)
+{
+	return v4lcontrol_get_ctrl(data->control, V4LCONTROL_ROTATE) / 90 % 4;
+}
+
+static void v4lconvert_swap_size(struct v4l2_format *fmt)
+{
+	unsigned int tmp = fmt->fmt.pix.width;
+
+	fmt->fmt.pix.width = fmt->fmt.pix.height;
+	fmt->fmt.pix.height = tmp;
+}
+
+/* Can a width x height frame be scaled down to the desired size ? Like the
+   jpeg decoders we scale down at most 8 times */
+static int v4lconvert_scale_src_fits(const struct v4l2_format *fmt,
+		unsigned int desired_width, unsigned int desired_height)
+{
+	return fmt->fmt.pix.width >= desired_width &&
+	       fmt->fmt.pix.height >= desired_height &&
+	       fmt->fmt.pix.width <= 8 * desired_width &&
+	       fmt->fmt.pix.height <= 8 * desired_height;
+}
+
+/* Set the size of fmt to the smallest enumerated framesize which can be
+   scaled down to the desired size */
+static int v4lconvert_scale_src_size(struct v4lconvert_data *data,
+		unsigned int desired_width, unsigned int desired_height,
+		struct v4l2_format *fmt)
+{
+	unsigned int i, best_width = 0, best_height = 0;
+	struct v4l2_format try_fmt = *fmt;
+
+	for (i = 0; i < data->no_framesizes; i++) {
+		unsigned int width, height;
+
+		if (data->framesizes[i].type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+			width = data->framesizes[i].discrete.width;
+			height = data->framesizes[i].discrete.height;
+		} else {
+			/* Round the desired size up to the next step */
+			const struct v4l2_frmsize_stepwise *sw =
+				&data->framesizes[i].stepwise;
+			unsigned int step_width = sw->step_width ?
+				sw->step_width : 1;
+			unsigned int step_height = sw->step_height ?
+				sw->step_height : 1;
+
+			width = sw->min_width;
+			if (width < desired_width)
+				width += (desired_width - width +
+					  step_width - 1) / step_width *
+					 step_width;
+			height = sw->min_height;
+			if (height < desired_height)
+				height += (desired_height - height +
+					   step_height - 1) / step_height *
+					  step_height;
+			if (width > sw->max_width || height > sw->max_height)
+				continue;
+		}
+
+		try_fmt.fmt.pix.width = width;
+		try_fmt.fmt.pix.height = height;
+		if (v4lconvert_scale_src_fits(&try_fmt, desired_width,
+					      desired_height) &&
+		    (!best_width || width * height < best_width * best_height)) {
+			best_width = width;
+			best_height = height;
+		}
+	}
+	if (!best_width)
+		return -1;
+
+	fmt->fmt.pix.width = best_width;
+	fmt->fmt.pix.height = best_height;
+	return 0;
+}
+
 /* See libv4lconvert.h for description of in / out parameters */
 int v4lconvert_try_format(struct v4lconvert_data *data,
 		struct v4l2_format *dest_fmt, struct v4l2_format *src_fmt)
 {
-	int i, result;
-	unsigned int desired_width = dest_fmt->fmt.pix.width;
-	unsigned int desired_height = dest_fmt->fmt.pix.height;
+	int i, result, rotate90 = v4lconvert_get_rotation(data) & 1;
+	unsigned int desired_width, desired_height;
 	struct v4l2_format try_src, try_dest, try2_src, try2_dest;
 
 	if (dest_fmt->type == V4L2_BUF_TYPE_VIDEO_CAPTURE &&
@@ -553,7 +894,12 @@ int v4lconvert_try_format(struct v4lconvert_data *data,
 			!v4lconvert_supported_dst_format(dest_fmt->fmt.pix.pixelformat))
 		dest_fmt->fmt.pix.pixelformat = V4L2_PIX_FMT_RGB24;
 
+	/* Look for a src format with the size of the frame before rotating */
 	try_dest = *dest_fmt;
+	if (rotate90)
+		v4lconvert_swap_size(&try_dest);
+	desired_width = try_dest.fmt.pix.width;
+	desired_height = try_dest.fmt.pix.height;
 
 	/* Can we do conversion to the requested format & type? */
 	if (!v4lconvert_supported_dst_format(dest_fmt->fmt.pix.pixelformat) ||
@@ -589,6 +935,31 @@ int v4lconvert_try_format(struct v4lconvert_data *data,
 		}
 	}
 
+	/* In case of a non exact resolution match, see if the cam can do 2, 4 or
+	   8 times the resolution as (M)JPEG, which we can then decode at 1/2,
+	   1/4 or 1/8 of its size at little cost */
+	if (try_dest.fmt.pix.width != desired_width ||
+			try_dest.fmt.pix.height != desired_height) {
+		for (i = 2; i <= 8; i *= 2) {
+			try2_dest = *dest_fmt;
+			try2_dest.fmt.pix.width = desired_width * i;
+			try2_dest.fmt.pix.height = desired_height * i;
+			result = v4lconvert_do_try_format(data, &try2_dest, &try2_src);
+			if (result == 0 &&
+			    try2_src.fmt.pix.width / i < desired_width + 8 &&
+			    try2_src.fmt.pix.height / i < desired_height + 2 &&
+			    v4lconvert_jpeg_scale(&try2_src, desired_width,
+						  desired_height) == i) {
+				/* Success! */
+				try2_dest.fmt.pix.width = desired_width;
+				try2_dest.fmt.pix.height = desired_height;
+				try_dest = try2_dest;
+				try_src = try2_src;
+				break;
+			}
+		}
+	}
+
 	/* In case of a non exact resolution match, see if this is a well known
 	   resolution some apps are hardcoded too and try to give the app what it
 	   asked for by cropping a slightly larger resolution or adding a small
@@ -632,6 +1003,34 @@ int v4lconvert_try_format(struct v4lconvert_data *data,
 		}
 	}
 
+	/* In case of a non exact resolution match, when enabled, scale down the
+	   closest resolution, or else the smallest resolution the cam offers
+	   which is at least as large */
+	if ((data->flags & V4LCONVERT_SCALE) &&
+	    (try_dest.fmt.pix.width != desired_width ||
+	     try_dest.fmt.pix.height != desired_height)) {
+		if (!v4lconvert_scale_src_fits(&try_dest, desired_width,
+					       desired_height)) {
+			try2_dest = *dest_fmt;
+			if (v4lconvert_scale_src_size(data, desired_width,
+					desired_height, &try2_dest) == 0 &&
+			    v4lconvert_do_try_format(data, &try2_dest,
+						     &try2_src) == 0) {
+				try_dest = try2_dest;
+				try_src = try2_src;
+			}
+		}
+		if (v4lconvert_scale_src_fits(&try_dest, desired_width,
+					      desired_height)) {
+			/* Success! */
+			try_dest.fmt.pix.width = desired_width;
+			try_dest.fmt.pix.height = desired_height;
+		}
+	}
+
+	if (rotate90)
+		v4lconvert_swap_size(&try_dest);
+
 	/* Some applications / libs (*cough* gstreamer *cough*) will not work
 	   correctly with planar YUV formats when the width is not a multiple of 8
 	   or the height is not a multiple of 2. With RGB formats these apps require
@@ -714,16 +1113,6 @@ unsigned char *v4lconvert_alloc_buffer(int needed,
 	return *buf;
 }
 
-static void v4lconvert_10to8(void *_src, unsigned char *dst, int width, int height)
-{
-	int i;
-	uint16_t *src = _src;
-	
-	for (i = 0; i < width * height; i++) {
-		dst[i] = src[i] >> 2;
-	}
-}
-
 int v4lconvert_oom_error(struct v4lconvert_data *data)
 {
 	V4LCONVERT_ERR("could not allocate memory\n");
@@ -731,7 +1120,199 @@ int v4lconvert_oom_error(struct v4lconvert_data *data)
 	return -1;
 }
 
-static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
+/* A conversion split into horizontal slices, which are done in parallel */
+struct v4lconvert_slice_args {
+	const unsigned char *src;
+	unsigned char *dest;
+	int width;
+	int height;
+	int bytesperline;
+	int yvu;
+	/* Only one of these is set */
+	void (*packed_to_rgb24)(const unsigned char *src, unsigned char *dst,
+		int width, int height, int stride);
+	void (*packed_to_yuv420)(const unsigned char *src, unsigned char *ydst,
+		unsigned char *udst, unsigned char *vdst,
+		int width, int height, int stride);
+	void (*yuv420_to_rgb24)(const unsigned char *ysrc,
+		const unsigned char *usrc, const unsigned char *vsrc,
+		unsigned char *dst, int width, int height);
+};
+
+static void v4lconvert_convert_slice(void *arg, int slice, int first,
+		int last)
+{
+	struct v4lconvert_slice_args *args = arg;
+	int width = args->width;
+	int height = args->height;
+	int bytesperline = args->bytesperline;
+	const unsigned char *src = args->src;
+	unsigned char *dest = args->dest;
+	const unsigned char *usrc, *vsrc;
+	unsigned char *udest, *vdest;
+
+	if (args->packed_to_rgb24) {
+		args->packed_to_rgb24(src + first * bytesperline,
+				dest + first * width * 3,
+				width, last - first, bytesperline);
+	} else if (args->packed_to_yuv420) {
+		if (args->yvu) {
+			vdest = dest + width * height;
+			udest = vdest + width * height / 4;
+		} else {
+			udest = dest + width * height;
+			vdest = udest + width * height / 4;
+		}
+		args->packed_to_yuv420(src + first * bytesperline,
+				dest + first * width,
+				udest + first / 2 * width / 2,
+				vdest + first / 2 * width / 2,
+				width, last - first, bytesperline);
+	} else {
+		if (args->yvu) {
+			vsrc = src + width * height;
+			usrc = vsrc + width * height / 4;
+		} else {
+			usrc = src + width * height;
+			vsrc = usrc + width * height / 4;
+		}
+		args->yuv420_to_rgb24(src + first * width,
+				usrc + first / 2 * width / 2,
+				vsrc + first / 2 * width / 2,
+				dest + first * width * 3,
+				width, last - first);
+	}
+}
+
+/* Bayer demosaicing, done in slices as each line only needs the lines
+   directly above and below it */
+struct v4lconvert_bayer_args {
+	const unsigned char *src;
+	unsigned char *dest;
+	int width;
+	int height;
+	int bytesperline;
+	unsigned int src_pix_fmt;
+	unsigned int dest_pix_fmt;
+	unsigned char *line_buf; /* 3 lines per slice */
+};
+
+static void v4lconvert_bayer_slice(void *arg, int slice, int first, int last)
+{
+	struct v4lconvert_bayer_args *args = arg;
+	unsigned char *line_buf = NULL;
+
+	if (args->line_buf)
+		line_buf = args->line_buf + slice * 3 * args->width;
+
+	switch (args->dest_pix_fmt) {
+	case V4L2_PIX_FMT_RGB24:
+		v4lconvert_bayer_to_rgb24(args->src, args->dest, args->width,
+				args->height, args->bytesperline,
+				args->src_pix_fmt, line_buf, first, last);
+		break;
+	case V4L2_PIX_FMT_BGR24:
+		v4lconvert_bayer_to_bgr24(args->src, args->dest, args->width,
+				args->height, args->bytesperline,
+				args->src_pix_fmt, line_buf, first, last);
+		break;
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+		v4lconvert_bayer_to_yuv420(args->src, args->dest, args->width,
+				args->height, args->bytesperline,
+				args->src_pix_fmt,
+				args->dest_pix_fmt == V4L2_PIX_FMT_YVU420,
+				line_buf, first, last);
+		break;
+	}
+}
+
+/* Try to do the conversion using multiple threads, returns 0 on success,
+   or -1 if the conversion cannot be split into slices, in which case the
+   caller should do it single threaded */
+static int v4lconvert_convert_pixfmt_threaded(struct v4lconvert_data *data,
+	unsigned char *src, int src_size, unsigned char *dest,
+	struct v4l2_format *fmt, unsigned int dest_pix_fmt)
+{
+	struct v4lconvert_slice_args args = {
+		.src = src,
+		.dest = dest,
+		.width = fmt->fmt.pix.width,
+		.height = fmt->fmt.pix.height,
+		.bytesperline = fmt->fmt.pix.bytesperline,
+	};
+	int to_rgb24 = dest_pix_fmt == V4L2_PIX_FMT_RGB24;
+	int to_bgr24 = dest_pix_fmt == V4L2_PIX_FMT_BGR24;
+	int to_yuv420 = !to_rgb24 && !to_bgr24;
+
+	/* Slices must start at a chroma line and the 4:2:0 planes must not
+	   have odd sizes */
+	if ((args.width & 1) || (args.height & 1))
+		return -1;
+
+	switch (fmt->fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_YVYU:
+	case V4L2_PIX_FMT_UYVY:
+		if (src_size < args.width * args.height * 2)
+			return -1;
+		break;
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+		if (to_yuv420 ||
+		    src_size < args.width * args.height * 3 / 2)
+			return -1;
+		break;
+	default:
+		return -1;
+	}
+
+	switch (fmt->fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_YUYV:
+		if (to_rgb24)
+			args.packed_to_rgb24 = v4lconvert_yuyv_to_rgb24;
+		else if (to_bgr24)
+			args.packed_to_rgb24 = v4lconvert_yuyv_to_bgr24;
+		else
+			args.packed_to_yuv420 = v4lconvert_yuyv_to_yuv420_planes;
+		args.yvu = dest_pix_fmt == V4L2_PIX_FMT_YVU420;
+		break;
+	case V4L2_PIX_FMT_YVYU:
+		if (to_rgb24)
+			args.packed_to_rgb24 = v4lconvert_yvyu_to_rgb24;
+		else if (to_bgr24)
+			args.packed_to_rgb24 = v4lconvert_yvyu_to_bgr24;
+		else
+			args.packed_to_yuv420 = v4lconvert_yuyv_to_yuv420_planes;
+		/* yvyu is yuyv with U and V swapped */
+		args.yvu = dest_pix_fmt == V4L2_PIX_FMT_YUV420;
+		break;
+	case V4L2_PIX_FMT_UYVY:
+		if (to_rgb24)
+			args.packed_to_rgb24 = v4lconvert_uyvy_to_rgb24;
+		else if (to_bgr24)
+			args.packed_to_rgb24 = v4lconvert_uyvy_to_bgr24;
+		else
+			args.packed_to_yuv420 = v4lconvert_uyvy_to_yuv420_planes;
+		args.yvu = dest_pix_fmt == V4L2_PIX_FMT_YVU420;
+		break;
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+		if (to_rgb24)
+			args.yuv420_to_rgb24 = v4lconvert_yuv420_planes_to_rgb24;
+		else
+			args.yuv420_to_rgb24 = v4lconvert_yuv420_planes_to_bgr24;
+		args.yvu = fmt->fmt.pix.pixelformat == V4L2_PIX_FMT_YVU420;
+		break;
+	}
+
+	v4lconvert_threads_run(data->threads, args.height, 2,
+			       v4lconvert_convert_slice, &args);
+
+	return 0;
+}
+
+int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 	unsigned char *src, int src_size, unsigned char *dest, int dest_size,
 	struct v4l2_format *fmt, unsigned int dest_pix_fmt)
 {
@@ -741,6 +1322,13 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 	unsigned int height = fmt->fmt.pix.height;
 	unsigned int bytesperline = fmt->fmt.pix.bytesperline;
 
+	if (data->threads && v4lconvert_convert_pixfmt_threaded(data, src,
+				src_size, dest, fmt, dest_pix_fmt) == 0) {
+		fmt->fmt.pix.pixelformat = dest_pix_fmt;
+		v4lconvert_fixup_fmt(fmt);
+		return 0;
+	}
+
 	switch (src_pix_fmt) {
 	/* JPG and variants */
 	case V4L2_PIX_FMT_MJPEG:
@@ -756,15 +1344,6 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 			result = v4lconvert_decode_jpeg_libjpeg(data,
 							src, src_size, dest,
 							fmt, dest_pix_fmt);
-			if (result == -1 && errno == EOPNOTSUPP) {
-				/* Fall back to tinyjpeg */
-				jpeg_destroy_decompress(&data->cinfo);
-				data->cinfo_initialized = 0;
-				data->flags |= V4LCONVERT_USE_TINYJPEG;
-				result = v4lconvert_decode_jpeg_tinyjpeg(data,
-							src, src_size, dest,
-							fmt, dest_pix_fmt, 0);
-			}
 		}
 #endif // HAVE_JPEG
 		break;
@@ -886,6 +1465,12 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		case V4L2_PIX_FMT_YVU420:
 			v4lconvert_hm12_to_yuv420(src, dest, width, height, 1);
 			break;
+		case V4L2_PIX_FMT_NV12:
+			v4lconvert_hm12_to_nv12(src, dest, width, height, 0);
+			break;
+		case V4L2_PIX_FMT_NV21:
+			v4lconvert_hm12_to_nv12(src, dest, width, height, 1);
+			break;
 		}
 		break;
 
@@ -899,8 +1484,7 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 #endif
 	case V4L2_PIX_FMT_SN9C2028:
 	case V4L2_PIX_FMT_SQ905C:
-	case V4L2_PIX_FMT_STV0680:
-	case V4L2_PIX_FMT_SGRBG10: { /* Not compressed but needs some shuffling */
+	case V4L2_PIX_FMT_STV0680: {
 		unsigned char *tmpbuf;
 		struct v4l2_format tmpfmt = *fmt;
 
@@ -910,17 +1494,13 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 			return v4lconvert_oom_error(data);
 
 		switch (src_pix_fmt) {
-		case V4L2_PIX_FMT_SGRBG10:
-			v4lconvert_10to8(src, tmpbuf, width, height);
-			tmpfmt.fmt.pix.pixelformat = V4L2_PIX_FMT_SGRBG8;
-			bytesperline = width;
-			break;
 		case V4L2_PIX_FMT_SPCA561:
 			v4lconvert_decode_spca561(src, tmpbuf, width, height);
 			tmpfmt.fmt.pix.pixelformat = V4L2_PIX_FMT_SGBRG8;
 			break;
 		case V4L2_PIX_FMT_SN9C10X:
-			v4lconvert_decode_sn9c10x(src, tmpbuf, width, height);
+			v4lconvert_decode_sn9c10x(src, src_size, tmpbuf,
+					width, height);
 			tmpfmt.fmt.pix.pixelformat = V4L2_PIX_FMT_SBGGR8;
 			break;
 		case V4L2_PIX_FMT_PAC207:
@@ -954,7 +1534,8 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 			break;
 #endif
 		case V4L2_PIX_FMT_SN9C2028:
-			v4lconvert_decode_sn9c2028(src, tmpbuf, width, height);
+			v4lconvert_decode_sn9c2028(src, src_size, tmpbuf,
+					width, height);
 			tmpfmt.fmt.pix.pixelformat = V4L2_PIX_FMT_SBGGR8;
 			break;
 		case V4L2_PIX_FMT_SQ905C:
@@ -970,39 +1551,77 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		   cheaper, and bayer == rgb and our dest_fmt may be yuv */
 		tmpfmt.fmt.pix.bytesperline = width;
 		tmpfmt.fmt.pix.sizeimage = width * height;
-		v4lprocessing_processing(data->processing, tmpbuf, &tmpfmt);
+		if (data->do_process && v4lprocessing_processing(
+					data->processing, tmpbuf, &tmpfmt))
+			data->do_process = 0;
 		/* Deliberate fall through to raw bayer fmt code! */
 		src_pix_fmt = tmpfmt.fmt.pix.pixelformat;
 		src = tmpbuf;
 		src_size = width * height;
+		bytesperline = width;
 		/* fall through */
 	}
 
-		/* Raw bayer formats */
+		/* Raw bayer formats, the ones with more than 8 bits per pixel
+		   get demosaiced using the 8 most significant bits */
 	case V4L2_PIX_FMT_SBGGR8:
 	case V4L2_PIX_FMT_SGBRG8:
 	case V4L2_PIX_FMT_SGRBG8:
 	case V4L2_PIX_FMT_SRGGB8:
-		if (src_size < (width * height)) {
+	case V4L2_PIX_FMT_SBGGR10:
+	case V4L2_PIX_FMT_SGBRG10:
+	case V4L2_PIX_FMT_SGRBG10:
+	case V4L2_PIX_FMT_SRGGB10:
+	case V4L2_PIX_FMT_SBGGR12:
+	case V4L2_PIX_FMT_SGBRG12:
+	case V4L2_PIX_FMT_SGRBG12:
+	case V4L2_PIX_FMT_SRGGB12:
+	case V4L2_PIX_FMT_SBGGR16:
+	case V4L2_PIX_FMT_SGBRG16:
+	case V4L2_PIX_FMT_SGRBG16:
+	case V4L2_PIX_FMT_SRGGB16:
+	case V4L2_PIX_FMT_SBGGR10P:
+	case V4L2_PIX_FMT_SGBRG10P:
+	case V4L2_PIX_FMT_SGRBG10P:
+	case V4L2_PIX_FMT_SRGGB10P:
+	case V4L2_PIX_FMT_SBGGR12P:
+	case V4L2_PIX_FMT_SGBRG12P:
+	case V4L2_PIX_FMT_SGRBG12P:
+	case V4L2_PIX_FMT_SRGGB12P: {
+		struct v4lconvert_bayer_args args = {
+			.src = src,
+			.dest = dest,
+			.width = width,
+			.height = height,
+			.src_pix_fmt = src_pix_fmt,
+			.dest_pix_fmt = dest_pix_fmt,
+		};
+		int line_size = v4lconvert_bayer_line_size(src_pix_fmt, width);
+
+		if (bytesperline < line_size)
+			bytesperline = line_size;
+		args.bytesperline = bytesperline;
+
+		if (src_size < (height - 1) * bytesperline + line_size) {
 			V4LCONVERT_ERR("short raw bayer data frame\n");
 			errno = EPIPE;
 			result = -1;
 		}
-		switch (dest_pix_fmt) {
-		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_bayer_to_rgb24(src, dest, width, height, bytesperline, src_pix_fmt);
-			break;
-		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_bayer_to_bgr24(src, dest, width, height, bytesperline, src_pix_fmt);
-			break;
-		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_bayer_to_yuv420(src, dest, width, height, bytesperline, src_pix_fmt, 0);
-			break;
-		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_bayer_to_yuv420(src, dest, width, height, bytesperline, src_pix_fmt, 1);
-			break;
+
+		/* Scratch space for unpacking 3 lines per slice to 8 bit */
+		if (line_size != width) {
+			args.line_buf = v4lconvert_alloc_buffer(
+				v4lconvert_threads_count(data->threads) *
+				3 * width, &data->convert_pixfmt_buf,
+				&data->convert_pixfmt_buf_size);
+			if (!args.line_buf)
+				return v4lconvert_oom_error(data);
 		}
+
+		v4lconvert_threads_run(data->threads, height, 2,
+				       v4lconvert_bayer_slice, &args);
 		break;
+	}
 
 	case V4L2_PIX_FMT_SE401: {
 		unsigned char *d = NULL;
@@ -1269,6 +1888,36 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		break;
 
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV21: {
+		int nv21 = src_pix_fmt == V4L2_PIX_FMT_NV21;
+
+		if (src_size < (width * height * 3 / 2)) {
+			V4LCONVERT_ERR("short nv12 data frame\n");
+			errno = EPIPE;
+			result = -1;
+		}
+		switch (dest_pix_fmt) {
+		case V4L2_PIX_FMT_RGB24:
+			v4lconvert_nv12_to_rgb24(src, dest, width, height,
+					bytesperline, nv21);
+			break;
+		case V4L2_PIX_FMT_BGR24:
+			v4lconvert_nv12_to_bgr24(src, dest, width, height,
+					bytesperline, nv21);
+			break;
+		case V4L2_PIX_FMT_YUV420:
+			v4lconvert_nv12_to_yuv420(src, dest, width, height,
+					bytesperline, nv21);
+			break;
+		case V4L2_PIX_FMT_YVU420:
+			v4lconvert_nv12_to_yuv420(src, dest, width, height,
+					bytesperline, !nv21);
+			break;
+		}
+		break;
+	}
+
 	case V4L2_PIX_FMT_NV16: {
 		unsigned char *tmpbuf;
 
@@ -1437,54 +2086,198 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 	return result;
 }
 
-int v4lconvert_convert(struct v4lconvert_data *data,
-		const struct v4l2_format *src_fmt,  /* in */
-		const struct v4l2_format *dest_fmt, /* in */
-		unsigned char *src, int src_size, unsigned char *dest, int dest_size)
+/* A conversion plan holds everything v4lconvert_convert needs which only
+   depends on the src / dest format and the control state: which steps to do,
+   into which buffers, and the intermediate buffers themselves. It is rebuilt
+   when the formats or controls change, so that the per frame work is just
+   running the steps. */
+struct v4lconvert_plan {
+	struct v4lconvert_data *data;
+	struct v4l2_format src_fmt;
+	struct v4l2_format dest_fmt;
+	/* The control values the plan was build for */
+	unsigned int ctrl_values[V4LCONTROL_COUNT];
+	int valid;
+	int copy; /* Return an unprocessed copy of the src frame */
+	int processing;
+	int rotate90;
+	int hflip;
+	int vflip;
+	int crop;
+	int fused; /* Try v4lconvert_fused_convert first */
+	int repack;
+	int convert; /* Number of convert_pixfmt steps, 0 - 2 */
+	int dest_needed;
+	unsigned int jpeg_scale;
+	struct v4l2_format my_src_fmt; /* src_fmt after jpeg scaling */
+	/* The steps of the plan all work on rgb24 / bgr24 / yuv420 / yvu420,
+	   the other destination formats are produced by converting to one of
+	   these (base_fmt) first and then repacking the result */
+	struct v4lconvert_plan *repack_plan;
+	struct v4l2_format base_fmt;
+	/* Src / dest of the steps, NULL for the frame src / dest */
+	unsigned char *convert2_src;
+	unsigned char *convert2_dest;
+	unsigned char *rotate90_src;
+	unsigned char *rotate90_dest;
+	unsigned char *flip_src;
+	unsigned char *flip_dest;
+	unsigned char *crop_src;
+	/* Intermediate buffers */
+	int convert1_buf_size;
+	int convert2_buf_size;
+	int rotate90_buf_size;
+	int flip_buf_size;
+	int crop_buf_size;
+	int repack_buf_size;
+	unsigned char *convert1_buf;
+	unsigned char *convert2_buf;
+	unsigned char *rotate90_buf;
+	unsigned char *flip_buf;
+	unsigned char *crop_buf; /* Scaler weights + accumulators */
+	unsigned char *repack_buf;
+};
+
+/* Only the parts of the format the conversion depends on, sizeimage may
+   change per frame for compressed formats */
+static int v4lconvert_plan_fmt_equal(const struct v4l2_format *a,
+		const struct v4l2_format *b)
+{
+	return a->fmt.pix.pixelformat == b->fmt.pix.pixelformat &&
+	       a->fmt.pix.width == b->fmt.pix.width &&
+	       a->fmt.pix.height == b->fmt.pix.height &&
+	       a->fmt.pix.bytesperline == b->fmt.pix.bytesperline;
+}
+
+static void v4lconvert_plan_set_fmt(struct v4lconvert_plan *plan,
+		const struct v4l2_format *src_fmt,
+		const struct v4l2_format *dest_fmt)
+{
+	plan->src_fmt = *src_fmt;
+	plan->dest_fmt = *dest_fmt;
+	plan->valid = 0;
+}
+
+/* Can the dest be cropped / bordered out of the src, after rotating the src
+   a quarter turn when rotate90 is set ? */
+static int v4lconvert_size_fits(const struct v4l2_format *src_fmt,
+		const struct v4l2_format *dest_fmt, int rotate90)
+{
+	unsigned int width = src_fmt->fmt.pix.width;
+	unsigned int height = src_fmt->fmt.pix.height;
+
+	if (rotate90) {
+		width = src_fmt->fmt.pix.height;
+		height = src_fmt->fmt.pix.width;
+	}
+
+	return (width >= dest_fmt->fmt.pix.width &&
+		height >= dest_fmt->fmt.pix.height) ||
+	       (width <= dest_fmt->fmt.pix.width &&
+		height <= dest_fmt->fmt.pix.height);
+}
+
+static int v4lconvert_plan_build(struct v4lconvert_plan *plan)
 {
-	int res, dest_needed, temp_needed, processing, convert = 0;
-	int rotate90, vflip, hflip, crop;
-	unsigned char *convert1_dest = dest;
-	int convert1_dest_size = dest_size;
-	unsigned char *convert2_src = src, *convert2_dest = dest;
-	int convert2_dest_size = dest_size;
-	unsigned char *rotate90_src = src, *rotate90_dest = dest;
-	unsigned char *flip_src = src, *flip_dest = dest;
-	unsigned char *crop_src = src;
-	struct v4l2_format my_src_fmt = *src_fmt;
-	struct v4l2_format my_dest_fmt = *dest_fmt;
+	struct v4lconvert_data *data = plan->data;
+	const struct v4l2_format *src_fmt = &plan->src_fmt;
+	const struct v4l2_format *dest_fmt = &plan->dest_fmt;
+	struct v4l2_format *my_src_fmt = &plan->my_src_fmt;
+	int temp_needed = 0, repack = 0;
+	int processing, rotation, rotate90, hflip, vflip, crop, convert = 0;
+	int width = dest_fmt->fmt.pix.width, height = dest_fmt->fmt.pix.height;
+	unsigned char *convert2_src = NULL, *convert2_dest = NULL;
+	unsigned char *rotate90_src = NULL, *rotate90_dest = NULL;
+	unsigned char *flip_src = NULL, *flip_dest = NULL;
+	unsigned char *crop_src = NULL;
+
+	plan->valid = 0;
+	v4lcontrol_ctrls_changed_since(data->control, plan->ctrl_values);
 
 	processing = v4lprocessing_pre_processing(data->processing);
-	rotate90 = data->control_flags & V4LCONTROL_ROTATED_90_JPEG;
 	hflip = v4lcontrol_get_ctrl(data->control, V4LCONTROL_HFLIP);
 	vflip = v4lcontrol_get_ctrl(data->control, V4LCONTROL_VFLIP);
-	crop = my_dest_fmt.fmt.pix.width != my_src_fmt.fmt.pix.width ||
-		my_dest_fmt.fmt.pix.height != my_src_fmt.fmt.pix.height;
-
-	if (/* If no conversion/processing is needed */
-			(src_fmt->fmt.pix.pixelformat == dest_fmt->fmt.pix.pixelformat &&
-			 !processing && !rotate90 && !hflip && !vflip && !crop) ||
-			/* or if we should do processing/rotating/flipping but the app tries to
-			   use the native cam format, we just return an unprocessed frame copy */
-			!v4lconvert_supported_dst_format(dest_fmt->fmt.pix.pixelformat)) {
-		int to_copy = MIN(dest_size, src_size);
-		memcpy(dest, src, to_copy);
-		return to_copy;
+
+	/* With a quarter turn the steps before the rotation work on frames
+	   with width and height swapped. When the rotation gets changed between
+	   portrait and landscape while streaming, the negotiated dest size can
+	   not be made out of the src in the new orientation. Then the frames
+	   keep their old orientation until the app sets a new format */
+	rotation = v4lconvert_get_rotation(data);
+	if (!v4lconvert_size_fits(src_fmt, dest_fmt, rotation & 1) &&
+	    v4lconvert_size_fits(src_fmt, dest_fmt, !(rotation & 1)))
+		rotation ^= 1;
+	if (rotation & 1) {
+		width = dest_fmt->fmt.pix.height;
+		height = dest_fmt->fmt.pix.width;
+	}
+	/* Cams with V4LCONTROL_ROTATED_90_JPEG report the rotated size, but
+	   send unrotated jpeg frames */
+	if (data->control_flags & V4LCONTROL_ROTATED_90_JPEG)
+		rotation++;
+	/* The rotate90 step does the odd quarter turn, the 180 degrees are
+	   done by flipping both ways */
+	rotate90 = rotation & 1;
+	if (rotation & 2) {
+		hflip = !hflip;
+		vflip = !vflip;
 	}
 
-	/* sanity check, is the dest buffer large enough? */
-	switch (my_dest_fmt.fmt.pix.pixelformat) {
+	*my_src_fmt = *src_fmt;
+	crop = width != my_src_fmt->fmt.pix.width ||
+		height != my_src_fmt->fmt.pix.height;
+
+	plan->copy =
+		/* If no conversion/processing is needed */
+		(src_fmt->fmt.pix.pixelformat == dest_fmt->fmt.pix.pixelformat &&
+		 !processing && !rotate90 && !hflip && !vflip && !crop) ||
+		/* or if we should do processing/rotating/flipping but the app
+		   tries to use the native cam format, we just return an
+		   unprocessed frame copy */
+		!v4lconvert_supported_dst_format(dest_fmt->fmt.pix.pixelformat);
+	if (plan->copy) {
+		plan->valid = 1;
+		return 0;
+	}
+
+	/* Let the jpeg decoder do (part of) the downscaling */
+	plan->jpeg_scale = v4lconvert_jpeg_scale(my_src_fmt, width, height);
+	if (plan->jpeg_scale > 1) {
+		my_src_fmt->fmt.pix.width /= plan->jpeg_scale;
+		my_src_fmt->fmt.pix.height /= plan->jpeg_scale;
+		crop = width != my_src_fmt->fmt.pix.width ||
+			height != my_src_fmt->fmt.pix.height;
+	}
+
+	switch (dest_fmt->fmt.pix.pixelformat) {
 	case V4L2_PIX_FMT_RGB24:
 	case V4L2_PIX_FMT_BGR24:
-		dest_needed = my_dest_fmt.fmt.pix.width * my_dest_fmt.fmt.pix.height * 3;
-		temp_needed = my_src_fmt.fmt.pix.width * my_src_fmt.fmt.pix.height * 3;
+		plan->dest_needed = width * height * 3;
+		temp_needed = my_src_fmt->fmt.pix.width *
+			my_src_fmt->fmt.pix.height * 3;
 		break;
 	case V4L2_PIX_FMT_YUV420:
 	case V4L2_PIX_FMT_YVU420:
-		dest_needed =
-			my_dest_fmt.fmt.pix.width * my_dest_fmt.fmt.pix.height * 3 / 2;
-		temp_needed =
-			my_src_fmt.fmt.pix.width * my_src_fmt.fmt.pix.height * 3 / 2;
+		plan->dest_needed = width * height * 3 / 2;
+		temp_needed = my_src_fmt->fmt.pix.width *
+			my_src_fmt->fmt.pix.height * 3 / 2;
+		break;
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV21:
+		plan->dest_needed = width * height * 3 / 2;
+		temp_needed = plan->dest_needed;
+		/* HM12 can be de-tiled straight into nv12 / nv21 */
+		repack = my_src_fmt->fmt.pix.pixelformat != V4L2_PIX_FMT_HM12 ||
+			processing || rotate90 || hflip || vflip || crop;
+		break;
+	case V4L2_PIX_FMT_YUYV:
+		plan->dest_needed = width * height * 2;
+		repack = 1;
+		break;
+	case V4L2_PIX_FMT_XRGB32:
+	case V4L2_PIX_FMT_XBGR32:
+		plan->dest_needed = width * height * 4;
+		repack = 1;
 		break;
 	default:
 		V4LCONVERT_ERR("Unknown dest format in conversion\n");
@@ -1492,22 +2285,59 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 		return -1;
 	}
 
-	if (dest_size < dest_needed) {
-		V4LCONVERT_ERR("destination buffer too small (%d < %d)\n",
-				dest_size, dest_needed);
-		errno = EFAULT;
-		return -1;
-	}
+	plan->processing = processing;
+	plan->rotate90 = rotate90;
+	plan->hflip = hflip;
+	plan->vflip = vflip;
+	plan->crop = crop;
+	plan->repack = repack;
+	/* Try to do convert -> flip -> crop in a single pass, without going
+	   through full frame intermediate buffers */
+	plan->fused = !processing && !rotate90 &&
+		(hflip || vflip || crop || repack);
+
+	if (repack) {
+		plan->base_fmt = *dest_fmt;
+		switch (dest_fmt->fmt.pix.pixelformat) {
+		case V4L2_PIX_FMT_XRGB32:
+		case V4L2_PIX_FMT_XBGR32:
+			plan->base_fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_RGB24;
+			break;
+		default:
+			plan->base_fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUV420;
+			break;
+		}
+		v4lconvert_fixup_fmt(&plan->base_fmt);
+
+		if (!v4lconvert_alloc_buffer(plan->base_fmt.fmt.pix.sizeimage,
+				&plan->repack_buf, &plan->repack_buf_size))
+			return v4lconvert_oom_error(data);
+
+		/* Pass the unscaled src_fmt, the repack plan will pick the
+		   same jpeg_scale */
+		if (!plan->repack_plan) {
+			plan->repack_plan = calloc(1, sizeof(*plan->repack_plan));
+			if (!plan->repack_plan)
+				return v4lconvert_oom_error(data);
+			plan->repack_plan->data = data;
+		}
+		v4lconvert_plan_set_fmt(plan->repack_plan, src_fmt,
+					&plan->base_fmt);
+		if (v4lconvert_plan_build(plan->repack_plan))
+			return -1;
 
+		plan->valid = 1;
+		return 0;
+	}
 
 	/* Sometimes we need foo -> rgb -> bar as video processing (whitebalance,
 	   etc.) can only be done on rgb data */
 	if (processing && v4lconvert_processing_needs_double_conversion(
-				my_src_fmt.fmt.pix.pixelformat,
-				my_dest_fmt.fmt.pix.pixelformat))
+				my_src_fmt->fmt.pix.pixelformat,
+				dest_fmt->fmt.pix.pixelformat))
 		convert = 2;
-	else if (my_dest_fmt.fmt.pix.pixelformat !=
-			my_src_fmt.fmt.pix.pixelformat ||
+	else if (dest_fmt->fmt.pix.pixelformat !=
+			my_src_fmt->fmt.pix.pixelformat ||
 		 /* Special case if we do not need to do conversion, but we
 		    are not doing any other step involving copying either,
 		    force going through convert_pixfmt to copy the data from
@@ -1518,30 +2348,26 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 	/* convert_pixfmt (only if convert == 2) -> processing -> convert_pixfmt ->
 	   rotate -> flip -> crop, all steps are optional */
 	if (convert == 2) {
-		convert1_dest = v4lconvert_alloc_buffer(
-				my_src_fmt.fmt.pix.width * my_src_fmt.fmt.pix.height * 3,
-				&data->convert1_buf, &data->convert1_buf_size);
-		if (!convert1_dest)
+		convert2_src = v4lconvert_alloc_buffer(
+				my_src_fmt->fmt.pix.width *
+				my_src_fmt->fmt.pix.height * 3,
+				&plan->convert1_buf, &plan->convert1_buf_size);
+		if (!convert2_src)
 			return v4lconvert_oom_error(data);
-
-		convert1_dest_size =
-			my_src_fmt.fmt.pix.width * my_src_fmt.fmt.pix.height * 3;
-		convert2_src = convert1_dest;
 	}
 
 	if (convert && (rotate90 || hflip || vflip || crop)) {
 		convert2_dest = v4lconvert_alloc_buffer(temp_needed,
-				&data->convert2_buf, &data->convert2_buf_size);
+				&plan->convert2_buf, &plan->convert2_buf_size);
 		if (!convert2_dest)
 			return v4lconvert_oom_error(data);
 
-		convert2_dest_size = temp_needed;
 		rotate90_src = flip_src = crop_src = convert2_dest;
 	}
 
 	if (rotate90 && (hflip || vflip || crop)) {
 		rotate90_dest = v4lconvert_alloc_buffer(temp_needed,
-				&data->rotate90_buf, &data->rotate90_buf_size);
+				&plan->rotate90_buf, &plan->rotate90_buf_size);
 		if (!rotate90_dest)
 			return v4lconvert_oom_error(data);
 
@@ -1549,57 +2375,241 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 	}
 
 	if ((vflip || hflip) && crop) {
-		flip_dest = v4lconvert_alloc_buffer(temp_needed, &data->flip_buf,
-				&data->flip_buf_size);
+		flip_dest = v4lconvert_alloc_buffer(temp_needed,
+				&plan->flip_buf, &plan->flip_buf_size);
 		if (!flip_dest)
 			return v4lconvert_oom_error(data);
 
 		crop_src = flip_dest;
 	}
 
-	/* Done setting sources / dest and allocating intermediate buffers,
-	   real conversion / processing / ... starts here. */
-	if (convert == 2) {
+	if (crop) {
+		struct v4l2_format crop_fmt = *my_src_fmt;
+		int crop_buf_size;
+
+		if (rotate90)
+			v4lconvert_swap_size(&crop_fmt);
+		crop_buf_size = v4lconvert_crop_buf_size(&crop_fmt, dest_fmt);
+		if (crop_buf_size && !v4lconvert_alloc_buffer(crop_buf_size,
+				&plan->crop_buf, &plan->crop_buf_size))
+			return v4lconvert_oom_error(data);
+	}
+
+	plan->convert = convert;
+	plan->convert2_src = convert2_src;
+	plan->convert2_dest = convert2_dest;
+	plan->rotate90_src = rotate90_src;
+	plan->rotate90_dest = rotate90_dest;
+	plan->flip_src = flip_src;
+	plan->flip_dest = flip_dest;
+	plan->crop_src = crop_src;
+	plan->valid = 1;
+
+	return 0;
+}
+
+#define PLAN_BUF(buf, frame_buf)	((buf) ? (buf) : (frame_buf))
+
+/* Rebuild the plan if the controls changed since it was built */
+static int v4lconvert_plan_validate(struct v4lconvert_plan *plan)
+{
+	if (v4lcontrol_ctrls_changed_since(plan->data->control,
+					   plan->ctrl_values))
+		plan->valid = 0;
+	if (!plan->valid && v4lconvert_plan_build(plan))
+		return -1;
+
+	return 0;
+}
+
+static int v4lconvert_plan_run(struct v4lconvert_plan *plan,
+		unsigned char *src, int src_size, unsigned char *dest, int dest_size)
+{
+	struct v4lconvert_data *data = plan->data;
+	struct v4l2_format my_src_fmt;
+	int res, width = plan->dest_fmt.fmt.pix.width;
+	int height = plan->dest_fmt.fmt.pix.height;
+	unsigned char *convert2_src, *convert2_dest;
+
+	if (v4lconvert_plan_validate(plan))
+		return -1;
+
+	if (plan->copy) {
+		int to_copy = MIN(dest_size, src_size);
+		memcpy(dest, src, to_copy);
+		return to_copy;
+	}
+
+	/* sanity check, is the dest buffer large enough? */
+	if (dest_size < plan->dest_needed) {
+		V4LCONVERT_ERR("destination buffer too small (%d < %d)\n",
+				dest_size, plan->dest_needed);
+		errno = EFAULT;
+		return -1;
+	}
+
+	data->jpeg_scale = plan->jpeg_scale;
+	my_src_fmt = plan->my_src_fmt;
+
+	if (plan->fused && v4lconvert_fused_convert(data, src, src_size,
+				&my_src_fmt, dest, &plan->dest_fmt,
+				plan->hflip, plan->vflip) == 0)
+		return plan->dest_needed;
+
+	if (plan->repack) {
+		unsigned char *buf = plan->repack_buf;
+
+		res = v4lconvert_plan_run(plan->repack_plan, src, src_size, buf,
+				plan->base_fmt.fmt.pix.sizeimage);
+		if (res < 0)
+			return res;
+
+		switch (plan->dest_fmt.fmt.pix.pixelformat) {
+		case V4L2_PIX_FMT_NV12:
+			v4lconvert_yuv420_to_nv12(buf, dest, width, height, 0);
+			break;
+		case V4L2_PIX_FMT_NV21:
+			v4lconvert_yuv420_to_nv12(buf, dest, width, height, 1);
+			break;
+		case V4L2_PIX_FMT_YUYV:
+			v4lconvert_yuv420_to_yuyv(buf, dest, width, height);
+			break;
+		case V4L2_PIX_FMT_XRGB32:
+			v4lconvert_rgb24_to_rgb32(buf, dest, width, height, 0);
+			break;
+		case V4L2_PIX_FMT_XBGR32:
+			v4lconvert_rgb24_to_rgb32(buf, dest, width, height, 1);
+			break;
+		}
+
+		return plan->dest_needed;
+	}
+
+	data->do_process = plan->processing &&
+		v4lprocessing_pre_processing(data->processing);
+
+	convert2_src = PLAN_BUF(plan->convert2_src, src);
+	convert2_dest = PLAN_BUF(plan->convert2_dest, dest);
+
+	if (plan->convert == 2) {
 		res = v4lconvert_convert_pixfmt(data, src, src_size,
-				convert1_dest, convert1_dest_size,
-				&my_src_fmt,
-				V4L2_PIX_FMT_RGB24);
+				convert2_src, plan->convert1_buf_size,
+				&my_src_fmt, V4L2_PIX_FMT_RGB24);
 		if (res)
 			return res;
 
 		src_size = my_src_fmt.fmt.pix.sizeimage;
 	}
 
-	if (processing)
-		v4lprocessing_processing(data->processing, convert2_src, &my_src_fmt);
+	if (data->do_process && v4lprocessing_processing(data->processing,
+					convert2_src, &my_src_fmt))
+		data->do_process = 0;
 
-	if (convert) {
+	if (plan->convert) {
 		res = v4lconvert_convert_pixfmt(data, convert2_src, src_size,
-				convert2_dest, convert2_dest_size,
-				&my_src_fmt,
-				my_dest_fmt.fmt.pix.pixelformat);
+				convert2_dest, plan->convert2_dest ?
+				plan->convert2_buf_size : dest_size,
+				&my_src_fmt, plan->dest_fmt.fmt.pix.pixelformat);
 		if (res)
 			return res;
 
 		src_size = my_src_fmt.fmt.pix.sizeimage;
 
 		/* We call processing here again in case the source format was not
-		   rgb, but the dest is. v4lprocessing checks it self it only actually
-		   does the processing once per frame. */
-		if (processing)
-			v4lprocessing_processing(data->processing, convert2_dest, &my_src_fmt);
+		   rgb, but the dest is */
+		if (data->do_process && v4lprocessing_processing(
+					data->processing, convert2_dest,
+					&my_src_fmt))
+			data->do_process = 0;
 	}
 
-	if (rotate90)
-		v4lconvert_rotate90(rotate90_src, rotate90_dest, &my_src_fmt);
+	if (plan->rotate90)
+		v4lconvert_rotate90(PLAN_BUF(plan->rotate90_src, src),
+				    PLAN_BUF(plan->rotate90_dest, dest),
+				    &my_src_fmt);
 
-	if (hflip || vflip)
-		v4lconvert_flip(flip_src, flip_dest, &my_src_fmt, hflip, vflip);
+	if (plan->hflip || plan->vflip)
+		v4lconvert_flip(PLAN_BUF(plan->flip_src, src),
+				PLAN_BUF(plan->flip_dest, dest), &my_src_fmt,
+				plan->hflip, plan->vflip);
 
-	if (crop)
-		v4lconvert_crop(crop_src, dest, &my_src_fmt, &my_dest_fmt);
+	if (plan->crop)
+		v4lconvert_crop(PLAN_BUF(plan->crop_src, src), dest,
+				&my_src_fmt, &plan->dest_fmt, plan->crop_buf);
 
-	return dest_needed;
+	return plan->dest_needed;
+}
+
+struct v4lconvert_plan *v4lconvert_plan_create(struct v4lconvert_data *data,
+		const struct v4l2_format *src_fmt,
+		const struct v4l2_format *dest_fmt)
+{
+	struct v4lconvert_plan *plan = calloc(1, sizeof(*plan));
+
+	if (!plan) {
+		v4lconvert_oom_error(data);
+		return NULL;
+	}
+
+	plan->data = data;
+	v4lconvert_plan_set_fmt(plan, src_fmt, dest_fmt);
+	if (v4lconvert_plan_build(plan)) {
+		int saved_err = errno;
+
+		v4lconvert_plan_destroy(plan);
+		errno = saved_err;
+		return NULL;
+	}
+
+	return plan;
+}
+
+void v4lconvert_plan_destroy(struct v4lconvert_plan *plan)
+{
+	if (!plan)
+		return;
+
+	v4lconvert_plan_destroy(plan->repack_plan);
+	free(plan->convert1_buf);
+	free(plan->convert2_buf);
+	free(plan->rotate90_buf);
+	free(plan->flip_buf);
+	free(plan->crop_buf);
+	free(plan->repack_buf);
+	free(plan);
+}
+
+int v4lconvert_plan_convert(struct v4lconvert_plan *plan,
+		unsigned char *src, int src_size, unsigned char *dest, int dest_size)
+{
+	return v4lconvert_plan_run(plan, src, src_size, dest, dest_size);
+}
+
+int v4lconvert_plan_is_copy(struct v4lconvert_plan *plan)
+{
+	if (v4lconvert_plan_validate(plan))
+		return -1;
+
+	return plan->copy;
+}
+
+int v4lconvert_convert(struct v4lconvert_data *data,
+		const struct v4l2_format *src_fmt,  /* in */
+		const struct v4l2_format *dest_fmt, /* in */
+		unsigned char *src, int src_size, unsigned char *dest, int dest_size)
+{
+	/* Keep a plan for the last used formats */
+	if (!data->plan) {
+		data->plan = calloc(1, sizeof(*data->plan));
+		if (!data->plan)
+			return v4lconvert_oom_error(data);
+		data->plan->data = data;
+		v4lconvert_plan_set_fmt(data->plan, src_fmt, dest_fmt);
+	} else if (!v4lconvert_plan_fmt_equal(&data->plan->src_fmt, src_fmt) ||
+		   !v4lconvert_plan_fmt_equal(&data->plan->dest_fmt, dest_fmt))
+		v4lconvert_plan_set_fmt(data->plan, src_fmt, dest_fmt);
+
+	return v4lconvert_plan_run(data->plan, src, src_size, dest, dest_size);
 }
 
 const char *v4lconvert_get_error_message(struct v4lconvert_data *data)
@@ -1607,15 +2617,31 @@ const char *v4lconvert_get_error_message(struct v4lconvert_data *data)
 	return data->error_msg;
 }
 
+int v4lconvert_workspace_convert(struct v4lconvert_workspace *ws,
+		const struct v4l2_format *src_fmt,  /* in */
+		const struct v4l2_format *dest_fmt, /* in */
+		unsigned char *src, int src_size, unsigned char *dest, int dest_size)
+{
+	return v4lconvert_convert(&ws->data, src_fmt, dest_fmt, src, src_size,
+				  dest, dest_size);
+}
+
+const char *v4lconvert_workspace_get_error_message(
+		struct v4lconvert_workspace *ws)
+{
+	return ws->data.error_msg;
+}
+
 static void v4lconvert_get_framesizes(struct v4lconvert_data *data,
-		unsigned int pixelformat, int index)
+		struct v4lconvert_enum_cache *cache, unsigned int pixelformat,
+		int index)
 {
 	int i, j, match;
 	struct v4l2_frmsizeenum frmsize = { .pixel_format = pixelformat };
 
 	for (i = 0; ; i++) {
 		frmsize.index = i;
-		if (data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
+		if (v4lconvert_enum_cache_ioctl(cache, data,
 				VIDIOC_ENUM_FRAMESIZES, &frmsize))
 			break;
 
@@ -1648,7 +2674,11 @@ static void v4lconvert_get_framesizes(struct v4lconvert_data *data,
 				return;
 			}
 			data->framesizes[data->no_framesizes].type = frmsize.type;
-			data->framesize_supported_src_formats[data->no_framesizes] = 1ULL << index;
+			memset(data->framesize_supported_src_formats[data->no_framesizes],
+			       0, sizeof(data->framesize_supported_src_formats[0]));
+			v4lconvert_src_fmts_set(
+				data->framesize_supported_src_formats[data->no_framesizes],
+				index);
 
 			switch (frmsize.type) {
 			case V4L2_FRMSIZE_TYPE_DISCRETE:
@@ -1661,7 +2691,8 @@ static void v4lconvert_get_framesizes(struct v4lconvert_data *data,
 			}
 			data->no_framesizes++;
 		} else {
-			data->framesize_supported_src_formats[j] |= 1ULL << index;
+			v4lconvert_src_fmts_set(
+				data->framesize_supported_src_formats[j], index);
 		}
 	}
 }
@@ -1669,6 +2700,8 @@ static void v4lconvert_get_framesizes(struct v4lconvert_data *data,
 int v4lconvert_enum_framesizes(struct v4lconvert_data *data,
 		struct v4l2_frmsizeenum *frmsize)
 {
+	int rotate90 = v4lconvert_get_rotation(data) & 1;
+
 	if (!v4lconvert_supported_dst_format(frmsize->pixel_format)) {
 		if (v4lconvert_supported_dst_fmt_only(data)) {
 			errno = EINVAL;
@@ -1688,6 +2721,12 @@ int v4lconvert_enum_framesizes(struct v4lconvert_data *data,
 	switch (frmsize->type) {
 	case V4L2_FRMSIZE_TYPE_DISCRETE:
 		frmsize->discrete = data->framesizes[frmsize->index].discrete;
+		if (rotate90) {
+			frmsize->discrete.width =
+				data->framesizes[frmsize->index].discrete.height;
+			frmsize->discrete.height =
+				data->framesizes[frmsize->index].discrete.width;
+		}
 		/* Apply the same rounding algorithm as v4lconvert_try_format */
 		frmsize->discrete.width &= ~7;
 		frmsize->discrete.height &= ~1;
@@ -1695,6 +2734,17 @@ int v4lconvert_enum_framesizes(struct v4lconvert_data *data,
 	case V4L2_FRMSIZE_TYPE_CONTINUOUS:
 	case V4L2_FRMSIZE_TYPE_STEPWISE:
 		frmsize->stepwise = data->framesizes[frmsize->index].stepwise;
+		if (rotate90) {
+			const struct v4l2_frmsize_stepwise *sw =
+				&data->framesizes[frmsize->index].stepwise;
+
+			frmsize->stepwise.min_width = sw->min_height;
+			frmsize->stepwise.max_width = sw->max_height;
+			frmsize->stepwise.step_width = sw->step_height;
+			frmsize->stepwise.min_height = sw->min_width;
+			frmsize->stepwise.max_height = sw->max_width;
+			frmsize->stepwise.step_height = sw->step_width;
+		}
 		break;
 	}
 
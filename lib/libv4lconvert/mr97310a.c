@@ -22,6 +22,7 @@
 #include <unistd.h>
 #include "libv4lconvert-priv.h"
 #include "libv4lsyscall-priv.h"
+#include "bitstream.h"
 
 #define CLIP(x) ((x) < 0 ? 0 : ((x) > 0xff) ? 0xff : (x))
 
@@ -86,22 +87,13 @@ static void init_mr97310a_decoder(void)
 	decoder_initialized = 1;
 }
 
-static inline unsigned char get_byte(const unsigned char *inp,
-		unsigned int bitpos)
-{
-	const unsigned char *addr;
-
-	addr = inp + (bitpos >> 3);
-	return (addr[0] << (bitpos & 7)) | (addr[1] >> (8 - (bitpos & 7)));
-}
-
 int v4lconvert_decode_mr97310a(struct v4lconvert_data *data,
 		const unsigned char *inp, int src_size,
 		unsigned char *outp, int width, int height)
 {
+	struct v4lconvert_bitstream bs;
 	int row, col;
 	int val;
-	int bitpos;
 	unsigned char code;
 	unsigned char lp, tp, tlp, trp;
 	struct v4l2_control min_clockdiv = { .id = MIN_CLOCKDIV_CID };
@@ -110,9 +102,7 @@ int v4lconvert_decode_mr97310a(struct v4lconvert_data *data,
 		init_mr97310a_decoder();
 
 	/* remove the header */
-	inp += 12;
-
-	bitpos = 0;
+	v4lconvert_bits_init(&bs, inp + 12, src_size - 12);
 
 	/* main decoding loop */
 	for (row = 0; row < height; ++row) {
@@ -120,29 +110,23 @@ int v4lconvert_decode_mr97310a(struct v4lconvert_data *data,
 
 		/* first two pixels in first two rows are stored as raw 8-bit */
 		if (row < 2) {
-			code = get_byte(inp, bitpos);
-			bitpos += 8;
-			*outp++ = code;
-
-			code = get_byte(inp, bitpos);
-			bitpos += 8;
-			*outp++ = code;
-
+			*outp++ = v4lconvert_bits_get(&bs, 8);
+			*outp++ = v4lconvert_bits_get(&bs, 8);
 			col += 2;
 		}
 
 		while (col < width) {
 			/* get bitcode */
-			code = get_byte(inp, bitpos);
+			v4lconvert_bits_refill(&bs);
+			code = v4lconvert_bits_peek(&bs, 8);
 			/* update bit position */
-			bitpos += table[code].len;
+			v4lconvert_bits_skip(&bs, table[code].len);
 
 			/* calculate pixel value */
 			if (table[code].is_abs) {
 				/* get 5 more bits and use them as absolute value */
-				code = get_byte(inp, bitpos);
-				val = (code & 0xf8);
-				bitpos += 5;
+				val = v4lconvert_bits_peek(&bs, 5) << 3;
+				v4lconvert_bits_skip(&bs, 5);
 
 			} else {
 				/* value is relative to top or left pixel */
@@ -178,7 +162,7 @@ int v4lconvert_decode_mr97310a(struct v4lconvert_data *data,
 		}
 
 		/* src_size - 12 because of 12 byte footer */
-		if (((bitpos - 1) / 8) >= (src_size - 12)) {
+		if (((v4lconvert_bits_pos(&bs) - 1) / 8) >= (src_size - 12)) {
 			data->frames_dropped++;
 			if (data->frames_dropped == 3) {
 				/* Tell the driver to go slower as
@@ -17,7 +17,13 @@
 #include <limits.h>
 #include <string.h>
 #include <unistd.h>
+#ifdef V4LCONVERT_DECOMP_PLUGIN
+#include <stdio.h>
+#include <linux/videodev2.h>
+#include "decomp-plugin.h"
+#else
 #include "helper-funcs.h"
+#endif
 
 /******************************************************************************
  * Decompression Functions
@@ -611,12 +617,35 @@ static int v4lconvert_ov511_to_yuv420(unsigned char *src, unsigned char *dest,
 	return rc;
 }
 
+#ifdef V4LCONVERT_DECOMP_PLUGIN
+static int ov511_decompress(unsigned char *src, int src_size,
+		unsigned char *dest, int dest_size, int width, int height, int yvu)
+{
+	if (width <= 0 || width > SHRT_MAX || height <= 0 || height > SHRT_MAX ||
+			width * height * 3 / 2 > dest_size)
+		return -1;
+
+	return v4lconvert_ov511_to_yuv420(src, dest, width, height, yvu,
+			src_size) ? -1 : 0;
+}
+
+__attribute__ ((visibility("default")))
+const struct v4lconvert_decomp_plugin v4lconvert_decomp_plugin = {
+	.abi_version = V4LCONVERT_DECOMP_ABI_VERSION,
+	.pixelformat = V4L2_PIX_FMT_OV511,
+	.decompress = ov511_decompress,
+};
+#else
 int main(int argc, char *argv[])
 {
 	int width, height, yvu, src_size, dest_size;
 	unsigned char src_buf[500000];
 	unsigned char dest_buf[500000];
 
+	if (argc == 2 && !strcmp(argv[1], "--shm"))
+		return v4lconvert_helper_shm_loop(v4lconvert_ov511_to_yuv420,
+				argv[0]);
+
 	while (1) {
 		if (v4lconvert_helper_read(STDIN_FILENO, &width, sizeof(int), argv[0]))
 			return 1; /* Erm, no way to recover without loosing sync with libv4l */
@@ -664,3 +693,4 @@ int main(int argc, char *argv[])
 			return 1; /* Erm, no way to recover without loosing sync with libv4l */
 	}
 }
+#endif
@@ -18,7 +18,13 @@
 #include <limits.h>
 #include <string.h>
 #include <unistd.h>
+#ifdef V4LCONVERT_DECOMP_PLUGIN
+#include <stdio.h>
+#include <linux/videodev2.h>
+#include "decomp-plugin.h"
+#else
 #include "helper-funcs.h"
+#endif
 
 /******************************************************************************
  * Compile-time Options
@@ -1425,12 +1431,35 @@ static int v4lconvert_ov518_to_yuv420(unsigned char *src, unsigned char *dst,
 	return 0;
 }
 
+#ifdef V4LCONVERT_DECOMP_PLUGIN
+static int ov518_decompress(unsigned char *src, int src_size,
+		unsigned char *dest, int dest_size, int width, int height, int yvu)
+{
+	if (width <= 0 || width > SHRT_MAX || height <= 0 || height > SHRT_MAX ||
+			width * height * 3 / 2 > dest_size)
+		return -1;
+
+	return v4lconvert_ov518_to_yuv420(src, dest, width, height, yvu,
+			src_size) ? -1 : 0;
+}
+
+__attribute__ ((visibility("default")))
+const struct v4lconvert_decomp_plugin v4lconvert_decomp_plugin = {
+	.abi_version = V4LCONVERT_DECOMP_ABI_VERSION,
+	.pixelformat = V4L2_PIX_FMT_OV518,
+	.decompress = ov518_decompress,
+};
+#else
 int main(int argc, char *argv[])
 {
 	int width, height, yvu, src_size, dest_size;
 	unsigned char src_buf[200000];
 	unsigned char dest_buf[500000];
 
+	if (argc == 2 && !strcmp(argv[1], "--shm"))
+		return v4lconvert_helper_shm_loop(v4lconvert_ov518_to_yuv420,
+				argv[0]);
+
 	while (1) {
 		if (v4lconvert_helper_read(STDIN_FILENO, &width, sizeof(int), argv[0]))
 			return 1; /* Erm, no way to recover without loosing sync with libv4l */
@@ -1478,3 +1507,4 @@ int main(int argc, char *argv[])
 			return 1; /* Erm, no way to recover without loosing sync with libv4l */
 	}
 }
+#endif
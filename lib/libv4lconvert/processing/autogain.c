@@ -75,6 +75,7 @@ static int autogain_calculate_lookup_tables(
 		unsigned char *buf, const struct v4l2_format *fmt)
 {
 	int x, y, target, steps, avg_lum = 0;
+	unsigned int sum = 0, samples = 0;
 	int gain, exposure, orig_gain, orig_exposure, exposure_low;
 	struct v4l2_control ctrl;
 	struct v4l2_queryctrl gainctrl, expoctrl;
@@ -105,6 +106,8 @@ static int autogain_calculate_lookup_tables(
 		return 0;
 	gain = orig_gain = ctrl.value;
 
+	/* Sample (the line pairs of) every V4L2PROCESSING_STATS_STEP th line
+	   of the center of the frame */
 	switch (fmt->fmt.pix.pixelformat) {
 	case V4L2_PIX_FMT_SGBRG8:
 	case V4L2_PIX_FMT_SGRBG8:
@@ -113,12 +116,15 @@ static int autogain_calculate_lookup_tables(
 		buf += fmt->fmt.pix.height * fmt->fmt.pix.bytesperline / 4 +
 			fmt->fmt.pix.width / 4;
 
-		for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-			for (x = 0; x < fmt->fmt.pix.width / 2; x++)
-				avg_lum += *buf++;
-			buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width / 2;
+		for (y = 0; y + 1 < fmt->fmt.pix.height / 2;
+		     y += 2 * V4L2PROCESSING_STATS_STEP) {
+			for (x = 0; x < 2; x++)
+				v4lprocessing_sum_pairs(buf + (y + x) *
+						fmt->fmt.pix.bytesperline,
+						fmt->fmt.pix.width / 2,
+						&sum, &sum);
+			samples += fmt->fmt.pix.width;
 		}
-		avg_lum /= fmt->fmt.pix.height * fmt->fmt.pix.width / 4;
 		break;
 
 	case V4L2_PIX_FMT_RGB24:
@@ -126,17 +132,18 @@ static int autogain_calculate_lookup_tables(
 		buf += fmt->fmt.pix.height * fmt->fmt.pix.bytesperline / 4 +
 			fmt->fmt.pix.width * 3 / 4;
 
-		for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-			for (x = 0; x < fmt->fmt.pix.width / 2; x++) {
-				avg_lum += *buf++;
-				avg_lum += *buf++;
-				avg_lum += *buf++;
-			}
-			buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width * 3 / 2;
+		for (y = 0; y < fmt->fmt.pix.height / 2;
+		     y += V4L2PROCESSING_STATS_STEP) {
+			v4lprocessing_sum_pairs(buf + y *
+					fmt->fmt.pix.bytesperline,
+					fmt->fmt.pix.width / 2 * 3,
+					&sum, &sum);
+			samples += fmt->fmt.pix.width / 2 * 3;
 		}
-		avg_lum /= fmt->fmt.pix.height * fmt->fmt.pix.width * 3 / 4;
 		break;
 	}
+	if (samples)
+		avg_lum = sum / samples;
 
 	/* If we are off a multiple of deadzone, do multiple steps to reach the
 	   desired lumination fast (with the risc of a slight overshoot) */
@@ -21,15 +21,22 @@
 #ifndef __LIBV4LPROCESSING_PRIV_H
 #define __LIBV4LPROCESSING_PRIV_H
 
+#include <pthread.h>
 #include "../control/libv4lcontrol.h"
 #include "../libv4lsyscall-priv.h"
 
 #define V4L2PROCESSING_UPDATE_RATE 10
+/* The statistics the lookup tables are based on are gathered from every
+   V4L2PROCESSING_STATS_STEP th line (line pair for bayer) only, this is
+   plenty for the frame averages we need */
+#define V4L2PROCESSING_STATS_STEP 4
 
 struct v4lprocessing_data {
 	struct v4lcontrol_data *control;
 	int fd;
-	int do_process;
+	/* Protects all of the below, frames from the same stream may be
+	   processed from multiple threads (see v4lconvert_workspace) */
+	pthread_mutex_t lock;
 	int controls_changed;
 	/* True if any of the lookup tables does not contain
 	   linear 0-255 */
@@ -61,6 +68,14 @@ struct v4lprocessing_filter {
 			unsigned char *buf, const struct v4l2_format *fmt);
 };
 
+/* Add the sums of the even and the odd bytes of a line of bytes bytes to
+   even and odd */
+void v4lprocessing_sum_pairs(const unsigned char *buf, int bytes,
+		unsigned int *even, unsigned int *odd);
+/* Add the sums of each of the 3 colors of a line of rgb24 pixels to sums */
+void v4lprocessing_sum_rgb24(const unsigned char *buf, int pixels,
+		unsigned int *sums);
+
 extern struct v4lprocessing_filter whitebalance_filter;
 extern struct v4lprocessing_filter autogain_filter;
 extern struct v4lprocessing_filter gamma_filter;
@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <pthread.h>
 #include "libv4lprocessing.h"
 #include "libv4lprocessing-priv.h"
 #include "../libv4lconvert-priv.h" /* for PIX_FMT defines */
@@ -45,28 +46,66 @@ struct v4lprocessing_data *v4lprocessing_create(int fd, struct v4lcontrol_data *
 
 	data->fd = fd;
 	data->control = control;
+	pthread_mutex_init(&data->lock, NULL);
 
 	return data;
 }
 
 void v4lprocessing_destroy(struct v4lprocessing_data *data)
 {
+	pthread_mutex_destroy(&data->lock);
 	free(data);
 }
 
 int v4lprocessing_pre_processing(struct v4lprocessing_data *data)
 {
-	int i;
+	int i, do_process = 0;
 
-	data->do_process = 0;
+	pthread_mutex_lock(&data->lock);
 	for (i = 0; i < ARRAY_SIZE(filters); i++) {
 		if (filters[i]->active(data))
-			data->do_process = 1;
+			do_process = 1;
 	}
 
 	data->controls_changed |= v4lcontrol_controls_changed(data->control);
+	pthread_mutex_unlock(&data->lock);
+
+	return do_process;
+}
+
+void v4lprocessing_sum_pairs(const unsigned char *buf, int bytes,
+		unsigned int *even, unsigned int *odd)
+{
+	int x = 0;
+
+	if (v4lconvert_simd.sum_pairs) {
+		x = bytes & ~15;
+		v4lconvert_simd.sum_pairs(buf, x / 2, even, odd);
+	}
+
+	for (; x + 1 < bytes; x += 2) {
+		*even += buf[x];
+		*odd += buf[x + 1];
+	}
+	if (x < bytes)
+		*even += buf[x];
+}
+
+void v4lprocessing_sum_rgb24(const unsigned char *buf, int pixels,
+		unsigned int *sums)
+{
+	int x = 0;
 
-	return data->do_process;
+	if (v4lconvert_simd.sum_rgb24) {
+		x = pixels & ~15;
+		v4lconvert_simd.sum_rgb24(buf, x, sums);
+	}
+
+	for (; x < pixels; x++) {
+		sums[0] += buf[3 * x];
+		sums[1] += buf[3 * x + 1];
+		sums[2] += buf[3 * x + 2];
+	}
 }
 
 static void v4lprocessing_update_lookup_tables(struct v4lprocessing_data *data,
@@ -89,75 +128,83 @@ static void v4lprocessing_update_lookup_tables(struct v4lprocessing_data *data,
 	}
 }
 
+static void v4lprocessing_lut_pairs(unsigned char *buf, int pairs,
+		const unsigned char *lut0, const unsigned char *lut1)
+{
+	int x = 0;
+
+	if (v4lconvert_simd.lut_pairs) {
+		x = pairs & ~15;
+		v4lconvert_simd.lut_pairs(buf, x, lut0, lut1);
+	}
+
+	for (; x < pairs; x++) {
+		buf[2 * x] = lut0[buf[2 * x]];
+		buf[2 * x + 1] = lut1[buf[2 * x + 1]];
+	}
+}
+
+static void v4lprocessing_lut_rgb24(unsigned char *buf, int pixels,
+		const unsigned char *lut0, const unsigned char *lut1,
+		const unsigned char *lut2)
+{
+	int x = 0;
+
+	if (v4lconvert_simd.lut_rgb24) {
+		x = pixels & ~15;
+		v4lconvert_simd.lut_rgb24(buf, x, lut0, lut1, lut2);
+	}
+
+	for (; x < pixels; x++) {
+		buf[3 * x] = lut0[buf[3 * x]];
+		buf[3 * x + 1] = lut1[buf[3 * x + 1]];
+		buf[3 * x + 2] = lut2[buf[3 * x + 2]];
+	}
+}
+
 static void v4lprocessing_do_processing(struct v4lprocessing_data *data,
 		unsigned char *buf, const struct v4l2_format *fmt)
 {
-	int x, y;
+	unsigned int y, bpl = fmt->fmt.pix.bytesperline;
 
 	switch (fmt->fmt.pix.pixelformat) {
 	case V4L2_PIX_FMT_SGBRG8:
 	case V4L2_PIX_FMT_SGRBG8: /* Bayer patterns starting with green */
-		for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-			for (x = 0; x < fmt->fmt.pix.width / 2; x++) {
-				*buf = data->green[*buf];
-				buf++;
-				*buf = data->comp1[*buf];
-				buf++;
-			}
-			buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
-			for (x = 0; x < fmt->fmt.pix.width / 2; x++) {
-				*buf = data->comp2[*buf];
-				buf++;
-				*buf = data->green[*buf];
-				buf++;
-			}
-			buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
+		for (y = 0; y + 1 < fmt->fmt.pix.height; y += 2) {
+			v4lprocessing_lut_pairs(buf + y * bpl,
+						fmt->fmt.pix.width / 2,
+						data->green, data->comp1);
+			v4lprocessing_lut_pairs(buf + (y + 1) * bpl,
+						fmt->fmt.pix.width / 2,
+						data->comp2, data->green);
 		}
 		break;
 
 	case V4L2_PIX_FMT_SBGGR8:
 	case V4L2_PIX_FMT_SRGGB8: /* Bayer patterns *NOT* starting with green */
-		for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-			for (x = 0; x < fmt->fmt.pix.width / 2; x++) {
-				*buf = data->comp1[*buf];
-				buf++;
-				*buf = data->green[*buf];
-				buf++;
-			}
-			buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
-			for (x = 0; x < fmt->fmt.pix.width / 2; x++) {
-				*buf = data->green[*buf];
-				buf++;
-				*buf = data->comp2[*buf];
-				buf++;
-			}
-			buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
+		for (y = 0; y + 1 < fmt->fmt.pix.height; y += 2) {
+			v4lprocessing_lut_pairs(buf + y * bpl,
+						fmt->fmt.pix.width / 2,
+						data->comp1, data->green);
+			v4lprocessing_lut_pairs(buf + (y + 1) * bpl,
+						fmt->fmt.pix.width / 2,
+						data->green, data->comp2);
 		}
 		break;
 
 	case V4L2_PIX_FMT_RGB24:
 	case V4L2_PIX_FMT_BGR24:
-		for (y = 0; y < fmt->fmt.pix.height; y++) {
-			for (x = 0; x < fmt->fmt.pix.width; x++) {
-				*buf = data->comp1[*buf];
-				buf++;
-				*buf = data->green[*buf];
-				buf++;
-				*buf = data->comp2[*buf];
-				buf++;
-			}
-			buf += fmt->fmt.pix.bytesperline - 3 * fmt->fmt.pix.width;
-		}
+		for (y = 0; y < fmt->fmt.pix.height; y++)
+			v4lprocessing_lut_rgb24(buf + y * bpl,
+						fmt->fmt.pix.width, data->comp1,
+						data->green, data->comp2);
 		break;
 	}
 }
 
-void v4lprocessing_processing(struct v4lprocessing_data *data,
+int v4lprocessing_processing(struct v4lprocessing_data *data,
 		unsigned char *buf, const struct v4l2_format *fmt)
 {
-	if (!data->do_process)
-		return;
-
 	/* Do we support the current pixformat? */
 	switch (fmt->fmt.pix.pixelformat) {
 	case V4L2_PIX_FMT_SGBRG8:
@@ -168,9 +215,10 @@ void v4lprocessing_processing(struct v4lprocessing_data *data,
 	case V4L2_PIX_FMT_BGR24:
 		break;
 	default:
-		return; /* Non supported pix format */
+		return 0; /* Non supported pix format */
 	}
 
+	pthread_mutex_lock(&data->lock);
 	if (data->controls_changed ||
 			data->lookup_table_update_counter == V4L2PROCESSING_UPDATE_RATE) {
 		data->controls_changed = 0;
@@ -183,6 +231,7 @@ void v4lprocessing_processing(struct v4lprocessing_data *data,
 
 	if (data->lookup_table_active)
 		v4lprocessing_do_processing(data, buf, fmt);
+	pthread_mutex_unlock(&data->lock);
 
-	data->do_process = 0;
+	return 1;
 }
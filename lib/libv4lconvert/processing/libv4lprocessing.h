@@ -38,10 +38,11 @@ void v4lprocessing_destroy(struct v4lprocessing_data *data);
    return 0 if no processing will be done */
 int v4lprocessing_pre_processing(struct v4lprocessing_data *data);
 
-/* Do the actual processing, this is a nop if v4lprocessing_pre_processing()
-   returned 0, or if called more then 1 time after a single
-   v4lprocessing_pre_processing() call. */
-void v4lprocessing_processing(struct v4lprocessing_data *data,
+/* Do the actual processing of a frame for which v4lprocessing_pre_processing()
+   returned 1. Returns 0 if buf is in a format processing cannot be done on,
+   in which case the caller should call this again after converting the frame
+   to rgb, 1 when done. */
+int v4lprocessing_processing(struct v4lprocessing_data *data,
   unsigned char *buf, const struct v4l2_format *fmt);
 
 #endif
@@ -124,37 +124,31 @@ static int whitebalance_calculate_lookup_tables_bayer(
 		struct v4lprocessing_data *data, unsigned char *buf,
 		const struct v4l2_format *fmt, int starts_with_green)
 {
-	int x, y, a1 = 0, a2 = 0, b1 = 0, b2 = 0;
+	unsigned int y, a1 = 0, a2 = 0, b1 = 0, b2 = 0, samples = 0;
 	int green_avg, comp1_avg, comp2_avg;
 
-	for (y = 0; y < fmt->fmt.pix.height; y += 2) {
-		for (x = 0; x < fmt->fmt.pix.width; x += 2) {
-			a1 += *buf++;
-			a2 += *buf++;
-		}
-		buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
-		for (x = 0; x < fmt->fmt.pix.width; x += 2) {
-			b1 += *buf++;
-			b2 += *buf++;
-		}
-		buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
+	for (y = 0; y + 1 < fmt->fmt.pix.height;
+	     y += 2 * V4L2PROCESSING_STATS_STEP) {
+		v4lprocessing_sum_pairs(buf + y * fmt->fmt.pix.bytesperline,
+					fmt->fmt.pix.width, &a1, &a2);
+		v4lprocessing_sum_pairs(buf + (y + 1) * fmt->fmt.pix.bytesperline,
+					fmt->fmt.pix.width, &b1, &b2);
+		samples += fmt->fmt.pix.width / 2;
 	}
+	if (!samples)
+		return 0;
 
+	/* Norm avg to ~ 0 - 4095 */
 	if (starts_with_green) {
-		green_avg = a1 / 2 + b2 / 2;
-		comp1_avg = a2;
-		comp2_avg = b1;
+		green_avg = (a1 + (long long)b2) * 8 / samples;
+		comp1_avg = a2 * 16LL / samples;
+		comp2_avg = b1 * 16LL / samples;
 	} else {
-		green_avg = a2 / 2 + b1 / 2;
-		comp1_avg = a1;
-		comp2_avg = b2;
+		green_avg = (a2 + (long long)b1) * 8 / samples;
+		comp1_avg = a1 * 16LL / samples;
+		comp2_avg = b2 * 16LL / samples;
 	}
 
-	/* Norm avg to ~ 0 - 4095 */
-	green_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 64;
-	comp1_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 64;
-	comp2_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 64;
-
 	return whitebalance_calculate_lookup_tables_generic(data, green_avg,
 			comp1_avg, comp2_avg);
 }
@@ -163,27 +157,26 @@ static int whitebalance_calculate_lookup_tables_rgb(
 		struct v4lprocessing_data *data, unsigned char *buf,
 		const struct v4l2_format *fmt)
 {
-	int x, y, green_avg = 0, comp1_avg = 0, comp2_avg = 0;
-
-	for (y = 0; y < fmt->fmt.pix.height; y++) {
-		for (x = 0; x < fmt->fmt.pix.width; x++) {
-			comp1_avg += *buf++;
-			green_avg += *buf++;
-			comp2_avg += *buf++;
-		}
-		buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width * 3;
+	unsigned int y, sums[3] = { 0, 0, 0 }, samples = 0;
+	int green_avg, comp1_avg, comp2_avg;
+
+	for (y = 0; y < fmt->fmt.pix.height; y += V4L2PROCESSING_STATS_STEP) {
+		v4lprocessing_sum_rgb24(buf + y * fmt->fmt.pix.bytesperline,
+					fmt->fmt.pix.width, sums);
+		samples += fmt->fmt.pix.width;
 	}
+	if (!samples)
+		return 0;
 
 	/* Norm avg to ~ 0 - 4095 */
-	green_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 16;
-	comp1_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 16;
-	comp2_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 16;
+	comp1_avg = sums[0] * 16LL / samples;
+	green_avg = sums[1] * 16LL / samples;
+	comp2_avg = sums[2] * 16LL / samples;
 
 	return whitebalance_calculate_lookup_tables_generic(data, green_avg,
 			comp1_avg, comp2_avg);
 }
 
-
 static int whitebalance_calculate_lookup_tables(
 		struct v4lprocessing_data *data,
 		unsigned char *buf, const struct v4l2_format *fmt)
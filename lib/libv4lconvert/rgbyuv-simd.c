@@ -0,0 +1,1769 @@
+/*
+
+# SIMD versions of the packed / planar YUV conversion routines from rgbyuv.c,
+# and of the tinyjpeg, bayer demosaicing, video processing, rotation and
+# scaling inner loops
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+
+ */
+
+/*
+ * All routines in here produce bit-exact the same output as the C versions in
+ * rgbyuv.c. They use the same multiplication free "fast slightly less
+ * accurate" yuv -> rgb formula, which fits in 16 bit signed lanes, and take
+ * the same shortcuts (truncating chroma averaging, odd trailing pixels
+ * dropped). The vector loops handle 16 (SSE2 / NEON) or 32 (AVX2) pixels per
+ * iteration, the remaining pixels of each line are done by the scalar tails.
+ *
+ * The jpeg_ycbcr_to_rgb24 routines are the same for the JFIF YCbCr -> rgb
+ * conversion in tinyjpeg.c, they give bit-exact the same output as the 32 bit
+ * fixed point C code there.
+ *
+ * The bayer routines do the middle part of a line for bayer.c, again with
+ * bit-exact the same output as the C code.
+ *
+ * The implementation to use is selected once at runtime by
+ * v4lconvert_simd_init(), rgbyuv.c and tinyjpeg.c call through v4lconvert_simd
+ * when the function pointer for a conversion is set.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libv4lconvert-priv.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define V4LCONVERT_SIMD_X86
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define V4LCONVERT_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+struct v4lconvert_simd_funcs v4lconvert_simd;
+
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+
+#define CLIP(color) (unsigned char)(((color) > 0xFF) ? 0xff : (((color) < 0) ? 0 : (color)))
+
+/* Layout of the packed 4:2:2 formats: byte offset of the first luma sample
+   and of the u and v samples inside a 4 byte macropixel */
+#define YUYV_LAYOUT 0, 1, 3
+#define YVYU_LAYOUT 0, 3, 1
+#define UYVY_LAYOUT 1, 0, 2
+
+static inline void yuv_to_rgb24_pair(int y0, int y1, int u, int v,
+		unsigned char *dest, int bgr)
+{
+	int u1 = (((u - 128) << 7) +  (u - 128)) >> 6;
+	int rg = (((u - 128) << 1) +  (u - 128) +
+			((v - 128) << 2) + ((v - 128) << 1)) >> 3;
+	int v1 = (((v - 128) << 1) +  (v - 128)) >> 1;
+
+	if (bgr) {
+		dest[0] = CLIP(y0 + u1);
+		dest[1] = CLIP(y0 - rg);
+		dest[2] = CLIP(y0 + v1);
+		dest[3] = CLIP(y1 + u1);
+		dest[4] = CLIP(y1 - rg);
+		dest[5] = CLIP(y1 + v1);
+	} else {
+		dest[0] = CLIP(y0 + v1);
+		dest[1] = CLIP(y0 - rg);
+		dest[2] = CLIP(y0 + u1);
+		dest[3] = CLIP(y1 + v1);
+		dest[4] = CLIP(y1 - rg);
+		dest[5] = CLIP(y1 + u1);
+	}
+}
+
+/* Scalar tail for packed 4:2:2 -> rgb24 / bgr24, from pixel x to the end of
+   the line */
+static inline void yuv422_to_rgb24_tail(const unsigned char *src,
+		unsigned char *dest, int x, int width, int yoff, int uoff, int voff,
+		int bgr)
+{
+	for (; x + 1 < width; x += 2) {
+		yuv_to_rgb24_pair(src[yoff], src[yoff + 2], src[uoff], src[voff],
+				dest, bgr);
+		src += 4;
+		dest += 6;
+	}
+}
+
+/* Scalar tail for packed 4:2:2 -> yuv420 chroma, src and src1 point to the
+   first chroma sample of the current pixel pair on 2 successive lines */
+static inline void yuv422_to_yuv420_uv_tail(const unsigned char *src,
+		const unsigned char *src1, unsigned char *udest,
+		unsigned char *vdest, int x, int width)
+{
+	for (; x + 1 < width; x += 2) {
+		*udest++ = ((int) src[0] + src1[0]) / 2;
+		*vdest++ = ((int) src[2] + src1[2]) / 2;
+		src += 4;
+		src1 += 4;
+	}
+}
+
+/* JFIF YCbCr -> rgb: the luma is scaled by 1 << 10 in the C code, so
+   (y << 10 + chroma_term) >> 10 == y + chroma_term >> 10, which allows
+   calculating the chroma terms exactly in 32 bit and then adding them to y
+   in 16 bit lanes */
+#define JPEG_FIX_CR_R	1436	/* FIX(1.40200) */
+#define JPEG_FIX_CB_G	-352	/* -FIX(0.34414) */
+#define JPEG_FIX_CR_G	-731	/* -FIX(0.71414) */
+#define JPEG_FIX_CB_B	1815	/* FIX(1.77200) */
+#define JPEG_ONE_HALF	512
+
+#endif /* V4LCONVERT_SIMD_X86 || V4LCONVERT_SIMD_NEON */
+
+#ifdef V4LCONVERT_SIMD_X86
+
+/* Store 16 pixels given as separate r, g and b byte vectors as 48 bytes of
+   packed rgb24 */
+static inline TARGET_SSE2 void store_rgb24_sse2(unsigned char *dest,
+		__m128i r, __m128i g, __m128i b)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i lo32 = _mm_set_epi32(0, -1, 0, -1);
+	const __m128i lo48 = _mm_set_epi32(0, 0, 0xffff, -1);
+	__m128i rg_lo = _mm_unpacklo_epi8(r, g);
+	__m128i rg_hi = _mm_unpackhi_epi8(r, g);
+	__m128i b0_lo = _mm_unpacklo_epi8(b, zero);
+	__m128i b0_hi = _mm_unpackhi_epi8(b, zero);
+	__m128i p[4];
+	uint32_t last;
+	int i;
+
+	/* 4 pixels per vector as r, g, b, 0 */
+	p[0] = _mm_unpacklo_epi16(rg_lo, b0_lo);
+	p[1] = _mm_unpackhi_epi16(rg_lo, b0_lo);
+	p[2] = _mm_unpacklo_epi16(rg_hi, b0_hi);
+	p[3] = _mm_unpackhi_epi16(rg_hi, b0_hi);
+
+	/* Squeeze out the 0 bytes, first within each 64 bit half, then
+	   between the halves, leaving 12 bytes of pixel data at the start */
+	for (i = 0; i < 4; i++) {
+		p[i] = _mm_or_si128(_mm_and_si128(p[i], lo32),
+			_mm_srli_epi64(_mm_andnot_si128(lo32, p[i]), 8));
+		p[i] = _mm_or_si128(_mm_and_si128(p[i], lo48),
+			_mm_andnot_si128(lo48, _mm_srli_si128(p[i], 2)));
+	}
+
+	/* Overlapping stores, each one overwrites the 4 junk bytes of the
+	   previous one, the last one must not write past the 48 bytes */
+	_mm_storeu_si128((__m128i *)dest, p[0]);
+	_mm_storeu_si128((__m128i *)(dest + 12), p[1]);
+	_mm_storeu_si128((__m128i *)(dest + 24), p[2]);
+	_mm_storel_epi64((__m128i *)(dest + 36), p[3]);
+	last = _mm_cvtsi128_si32(_mm_srli_si128(p[3], 8));
+	memcpy(dest + 44, &last, 4);
+}
+
+/* yuv -> rgb in 16 bit lanes, with u and v already duplicated for each
+   pixel of a pair. T is the vector type and P the intrinsics prefix. */
+#define YUV_TO_RGB_EPI16(T, P, y, u, v, r, g, b) \
+	do { \
+		const T c128 = P##_set1_epi16(128); \
+		T du = P##_sub_epi16(u, c128); \
+		T dv = P##_sub_epi16(v, c128); \
+		T u1 = P##_srai_epi16(P##_add_epi16(P##_slli_epi16(du, 7), du), 6); \
+		T rg = P##_srai_epi16(P##_add_epi16( \
+				P##_add_epi16(P##_slli_epi16(du, 1), du), \
+				P##_add_epi16(P##_slli_epi16(dv, 2), \
+					      P##_slli_epi16(dv, 1))), 3); \
+		T v1 = P##_srai_epi16(P##_add_epi16(P##_slli_epi16(dv, 1), dv), 1); \
+		(r) = P##_add_epi16(y, v1); \
+		(g) = P##_sub_epi16(y, rg); \
+		(b) = P##_add_epi16(y, u1); \
+	} while (0)
+
+/* Split packed 4:2:2 into 16 bit y lanes and u, v lanes duplicated for both
+   pixels of a macropixel. AND is the bitwise and intrinsic for T. */
+#define SPLIT_YUV422(T, P, AND, in, yoff, uoff, y, u, v) \
+	do { \
+		const T lo8 = P##_set1_epi16(0xff); \
+		T c, c0, c1; \
+		if (yoff) { \
+			(y) = P##_srli_epi16(in, 8); \
+			c = AND(in, lo8); \
+		} else { \
+			(y) = AND(in, lo8); \
+			c = P##_srli_epi16(in, 8); \
+		} \
+		/* c is now c0 c1 c0 c1 ... */ \
+		c0 = P##_shufflehi_epi16(P##_shufflelo_epi16(c, \
+			_MM_SHUFFLE(2, 2, 0, 0)), _MM_SHUFFLE(2, 2, 0, 0)); \
+		c1 = P##_shufflehi_epi16(P##_shufflelo_epi16(c, \
+			_MM_SHUFFLE(3, 3, 1, 1)), _MM_SHUFFLE(3, 3, 1, 1)); \
+		/* u is c0 when it is in the first half of the macropixel */ \
+		(u) = (uoff & 2) ? c1 : c0; \
+		(v) = (uoff & 2) ? c0 : c1; \
+	} while (0)
+
+static inline TARGET_SSE2 void packed_to_rgb24_sse2(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int yoff, int uoff, int voff, int bgr)
+{
+	int x;
+
+	while (--height >= 0) {
+		const unsigned char *s = src;
+		unsigned char *d = dest;
+
+		for (x = 0; x + 16 <= width; x += 16) {
+			__m128i y, u, v, r[2], g[2], b[2];
+			int i;
+
+			for (i = 0; i < 2; i++) {
+				__m128i in = _mm_loadu_si128((const __m128i *)(s + 16 * i));
+
+				SPLIT_YUV422(__m128i, _mm, _mm_and_si128, in, yoff, uoff, y, u, v);
+				YUV_TO_RGB_EPI16(__m128i, _mm, y, u, v, r[i], g[i], b[i]);
+			}
+			r[0] = _mm_packus_epi16(r[0], r[1]);
+			g[0] = _mm_packus_epi16(g[0], g[1]);
+			b[0] = _mm_packus_epi16(b[0], b[1]);
+			if (bgr)
+				store_rgb24_sse2(d, b[0], g[0], r[0]);
+			else
+				store_rgb24_sse2(d, r[0], g[0], b[0]);
+			s += 32;
+			d += 48;
+		}
+		yuv422_to_rgb24_tail(s, d, x, width, yoff, uoff, voff, bgr);
+		/* Same as the C version, which leaves src behind the last
+		   complete macropixel and then adds stride - width * 2 */
+		src += stride - (width & 1) * 2;
+		dest += (width & ~1) * 3;
+	}
+}
+
+static inline TARGET_AVX2 void packed_to_rgb24_avx2(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int yoff, int uoff, int voff, int bgr)
+{
+	int x;
+
+	while (--height >= 0) {
+		const unsigned char *s = src;
+		unsigned char *d = dest;
+
+		for (x = 0; x + 32 <= width; x += 32) {
+			__m256i y, u, v, r[2], g[2], b[2];
+			int i;
+
+			for (i = 0; i < 2; i++) {
+				__m256i in = _mm256_loadu_si256((const __m256i *)(s + 32 * i));
+
+				SPLIT_YUV422(__m256i, _mm256, _mm256_and_si256, in, yoff, uoff, y, u, v);
+				YUV_TO_RGB_EPI16(__m256i, _mm256, y, u, v, r[i], g[i], b[i]);
+			}
+			/* packus works per 128 bit lane, restore pixel order */
+			r[0] = _mm256_permute4x64_epi64(_mm256_packus_epi16(r[0], r[1]),
+					_MM_SHUFFLE(3, 1, 2, 0));
+			g[0] = _mm256_permute4x64_epi64(_mm256_packus_epi16(g[0], g[1]),
+					_MM_SHUFFLE(3, 1, 2, 0));
+			b[0] = _mm256_permute4x64_epi64(_mm256_packus_epi16(b[0], b[1]),
+					_MM_SHUFFLE(3, 1, 2, 0));
+			if (bgr) {
+				store_rgb24_sse2(d, _mm256_castsi256_si128(b[0]),
+					_mm256_castsi256_si128(g[0]),
+					_mm256_castsi256_si128(r[0]));
+				store_rgb24_sse2(d + 48, _mm256_extracti128_si256(b[0], 1),
+					_mm256_extracti128_si256(g[0], 1),
+					_mm256_extracti128_si256(r[0], 1));
+			} else {
+				store_rgb24_sse2(d, _mm256_castsi256_si128(r[0]),
+					_mm256_castsi256_si128(g[0]),
+					_mm256_castsi256_si128(b[0]));
+				store_rgb24_sse2(d + 48, _mm256_extracti128_si256(r[0], 1),
+					_mm256_extracti128_si256(g[0], 1),
+					_mm256_extracti128_si256(b[0], 1));
+			}
+			s += 64;
+			d += 96;
+		}
+		yuv422_to_rgb24_tail(s, d, x, width, yoff, uoff, voff, bgr);
+		/* Same as the C version, which leaves src behind the last
+		   complete macropixel and then adds stride - width * 2 */
+		src += stride - (width & 1) * 2;
+		dest += (width & ~1) * 3;
+	}
+}
+
+/* Average the chroma of 8 pixels on 2 lines, returns u in the low 4 and v in
+   the high 4 16 bit lanes (after packs) */
+static inline TARGET_SSE2 __m128i yuv422_avg_uv_sse2(__m128i l0, __m128i l1,
+		int yoff)
+{
+	__m128i c0, c1;
+
+	if (yoff) {
+		const __m128i lo8 = _mm_set1_epi16(0xff);
+
+		c0 = _mm_and_si128(l0, lo8);
+		c1 = _mm_and_si128(l1, lo8);
+	} else {
+		c0 = _mm_srli_epi16(l0, 8);
+		c1 = _mm_srli_epi16(l1, 8);
+	}
+	/* c0 + c1 fits in 9 bits, so the shift is the truncating / 2 */
+	return _mm_srli_epi16(_mm_add_epi16(c0, c1), 1);
+}
+
+static inline TARGET_SSE2 void packed_to_yuv420_sse2(const unsigned char *src,
+		unsigned char *dest, unsigned char *udest, unsigned char *vdest,
+		int width, int height, int stride, int yoff)
+{
+	const __m128i lo8 = _mm_set1_epi16(0xff);
+	const __m128i lo16 = _mm_set1_epi32(0xffff);
+	const unsigned char *src1;
+	int i, x;
+
+	/* copy the Y values */
+	for (i = 0; i < height; i++) {
+		const unsigned char *s = src + i * (stride - (width & 1) * 2);
+
+		for (x = 0; x + 16 <= width; x += 16) {
+			__m128i a = _mm_loadu_si128((const __m128i *)s);
+			__m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+
+			if (yoff) {
+				a = _mm_srli_epi16(a, 8);
+				b = _mm_srli_epi16(b, 8);
+			} else {
+				a = _mm_and_si128(a, lo8);
+				b = _mm_and_si128(b, lo8);
+			}
+			_mm_storeu_si128((__m128i *)dest, _mm_packus_epi16(a, b));
+			s += 32;
+			dest += 16;
+		}
+		for (; x + 1 < width; x += 2) {
+			*dest++ = s[yoff];
+			*dest++ = s[yoff + 2];
+			s += 4;
+		}
+	}
+
+	/* copy the U and V values */
+	for (i = 0; i < height; i += 2) {
+		const unsigned char *s = src + i / 2 * (2 * stride - (width & 1) * 2);
+
+		src1 = s + stride;
+		for (x = 0; x + 16 <= width; x += 16) {
+			__m128i a = yuv422_avg_uv_sse2(
+				_mm_loadu_si128((const __m128i *)s),
+				_mm_loadu_si128((const __m128i *)src1), yoff);
+			__m128i b = yuv422_avg_uv_sse2(
+				_mm_loadu_si128((const __m128i *)(s + 16)),
+				_mm_loadu_si128((const __m128i *)(src1 + 16)), yoff);
+			__m128i u = _mm_packs_epi32(_mm_and_si128(a, lo16),
+						    _mm_and_si128(b, lo16));
+			__m128i v = _mm_packs_epi32(_mm_srli_epi32(a, 16),
+						    _mm_srli_epi32(b, 16));
+
+			_mm_storel_epi64((__m128i *)udest, _mm_packus_epi16(u, u));
+			_mm_storel_epi64((__m128i *)vdest, _mm_packus_epi16(v, v));
+			s += 32;
+			src1 += 32;
+			udest += 8;
+			vdest += 8;
+		}
+		yuv422_to_yuv420_uv_tail(s + !yoff, src1 + !yoff, udest, vdest,
+					 x, width);
+		udest += (width - x) / 2;
+		vdest += (width - x) / 2;
+	}
+}
+
+static inline TARGET_AVX2 void packed_to_yuv420_avx2(const unsigned char *src,
+		unsigned char *dest, unsigned char *udest, unsigned char *vdest,
+		int width, int height, int stride, int yoff)
+{
+	const __m256i lo8 = _mm256_set1_epi16(0xff);
+	const __m256i lo16 = _mm256_set1_epi32(0xffff);
+	const unsigned char *src1;
+	int i, x;
+
+	/* copy the Y values */
+	for (i = 0; i < height; i++) {
+		const unsigned char *s = src + i * (stride - (width & 1) * 2);
+
+		for (x = 0; x + 32 <= width; x += 32) {
+			__m256i a = _mm256_loadu_si256((const __m256i *)s);
+			__m256i b = _mm256_loadu_si256((const __m256i *)(s + 32));
+
+			if (yoff) {
+				a = _mm256_srli_epi16(a, 8);
+				b = _mm256_srli_epi16(b, 8);
+			} else {
+				a = _mm256_and_si256(a, lo8);
+				b = _mm256_and_si256(b, lo8);
+			}
+			_mm256_storeu_si256((__m256i *)dest,
+				_mm256_permute4x64_epi64(_mm256_packus_epi16(a, b),
+					_MM_SHUFFLE(3, 1, 2, 0)));
+			s += 64;
+			dest += 32;
+		}
+		for (; x + 1 < width; x += 2) {
+			*dest++ = s[yoff];
+			*dest++ = s[yoff + 2];
+			s += 4;
+		}
+	}
+
+	/* copy the U and V values */
+	for (i = 0; i < height; i += 2) {
+		const unsigned char *s = src + i / 2 * (2 * stride - (width & 1) * 2);
+
+		src1 = s + stride;
+		for (x = 0; x + 32 <= width; x += 32) {
+			__m256i a, b, c0, c1, u, v;
+
+			a = _mm256_loadu_si256((const __m256i *)s);
+			b = _mm256_loadu_si256((const __m256i *)src1);
+			c0 = yoff ? _mm256_and_si256(a, lo8) : _mm256_srli_epi16(a, 8);
+			c1 = yoff ? _mm256_and_si256(b, lo8) : _mm256_srli_epi16(b, 8);
+			a = _mm256_srli_epi16(_mm256_add_epi16(c0, c1), 1);
+
+			b = _mm256_loadu_si256((const __m256i *)(s + 32));
+			c0 = _mm256_loadu_si256((const __m256i *)(src1 + 32));
+			c1 = yoff ? _mm256_and_si256(c0, lo8) : _mm256_srli_epi16(c0, 8);
+			c0 = yoff ? _mm256_and_si256(b, lo8) : _mm256_srli_epi16(b, 8);
+			b = _mm256_srli_epi16(_mm256_add_epi16(c0, c1), 1);
+
+			/* packs works per 128 bit lane, restore pixel order */
+			u = _mm256_permute4x64_epi64(_mm256_packs_epi32(
+					_mm256_and_si256(a, lo16),
+					_mm256_and_si256(b, lo16)),
+				_MM_SHUFFLE(3, 1, 2, 0));
+			v = _mm256_permute4x64_epi64(_mm256_packs_epi32(
+					_mm256_srli_epi32(a, 16),
+					_mm256_srli_epi32(b, 16)),
+				_MM_SHUFFLE(3, 1, 2, 0));
+			_mm_storeu_si128((__m128i *)udest, _mm_packus_epi16(
+				_mm256_castsi256_si128(u),
+				_mm256_extracti128_si256(u, 1)));
+			_mm_storeu_si128((__m128i *)vdest, _mm_packus_epi16(
+				_mm256_castsi256_si128(v),
+				_mm256_extracti128_si256(v, 1)));
+			s += 64;
+			src1 += 64;
+			udest += 16;
+			vdest += 16;
+		}
+		yuv422_to_yuv420_uv_tail(s + !yoff, src1 + !yoff, udest, vdest,
+					 x, width);
+		udest += (width - x) / 2;
+		vdest += (width - x) / 2;
+	}
+}
+
+/* Note that like the C version this walks the chroma planes with the
+   advance / rewind logic for odd widths */
+static inline TARGET_SSE2 void planar_to_rgb24_sse2(const unsigned char *ysrc,
+		const unsigned char *usrc, const unsigned char *vsrc,
+		unsigned char *dest, int width, int height, int bgr)
+{
+	const __m128i zero = _mm_setzero_si128();
+	int i, j;
+
+	for (i = 0; i < height; i++) {
+		for (j = 0; j + 16 <= width; j += 16) {
+			__m128i y = _mm_loadu_si128((const __m128i *)ysrc);
+			__m128i u = _mm_unpacklo_epi8(
+				_mm_loadl_epi64((const __m128i *)usrc), zero);
+			__m128i v = _mm_unpacklo_epi8(
+				_mm_loadl_epi64((const __m128i *)vsrc), zero);
+			__m128i r[2], g[2], b[2];
+
+			YUV_TO_RGB_EPI16(__m128i, _mm, _mm_unpacklo_epi8(y, zero),
+				_mm_unpacklo_epi16(u, u), _mm_unpacklo_epi16(v, v),
+				r[0], g[0], b[0]);
+			YUV_TO_RGB_EPI16(__m128i, _mm, _mm_unpackhi_epi8(y, zero),
+				_mm_unpackhi_epi16(u, u), _mm_unpackhi_epi16(v, v),
+				r[1], g[1], b[1]);
+			r[0] = _mm_packus_epi16(r[0], r[1]);
+			g[0] = _mm_packus_epi16(g[0], g[1]);
+			b[0] = _mm_packus_epi16(b[0], b[1]);
+			if (bgr)
+				store_rgb24_sse2(dest, b[0], g[0], r[0]);
+			else
+				store_rgb24_sse2(dest, r[0], g[0], b[0]);
+			ysrc += 16;
+			usrc += 8;
+			vsrc += 8;
+			dest += 48;
+		}
+		for (; j < width; j += 2) {
+			yuv_to_rgb24_pair(ysrc[0], ysrc[1], *usrc, *vsrc, dest, bgr);
+			ysrc += 2;
+			usrc++;
+			vsrc++;
+			dest += 6;
+		}
+		/* Rewind u and v for next line */
+		if (!(i & 1)) {
+			usrc -= width / 2;
+			vsrc -= width / 2;
+		}
+	}
+}
+
+static inline TARGET_AVX2 void planar_to_rgb24_avx2(const unsigned char *ysrc,
+		const unsigned char *usrc, const unsigned char *vsrc,
+		unsigned char *dest, int width, int height, int bgr)
+{
+	int i, j;
+
+	for (i = 0; i < height; i++) {
+		for (j = 0; j + 32 <= width; j += 32) {
+			__m256i r[2], g[2], b[2];
+			int k;
+
+			for (k = 0; k < 2; k++) {
+				__m128i u8 = _mm_loadl_epi64((const __m128i *)(usrc + 8 * k));
+				__m128i v8 = _mm_loadl_epi64((const __m128i *)(vsrc + 8 * k));
+				__m128i u16 = _mm_cvtepu8_epi16(u8);
+				__m128i v16 = _mm_cvtepu8_epi16(v8);
+				__m256i y = _mm256_cvtepu8_epi16(
+					_mm_loadu_si128((const __m128i *)(ysrc + 16 * k)));
+				__m256i u = _mm256_inserti128_si256(_mm256_castsi128_si256(
+						_mm_unpacklo_epi16(u16, u16)),
+						_mm_unpackhi_epi16(u16, u16), 1);
+				__m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(
+						_mm_unpacklo_epi16(v16, v16)),
+						_mm_unpackhi_epi16(v16, v16), 1);
+
+				YUV_TO_RGB_EPI16(__m256i, _mm256, y, u, v, r[k], g[k], b[k]);
+			}
+			/* packus works per 128 bit lane, restore pixel order */
+			r[0] = _mm256_permute4x64_epi64(_mm256_packus_epi16(r[0], r[1]),
+					_MM_SHUFFLE(3, 1, 2, 0));
+			g[0] = _mm256_permute4x64_epi64(_mm256_packus_epi16(g[0], g[1]),
+					_MM_SHUFFLE(3, 1, 2, 0));
+			b[0] = _mm256_permute4x64_epi64(_mm256_packus_epi16(b[0], b[1]),
+					_MM_SHUFFLE(3, 1, 2, 0));
+			if (bgr) {
+				__m256i t = r[0];
+
+				r[0] = b[0];
+				b[0] = t;
+			}
+			store_rgb24_sse2(dest, _mm256_castsi256_si128(r[0]),
+				_mm256_castsi256_si128(g[0]),
+				_mm256_castsi256_si128(b[0]));
+			store_rgb24_sse2(dest + 48, _mm256_extracti128_si256(r[0], 1),
+				_mm256_extracti128_si256(g[0], 1),
+				_mm256_extracti128_si256(b[0], 1));
+			ysrc += 32;
+			usrc += 16;
+			vsrc += 16;
+			dest += 96;
+		}
+		for (; j < width; j += 2) {
+			yuv_to_rgb24_pair(ysrc[0], ysrc[1], *usrc, *vsrc, dest, bgr);
+			ysrc += 2;
+			usrc++;
+			vsrc++;
+			dest += 6;
+		}
+		/* Rewind u and v for next line */
+		if (!(i & 1)) {
+			usrc -= width / 2;
+			vsrc -= width / 2;
+		}
+	}
+}
+
+/* Calculate the r, g and b chroma terms for 8 chroma samples */
+static inline TARGET_SSE2 void jpeg_chroma_sse2(const unsigned char *cbsrc,
+		const unsigned char *crsrc, __m128i *dr, __m128i *dg, __m128i *db)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i c128 = _mm_set1_epi16(128);
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i kr = _mm_setr_epi16(JPEG_FIX_CR_R, JPEG_ONE_HALF,
+		JPEG_FIX_CR_R, JPEG_ONE_HALF, JPEG_FIX_CR_R, JPEG_ONE_HALF,
+		JPEG_FIX_CR_R, JPEG_ONE_HALF);
+	const __m128i kg = _mm_setr_epi16(JPEG_FIX_CB_G, JPEG_FIX_CR_G,
+		JPEG_FIX_CB_G, JPEG_FIX_CR_G, JPEG_FIX_CB_G, JPEG_FIX_CR_G,
+		JPEG_FIX_CB_G, JPEG_FIX_CR_G);
+	const __m128i kb = _mm_setr_epi16(JPEG_FIX_CB_B, JPEG_ONE_HALF,
+		JPEG_FIX_CB_B, JPEG_ONE_HALF, JPEG_FIX_CB_B, JPEG_ONE_HALF,
+		JPEG_FIX_CB_B, JPEG_ONE_HALF);
+	const __m128i half = _mm_set1_epi32(JPEG_ONE_HALF);
+	__m128i cb = _mm_sub_epi16(_mm_unpacklo_epi8(
+		_mm_loadl_epi64((const __m128i *)cbsrc), zero), c128);
+	__m128i cr = _mm_sub_epi16(_mm_unpacklo_epi8(
+		_mm_loadl_epi64((const __m128i *)crsrc), zero), c128);
+	__m128i lo, hi;
+
+	lo = _mm_madd_epi16(_mm_unpacklo_epi16(cr, one), kr);
+	hi = _mm_madd_epi16(_mm_unpackhi_epi16(cr, one), kr);
+	*dr = _mm_packs_epi32(_mm_srai_epi32(lo, 10), _mm_srai_epi32(hi, 10));
+
+	lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(cb, cr), kg), half);
+	hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(cb, cr), kg), half);
+	*dg = _mm_packs_epi32(_mm_srai_epi32(lo, 10), _mm_srai_epi32(hi, 10));
+
+	lo = _mm_madd_epi16(_mm_unpacklo_epi16(cb, one), kb);
+	hi = _mm_madd_epi16(_mm_unpackhi_epi16(cb, one), kb);
+	*db = _mm_packs_epi32(_mm_srai_epi32(lo, 10), _mm_srai_epi32(hi, 10));
+}
+
+static TARGET_SSE2 void jpeg_ycbcr_to_rgb24_sse2(const unsigned char *ysrc,
+		const unsigned char *cbsrc, const unsigned char *crsrc,
+		unsigned char *dest, int width, int h_sub, int bgr)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i dr[2], dg[2], db[2], r, g, b;
+	int x;
+
+	for (x = 0; x < width; x += 16) {
+		__m128i y = _mm_loadl_epi64((const __m128i *)ysrc);
+
+		if (h_sub) {
+			jpeg_chroma_sse2(cbsrc, crsrc, &dr[0], &dg[0], &db[0]);
+			dr[1] = _mm_unpackhi_epi16(dr[0], dr[0]);
+			dg[1] = _mm_unpackhi_epi16(dg[0], dg[0]);
+			db[1] = _mm_unpackhi_epi16(db[0], db[0]);
+			dr[0] = _mm_unpacklo_epi16(dr[0], dr[0]);
+			dg[0] = _mm_unpacklo_epi16(dg[0], dg[0]);
+			db[0] = _mm_unpacklo_epi16(db[0], db[0]);
+			cbsrc += 8;
+			crsrc += 8;
+		} else {
+			jpeg_chroma_sse2(cbsrc, crsrc, &dr[0], &dg[0], &db[0]);
+			cbsrc += 8;
+			crsrc += 8;
+			if (x + 8 < width) {
+				jpeg_chroma_sse2(cbsrc, crsrc, &dr[1], &dg[1],
+						 &db[1]);
+				cbsrc += 8;
+				crsrc += 8;
+			}
+		}
+
+		if (x + 8 < width) {
+			__m128i y1 = _mm_loadl_epi64((const __m128i *)(ysrc + 8));
+
+			y = _mm_unpacklo_epi8(y, zero);
+			y1 = _mm_unpacklo_epi8(y1, zero);
+			r = _mm_packus_epi16(_mm_add_epi16(y, dr[0]),
+					     _mm_add_epi16(y1, dr[1]));
+			g = _mm_packus_epi16(_mm_add_epi16(y, dg[0]),
+					     _mm_add_epi16(y1, dg[1]));
+			b = _mm_packus_epi16(_mm_add_epi16(y, db[0]),
+					     _mm_add_epi16(y1, db[1]));
+			if (bgr)
+				store_rgb24_sse2(dest, b, g, r);
+			else
+				store_rgb24_sse2(dest, r, g, b);
+		} else {
+			/* Last 8 pixels, go through a temp buffer so that we
+			   do not write past the end of the line */
+			unsigned char tmp[48];
+
+			y = _mm_unpacklo_epi8(y, zero);
+			r = _mm_packus_epi16(_mm_add_epi16(y, dr[0]), zero);
+			g = _mm_packus_epi16(_mm_add_epi16(y, dg[0]), zero);
+			b = _mm_packus_epi16(_mm_add_epi16(y, db[0]), zero);
+			if (bgr)
+				store_rgb24_sse2(tmp, b, g, r);
+			else
+				store_rgb24_sse2(tmp, r, g, b);
+			memcpy(dest, tmp, 24);
+		}
+		ysrc += 16;
+		dest += 48;
+	}
+}
+
+/* Bayer demosaicing of 8 pixel pairs at a time, see bayer_line_to_rgbbgr24()
+   and bayer_line_to_y() in bayer.c. Loading the lines at offset 0 and 2 and
+   splitting the loads in even and odd 16 bit lanes gives all neighbours of
+   the 1st (lanes of cur >> 8) and 2nd (lanes of cur + 2 & 0xff) pixel of
+   each pair. */
+#define BAYER_LOAD_SSE2(prev, cur, next) \
+	__m128i p = _mm_loadu_si128((const __m128i *)(prev)); \
+	__m128i p2 = _mm_loadu_si128((const __m128i *)((prev) + 2)); \
+	__m128i c = _mm_loadu_si128((const __m128i *)(cur)); \
+	__m128i c2 = _mm_loadu_si128((const __m128i *)((cur) + 2)); \
+	__m128i n = _mm_loadu_si128((const __m128i *)(next)); \
+	__m128i n2 = _mm_loadu_si128((const __m128i *)((next) + 2)); \
+	/* The diagonal and the horizontal + vertical neighbours of the 1st \
+	   pixel, they are 4 samples of the 2 colors it is missing */ \
+	__m128i diag = _mm_add_epi16( \
+		_mm_add_epi16(_mm_and_si128(p, lo8), _mm_and_si128(p2, lo8)), \
+		_mm_add_epi16(_mm_and_si128(n, lo8), _mm_and_si128(n2, lo8))); \
+	__m128i cross = _mm_add_epi16( \
+		_mm_add_epi16(_mm_srli_epi16(p, 8), _mm_and_si128(c, lo8)), \
+		_mm_add_epi16(_mm_and_si128(c2, lo8), _mm_srli_epi16(n, 8)))
+
+static TARGET_SSE2 void bayer_to_rgb24_pairs_sse2(const unsigned char *prev,
+		const unsigned char *cur, const unsigned char *next,
+		unsigned char *dest, int pairs, int blue_line)
+{
+	const __m128i lo8 = _mm_set1_epi16(0xff);
+	const __m128i two = _mm_set1_epi16(2);
+	int i;
+
+	for (i = 0; i < pairs; i += 8) {
+		BAYER_LOAD_SSE2(prev, cur, next);
+		__m128i ch0, ch1, ch2;
+
+		diag = _mm_srli_epi16(_mm_add_epi16(diag, two), 2);
+		cross = _mm_srli_epi16(_mm_add_epi16(cross, two), 2);
+
+		/* 1st pixel in the low, 2nd pixel in the high byte of each
+		   lane, the 2nd pixel gets the rounded average of its vertical
+		   and horizontal neighbours (_mm_avg_epu8 rounds up too) */
+		ch0 = _mm_or_si128(diag, _mm_slli_epi16(_mm_avg_epu8(p2, n2), 8));
+		ch1 = _mm_or_si128(cross, _mm_slli_epi16(c2, 8));
+		ch2 = _mm_or_si128(_mm_srli_epi16(c, 8),
+			_mm_andnot_si128(lo8, _mm_avg_epu8(c, c2)));
+
+		if (blue_line)
+			store_rgb24_sse2(dest, ch0, ch1, ch2);
+		else
+			store_rgb24_sse2(dest, ch2, ch1, ch0);
+
+		prev += 16;
+		cur += 16;
+		next += 16;
+		dest += 48;
+	}
+}
+
+/* (ka * a + kb * b + kc * c + 524288) >> 15 for 8 pixels in 16 bit lanes, kab
+   holds ka and kb as 16 bit pairs, kc is 32 bit. 524288 is 16 << 15. */
+static inline TARGET_SSE2 __m128i bayer_y_sse2(__m128i a, __m128i b,
+		__m128i c, __m128i kab, __m128i kc)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i lo, hi;
+
+	lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(a, b), kab),
+			   _mm_madd_epi16(_mm_unpacklo_epi16(c, zero), kc));
+	hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(a, b), kab),
+			   _mm_madd_epi16(_mm_unpackhi_epi16(c, zero), kc));
+	return _mm_add_epi16(_mm_packs_epi32(_mm_srai_epi32(lo, 15),
+					     _mm_srai_epi32(hi, 15)),
+			     _mm_set1_epi16(16));
+}
+
+#define BAYER_K_PAIR(a, b) _mm_set1_epi32(((b) << 16) | (a))
+
+static TARGET_SSE2 void bayer_to_y_pairs_sse2(const unsigned char *prev,
+		const unsigned char *cur, const unsigned char *next,
+		unsigned char *ydest, int pairs, int blue_line)
+{
+	const __m128i lo8 = _mm_set1_epi16(0xff);
+	/* 1st pixel: own color and cross (green), diagonal */
+	const __m128i k1 = BAYER_K_PAIR(blue_line ? 8453 : 3223, 4148);
+	const __m128i k1_diag = _mm_set1_epi32(blue_line ? 806 : 2113);
+	/* 2nd pixel (green): vertical and own color, horizontal */
+	const __m128i k2 = BAYER_K_PAIR(blue_line ? 1611 : 4226, 16594);
+	const __m128i k2_hor = _mm_set1_epi32(blue_line ? 4226 : 1611);
+	int i;
+
+	for (i = 0; i < pairs; i += 8) {
+		BAYER_LOAD_SSE2(prev, cur, next);
+		__m128i vert = _mm_add_epi16(_mm_and_si128(p2, lo8),
+					     _mm_and_si128(n2, lo8));
+		__m128i hor = _mm_add_epi16(_mm_srli_epi16(c, 8),
+					    _mm_srli_epi16(c2, 8));
+		__m128i y1, y2;
+
+		y1 = bayer_y_sse2(_mm_srli_epi16(c, 8), cross, diag, k1, k1_diag);
+		y2 = bayer_y_sse2(vert, _mm_and_si128(c2, lo8), hor, k2, k2_hor);
+		_mm_storeu_si128((__m128i *)ydest,
+				 _mm_or_si128(y1, _mm_slli_epi16(y2, 8)));
+
+		prev += 16;
+		cur += 16;
+		next += 16;
+		ydest += 16;
+	}
+}
+
+/* libv4lprocessing statistics, psadbw sums 8 bytes at once, and the masks
+   select the even / odd bytes resp. one color of 16 rgb24 pixels */
+static TARGET_SSE2 void sum_pairs_sse2(const unsigned char *src, int pairs,
+		unsigned int *even, unsigned int *odd)
+{
+	const __m128i lo8 = _mm_set1_epi16(0x00ff);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i e = zero, o = zero;
+	int i;
+
+	for (i = 0; i < pairs; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+
+		e = _mm_add_epi64(e, _mm_sad_epu8(_mm_and_si128(v, lo8), zero));
+		o = _mm_add_epi64(o, _mm_sad_epu8(_mm_srli_epi16(v, 8), zero));
+	}
+	e = _mm_add_epi64(e, _mm_unpackhi_epi64(e, e));
+	o = _mm_add_epi64(o, _mm_unpackhi_epi64(o, o));
+	*even += _mm_cvtsi128_si32(e);
+	*odd += _mm_cvtsi128_si32(o);
+}
+
+static const unsigned char rgb24_masks[3][3][16] __attribute__((aligned(16))) = {
+	{
+		{ 255, 0, 0, 255, 0, 0, 255, 0, 0, 255, 0, 0, 255, 0, 0, 255 },
+		{ 0, 255, 0, 0, 255, 0, 0, 255, 0, 0, 255, 0, 0, 255, 0, 0 },
+		{ 0, 0, 255, 0, 0, 255, 0, 0, 255, 0, 0, 255, 0, 0, 255, 0 },
+	}, {
+		{ 0, 0, 255, 0, 0, 255, 0, 0, 255, 0, 0, 255, 0, 0, 255, 0 },
+		{ 255, 0, 0, 255, 0, 0, 255, 0, 0, 255, 0, 0, 255, 0, 0, 255 },
+		{ 0, 255, 0, 0, 255, 0, 0, 255, 0, 0, 255, 0, 0, 255, 0, 0 },
+	}, {
+		{ 0, 255, 0, 0, 255, 0, 0, 255, 0, 0, 255, 0, 0, 255, 0, 0 },
+		{ 0, 0, 255, 0, 0, 255, 0, 0, 255, 0, 0, 255, 0, 0, 255, 0 },
+		{ 255, 0, 0, 255, 0, 0, 255, 0, 0, 255, 0, 0, 255, 0, 0, 255 },
+	},
+};
+
+static TARGET_SSE2 void sum_rgb24_sse2(const unsigned char *src, int pixels,
+		unsigned int *sums)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc[3] = { zero, zero, zero };
+	int i, j, c;
+
+	for (i = 0; i < pixels; i += 16) {
+		for (j = 0; j < 3; j++) {
+			__m128i v = _mm_loadu_si128(
+				(const __m128i *)(src + 3 * i + 16 * j));
+
+			for (c = 0; c < 3; c++) {
+				__m128i m = _mm_load_si128(
+					(const __m128i *)rgb24_masks[j][c]);
+
+				acc[c] = _mm_add_epi64(acc[c], _mm_sad_epu8(
+						_mm_and_si128(v, m), zero));
+			}
+		}
+	}
+	for (c = 0; c < 3; c++) {
+		acc[c] = _mm_add_epi64(acc[c], _mm_unpackhi_epi64(acc[c], acc[c]));
+		sums[c] += _mm_cvtsi128_si32(acc[c]);
+	}
+}
+
+/* Interleaving rows i and i + 8 moves the highest row index bit to the
+   lowest column index bit and the highest column bit to the lowest row bit,
+   after 4 rounds the row and column index have swapped places */
+#define TRANSPOSE_ZIP_SSE2(a, b, i) \
+	b[2 * (i)] = _mm_unpacklo_epi8(a[i], a[(i) + 8]); \
+	b[2 * (i) + 1] = _mm_unpackhi_epi8(a[i], a[(i) + 8]);
+#define TRANSPOSE_ROUND_SSE2(a, b) \
+	TRANSPOSE_ZIP_SSE2(a, b, 0) TRANSPOSE_ZIP_SSE2(a, b, 1) \
+	TRANSPOSE_ZIP_SSE2(a, b, 2) TRANSPOSE_ZIP_SSE2(a, b, 3) \
+	TRANSPOSE_ZIP_SSE2(a, b, 4) TRANSPOSE_ZIP_SSE2(a, b, 5) \
+	TRANSPOSE_ZIP_SSE2(a, b, 6) TRANSPOSE_ZIP_SSE2(a, b, 7)
+
+static TARGET_SSE2 void transpose_16x16_sse2(const unsigned char *src,
+		int src_stride, unsigned char *dst, int dst_stride)
+{
+	__m128i a[16], b[16];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		a[i] = _mm_loadu_si128((const __m128i *)(src + i * src_stride));
+	TRANSPOSE_ROUND_SSE2(a, b)
+	TRANSPOSE_ROUND_SSE2(b, a)
+	TRANSPOSE_ROUND_SSE2(a, b)
+	TRANSPOSE_ROUND_SSE2(b, a)
+	for (i = 0; i < 16; i++)
+		_mm_storeu_si128((__m128i *)(dst + i * dst_stride), a[i]);
+}
+
+/* pshufb masks for splitting 16 rgb24 pixels (3 registers) into 16 bytes of
+   each color, indexed [register][color], resp. for merging 16 bytes of each
+   color back into 16 rgb24 pixels, indexed [color][register] */
+static const unsigned char rgb24_split_masks[3][3][16] __attribute__((aligned(16))) = {
+	{
+		{ 0, 3, 6, 9, 12, 15, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128 },
+		{ 1, 4, 7, 10, 13, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128 },
+		{ 2, 5, 8, 11, 14, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128 },
+	}, {
+		{ 128, 128, 128, 128, 128, 128, 2, 5, 8, 11, 14, 128, 128, 128, 128, 128 },
+		{ 128, 128, 128, 128, 128, 0, 3, 6, 9, 12, 15, 128, 128, 128, 128, 128 },
+		{ 128, 128, 128, 128, 128, 1, 4, 7, 10, 13, 128, 128, 128, 128, 128, 128 },
+	}, {
+		{ 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 1, 4, 7, 10, 13 },
+		{ 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 2, 5, 8, 11, 14 },
+		{ 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 0, 3, 6, 9, 12, 15 },
+	},
+};
+
+static const unsigned char rgb24_merge_masks[3][3][16] __attribute__((aligned(16))) = {
+	{
+		{ 0, 128, 128, 1, 128, 128, 2, 128, 128, 3, 128, 128, 4, 128, 128, 5 },
+		{ 128, 128, 6, 128, 128, 7, 128, 128, 8, 128, 128, 9, 128, 128, 10, 128 },
+		{ 128, 11, 128, 128, 12, 128, 128, 13, 128, 128, 14, 128, 128, 15, 128, 128 },
+	}, {
+		{ 128, 0, 128, 128, 1, 128, 128, 2, 128, 128, 3, 128, 128, 4, 128, 128 },
+		{ 5, 128, 128, 6, 128, 128, 7, 128, 128, 8, 128, 128, 9, 128, 128, 10 },
+		{ 128, 128, 11, 128, 128, 12, 128, 128, 13, 128, 128, 14, 128, 128, 15, 128 },
+	}, {
+		{ 128, 128, 0, 128, 128, 1, 128, 128, 2, 128, 128, 3, 128, 128, 4, 128 },
+		{ 128, 5, 128, 128, 6, 128, 128, 7, 128, 128, 8, 128, 128, 9, 128, 128 },
+		{ 10, 128, 128, 11, 128, 128, 12, 128, 128, 13, 128, 128, 14, 128, 128, 15 },
+	},
+};
+
+#define RGB24_SPLIT_MERGE(v0, v1, v2, masks, c) \
+	_mm_or_si128(_mm_or_si128( \
+		_mm_shuffle_epi8(v0, *(const __m128i *)masks[0][c]), \
+		_mm_shuffle_epi8(v1, *(const __m128i *)masks[1][c])), \
+		_mm_shuffle_epi8(v2, *(const __m128i *)masks[2][c]))
+
+/* Note this uses the ssse3 pshufb, so it is only used in the AVX2 table */
+static TARGET_AVX2 void transpose_rgb24_16x16_avx2(const unsigned char *src,
+		int src_stride, unsigned char *dst, int dst_stride)
+{
+	__m128i r[16], g[16], b[16], t[16];
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		const __m128i *s = (const __m128i *)(src + i * src_stride);
+		__m128i v0 = _mm_loadu_si128(s);
+		__m128i v1 = _mm_loadu_si128(s + 1);
+		__m128i v2 = _mm_loadu_si128(s + 2);
+
+		r[i] = RGB24_SPLIT_MERGE(v0, v1, v2, rgb24_split_masks, 0);
+		g[i] = RGB24_SPLIT_MERGE(v0, v1, v2, rgb24_split_masks, 1);
+		b[i] = RGB24_SPLIT_MERGE(v0, v1, v2, rgb24_split_masks, 2);
+	}
+	TRANSPOSE_ROUND_SSE2(r, t)
+	TRANSPOSE_ROUND_SSE2(t, r)
+	TRANSPOSE_ROUND_SSE2(r, t)
+	TRANSPOSE_ROUND_SSE2(t, r)
+	TRANSPOSE_ROUND_SSE2(g, t)
+	TRANSPOSE_ROUND_SSE2(t, g)
+	TRANSPOSE_ROUND_SSE2(g, t)
+	TRANSPOSE_ROUND_SSE2(t, g)
+	TRANSPOSE_ROUND_SSE2(b, t)
+	TRANSPOSE_ROUND_SSE2(t, b)
+	TRANSPOSE_ROUND_SSE2(b, t)
+	TRANSPOSE_ROUND_SSE2(t, b)
+	for (i = 0; i < 16; i++) {
+		__m128i *d = (__m128i *)(dst + i * dst_stride);
+
+		_mm_storeu_si128(d, RGB24_SPLIT_MERGE(r[i], g[i], b[i],
+						       rgb24_merge_masks, 0));
+		_mm_storeu_si128(d + 1, RGB24_SPLIT_MERGE(r[i], g[i], b[i],
+						       rgb24_merge_masks, 1));
+		_mm_storeu_si128(d + 2, RGB24_SPLIT_MERGE(r[i], g[i], b[i],
+						       rgb24_merge_masks, 2));
+	}
+}
+
+/* Scaler line accumulation, the products fit in 16 bits as the weight is at
+   most 256 */
+static TARGET_SSE2 void scale_accumulate_sse2(const unsigned char *src,
+		unsigned short *acc, int n, int weight)
+{
+	const __m128i w = _mm_set1_epi16(weight);
+	const __m128i zero = _mm_setzero_si128();
+	int i;
+
+	for (i = 0; i < n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i *a = (__m128i *)(acc + i);
+		__m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), w);
+		__m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), w);
+
+		_mm_storeu_si128(a, _mm_add_epi16(_mm_loadu_si128(a), lo));
+		_mm_storeu_si128(a + 1, _mm_add_epi16(_mm_loadu_si128(a + 1), hi));
+	}
+}
+
+static TARGET_AVX2 void scale_accumulate_avx2(const unsigned char *src,
+		unsigned short *acc, int n, int weight)
+{
+	const __m256i w = _mm256_set1_epi16(weight);
+	int i;
+
+	for (i = 0; i < n; i += 16) {
+		__m256i v = _mm256_cvtepu8_epi16(
+				_mm_loadu_si128((const __m128i *)(src + i)));
+		__m256i *a = (__m256i *)(acc + i);
+
+		_mm256_storeu_si256(a, _mm256_add_epi16(_mm256_loadu_si256(a),
+					_mm256_mullo_epi16(v, w)));
+	}
+}
+
+/* HM12 chroma tile lines, 2 lines at a time */
+static TARGET_SSE2 void split_uv_tile_sse2(const unsigned char *src,
+		unsigned char *dstu, unsigned char *dstv, int stride, int rows)
+{
+	const __m128i mask = _mm_set1_epi16(0xff);
+	int i;
+
+	for (i = 0; i < rows; i += 2) {
+		__m128i a = _mm_loadu_si128((const __m128i *)src);
+		__m128i b = i + 1 < rows ?
+			_mm_loadu_si128((const __m128i *)(src + 16)) : a;
+		__m128i u = _mm_packus_epi16(_mm_and_si128(a, mask),
+					     _mm_and_si128(b, mask));
+		__m128i v = _mm_packus_epi16(_mm_srli_epi16(a, 8),
+					     _mm_srli_epi16(b, 8));
+
+		_mm_storel_epi64((__m128i *)dstu, u);
+		_mm_storel_epi64((__m128i *)dstv, v);
+		if (i + 1 < rows) {
+			_mm_storel_epi64((__m128i *)(dstu + stride),
+					 _mm_srli_si128(u, 8));
+			_mm_storel_epi64((__m128i *)(dstv + stride),
+					 _mm_srli_si128(v, 8));
+		}
+		src += 32;
+		dstu += 2 * stride;
+		dstv += 2 * stride;
+	}
+}
+
+#define SIMD_X86_FUNCS(isa, ISA) \
+static TARGET_##ISA void yuyv_to_rgb24_##isa(const unsigned char *src, \
+		unsigned char *dest, int width, int height, int stride) \
+{ \
+	packed_to_rgb24_##isa(src, dest, width, height, stride, YUYV_LAYOUT, 0); \
+} \
+static TARGET_##ISA void yuyv_to_bgr24_##isa(const unsigned char *src, \
+		unsigned char *dest, int width, int height, int stride) \
+{ \
+	packed_to_rgb24_##isa(src, dest, width, height, stride, YUYV_LAYOUT, 1); \
+} \
+static TARGET_##ISA void yvyu_to_rgb24_##isa(const unsigned char *src, \
+		unsigned char *dest, int width, int height, int stride) \
+{ \
+	packed_to_rgb24_##isa(src, dest, width, height, stride, YVYU_LAYOUT, 0); \
+} \
+static TARGET_##ISA void yvyu_to_bgr24_##isa(const unsigned char *src, \
+		unsigned char *dest, int width, int height, int stride) \
+{ \
+	packed_to_rgb24_##isa(src, dest, width, height, stride, YVYU_LAYOUT, 1); \
+} \
+static TARGET_##ISA void uyvy_to_rgb24_##isa(const unsigned char *src, \
+		unsigned char *dest, int width, int height, int stride) \
+{ \
+	packed_to_rgb24_##isa(src, dest, width, height, stride, UYVY_LAYOUT, 0); \
+} \
+static TARGET_##ISA void uyvy_to_bgr24_##isa(const unsigned char *src, \
+		unsigned char *dest, int width, int height, int stride) \
+{ \
+	packed_to_rgb24_##isa(src, dest, width, height, stride, UYVY_LAYOUT, 1); \
+} \
+static TARGET_##ISA void yuyv_to_yuv420_##isa(const unsigned char *src, \
+		unsigned char *dest, unsigned char *udest, unsigned char *vdest, \
+		int width, int height, int stride) \
+{ \
+	packed_to_yuv420_##isa(src, dest, udest, vdest, width, height, stride, 0); \
+} \
+static TARGET_##ISA void uyvy_to_yuv420_##isa(const unsigned char *src, \
+		unsigned char *dest, unsigned char *udest, unsigned char *vdest, \
+		int width, int height, int stride) \
+{ \
+	packed_to_yuv420_##isa(src, dest, udest, vdest, width, height, stride, 1); \
+} \
+static TARGET_##ISA void yuv420_to_rgb24_##isa(const unsigned char *ysrc, \
+		const unsigned char *usrc, const unsigned char *vsrc, \
+		unsigned char *dest, int width, int height) \
+{ \
+	planar_to_rgb24_##isa(ysrc, usrc, vsrc, dest, width, height, 0); \
+} \
+static TARGET_##ISA void yuv420_to_bgr24_##isa(const unsigned char *ysrc, \
+		const unsigned char *usrc, const unsigned char *vsrc, \
+		unsigned char *dest, int width, int height) \
+{ \
+	planar_to_rgb24_##isa(ysrc, usrc, vsrc, dest, width, height, 1); \
+} \
+static const struct v4lconvert_simd_funcs simd_funcs_##isa = { \
+	.name = #ISA, \
+	.yuyv_to_rgb24 = yuyv_to_rgb24_##isa, \
+	.yuyv_to_bgr24 = yuyv_to_bgr24_##isa, \
+	.yvyu_to_rgb24 = yvyu_to_rgb24_##isa, \
+	.yvyu_to_bgr24 = yvyu_to_bgr24_##isa, \
+	.uyvy_to_rgb24 = uyvy_to_rgb24_##isa, \
+	.uyvy_to_bgr24 = uyvy_to_bgr24_##isa, \
+	.yuyv_to_yuv420 = yuyv_to_yuv420_##isa, \
+	.uyvy_to_yuv420 = uyvy_to_yuv420_##isa, \
+	.yuv420_to_rgb24 = yuv420_to_rgb24_##isa, \
+	.yuv420_to_bgr24 = yuv420_to_bgr24_##isa, \
+	.jpeg_idct = tinyjpeg_idct_ifast_sse2, \
+	.jpeg_ycbcr_to_rgb24 = jpeg_ycbcr_to_rgb24_sse2, \
+	.bayer_to_rgb24_pairs = bayer_to_rgb24_pairs_sse2, \
+	.bayer_to_y_pairs = bayer_to_y_pairs_sse2, \
+	.sum_pairs = sum_pairs_sse2, \
+	.sum_rgb24 = sum_rgb24_sse2, \
+	.transpose_16x16 = transpose_16x16_sse2, \
+	.transpose_rgb24_16x16 = TRANSPOSE_RGB24_##ISA, \
+	.scale_accumulate = scale_accumulate_##isa, \
+	.split_uv_tile = split_uv_tile_sse2, \
+};
+
+/* The jpeg blocks / MCU lines are only 8 or 16 pixels wide, so the AVX2
+   table uses the SSE2 versions of the jpeg routines. The bayer routines are
+   bound by their unaligned loads and the rgb24 stores, so AVX2 uses the SSE2
+   versions of those too, as do the (memory bound) statistics and rotation
+   routines. The HM12 chroma tiles are only 16 bytes wide. */
+#define TRANSPOSE_RGB24_SSE2 NULL
+#define TRANSPOSE_RGB24_AVX2 transpose_rgb24_16x16_avx2
+SIMD_X86_FUNCS(sse2, SSE2)
+SIMD_X86_FUNCS(avx2, AVX2)
+
+#endif /* V4LCONVERT_SIMD_X86 */
+
+#ifdef V4LCONVERT_SIMD_NEON
+
+/* yuv -> rgb for 8 pixels in 16 bit lanes, u and v are 1 per pixel */
+static inline void yuv_to_rgb_s16_neon(int16x8_t y, int16x8_t du,
+		int16x8_t dv, uint8x8_t *r, uint8x8_t *g, uint8x8_t *b)
+{
+	int16x8_t u1 = vshrq_n_s16(vaddq_s16(vshlq_n_s16(du, 7), du), 6);
+	int16x8_t rg = vshrq_n_s16(vaddq_s16(
+				vaddq_s16(vshlq_n_s16(du, 1), du),
+				vaddq_s16(vshlq_n_s16(dv, 2), vshlq_n_s16(dv, 1))), 3);
+	int16x8_t v1 = vshrq_n_s16(vaddq_s16(vshlq_n_s16(dv, 1), dv), 1);
+
+	*r = vqmovun_s16(vaddq_s16(y, v1));
+	*g = vqmovun_s16(vsubq_s16(y, rg));
+	*b = vqmovun_s16(vaddq_s16(y, u1));
+}
+
+/* 16 pixels, given as even / odd luma and 1 chroma sample per pixel pair */
+static inline void yuv_pairs_to_rgb24_neon(uint8x8_t y_even, uint8x8_t y_odd,
+		uint8x8_t u, uint8x8_t v, unsigned char *dest, int bgr)
+{
+	const uint8x8_t c128 = vdup_n_u8(128);
+	int16x8_t du = vreinterpretq_s16_u16(vsubl_u8(u, c128));
+	int16x8_t dv = vreinterpretq_s16_u16(vsubl_u8(v, c128));
+	uint8x8_t r0, g0, b0, r1, g1, b1;
+	uint8x8x2_t r, g, b;
+	uint8x16x3_t out;
+
+	yuv_to_rgb_s16_neon(vreinterpretq_s16_u16(vmovl_u8(y_even)), du, dv,
+			    &r0, &g0, &b0);
+	yuv_to_rgb_s16_neon(vreinterpretq_s16_u16(vmovl_u8(y_odd)), du, dv,
+			    &r1, &g1, &b1);
+	r = vzip_u8(r0, r1);
+	g = vzip_u8(g0, g1);
+	b = vzip_u8(b0, b1);
+	out.val[bgr ? 2 : 0] = vcombine_u8(r.val[0], r.val[1]);
+	out.val[1] = vcombine_u8(g.val[0], g.val[1]);
+	out.val[bgr ? 0 : 2] = vcombine_u8(b.val[0], b.val[1]);
+	vst3q_u8(dest, out);
+}
+
+static inline void packed_to_rgb24_neon(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		int yoff, int uoff, int voff, int bgr)
+{
+	int x;
+
+	while (--height >= 0) {
+		const unsigned char *s = src;
+		unsigned char *d = dest;
+
+		for (x = 0; x + 16 <= width; x += 16) {
+			/* val[n] is byte n of each macropixel */
+			uint8x8x4_t in = vld4_u8(s);
+
+			yuv_pairs_to_rgb24_neon(in.val[yoff], in.val[yoff + 2],
+					in.val[uoff], in.val[voff], d, bgr);
+			s += 32;
+			d += 48;
+		}
+		yuv422_to_rgb24_tail(s, d, x, width, yoff, uoff, voff, bgr);
+		/* Same as the C version, which leaves src behind the last
+		   complete macropixel and then adds stride - width * 2 */
+		src += stride - (width & 1) * 2;
+		dest += (width & ~1) * 3;
+	}
+}
+
+static inline void packed_to_yuv420_neon(const unsigned char *src,
+		unsigned char *dest, unsigned char *udest, unsigned char *vdest,
+		int width, int height, int stride, int yoff)
+{
+	const unsigned char *src1;
+	int i, x;
+
+	/* copy the Y values */
+	for (i = 0; i < height; i++) {
+		const unsigned char *s = src + i * (stride - (width & 1) * 2);
+
+		for (x = 0; x + 16 <= width; x += 16) {
+			uint8x16x2_t in = vld2q_u8(s);
+
+			vst1q_u8(dest, in.val[yoff]);
+			s += 32;
+			dest += 16;
+		}
+		for (; x + 1 < width; x += 2) {
+			*dest++ = s[yoff];
+			*dest++ = s[yoff + 2];
+			s += 4;
+		}
+	}
+
+	/* copy the U and V values */
+	for (i = 0; i < height; i += 2) {
+		const unsigned char *s = src + i / 2 * (2 * stride - (width & 1) * 2);
+
+		src1 = s + stride;
+		for (x = 0; x + 16 <= width; x += 16) {
+			uint8x8x4_t l0 = vld4_u8(s);
+			uint8x8x4_t l1 = vld4_u8(src1);
+			int uo = yoff ? 0 : 1, vo = yoff ? 2 : 3;
+
+			/* vhadd is the truncating (a + b) >> 1 */
+			vst1_u8(udest, vhadd_u8(l0.val[uo], l1.val[uo]));
+			vst1_u8(vdest, vhadd_u8(l0.val[vo], l1.val[vo]));
+			s += 32;
+			src1 += 32;
+			udest += 8;
+			vdest += 8;
+		}
+		yuv422_to_yuv420_uv_tail(s + !yoff, src1 + !yoff, udest, vdest,
+					 x, width);
+		udest += (width - x) / 2;
+		vdest += (width - x) / 2;
+	}
+}
+
+static inline void planar_to_rgb24_neon(const unsigned char *ysrc,
+		const unsigned char *usrc, const unsigned char *vsrc,
+		unsigned char *dest, int width, int height, int bgr)
+{
+	int i, j;
+
+	for (i = 0; i < height; i++) {
+		for (j = 0; j + 16 <= width; j += 16) {
+			uint8x8x2_t y = vld2_u8(ysrc);
+
+			yuv_pairs_to_rgb24_neon(y.val[0], y.val[1],
+					vld1_u8(usrc), vld1_u8(vsrc), dest, bgr);
+			ysrc += 16;
+			usrc += 8;
+			vsrc += 8;
+			dest += 48;
+		}
+		for (; j < width; j += 2) {
+			yuv_to_rgb24_pair(ysrc[0], ysrc[1], *usrc, *vsrc, dest, bgr);
+			ysrc += 2;
+			usrc++;
+			vsrc++;
+			dest += 6;
+		}
+		/* Rewind u and v for next line */
+		if (!(i & 1)) {
+			usrc -= width / 2;
+			vsrc -= width / 2;
+		}
+	}
+}
+
+static void yuyv_to_rgb24_neon(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride)
+{
+	packed_to_rgb24_neon(src, dest, width, height, stride, YUYV_LAYOUT, 0);
+}
+
+static void yuyv_to_bgr24_neon(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride)
+{
+	packed_to_rgb24_neon(src, dest, width, height, stride, YUYV_LAYOUT, 1);
+}
+
+static void yvyu_to_rgb24_neon(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride)
+{
+	packed_to_rgb24_neon(src, dest, width, height, stride, YVYU_LAYOUT, 0);
+}
+
+static void yvyu_to_bgr24_neon(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride)
+{
+	packed_to_rgb24_neon(src, dest, width, height, stride, YVYU_LAYOUT, 1);
+}
+
+static void uyvy_to_rgb24_neon(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride)
+{
+	packed_to_rgb24_neon(src, dest, width, height, stride, UYVY_LAYOUT, 0);
+}
+
+static void uyvy_to_bgr24_neon(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride)
+{
+	packed_to_rgb24_neon(src, dest, width, height, stride, UYVY_LAYOUT, 1);
+}
+
+static void yuyv_to_yuv420_neon(const unsigned char *src,
+		unsigned char *dest, unsigned char *udest, unsigned char *vdest,
+		int width, int height, int stride)
+{
+	packed_to_yuv420_neon(src, dest, udest, vdest, width, height, stride, 0);
+}
+
+static void uyvy_to_yuv420_neon(const unsigned char *src,
+		unsigned char *dest, unsigned char *udest, unsigned char *vdest,
+		int width, int height, int stride)
+{
+	packed_to_yuv420_neon(src, dest, udest, vdest, width, height, stride, 1);
+}
+
+static void yuv420_to_rgb24_neon(const unsigned char *ysrc,
+		const unsigned char *usrc, const unsigned char *vsrc,
+		unsigned char *dest, int width, int height)
+{
+	planar_to_rgb24_neon(ysrc, usrc, vsrc, dest, width, height, 0);
+}
+
+static void yuv420_to_bgr24_neon(const unsigned char *ysrc,
+		const unsigned char *usrc, const unsigned char *vsrc,
+		unsigned char *dest, int width, int height)
+{
+	planar_to_rgb24_neon(ysrc, usrc, vsrc, dest, width, height, 1);
+}
+
+/* Calculate the r, g and b chroma terms for 8 chroma samples */
+static inline void jpeg_chroma_neon(const unsigned char *cbsrc,
+		const unsigned char *crsrc, int16x8_t *dr, int16x8_t *dg,
+		int16x8_t *db)
+{
+	const uint8x8_t c128 = vdup_n_u8(128);
+	const int32x4_t half = vdupq_n_s32(JPEG_ONE_HALF);
+	int16x8_t cb = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(cbsrc), c128));
+	int16x8_t cr = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(crsrc), c128));
+	int32x4_t lo, hi;
+
+	lo = vmlal_n_s16(half, vget_low_s16(cr), JPEG_FIX_CR_R);
+	hi = vmlal_n_s16(half, vget_high_s16(cr), JPEG_FIX_CR_R);
+	*dr = vcombine_s16(vshrn_n_s32(lo, 10), vshrn_n_s32(hi, 10));
+
+	lo = vmlal_n_s16(vmlal_n_s16(half, vget_low_s16(cb), JPEG_FIX_CB_G),
+			 vget_low_s16(cr), JPEG_FIX_CR_G);
+	hi = vmlal_n_s16(vmlal_n_s16(half, vget_high_s16(cb), JPEG_FIX_CB_G),
+			 vget_high_s16(cr), JPEG_FIX_CR_G);
+	*dg = vcombine_s16(vshrn_n_s32(lo, 10), vshrn_n_s32(hi, 10));
+
+	lo = vmlal_n_s16(half, vget_low_s16(cb), JPEG_FIX_CB_B);
+	hi = vmlal_n_s16(half, vget_high_s16(cb), JPEG_FIX_CB_B);
+	*db = vcombine_s16(vshrn_n_s32(lo, 10), vshrn_n_s32(hi, 10));
+}
+
+static inline void jpeg_store8_neon(unsigned char *dest, uint8x8_t y,
+		int16x8_t dr, int16x8_t dg, int16x8_t db, int bgr)
+{
+	int16x8_t y16 = vreinterpretq_s16_u16(vmovl_u8(y));
+	uint8x8x3_t out;
+
+	out.val[bgr ? 2 : 0] = vqmovun_s16(vaddq_s16(y16, dr));
+	out.val[1] = vqmovun_s16(vaddq_s16(y16, dg));
+	out.val[bgr ? 0 : 2] = vqmovun_s16(vaddq_s16(y16, db));
+	vst3_u8(dest, out);
+}
+
+static void jpeg_ycbcr_to_rgb24_neon(const unsigned char *ysrc,
+		const unsigned char *cbsrc, const unsigned char *crsrc,
+		unsigned char *dest, int width, int h_sub, int bgr)
+{
+	int16x8_t dr, dg, db;
+	int x;
+
+	for (x = 0; x < width; x += 8) {
+		if (h_sub) {
+			int16x8x2_t r, g, b;
+
+			jpeg_chroma_neon(cbsrc, crsrc, &dr, &dg, &db);
+			r = vzipq_s16(dr, dr);
+			g = vzipq_s16(dg, dg);
+			b = vzipq_s16(db, db);
+			jpeg_store8_neon(dest, vld1_u8(ysrc), r.val[0], g.val[0],
+					 b.val[0], bgr);
+			jpeg_store8_neon(dest + 24, vld1_u8(ysrc + 8), r.val[1],
+					 g.val[1], b.val[1], bgr);
+			x += 8;
+			ysrc += 16;
+			dest += 48;
+		} else {
+			jpeg_chroma_neon(cbsrc, crsrc, &dr, &dg, &db);
+			jpeg_store8_neon(dest, vld1_u8(ysrc), dr, dg, db, bgr);
+			ysrc += 8;
+			dest += 24;
+		}
+		cbsrc += 8;
+		crsrc += 8;
+	}
+}
+
+/* Bayer demosaicing of 8 pixel pairs at a time, see bayer_line_to_rgbbgr24()
+   and bayer_line_to_y() in bayer.c. vld2 of the lines at offset 0 and 2 gives
+   all neighbours of the 1st (odd samples of cur) and 2nd (even samples of
+   cur + 2) pixel of each pair. */
+#define BAYER_LOAD_NEON(prev, cur, next) \
+	uint8x8x2_t p = vld2_u8(prev); \
+	uint8x8x2_t c = vld2_u8(cur); \
+	uint8x8x2_t n = vld2_u8(next); \
+	uint8x8_t p2 = vld2_u8((prev) + 2).val[0]; \
+	uint8x8x2_t c2 = vld2_u8((cur) + 2); \
+	uint8x8_t n2 = vld2_u8((next) + 2).val[0]; \
+	/* The diagonal and the horizontal + vertical neighbours of the 1st \
+	   pixel, they are 4 samples of the 2 colors it is missing */ \
+	uint16x8_t diag = vaddq_u16(vaddl_u8(p.val[0], p2), \
+				    vaddl_u8(n.val[0], n2)); \
+	uint16x8_t cross = vaddq_u16(vaddl_u8(p.val[1], n.val[1]), \
+				     vaddl_u8(c.val[0], c2.val[0]))
+
+static void bayer_to_rgb24_pairs_neon(const unsigned char *prev,
+		const unsigned char *cur, const unsigned char *next,
+		unsigned char *dest, int pairs, int blue_line)
+{
+	int i;
+
+	for (i = 0; i < pairs; i += 8) {
+		BAYER_LOAD_NEON(prev, cur, next);
+		uint8x8x2_t ch0, ch1, ch2;
+		uint8x16x3_t out;
+
+		/* 1st pixel, 2nd pixel */
+		ch0 = vzip_u8(vrshrn_n_u16(diag, 2), vrhadd_u8(p2, n2));
+		ch1 = vzip_u8(vrshrn_n_u16(cross, 2), c2.val[0]);
+		ch2 = vzip_u8(c.val[1], vrhadd_u8(c.val[1], c2.val[1]));
+
+		out.val[blue_line ? 0 : 2] = vcombine_u8(ch0.val[0], ch0.val[1]);
+		out.val[1] = vcombine_u8(ch1.val[0], ch1.val[1]);
+		out.val[blue_line ? 2 : 0] = vcombine_u8(ch2.val[0], ch2.val[1]);
+		vst3q_u8(dest, out);
+
+		prev += 16;
+		cur += 16;
+		next += 16;
+		dest += 48;
+	}
+}
+
+/* (ka * a + kb * b + kc * c + 524288) >> 15 for 8 pixels, 524288 is 16 << 15 */
+static inline uint8x8_t bayer_y_neon(uint16x8_t a, uint16x8_t b,
+		uint16x8_t c, uint16_t ka, uint16_t kb, uint16_t kc)
+{
+	uint32x4_t lo, hi;
+
+	lo = vmull_n_u16(vget_low_u16(a), ka);
+	lo = vmlal_n_u16(lo, vget_low_u16(b), kb);
+	lo = vmlal_n_u16(lo, vget_low_u16(c), kc);
+	hi = vmull_n_u16(vget_high_u16(a), ka);
+	hi = vmlal_n_u16(hi, vget_high_u16(b), kb);
+	hi = vmlal_n_u16(hi, vget_high_u16(c), kc);
+	return vmovn_u16(vaddq_u16(vcombine_u16(vshrn_n_u32(lo, 15),
+						vshrn_n_u32(hi, 15)),
+				   vdupq_n_u16(16)));
+}
+
+static void bayer_to_y_pairs_neon(const unsigned char *prev,
+		const unsigned char *cur, const unsigned char *next,
+		unsigned char *ydest, int pairs, int blue_line)
+{
+	int i;
+
+	for (i = 0; i < pairs; i += 8) {
+		BAYER_LOAD_NEON(prev, cur, next);
+		uint8x8x2_t y;
+
+		/* 1st pixel: own color, cross (green) and diagonal */
+		y.val[0] = bayer_y_neon(vmovl_u8(c.val[1]), cross, diag,
+					blue_line ? 8453 : 3223, 4148,
+					blue_line ? 806 : 2113);
+		/* 2nd pixel (green): vertical, own color and horizontal */
+		y.val[1] = bayer_y_neon(vaddl_u8(p2, n2), vmovl_u8(c2.val[0]),
+					vaddl_u8(c.val[1], c2.val[1]),
+					blue_line ? 1611 : 4226, 16594,
+					blue_line ? 4226 : 1611);
+		vst2_u8(ydest, y);
+
+		prev += 16;
+		cur += 16;
+		next += 16;
+		ydest += 16;
+	}
+}
+
+static inline unsigned int sum_u32x4_neon(uint32x4_t v)
+{
+	uint64x2_t s = vpaddlq_u32(v);
+
+	return vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1);
+}
+
+static void sum_pairs_neon(const unsigned char *src, int pairs,
+		unsigned int *even, unsigned int *odd)
+{
+	uint32x4_t e = vdupq_n_u32(0), o = vdupq_n_u32(0);
+	int i;
+
+	for (i = 0; i < pairs; i += 8) {
+		uint8x8x2_t v = vld2_u8(src + 2 * i);
+
+		e = vaddw_u16(e, vpaddl_u8(v.val[0]));
+		o = vaddw_u16(o, vpaddl_u8(v.val[1]));
+	}
+	*even += sum_u32x4_neon(e);
+	*odd += sum_u32x4_neon(o);
+}
+
+static void sum_rgb24_neon(const unsigned char *src, int pixels,
+		unsigned int *sums)
+{
+	uint32x4_t acc[3] = { vdupq_n_u32(0), vdupq_n_u32(0), vdupq_n_u32(0) };
+	int i, c;
+
+	for (i = 0; i < pixels; i += 16) {
+		uint8x16x3_t v = vld3q_u8(src + 3 * i);
+
+		for (c = 0; c < 3; c++)
+			acc[c] = vpadalq_u16(acc[c], vpaddlq_u8(v.val[c]));
+	}
+	for (c = 0; c < 3; c++)
+		sums[c] += sum_u32x4_neon(acc[c]);
+}
+
+/* See TRANSPOSE_ROUND_SSE2 */
+static inline void transpose_u8_16x16_neon(uint8x16_t *a)
+{
+	uint8x16_t b[16];
+	int i, round;
+
+	for (round = 0; round < 4; round++) {
+		for (i = 0; i < 8; i++) {
+			uint8x16x2_t z = vzipq_u8(a[i], a[i + 8]);
+
+			b[2 * i] = z.val[0];
+			b[2 * i + 1] = z.val[1];
+		}
+		memcpy(a, b, sizeof(b));
+	}
+}
+
+static void transpose_16x16_neon(const unsigned char *src, int src_stride,
+		unsigned char *dst, int dst_stride)
+{
+	uint8x16_t a[16];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		a[i] = vld1q_u8(src + i * src_stride);
+	transpose_u8_16x16_neon(a);
+	for (i = 0; i < 16; i++)
+		vst1q_u8(dst + i * dst_stride, a[i]);
+}
+
+static void transpose_rgb24_16x16_neon(const unsigned char *src,
+		int src_stride, unsigned char *dst, int dst_stride)
+{
+	uint8x16_t a[3][16];
+	int i, c;
+
+	for (i = 0; i < 16; i++) {
+		uint8x16x3_t v = vld3q_u8(src + i * src_stride);
+
+		for (c = 0; c < 3; c++)
+			a[c][i] = v.val[c];
+	}
+	for (c = 0; c < 3; c++)
+		transpose_u8_16x16_neon(a[c]);
+	for (i = 0; i < 16; i++) {
+		uint8x16x3_t v;
+
+		for (c = 0; c < 3; c++)
+			v.val[c] = a[c][i];
+		vst3q_u8(dst + i * dst_stride, v);
+	}
+}
+
+static void scale_accumulate_neon(const unsigned char *src,
+		unsigned short *acc, int n, int weight)
+{
+	const uint16x8_t w = vdupq_n_u16(weight);
+	int i;
+
+	for (i = 0; i < n; i += 16) {
+		uint8x16_t v = vld1q_u8(src + i);
+
+		vst1q_u16(acc + i, vmlaq_u16(vld1q_u16(acc + i),
+				vmovl_u8(vget_low_u8(v)), w));
+		vst1q_u16(acc + i + 8, vmlaq_u16(vld1q_u16(acc + i + 8),
+				vmovl_u8(vget_high_u8(v)), w));
+	}
+}
+
+static void split_uv_tile_neon(const unsigned char *src,
+		unsigned char *dstu, unsigned char *dstv, int stride, int rows)
+{
+	int i;
+
+	for (i = 0; i < rows; i++) {
+		uint8x8x2_t uv = vld2_u8(src);
+
+		vst1_u8(dstu, uv.val[0]);
+		vst1_u8(dstv, uv.val[1]);
+		src += 16;
+		dstu += stride;
+		dstv += stride;
+	}
+}
+
+#ifdef __aarch64__
+/* 256 entry table lookup, tbl looks up entries 0 - 63 (giving 0 for other
+   indices), each tbx the next 64 (leaving other lanes alone) */
+static inline uint8x16_t lut_neon(const uint8x16x4_t *t, uint8x16_t idx)
+{
+	const uint8x16_t off = vdupq_n_u8(64);
+	uint8x16_t r = vqtbl4q_u8(t[0], idx);
+
+	idx = vsubq_u8(idx, off);
+	r = vqtbx4q_u8(r, t[1], idx);
+	idx = vsubq_u8(idx, off);
+	r = vqtbx4q_u8(r, t[2], idx);
+	idx = vsubq_u8(idx, off);
+	return vqtbx4q_u8(r, t[3], idx);
+}
+
+static inline void lut_load_neon(uint8x16x4_t *t, const unsigned char *lut)
+{
+	int i, j;
+
+	for (i = 0; i < 4; i++)
+		for (j = 0; j < 4; j++)
+			t[i].val[j] = vld1q_u8(lut + 64 * i + 16 * j);
+}
+
+static void lut_pairs_neon(unsigned char *buf, int pairs,
+		const unsigned char *lut0, const unsigned char *lut1)
+{
+	uint8x16x4_t t0[4], t1[4];
+	int i;
+
+	lut_load_neon(t0, lut0);
+	lut_load_neon(t1, lut1);
+
+	for (i = 0; i < pairs; i += 16) {
+		uint8x16x2_t v = vld2q_u8(buf + 2 * i);
+
+		v.val[0] = lut_neon(t0, v.val[0]);
+		v.val[1] = lut_neon(t1, v.val[1]);
+		vst2q_u8(buf + 2 * i, v);
+	}
+}
+
+static void lut_rgb24_neon(unsigned char *buf, int pixels,
+		const unsigned char *lut0, const unsigned char *lut1,
+		const unsigned char *lut2)
+{
+	uint8x16x4_t t0[4], t1[4], t2[4];
+	int i;
+
+	lut_load_neon(t0, lut0);
+	lut_load_neon(t1, lut1);
+	lut_load_neon(t2, lut2);
+
+	for (i = 0; i < pixels; i += 16) {
+		uint8x16x3_t v = vld3q_u8(buf + 3 * i);
+
+		v.val[0] = lut_neon(t0, v.val[0]);
+		v.val[1] = lut_neon(t1, v.val[1]);
+		v.val[2] = lut_neon(t2, v.val[2]);
+		vst3q_u8(buf + 3 * i, v);
+	}
+}
+#endif
+
+static const struct v4lconvert_simd_funcs simd_funcs_neon = {
+	.name = "NEON",
+	.yuyv_to_rgb24 = yuyv_to_rgb24_neon,
+	.yuyv_to_bgr24 = yuyv_to_bgr24_neon,
+	.yvyu_to_rgb24 = yvyu_to_rgb24_neon,
+	.yvyu_to_bgr24 = yvyu_to_bgr24_neon,
+	.uyvy_to_rgb24 = uyvy_to_rgb24_neon,
+	.uyvy_to_bgr24 = uyvy_to_bgr24_neon,
+	.yuyv_to_yuv420 = yuyv_to_yuv420_neon,
+	.uyvy_to_yuv420 = uyvy_to_yuv420_neon,
+	.yuv420_to_rgb24 = yuv420_to_rgb24_neon,
+	.yuv420_to_bgr24 = yuv420_to_bgr24_neon,
+	.jpeg_idct = tinyjpeg_idct_ifast_neon,
+	.jpeg_ycbcr_to_rgb24 = jpeg_ycbcr_to_rgb24_neon,
+	.bayer_to_rgb24_pairs = bayer_to_rgb24_pairs_neon,
+	.bayer_to_y_pairs = bayer_to_y_pairs_neon,
+	.sum_pairs = sum_pairs_neon,
+	.sum_rgb24 = sum_rgb24_neon,
+	.transpose_16x16 = transpose_16x16_neon,
+	.transpose_rgb24_16x16 = transpose_rgb24_16x16_neon,
+	.scale_accumulate = scale_accumulate_neon,
+	.split_uv_tile = split_uv_tile_neon,
+#ifdef __aarch64__
+	.lut_pairs = lut_pairs_neon,
+	.lut_rgb24 = lut_rgb24_neon,
+#endif
+};
+
+#endif /* V4LCONVERT_SIMD_NEON */
+
+static void v4lconvert_simd_select(void)
+{
+	const char *s;
+
+	/* Allow forcing the C versions, for comparing them with the SIMD ones
+	   (see contrib/test/v4lconvert-simd-test.c) and for debugging */
+	s = getenv("LIBV4LCONVERT_SIMD");
+	if (s && !strtol(s, NULL, 0)) {
+		v4lconvert_simd.name = "C";
+		return;
+	}
+
+#ifdef V4LCONVERT_SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		v4lconvert_simd = simd_funcs_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		v4lconvert_simd = simd_funcs_sse2;
+#elif defined(V4LCONVERT_SIMD_NEON)
+	/* NEON is only used when the compiler targets it, so always present */
+	v4lconvert_simd = simd_funcs_neon;
+#endif
+	if (!v4lconvert_simd.name)
+		v4lconvert_simd.name = "C";
+}
+
+/* v4lconvert_create() may be called from multiple threads at once, the
+   table must be filled in completely before any of them uses it */
+void v4lconvert_simd_init(void)
+{
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+	pthread_once(&once, v4lconvert_simd_select);
+}
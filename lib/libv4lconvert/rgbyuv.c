@@ -92,20 +92,15 @@ void v4lconvert_rgb24_to_yuv420(const unsigned char *src, unsigned char *dest,
 
 #define CLIP(color) (unsigned char)(((color) > 0xFF) ? 0xff : (((color) < 0) ? 0 : (color)))
 
-void v4lconvert_yuv420_to_bgr24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int yvu)
+void v4lconvert_yuv420_planes_to_bgr24(const unsigned char *ysrc,
+		const unsigned char *usrc, const unsigned char *vsrc,
+		unsigned char *dest, int width, int height)
 {
 	int i, j;
 
-	const unsigned char *ysrc = src;
-	const unsigned char *usrc, *vsrc;
-
-	if (yvu) {
-		vsrc = src + width * height;
-		usrc = vsrc + (width * height) / 4;
-	} else {
-		usrc = src + width * height;
-		vsrc = usrc + (width * height) / 4;
+	if (v4lconvert_simd.yuv420_to_bgr24) {
+		v4lconvert_simd.yuv420_to_bgr24(ysrc, usrc, vsrc, dest, width, height);
+		return;
 	}
 
 	for (i = 0; i < height; i++) {
@@ -146,12 +141,9 @@ void v4lconvert_yuv420_to_bgr24(const unsigned char *src, unsigned char *dest,
 	}
 }
 
-void v4lconvert_yuv420_to_rgb24(const unsigned char *src, unsigned char *dest,
+void v4lconvert_yuv420_to_bgr24(const unsigned char *src, unsigned char *dest,
 		int width, int height, int yvu)
 {
-	int i, j;
-
-	const unsigned char *ysrc = src;
 	const unsigned char *usrc, *vsrc;
 
 	if (yvu) {
@@ -161,6 +153,19 @@ void v4lconvert_yuv420_to_rgb24(const unsigned char *src, unsigned char *dest,
 		usrc = src + width * height;
 		vsrc = usrc + (width * height) / 4;
 	}
+	v4lconvert_yuv420_planes_to_bgr24(src, usrc, vsrc, dest, width, height);
+}
+
+void v4lconvert_yuv420_planes_to_rgb24(const unsigned char *ysrc,
+		const unsigned char *usrc, const unsigned char *vsrc,
+		unsigned char *dest, int width, int height)
+{
+	int i, j;
+
+	if (v4lconvert_simd.yuv420_to_rgb24) {
+		v4lconvert_simd.yuv420_to_rgb24(ysrc, usrc, vsrc, dest, width, height);
+		return;
+	}
 
 	for (i = 0; i < height; i++) {
 		for (j = 0; j < width; j += 2) {
@@ -200,11 +205,31 @@ void v4lconvert_yuv420_to_rgb24(const unsigned char *src, unsigned char *dest,
 	}
 }
 
+void v4lconvert_yuv420_to_rgb24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int yvu)
+{
+	const unsigned char *usrc, *vsrc;
+
+	if (yvu) {
+		vsrc = src + width * height;
+		usrc = vsrc + (width * height) / 4;
+	} else {
+		usrc = src + width * height;
+		vsrc = usrc + (width * height) / 4;
+	}
+	v4lconvert_yuv420_planes_to_rgb24(src, usrc, vsrc, dest, width, height);
+}
+
 void v4lconvert_yuyv_to_bgr24(const unsigned char *src, unsigned char *dest,
 		int width, int height, int stride)
 {
 	int j;
 
+	if (v4lconvert_simd.yuyv_to_bgr24) {
+		v4lconvert_simd.yuyv_to_bgr24(src, dest, width, height, stride);
+		return;
+	}
+
 	while (--height >= 0) {
 		for (j = 0; j + 1 < width; j += 2) {
 			int u = src[1];
@@ -232,6 +257,11 @@ void v4lconvert_yuyv_to_rgb24(const unsigned char *src, unsigned char *dest,
 {
 	int j;
 
+	if (v4lconvert_simd.yuyv_to_rgb24) {
+		v4lconvert_simd.yuyv_to_rgb24(src, dest, width, height, stride);
+		return;
+	}
+
 	while (--height >= 0) {
 		for (j = 0; j + 1 < width; j += 2) {
 			int u = src[1];
@@ -254,19 +284,25 @@ void v4lconvert_yuyv_to_rgb24(const unsigned char *src, unsigned char *dest,
 	}
 }
 
-void v4lconvert_yuyv_to_yuv420(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride, int yvu)
+void v4lconvert_yuyv_to_yuv420_planes(const unsigned char *src,
+		unsigned char *ydest, unsigned char *udest, unsigned char *vdest,
+		int width, int height, int stride)
 {
 	int i, j;
 	const unsigned char *src1;
-	unsigned char *udest, *vdest;
+
+	if (v4lconvert_simd.yuyv_to_yuv420) {
+		v4lconvert_simd.yuyv_to_yuv420(src, ydest, udest, vdest, width,
+				height, stride);
+		return;
+	}
 
 	/* copy the Y values */
 	src1 = src;
 	for (i = 0; i < height; i++) {
 		for (j = 0; j + 1 < width; j += 2) {
-			*dest++ = src1[0];
-			*dest++ = src1[2];
+			*ydest++ = src1[0];
+			*ydest++ = src1[2];
 			src1 += 4;
 		}
 		src1 += stride - width * 2;
@@ -275,13 +311,6 @@ void v4lconvert_yuyv_to_yuv420(const unsigned char *src, unsigned char *dest,
 	/* copy the U and V values */
 	src++;				/* point to V */
 	src1 = src + stride;		/* next line */
-	if (yvu) {
-		vdest = dest;
-		udest = dest + width * height / 4;
-	} else {
-		udest = dest;
-		vdest = dest + width * height / 4;
-	}
 	for (i = 0; i < height; i += 2) {
 		for (j = 0; j + 1 < width; j += 2) {
 			*udest++ = ((int) src[0] + src1[0]) / 2;	/* U */
@@ -295,6 +324,23 @@ void v4lconvert_yuyv_to_yuv420(const unsigned char *src, unsigned char *dest,
 	}
 }
 
+void v4lconvert_yuyv_to_yuv420(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int yvu)
+{
+	/* The Y plane gets written with an even width */
+	unsigned char *udest, *vdest;
+
+	if (yvu) {
+		vdest = dest + (width & ~1) * height;
+		udest = vdest + width * height / 4;
+	} else {
+		udest = dest + (width & ~1) * height;
+		vdest = udest + width * height / 4;
+	}
+	v4lconvert_yuyv_to_yuv420_planes(src, dest, udest, vdest, width, height,
+			stride);
+}
+
 void v4lconvert_nv16_to_yuyv(const unsigned char *src, unsigned char *dest,
 		int width, int height)
 {
@@ -315,6 +361,11 @@ void v4lconvert_yvyu_to_bgr24(const unsigned char *src, unsigned char *dest,
 {
 	int j;
 
+	if (v4lconvert_simd.yvyu_to_bgr24) {
+		v4lconvert_simd.yvyu_to_bgr24(src, dest, width, height, stride);
+		return;
+	}
+
 	while (--height >= 0) {
 		for (j = 0; j + 1 < width; j += 2) {
 			int u = src[3];
@@ -342,6 +393,11 @@ void v4lconvert_yvyu_to_rgb24(const unsigned char *src, unsigned char *dest,
 {
 	int j;
 
+	if (v4lconvert_simd.yvyu_to_rgb24) {
+		v4lconvert_simd.yvyu_to_rgb24(src, dest, width, height, stride);
+		return;
+	}
+
 	while (--height >= 0) {
 		for (j = 0; j + 1 < width; j += 2) {
 			int u = src[3];
@@ -369,6 +425,11 @@ void v4lconvert_uyvy_to_bgr24(const unsigned char *src, unsigned char *dest,
 {
 	int j;
 
+	if (v4lconvert_simd.uyvy_to_bgr24) {
+		v4lconvert_simd.uyvy_to_bgr24(src, dest, width, height, stride);
+		return;
+	}
+
 	while (--height >= 0) {
 		for (j = 0; j + 1 < width; j += 2) {
 			int u = src[0];
@@ -396,6 +457,11 @@ void v4lconvert_uyvy_to_rgb24(const unsigned char *src, unsigned char *dest,
 {
 	int j;
 
+	if (v4lconvert_simd.uyvy_to_rgb24) {
+		v4lconvert_simd.uyvy_to_rgb24(src, dest, width, height, stride);
+		return;
+	}
+
 	while (--height >= 0) {
 		for (j = 0; j + 1 < width; j += 2) {
 			int u = src[0];
@@ -418,19 +484,25 @@ void v4lconvert_uyvy_to_rgb24(const unsigned char *src, unsigned char *dest,
 	}
 }
 
-void v4lconvert_uyvy_to_yuv420(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride, int yvu)
+void v4lconvert_uyvy_to_yuv420_planes(const unsigned char *src,
+		unsigned char *ydest, unsigned char *udest, unsigned char *vdest,
+		int width, int height, int stride)
 {
 	int i, j;
 	const unsigned char *src1;
-	unsigned char *udest, *vdest;
+
+	if (v4lconvert_simd.uyvy_to_yuv420) {
+		v4lconvert_simd.uyvy_to_yuv420(src, ydest, udest, vdest, width,
+				height, stride);
+		return;
+	}
 
 	/* copy the Y values */
 	src1 = src;
 	for (i = 0; i < height; i++) {
 		for (j = 0; j + 1 < width; j += 2) {
-			*dest++ = src1[1];
-			*dest++ = src1[3];
+			*ydest++ = src1[1];
+			*ydest++ = src1[3];
 			src1 += 4;
 		}
 		src1 += stride - width * 2;
@@ -438,13 +510,6 @@ void v4lconvert_uyvy_to_yuv420(const unsigned char *src, unsigned char *dest,
 
 	/* copy the U and V values */
 	src1 = src + stride;		/* next line */
-	if (yvu) {
-		vdest = dest;
-		udest = dest + width * height / 4;
-	} else {
-		udest = dest;
-		vdest = dest + width * height / 4;
-	}
 	for (i = 0; i < height; i += 2) {
 		for (j = 0; j + 1 < width; j += 2) {
 			*udest++ = ((int) src[0] + src1[0]) / 2;	/* U */
@@ -458,6 +523,23 @@ void v4lconvert_uyvy_to_yuv420(const unsigned char *src, unsigned char *dest,
 	}
 }
 
+void v4lconvert_uyvy_to_yuv420(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int yvu)
+{
+	/* The Y plane gets written with an even width */
+	unsigned char *udest, *vdest;
+
+	if (yvu) {
+		vdest = dest + (width & ~1) * height;
+		udest = vdest + width * height / 4;
+	} else {
+		udest = dest + (width & ~1) * height;
+		vdest = udest + width * height / 4;
+	}
+	v4lconvert_uyvy_to_yuv420_planes(src, dest, udest, vdest, width, height,
+			stride);
+}
+
 void v4lconvert_swap_rgb(const unsigned char *src, unsigned char *dst,
 		int width, int height)
 {
@@ -502,6 +584,130 @@ void v4lconvert_swap_uv(const unsigned char *src, unsigned char *dest,
 	}
 }
 
+static void v4lconvert_nv12_to_rgb(const unsigned char *src,
+		unsigned char *dest, int width, int height, int bytesperline,
+		int nv21, int bgr)
+{
+	const unsigned char *uvsrc = src + height * bytesperline;
+	int i, j, r, b;
+
+	/* The chroma plane is interleaved, u first for nv12, v first for nv21 */
+	r = bgr ? 2 : 0;
+	b = bgr ? 0 : 2;
+	for (i = 0; i < height; i++) {
+		const unsigned char *ysrc = src + i * bytesperline;
+		const unsigned char *uv = uvsrc + (i / 2) * bytesperline;
+
+		for (j = 0; j < width; j += 2) {
+			int u = uv[nv21] - 128;
+			int v = uv[!nv21] - 128;
+			int u1 = ((u << 7) + u) >> 6;
+			int rg = ((u << 1) + u + (v << 2) + (v << 1)) >> 3;
+			int v1 = ((v << 1) + v) >> 1;
+
+			dest[r] = CLIP(ysrc[0] + v1);
+			dest[1] = CLIP(ysrc[0] - rg);
+			dest[b] = CLIP(ysrc[0] + u1);
+
+			dest[3 + r] = CLIP(ysrc[1] + v1);
+			dest[3 + 1] = CLIP(ysrc[1] - rg);
+			dest[3 + b] = CLIP(ysrc[1] + u1);
+
+			ysrc += 2;
+			uv += 2;
+			dest += 6;
+		}
+	}
+}
+
+void v4lconvert_nv12_to_rgb24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int bytesperline, int nv21)
+{
+	v4lconvert_nv12_to_rgb(src, dest, width, height, bytesperline, nv21, 0);
+}
+
+void v4lconvert_nv12_to_bgr24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int bytesperline, int nv21)
+{
+	v4lconvert_nv12_to_rgb(src, dest, width, height, bytesperline, nv21, 1);
+}
+
+void v4lconvert_nv12_to_yuv420(const unsigned char *src, unsigned char *dest,
+		int width, int height, int bytesperline, int yvu)
+{
+	const unsigned char *uvsrc = src + height * bytesperline;
+	unsigned char *udest, *vdest;
+	int i, j;
+
+	for (i = 0; i < height; i++) {
+		memcpy(dest, src, width);
+		dest += width;
+		src += bytesperline;
+	}
+
+	if (yvu) {
+		vdest = dest;
+		udest = dest + width * height / 4;
+	} else {
+		udest = dest;
+		vdest = dest + width * height / 4;
+	}
+
+	for (i = 0; i < height / 2; i++) {
+		for (j = 0; j < width / 2; j++) {
+			*udest++ = uvsrc[2 * j];
+			*vdest++ = uvsrc[2 * j + 1];
+		}
+		uvsrc += bytesperline;
+	}
+}
+
+void v4lconvert_yuv420_to_nv12(const unsigned char *src, unsigned char *dest,
+		int width, int height, int nv21)
+{
+	const unsigned char *usrc, *vsrc;
+	int i;
+
+	memcpy(dest, src, width * height);
+	dest += width * height;
+
+	if (nv21) {
+		vsrc = src + width * height;
+		usrc = vsrc + width * height / 4;
+	} else {
+		usrc = src + width * height;
+		vsrc = usrc + width * height / 4;
+	}
+
+	for (i = 0; i < width * height / 4; i++) {
+		*dest++ = *usrc++;
+		*dest++ = *vsrc++;
+	}
+}
+
+void v4lconvert_yuv420_to_yuyv(const unsigned char *src, unsigned char *dest,
+		int width, int height)
+{
+	const unsigned char *ysrc = src;
+	const unsigned char *usrc = src + width * height;
+	const unsigned char *vsrc = usrc + width * height / 4;
+	int i, j;
+
+	for (i = 0; i < height; i++) {
+		for (j = 0; j < width / 2; j++) {
+			*dest++ = *ysrc++;
+			*dest++ = usrc[j];
+			*dest++ = *ysrc++;
+			*dest++ = vsrc[j];
+		}
+		/* 2 lines share their chroma */
+		if (i & 1) {
+			usrc += width / 2;
+			vsrc += width / 2;
+		}
+	}
+}
+
 void v4lconvert_rgb565_to_rgb24(const unsigned char *src, unsigned char *dest,
 		int width, int height)
 {
@@ -582,12 +788,12 @@ void v4lconvert_rgb565_to_yuv420(const unsigned char *src, unsigned char *dest,
 			g[1] = 0xfc & (tmp >> 3);
 			b[1] = 0xf8 & (tmp >> 8);
 
-			tmp = *(((unsigned short *)src) + src_fmt->fmt.pix.bytesperline);
+			tmp = *(unsigned short *)(src + src_fmt->fmt.pix.bytesperline);
 			r[2] = 0xf8 & (tmp << 3);
 			g[2] = 0xfc & (tmp >> 3);
 			b[2] = 0xf8 & (tmp >> 8);
 
-			tmp = *(((unsigned short *)src) + src_fmt->fmt.pix.bytesperline + 1);
+			tmp = *(((unsigned short *)(src + src_fmt->fmt.pix.bytesperline)) + 1);
 			r[3] = 0xf8 & (tmp << 3);
 			g[3] = 0xfc & (tmp >> 3);
 			b[3] = 0xf8 & (tmp >> 8);
@@ -771,6 +977,28 @@ void v4lconvert_rgb32_to_rgb24(const unsigned char *src, unsigned char *dest,
 	}
 }
 
+void v4lconvert_rgb24_to_rgb32(const unsigned char *src, unsigned char *dest,
+		int width, int height, int bgr)
+{
+	int i;
+
+	/* rgb32 is X R G B in memory, bgr32 is B G R X */
+	for (i = 0; i < width * height; i++) {
+		if (bgr) {
+			*dest++ = src[2];
+			*dest++ = src[1];
+			*dest++ = src[0];
+			*dest++ = 0xff;
+		} else {
+			*dest++ = 0xff;
+			*dest++ = src[0];
+			*dest++ = src[1];
+			*dest++ = src[2];
+		}
+		src += 3;
+	}
+}
+
 static void hsvtorgb(const unsigned char *hsv, unsigned char *rgb,
 		     unsigned char hsv_enc)
 {
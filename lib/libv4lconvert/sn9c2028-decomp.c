@@ -37,81 +37,52 @@
  */
 
 #include "libv4lconvert-priv.h"
+#include "bitstream.h"
 
-/* Four defines for bitstream operations, used in the decode function */
+#define CLIP(x) ((x) < 0 ? 0 : ((x) > 0xff) ? 0xff : (x))
 
-#define PEEK_BITS(num, to) { \
-	if (bitBufCount < num) { \
-		do { \
-			bitBuf = (bitBuf << 8) | (*(src++)); \
-			bitBufCount += 8; \
-		} while (bitBufCount < 24); \
-	} \
-	to = bitBuf >> (bitBufCount - num); \
-}
-
-/*
- * PEEK_BITS puts the next <num> bits into the low bits of <to>.
- * when the buffer is empty, it is completely refilled.
- * This strategy tries to reduce memory access. Note that the high bits
- * are NOT set to zero!
- */
-
-#define EAT_BITS(num) { bitBufCount -= num; bits_eaten += num; }
-
-/*
- * EAT_BITS consumes <num> bits (PEEK_BITS does not consume anything,
- * it just peeks)
- */
+/* Code table indexed by the first 5 bits of a code, the 10 bit codes
+   starting with 11101 set the pixel to 8 times their last 5 bits */
+static const struct {
+	unsigned char is_abs;
+	unsigned char len;
+	signed char val;
+} table[32] = {
+	/* code 0 */
+	{ 0, 1, 0 }, { 0, 1, 0 }, { 0, 1, 0 }, { 0, 1, 0 },
+	{ 0, 1, 0 }, { 0, 1, 0 }, { 0, 1, 0 }, { 0, 1, 0 },
+	{ 0, 1, 0 }, { 0, 1, 0 }, { 0, 1, 0 }, { 0, 1, 0 },
+	{ 0, 1, 0 }, { 0, 1, 0 }, { 0, 1, 0 }, { 0, 1, 0 },
+	/* codes 1000, 1001 */
+	{ 0, 4, 8 }, { 0, 4, 8 }, { 0, 4, -8 }, { 0, 4, -8 },
+	/* code 101 */
+	{ 0, 3, 3 }, { 0, 3, 3 }, { 0, 3, 3 }, { 0, 3, 3 },
+	/* code 110 */
+	{ 0, 3, -3 }, { 0, 3, -3 }, { 0, 3, -3 }, { 0, 3, -3 },
+	/* codes 11100, 11101xxxxx, 1111 */
+	{ 0, 5, 20 }, { 1, 10, 0 }, { 0, 4, -20 }, { 0, 4, -20 },
+};
 
-#define PARSE_PIXEL(val) {\
-	PEEK_BITS(10, bits);\
+/* Code 0 (pixel unchanged) is by far the most common one, checking for it
+   first lets the cpu run ahead on a predicted branch, instead of waiting for
+   the table lookup before it can consume the next code */
+#define PARSE_PIXEL(pix) {\
+	bits = v4lconvert_bits_peek(&bs, 10);\
 	if ((bits & 0x200) == 0) {\
-		EAT_BITS(1);\
-	} \
-	else if ((bits & 0x380) == 0x280) {\
-		EAT_BITS(3);\
-		val += 3;\
-		if (val > 255)\
-			val = 255;\
-	} \
-	else if ((bits & 0x380) == 0x300) {\
-		EAT_BITS(3);\
-		val -= 3;\
-		if (val < 0)\
-			val = 0;\
-	} \
-	else if ((bits & 0x3c0) == 0x200) {\
-		EAT_BITS(4);\
-		val += 8;\
-		if (val > 255)\
-			val = 255;\
-	} \
-	else if ((bits & 0x3c0) == 0x240) {\
-		EAT_BITS(4);\
-		val -= 8;\
-		if (val < 0)\
-			val = 0;\
-	} \
-	else if ((bits & 0x3c0) == 0x3c0) {\
-		EAT_BITS(4);\
-		val -= 20;\
-		if (val < 0)\
-			val = 0;\
-	} \
-	else if ((bits & 0x3e0) == 0x380) {\
-		EAT_BITS(5);\
-		val += 20;\
-		if (val > 255)\
-			val = 255;\
+		v4lconvert_bits_skip(&bs, 1);\
 	} \
 	else {\
-		EAT_BITS(10);\
-		val = 8 * (bits & 0x1f);\
+		code = bits >> 5;\
+		v4lconvert_bits_skip(&bs, table[code].len);\
+		if (table[code].is_abs) \
+			pix = 8 * (bits & 0x1f);\
+		else {\
+			pix += table[code].val;\
+			pix = CLIP(pix);\
+		} \
 	} \
 }
 
-
 #define PUT_PIXEL_PAIR {\
 	long pp;\
 	pp = (c1val << 8) + c2val;\
@@ -121,32 +92,28 @@
 
 /* Now the decode function itself */
 
-void v4lconvert_decode_sn9c2028(const unsigned char *src, unsigned char *dst,
-		int width, int height)
+void v4lconvert_decode_sn9c2028(const unsigned char *src, int src_size,
+		unsigned char *dst, int width, int height)
 {
+	struct v4lconvert_bitstream bs;
 	long dst_index = 0;
 	int starting_row = 0;
-	unsigned short bits;
+	unsigned int bits, code;
 	short c1val, c2val;
 	int x, y;
-	unsigned long bitBuf = 0;
-	unsigned long bitBufCount = 0;
-	unsigned long bits_eaten = 0;
 
-	src += 12;    /* Remove the header */
+	/* Remove the header */
+	v4lconvert_bits_init(&bs, src + 12, src_size - 12);
 
 	for (y = starting_row; y < height; y++) {
-		PEEK_BITS(8, bits);
-		EAT_BITS(8);
-		c2val = (bits & 0xff);
-		PEEK_BITS(8, bits);
-		EAT_BITS(8);
-		c1val = (bits & 0xff);
+		c2val = v4lconvert_bits_get(&bs, 8);
+		c1val = v4lconvert_bits_get(&bs, 8);
 
 		PUT_PIXEL_PAIR;
 
 		for (x = 2; x < width ; x += 2) {
 			/* The compression reversed the even and odd columns.*/
+			v4lconvert_bits_refill(&bs);
 			PARSE_PIXEL(c2val);
 			PARSE_PIXEL(c1val);
 			PUT_PIXEL_PAIR;
@@ -0,0 +1,179 @@
+/*
+# Worker pool for doing conversions in horizontal slices on multiple cores
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include "libv4lconvert-priv.h"
+
+#define V4LCONVERT_MAX_THREADS 64
+
+struct v4lconvert_threads {
+	int count; /* Number of threads working on a job, including the caller */
+	pthread_t *workers;
+	pthread_mutex_t lock;
+	pthread_cond_t start_cond;
+	pthread_cond_t done_cond;
+	unsigned int generation; /* Incremented for each new job */
+	int quit;
+	/* The current job */
+	void (*func)(void *arg, int slice, int first, int last);
+	void *arg;
+	int rows;
+	int slice_rows;
+	int slices;
+	int next_slice;
+	int pending; /* Slices not finished yet */
+};
+
+/* Called with threads->lock held, returns with it held */
+static void v4lconvert_threads_do_slices(struct v4lconvert_threads *threads)
+{
+	while (threads->next_slice < threads->slices) {
+		int slice = threads->next_slice++;
+		int first = slice * threads->slice_rows;
+		int last = first + threads->slice_rows;
+
+		if (last > threads->rows)
+			last = threads->rows;
+
+		pthread_mutex_unlock(&threads->lock);
+		threads->func(threads->arg, slice, first, last);
+		pthread_mutex_lock(&threads->lock);
+
+		if (--threads->pending == 0)
+			pthread_cond_signal(&threads->done_cond);
+	}
+}
+
+static void *v4lconvert_threads_worker(void *arg)
+{
+	struct v4lconvert_threads *threads = arg;
+	unsigned int generation = 0;
+
+	pthread_mutex_lock(&threads->lock);
+	while (1) {
+		while (threads->generation == generation && !threads->quit)
+			pthread_cond_wait(&threads->start_cond, &threads->lock);
+		if (threads->quit)
+			break;
+		generation = threads->generation;
+		v4lconvert_threads_do_slices(threads);
+	}
+	pthread_mutex_unlock(&threads->lock);
+
+	return NULL;
+}
+
+struct v4lconvert_threads *v4lconvert_threads_create(int count)
+{
+	struct v4lconvert_threads *threads;
+	int i;
+
+	if (count < 2)
+		return NULL;
+	if (count > V4LCONVERT_MAX_THREADS)
+		count = V4LCONVERT_MAX_THREADS;
+
+	threads = calloc(1, sizeof(*threads));
+	if (!threads)
+		return NULL;
+
+	threads->workers = calloc(count - 1, sizeof(pthread_t));
+	if (!threads->workers) {
+		free(threads);
+		return NULL;
+	}
+
+	pthread_mutex_init(&threads->lock, NULL);
+	pthread_cond_init(&threads->start_cond, NULL);
+	pthread_cond_init(&threads->done_cond, NULL);
+
+	/* The calling thread is the first worker */
+	threads->count = 1;
+	for (i = 0; i < count - 1; i++) {
+		if (pthread_create(&threads->workers[i], NULL,
+				   v4lconvert_threads_worker, threads))
+			break;
+		threads->count++;
+	}
+
+	if (threads->count < 2) {
+		v4lconvert_threads_destroy(threads);
+		return NULL;
+	}
+
+	return threads;
+}
+
+void v4lconvert_threads_destroy(struct v4lconvert_threads *threads)
+{
+	int i;
+
+	if (!threads)
+		return;
+
+	pthread_mutex_lock(&threads->lock);
+	threads->quit = 1;
+	pthread_cond_broadcast(&threads->start_cond);
+	pthread_mutex_unlock(&threads->lock);
+
+	for (i = 0; i < threads->count - 1; i++)
+		pthread_join(threads->workers[i], NULL);
+
+	pthread_cond_destroy(&threads->done_cond);
+	pthread_cond_destroy(&threads->start_cond);
+	pthread_mutex_destroy(&threads->lock);
+	free(threads->workers);
+	free(threads);
+}
+
+int v4lconvert_threads_count(struct v4lconvert_threads *threads)
+{
+	return threads ? threads->count : 1;
+}
+
+void v4lconvert_threads_run(struct v4lconvert_threads *threads, int rows,
+		int align, void (*func)(void *arg, int slice, int first, int last),
+		void *arg)
+{
+	int slice_rows;
+
+	if (!threads || rows < 2 * align) {
+		func(arg, 0, 0, rows);
+		return;
+	}
+
+	slice_rows = (rows + threads->count - 1) / threads->count;
+	slice_rows = (slice_rows + align - 1) / align * align;
+
+	pthread_mutex_lock(&threads->lock);
+	threads->func = func;
+	threads->arg = arg;
+	threads->rows = rows;
+	threads->slice_rows = slice_rows;
+	threads->slices = (rows + slice_rows - 1) / slice_rows;
+	threads->next_slice = 0;
+	threads->pending = threads->slices;
+	threads->generation++;
+	pthread_cond_broadcast(&threads->start_cond);
+
+	v4lconvert_threads_do_slices(threads);
+	while (threads->pending)
+		pthread_cond_wait(&threads->done_cond, &threads->lock);
+	pthread_mutex_unlock(&threads->lock);
+}
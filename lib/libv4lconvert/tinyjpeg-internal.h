@@ -60,12 +60,17 @@ struct huffman_table {
 	 * IMPROVEME: Calculate if 256 value is enough to store all values
 	 */
 	uint16_t slowtable[16 - HUFFMAN_HASH_NBITS][256];
+	/* For AC tables: if a code and the value bits following it together
+	 * fit in HUFFMAN_HASH_NBITS bits, this gives the already sign extended
+	 * value << 8 | run-length << 4 | total bits used, else 0 */
+	int16_t fast_ac[HUFFMAN_HASH_SIZE];
 };
 
 struct component {
 	unsigned int Hfactor;
 	unsigned int Vfactor;
 	float *Q_table;		/* Pointer to the quantisation table to use */
+	int16_t *IQ_table;	/* Same for the integer IDCT */
 	struct huffman_table *AC_table;
 	struct huffman_table *DC_table;
 	short int previous_DC;	/* Previous DC coefficient */
@@ -78,12 +83,14 @@ struct component {
 
 typedef void (*decode_MCU_fct) (struct jdec_private *priv);
 typedef void (*convert_colorspace_fct) (struct jdec_private *priv);
+typedef void (*idct_fct) (struct component *compptr, uint8_t *output_buf, int stride);
 
 struct jdec_private {
 	/* Public variables */
 	uint8_t *components[COMPONENTS];
 	unsigned int width, height;	/* Size of the image */
 	unsigned int flags;
+	unsigned int scale;		/* Decode at 1/scale of the size */
 
 	/* Private variables */
 	const unsigned char *stream_end;
@@ -94,6 +101,7 @@ struct jdec_private {
 
 	struct component component_infos[COMPONENTS];
 	float Q_tables[COMPONENTS][64];		/* quantization tables */
+	int16_t IQ_tables[COMPONENTS][64];	/* same for the integer IDCT */
 	struct huffman_table HTDC[HUFFMAN_TABLES];	/* DC huffman tables   */
 	struct huffman_table HTAC[HUFFMAN_TABLES];	/* AC huffman tables   */
 	int default_huffman_table_initialized;
@@ -109,6 +117,8 @@ struct jdec_private {
 	/* Temp space used after the IDCT to store each components */
 	uint8_t Y[64 * 4], Cr[64], Cb[64];
 
+	idct_fct idct;			/* IDCT or a reduced size one */
+
 	jmp_buf jump_state;
 	/* Internal Pointer use for colorspace conversion, do not modify it !!! */
 	uint8_t *plane[COMPONENTS];
@@ -118,10 +128,26 @@ struct jdec_private {
 	/* Temp buffers for multipass planar JPG -> RGB decoding */
 	int tmp_buf_y_size;
 	uint8_t *tmp_buf[COMPONENTS];
+
+	/* For decoding restart intervals in parallel */
+	struct v4lconvert_threads *threads;
+	struct jdec_private **slice_privs;	/* Per slice copy of this struct */
+	int slice_privs_count;
+	const unsigned char **rst_segments;	/* Start of each restart interval */
+	int rst_segments_size;
+	int slice_error;			/* Set in the per slice copy */
 };
 
+#if 1 /* The fixed point IDCT is faster and has SIMD versions */
+#define IDCT tinyjpeg_idct_ifast
+#else
 #define IDCT tinyjpeg_idct_float
+#endif
 void tinyjpeg_idct_float (struct component *compptr, uint8_t *output_buf, int stride);
+void tinyjpeg_idct_ifast (struct component *compptr, uint8_t *output_buf, int stride);
+void tinyjpeg_idct_4x4 (struct component *compptr, uint8_t *output_buf, int stride);
+void tinyjpeg_idct_2x2 (struct component *compptr, uint8_t *output_buf, int stride);
+void tinyjpeg_idct_1x1 (struct component *compptr, uint8_t *output_buf, int stride);
 
 #endif
 
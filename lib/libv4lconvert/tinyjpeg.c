@@ -385,6 +385,21 @@ static void process_Huffman_data_unit(struct jdec_private *priv, int component)
 	/* AC coefficient decoding */
 	j = 1;
 	while (j < 64) {
+		int fast;
+
+		/* Short code + value combinations are decoded in one go */
+		look_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, HUFFMAN_HASH_NBITS, huff_code);
+		fast = c->AC_table->fast_ac[huff_code];
+		if (fast) {
+			skip_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, fast & 15);
+			j += (fast >> 4) & 15;
+			if (j < 64) {
+				DCT[j] = fast >> 8;
+				j++;
+			}
+			continue;
+		}
+
 		huff_code = get_next_huffman_code(priv, c->AC_table);
 
 		size_val = huff_code & 0xF;
@@ -499,6 +514,34 @@ static int build_huffman_table(struct jdec_private *priv, const unsigned char *b
 	for (i = 0; i < (16 - HUFFMAN_HASH_NBITS); i++)
 		table->slowtable[i][slowtable_used[i]] = 0;
 
+	/*
+	 * Build the fast AC table: for codes which leave enough room in the
+	 * HUFFMAN_HASH_NBITS bits looked at for the value bits following them,
+	 * store the decoded value directly. Only values which fit in 8 bits
+	 * signed are stored, so that everything fits in 16 bits.
+	 */
+	memset(table->fast_ac, 0, sizeof(table->fast_ac));
+	for (i = 0; i < HUFFMAN_HASH_SIZE; i++) {
+		int value, run, size_val;
+
+		if (table->lookup[i] < 0)
+			continue;
+
+		val = table->lookup[i];
+		run = val >> 4;
+		size_val = val & 15;
+		code_size = table->code_size[val];
+		if (size_val == 0 || size_val > 7 ||
+		    code_size + size_val > HUFFMAN_HASH_NBITS)
+			continue;
+
+		value = (i >> (HUFFMAN_HASH_NBITS - code_size - size_val)) &
+			((1 << size_val) - 1);
+		if (value < (1 << (size_val - 1)))
+			value -= (1 << size_val) - 1;
+		table->fast_ac[i] = value * 256 + run * 16 + code_size + size_val;
+	}
+
 	return 0;
 }
 
@@ -1222,6 +1265,153 @@ static void YCrCB_to_BGR24_2x2(struct jdec_private *priv)
 #undef FIX
 }
 
+/*
+ *  YCrCb -> RGB24 / BGR24 for all MCU layouts, using the SIMD line
+ *  converter. Y is (8 * hfactor) x (8 * vfactor), Cb and Cr are 8x8.
+ */
+static void YCrCB_to_RGB24_simd(struct jdec_private *priv,
+		int hfactor, int vfactor, int bgr)
+{
+	unsigned char *p = priv->plane[0];
+	int i;
+
+	for (i = 0; i < 8 * vfactor; i++) {
+		int c = (i / vfactor) * 8;
+
+		v4lconvert_simd.jpeg_ycbcr_to_rgb24(priv->Y + i * 8 * hfactor,
+				priv->Cb + c, priv->Cr + c, p, 8 * hfactor,
+				hfactor == 2, bgr);
+		p += priv->width * 3;
+	}
+}
+
+static void YCrCB_to_RGB24_1x1_simd(struct jdec_private *priv)
+{
+	YCrCB_to_RGB24_simd(priv, 1, 1, 0);
+}
+
+static void YCrCB_to_RGB24_1x2_simd(struct jdec_private *priv)
+{
+	YCrCB_to_RGB24_simd(priv, 1, 2, 0);
+}
+
+static void YCrCB_to_RGB24_2x1_simd(struct jdec_private *priv)
+{
+	YCrCB_to_RGB24_simd(priv, 2, 1, 0);
+}
+
+static void YCrCB_to_RGB24_2x2_simd(struct jdec_private *priv)
+{
+	YCrCB_to_RGB24_simd(priv, 2, 2, 0);
+}
+
+static void YCrCB_to_BGR24_1x1_simd(struct jdec_private *priv)
+{
+	YCrCB_to_RGB24_simd(priv, 1, 1, 1);
+}
+
+static void YCrCB_to_BGR24_1x2_simd(struct jdec_private *priv)
+{
+	YCrCB_to_RGB24_simd(priv, 1, 2, 1);
+}
+
+static void YCrCB_to_BGR24_2x1_simd(struct jdec_private *priv)
+{
+	YCrCB_to_RGB24_simd(priv, 2, 1, 1);
+}
+
+static void YCrCB_to_BGR24_2x2_simd(struct jdec_private *priv)
+{
+	YCrCB_to_RGB24_simd(priv, 2, 2, 1);
+}
+
+/*
+ *  YCrCb -> RGB24 / BGR24 / packed YCbCr for all MCU layouts when decoding
+ *  at 1/scale. The reduced size IDCT-s leave (8 / scale) x (8 / scale) pixels
+ *  in the top left corner of each 8x8 block of Y, Cb and Cr.
+ */
+enum { SCALED_RGB24, SCALED_BGR24, SCALED_YCBCR24 };
+
+static void YCrCB_to_RGB24_scaled(struct jdec_private *priv, int fmt)
+{
+	/* Sampling factors are 1 or 2 */
+	int hshift = priv->component_infos[cY].Hfactor - 1;
+	int vshift = priv->component_infos[cY].Vfactor - 1;
+	int size = 8 / priv->scale;
+	int width = size << hshift;
+	unsigned char *p = priv->plane[0];
+	unsigned char Y[16];
+	int i, j;
+
+#define SCALEBITS       10
+#define ONE_HALF        (1UL << (SCALEBITS - 1))
+#define FIX(x)          ((int)((x) * (1UL << SCALEBITS) + 0.5))
+
+	for (i = 0; i < (size << vshift); i++) {
+		const unsigned char *Cb = priv->Cb + (i >> vshift) * 8;
+		const unsigned char *Cr = priv->Cr + (i >> vshift) * 8;
+		const unsigned char *src = priv->Y +
+			((i / size) * 8 + (i & (size - 1))) * (8 << hshift);
+		unsigned char *q = p;
+
+		/* Gather the line from the 1 or 2 blocks it spans */
+		memcpy(Y, src, size);
+		if (hshift)
+			memcpy(Y + size, src + 8, size);
+
+		for (j = 0; j < width; j++) {
+			int y, cb, cr;
+			int r, g, b;
+
+			y  = Y[j];
+			cb = Cb[j >> hshift];
+			cr = Cr[j >> hshift];
+			if (fmt == SCALED_YCBCR24) {
+				*q++ = y;
+				*q++ = cb;
+				*q++ = cr;
+				continue;
+			}
+
+			y <<= SCALEBITS;
+			cb -= 128;
+			cr -= 128;
+			r = (y + FIX(1.40200) * cr + ONE_HALF) >> SCALEBITS;
+			g = (y - FIX(0.34414) * cb - FIX(0.71414) * cr +
+			     ONE_HALF) >> SCALEBITS;
+			b = (y + FIX(1.77200) * cb + ONE_HALF) >> SCALEBITS;
+			if (fmt == SCALED_BGR24) {
+				*q++ = clamp(b);
+				*q++ = clamp(g);
+				*q++ = clamp(r);
+			} else {
+				*q++ = clamp(r);
+				*q++ = clamp(g);
+				*q++ = clamp(b);
+			}
+		}
+		p += priv->width / priv->scale * 3;
+	}
+
+#undef SCALEBITS
+#undef ONE_HALF
+#undef FIX
+}
+
+static void YCrCB_to_RGB24_scaled_rgb(struct jdec_private *priv)
+{
+	YCrCB_to_RGB24_scaled(priv, SCALED_RGB24);
+}
+
+static void YCrCB_to_RGB24_scaled_bgr(struct jdec_private *priv)
+{
+	YCrCB_to_RGB24_scaled(priv, SCALED_BGR24);
+}
+
+static void YCrCB_to_RGB24_scaled_ycbcr(struct jdec_private *priv)
+{
+	YCrCB_to_RGB24_scaled(priv, SCALED_YCBCR24);
+}
 
 
 /**
@@ -1327,15 +1517,15 @@ static void decode_MCU_1x1_3planes(struct jdec_private *priv)
 {
 	// Y
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y, 8);
+	priv->idct(&priv->component_infos[cY], priv->Y, 8);
 
 	// Cb
 	process_Huffman_data_unit(priv, cCb);
-	IDCT(&priv->component_infos[cCb], priv->Cb, 8);
+	priv->idct(&priv->component_infos[cCb], priv->Cb, 8);
 
 	// Cr
 	process_Huffman_data_unit(priv, cCr);
-	IDCT(&priv->component_infos[cCr], priv->Cr, 8);
+	priv->idct(&priv->component_infos[cCr], priv->Cr, 8);
 }
 
 /*
@@ -1345,15 +1535,15 @@ static void decode_MCU_1x1_1plane(struct jdec_private *priv)
 {
 	// Y
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y, 8);
+	priv->idct(&priv->component_infos[cY], priv->Y, 8);
 
 	// Cb
 	process_Huffman_data_unit(priv, cCb);
-	IDCT(&priv->component_infos[cCb], priv->Cb, 8);
+	priv->idct(&priv->component_infos[cCb], priv->Cb, 8);
 
 	// Cr
 	process_Huffman_data_unit(priv, cCr);
-	IDCT(&priv->component_infos[cCr], priv->Cr, 8);
+	priv->idct(&priv->component_infos[cCr], priv->Cr, 8);
 }
 
 
@@ -1367,20 +1557,21 @@ static void decode_MCU_2x1_3planes(struct jdec_private *priv)
 {
 	// Y
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y, 16);
+	priv->idct(&priv->component_infos[cY], priv->Y, 16);
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y + 8, 16);
+	priv->idct(&priv->component_infos[cY], priv->Y + 8, 16);
 
 	// Cb
 	process_Huffman_data_unit(priv, cCb);
-	IDCT(&priv->component_infos[cCb], priv->Cb, 8);
+	priv->idct(&priv->component_infos[cCb], priv->Cb, 8);
 
 	// Cr
 	process_Huffman_data_unit(priv, cCr);
-	IDCT(&priv->component_infos[cCr], priv->Cr, 8);
+	priv->idct(&priv->component_infos[cCr], priv->Cr, 8);
 }
 
-static void build_quantization_table(float *qtable, const unsigned char *ref_table);
+static void build_quantization_table(float *qtable, int16_t *iqtable,
+		const unsigned char *ref_table);
 
 static void pixart_decode_MCU_2x1_3planes(struct jdec_private *priv)
 {
@@ -1465,7 +1656,7 @@ static void pixart_decode_MCU_2x1_3planes(struct jdec_private *priv)
 			j = (pixart_q[lumi][i] * comp + 50) / 100;
 			qt[i] = (j < 255) ? j : 255;
 		}
-		build_quantization_table(priv->Q_tables[0], qt);
+		build_quantization_table(priv->Q_tables[0], priv->IQ_tables[0], qt);
 
 		/* If bit 7 of the marker is set chrominance uses the
 		   luminance quantization table */
@@ -1476,7 +1667,7 @@ static void pixart_decode_MCU_2x1_3planes(struct jdec_private *priv)
 				qt[i] = (j < 255) ? j : 255;
 			}
 		}
-		build_quantization_table(priv->Q_tables[1], qt);
+		build_quantization_table(priv->Q_tables[1], priv->IQ_tables[1], qt);
 
 		priv->marker = marker;
 	}
@@ -1484,17 +1675,17 @@ static void pixart_decode_MCU_2x1_3planes(struct jdec_private *priv)
 
 	// Y
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y, 16);
+	priv->idct(&priv->component_infos[cY], priv->Y, 16);
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y + 8, 16);
+	priv->idct(&priv->component_infos[cY], priv->Y + 8, 16);
 
 	// Cb
 	process_Huffman_data_unit(priv, cCb);
-	IDCT(&priv->component_infos[cCb], priv->Cb, 8);
+	priv->idct(&priv->component_infos[cCb], priv->Cb, 8);
 
 	// Cr
 	process_Huffman_data_unit(priv, cCr);
-	IDCT(&priv->component_infos[cCr], priv->Cr, 8);
+	priv->idct(&priv->component_infos[cCr], priv->Cr, 8);
 }
 
 /*
@@ -1507,9 +1698,9 @@ static void decode_MCU_2x1_1plane(struct jdec_private *priv)
 {
 	// Y
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y, 16);
+	priv->idct(&priv->component_infos[cY], priv->Y, 16);
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y + 8, 16);
+	priv->idct(&priv->component_infos[cY], priv->Y + 8, 16);
 
 	// Cb
 	process_Huffman_data_unit(priv, cCb);
@@ -1531,21 +1722,21 @@ static void decode_MCU_2x2_3planes(struct jdec_private *priv)
 {
 	// Y
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y, 16);
+	priv->idct(&priv->component_infos[cY], priv->Y, 16);
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y + 8, 16);
+	priv->idct(&priv->component_infos[cY], priv->Y + 8, 16);
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y + 64 * 2, 16);
+	priv->idct(&priv->component_infos[cY], priv->Y + 64 * 2, 16);
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y + 64 * 2 + 8, 16);
+	priv->idct(&priv->component_infos[cY], priv->Y + 64 * 2 + 8, 16);
 
 	// Cb
 	process_Huffman_data_unit(priv, cCb);
-	IDCT(&priv->component_infos[cCb], priv->Cb, 8);
+	priv->idct(&priv->component_infos[cCb], priv->Cb, 8);
 
 	// Cr
 	process_Huffman_data_unit(priv, cCr);
-	IDCT(&priv->component_infos[cCr], priv->Cr, 8);
+	priv->idct(&priv->component_infos[cCr], priv->Cr, 8);
 }
 
 /*
@@ -1560,13 +1751,13 @@ static void decode_MCU_2x2_1plane(struct jdec_private *priv)
 {
 	// Y
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y, 16);
+	priv->idct(&priv->component_infos[cY], priv->Y, 16);
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y + 8, 16);
+	priv->idct(&priv->component_infos[cY], priv->Y + 8, 16);
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y + 64 * 2, 16);
+	priv->idct(&priv->component_infos[cY], priv->Y + 64 * 2, 16);
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y + 64 * 2 + 8, 16);
+	priv->idct(&priv->component_infos[cY], priv->Y + 64 * 2 + 8, 16);
 
 	// Cb
 	process_Huffman_data_unit(priv, cCb);
@@ -1587,17 +1778,17 @@ static void decode_MCU_1x2_3planes(struct jdec_private *priv)
 {
 	// Y
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y, 8);
+	priv->idct(&priv->component_infos[cY], priv->Y, 8);
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y + 64, 8);
+	priv->idct(&priv->component_infos[cY], priv->Y + 64, 8);
 
 	// Cb
 	process_Huffman_data_unit(priv, cCb);
-	IDCT(&priv->component_infos[cCb], priv->Cb, 8);
+	priv->idct(&priv->component_infos[cCb], priv->Cb, 8);
 
 	// Cr
 	process_Huffman_data_unit(priv, cCr);
-	IDCT(&priv->component_infos[cCr], priv->Cr, 8);
+	priv->idct(&priv->component_infos[cCr], priv->Cr, 8);
 }
 
 /*
@@ -1612,9 +1803,9 @@ static void decode_MCU_1x2_1plane(struct jdec_private *priv)
 {
 	// Y
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y, 8);
+	priv->idct(&priv->component_infos[cY], priv->Y, 8);
 	process_Huffman_data_unit(priv, cY);
-	IDCT(&priv->component_infos[cY], priv->Y + 64, 8);
+	priv->idct(&priv->component_infos[cY], priv->Y + 64, 8);
 
 	// Cb
 	process_Huffman_data_unit(priv, cCb);
@@ -1657,7 +1848,8 @@ static void print_SOF(const unsigned char *stream)
  *
  ******************************************************************************/
 
-static void build_quantization_table(float *qtable, const unsigned char *ref_table)
+static void build_quantization_table(float *qtable, int16_t *iqtable,
+		const unsigned char *ref_table)
 {
 	/* Taken from libjpeg. Copyright Independent JPEG Group's LLM idct.
 	 * For float AA&N IDCT method, divisors are equal to quantization
@@ -1667,6 +1859,8 @@ static void build_quantization_table(float *qtable, const unsigned char *ref_tab
 	 * We apply a further scale factor of 8.
 	 * What's actually stored is 1/divisor so that the inner loop can
 	 * use a multiplication rather than a division.
+	 * For the integer AA&N IDCT the same multipliers are stored scaled
+	 * by 1 << 2 (PASS1_BITS in jidctfst.c) and rounded.
 	 */
 	int i, j;
 	static const double aanscalefactor[8] = {
@@ -1676,8 +1870,12 @@ static void build_quantization_table(float *qtable, const unsigned char *ref_tab
 	const unsigned char *zz = zigzag;
 
 	for (i = 0; i < 8; i++)
-		for (j = 0; j < 8; j++)
-			*qtable++ = ref_table[*zz++] * aanscalefactor[i] * aanscalefactor[j];
+		for (j = 0; j < 8; j++) {
+			double q = ref_table[*zz++] * aanscalefactor[i] * aanscalefactor[j];
+
+			*qtable++ = q;
+			*iqtable++ = (int16_t)(q * 4 + 0.5);
+		}
 
 }
 
@@ -1701,7 +1899,7 @@ static int parse_DQT(struct jdec_private *priv, const unsigned char *stream)
 					COMPONENTS, qi + 1);
 #endif
 		table = priv->Q_tables[qi];
-		build_quantization_table(table, stream);
+		build_quantization_table(table, priv->IQ_tables[qi], stream);
 		stream += 64;
 	}
 	trace("< DQT marker\n");
@@ -1744,6 +1942,7 @@ static int parse_SOF(struct jdec_private *priv, const unsigned char *stream)
 		c->Vfactor = sampling_factor & 0xf;
 		c->Hfactor = sampling_factor >> 4;
 		c->Q_table = priv->Q_tables[Q_table];
+		c->IQ_table = priv->IQ_tables[Q_table];
 		trace("Component:%d  factor:%dx%d  Quantization table:%d\n",
 				cid, c->Hfactor, c->Hfactor, Q_table);
 
@@ -1980,6 +2179,9 @@ static int parse_JFIF(struct jdec_private *priv, const unsigned char *stream)
 	int dht_marker_found = 0;
 	const unsigned char *next_chunck;
 
+	/* The restart interval is per frame, not sticky (only set by DRI) */
+	priv->restart_interval = 0;
+
 	/* Parse marker */
 	while (!sos_marker_found) {
 		if (*stream++ != 0xff)
@@ -2081,6 +2283,7 @@ struct jdec_private *tinyjpeg_init(void)
 	priv = (struct jdec_private *)calloc(1, sizeof(struct jdec_private));
 	if (priv == NULL)
 		return NULL;
+	priv->scale = 1;
 	return priv;
 }
 
@@ -2101,6 +2304,10 @@ void tinyjpeg_free(struct jdec_private *priv)
 	}
 	priv->tmp_buf_y_size = 0;
 	free(priv->stream_filtered);
+	for (i = 0; i < priv->slice_privs_count; i++)
+		free(priv->slice_privs[i]);
+	free(priv->slice_privs);
+	free(priv->rst_segments);
 	free(priv);
 }
 
@@ -2163,6 +2370,20 @@ static const convert_colorspace_fct convert_colorspace_bgr24[4] = {
 	YCrCB_to_BGR24_2x2,
 };
 
+static const convert_colorspace_fct convert_colorspace_rgb24_simd[4] = {
+	YCrCB_to_RGB24_1x1_simd,
+	YCrCB_to_RGB24_1x2_simd,
+	YCrCB_to_RGB24_2x1_simd,
+	YCrCB_to_RGB24_2x2_simd,
+};
+
+static const convert_colorspace_fct convert_colorspace_bgr24_simd[4] = {
+	YCrCB_to_BGR24_1x1_simd,
+	YCrCB_to_BGR24_1x2_simd,
+	YCrCB_to_BGR24_2x1_simd,
+	YCrCB_to_BGR24_2x2_simd,
+};
+
 static const convert_colorspace_fct convert_colorspace_grey[4] = {
 	YCrCB_to_Grey_1x1,
 	YCrCB_to_Grey_1x2,
@@ -2231,6 +2452,164 @@ kernel: 0xff 0xff 0x00 0xff 0x96, and we skip one unknown byte */
 	error("Short Pixart JPEG frame\n");
 }
 
+/*
+ * Find the start of each restart interval in the scan. Returns the number of
+ * intervals found, which is less than count if the stream ends early or has
+ * out of sequence RST markers.
+ */
+static int find_restart_intervals(struct jdec_private *priv, int count)
+{
+	const unsigned char *stream = priv->stream;
+	int found = 1, rst = 0;
+
+	priv->rst_segments[0] = stream;
+	while (found < count) {
+		/* The entropy coded data never contains 0xff followed by
+		   anything but 0x00, so we can simply look for 0xff */
+		stream = memchr(stream, 0xff, priv->stream_end - stream);
+		if (!stream || stream + 1 >= priv->stream_end)
+			break;
+
+		if (stream[1] == RST + rst) {
+			stream += 2;
+			priv->rst_segments[found++] = stream;
+			rst = (rst + 1) & 7;
+		} else if (stream[1] == 0x00 || stream[1] == 0xff) {
+			stream++;
+		} else {
+			break;
+		}
+	}
+	return found;
+}
+
+struct restart_intervals_job {
+	struct jdec_private *priv;
+	decode_MCU_fct decode_MCU;
+	convert_colorspace_fct convert_to_pixfmt;
+	unsigned int *bytes_per_blocklines;
+	unsigned int *bytes_per_mcu;
+	unsigned int mcus_per_row;
+	unsigned int mcus;
+};
+
+/* Decode restart intervals first - last - 1, run from the thread pool */
+static void decode_restart_intervals(void *arg, int slice, int first,
+		int last)
+{
+	struct restart_intervals_job *job = arg;
+	struct jdec_private *priv = job->priv->slice_privs[slice];
+	unsigned int i, mcu, end, x, y;
+
+	/* The Huffman and quantization tables are only read, and are shared
+	   through the component_infos pointers into the main struct */
+	memcpy(priv, job->priv, sizeof(*priv));
+	if (setjmp(priv->jump_state)) {
+		priv->slice_error = 1;
+		return;
+	}
+
+	for (i = first; i < last; i++) {
+		priv->stream = job->priv->rst_segments[i];
+		resync(priv);
+
+		mcu = i * priv->restart_interval;
+		end = mcu + priv->restart_interval;
+		if (end > job->mcus)
+			end = job->mcus;
+
+		for (; mcu < end; mcu++) {
+			x = mcu % job->mcus_per_row;
+			y = mcu / job->mcus_per_row;
+			priv->plane[0] = priv->components[0] +
+				y * job->bytes_per_blocklines[0] +
+				x * job->bytes_per_mcu[0];
+			priv->plane[1] = priv->components[1] +
+				y * job->bytes_per_blocklines[1] +
+				x * job->bytes_per_mcu[1];
+			priv->plane[2] = priv->components[2] +
+				y * job->bytes_per_blocklines[2] +
+				x * job->bytes_per_mcu[2];
+			job->decode_MCU(priv);
+			job->convert_to_pixfmt(priv);
+		}
+	}
+}
+
+/*
+ * Decode all restart intervals in parallel, each interval starts with
+ * freshly reset DC predictors at a known MCU, so they are independent.
+ * Returns 0 on success, -1 on error and 1 if the image cannot be decoded
+ * this way, in which case the caller should decode it sequentially.
+ */
+static int decode_parallel(struct jdec_private *priv,
+		decode_MCU_fct decode_MCU, convert_colorspace_fct convert_to_pixfmt,
+		unsigned int *bytes_per_blocklines, unsigned int *bytes_per_mcu,
+		unsigned int mcus_per_row, unsigned int mcu_rows)
+{
+	struct restart_intervals_job job;
+	int i, intervals, count = v4lconvert_threads_count(priv->threads);
+
+	job.priv = priv;
+	job.decode_MCU = decode_MCU;
+	job.convert_to_pixfmt = convert_to_pixfmt;
+	job.bytes_per_blocklines = bytes_per_blocklines;
+	job.bytes_per_mcu = bytes_per_mcu;
+	job.mcus_per_row = mcus_per_row;
+	job.mcus = mcus_per_row * mcu_rows;
+
+	intervals = (job.mcus + priv->restart_interval - 1) /
+		    priv->restart_interval;
+	if (intervals < 2)
+		return 1;
+
+	if (priv->rst_segments_size < intervals) {
+		free(priv->rst_segments);
+		priv->rst_segments = malloc(intervals * sizeof(*priv->rst_segments));
+		if (!priv->rst_segments) {
+			priv->rst_segments_size = 0;
+			return 1;
+		}
+		priv->rst_segments_size = intervals;
+	}
+	if (find_restart_intervals(priv, intervals) != intervals)
+		return 1;
+
+	if (priv->slice_privs_count < count) {
+		struct jdec_private **slice_privs;
+
+		slice_privs = realloc(priv->slice_privs,
+				      count * sizeof(*slice_privs));
+		if (!slice_privs)
+			return 1;
+		priv->slice_privs = slice_privs;
+		for (i = priv->slice_privs_count; i < count; i++) {
+			slice_privs[i] = malloc(sizeof(struct jdec_private));
+			if (!slice_privs[i])
+				return 1;
+			priv->slice_privs_count++;
+		}
+	}
+
+	for (i = 0; i < count; i++)
+		priv->slice_privs[i]->slice_error = 0;
+
+	v4lconvert_threads_run(priv->threads, intervals, 1,
+			       decode_restart_intervals, &job);
+
+	for (i = 0; i < count; i++) {
+		if (priv->slice_privs[i]->slice_error) {
+			memcpy(priv->error_string,
+			       priv->slice_privs[i]->error_string,
+			       sizeof(priv->error_string));
+			return -1;
+		}
+	}
+
+	priv->stream = priv->stream_end;
+	return 0;
+}
+
 /**
  * Decode and convert the jpeg image into @pixfmt@ image
  *
@@ -2248,8 +2627,11 @@ int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
 	if (setjmp(priv->jump_state))
 		return -1;
 
-	if (priv->flags & TINYJPEG_FLAGS_PLANAR_JPEG)
+	if (priv->flags & TINYJPEG_FLAGS_PLANAR_JPEG) {
+		if (priv->scale != 1)
+			error("Scaled decoding not supported for planar JPEG's\n");
 		return tinyjpeg_decode_planar(priv, pixfmt);
+	}
 
 	/* To keep gcc happy initialize some array */
 	bytes_per_mcu[1] = 0;
@@ -2297,7 +2679,10 @@ int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
 		break;
 
 	case TINYJPEG_FMT_RGB24:
-		colorspace_array_conv = convert_colorspace_rgb24;
+		if (v4lconvert_simd.jpeg_ycbcr_to_rgb24)
+			colorspace_array_conv = convert_colorspace_rgb24_simd;
+		else
+			colorspace_array_conv = convert_colorspace_rgb24;
 		if (priv->components[0] == NULL)
 			priv->components[0] = (uint8_t *)malloc(priv->width * priv->height * 3);
 		bytes_per_blocklines[0] = priv->width * 3;
@@ -2305,7 +2690,21 @@ int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
 		break;
 
 	case TINYJPEG_FMT_BGR24:
-		colorspace_array_conv = convert_colorspace_bgr24;
+		if (v4lconvert_simd.jpeg_ycbcr_to_rgb24)
+			colorspace_array_conv = convert_colorspace_bgr24_simd;
+		else
+			colorspace_array_conv = convert_colorspace_bgr24;
+		if (priv->components[0] == NULL)
+			priv->components[0] = (uint8_t *)malloc(priv->width * priv->height * 3);
+		bytes_per_blocklines[0] = priv->width * 3;
+		bytes_per_mcu[0] = 3*8;
+		break;
+
+	case TINYJPEG_FMT_YCBCR24:
+		/* Only for scaled decoding, which has its own conversion */
+		if (priv->scale == 1)
+			error("YCbCr24 output only supported for scaled decoding\n");
+		colorspace_array_conv = convert_colorspace_rgb24;
 		if (priv->components[0] == NULL)
 			priv->components[0] = (uint8_t *)malloc(priv->width * priv->height * 3);
 		bytes_per_blocklines[0] = priv->width * 3;
@@ -2353,6 +2752,33 @@ int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
 	if (decode_MCU == NULL)
 		error("no decode MCU function for this JPEG format (PIXART?)\n");
 
+	priv->idct = IDCT;
+	if (priv->scale != 1) {
+		switch (priv->scale) {
+		case 2:
+			priv->idct = tinyjpeg_idct_4x4;
+			break;
+		case 4:
+			priv->idct = tinyjpeg_idct_2x2;
+			break;
+		case 8:
+			priv->idct = tinyjpeg_idct_1x1;
+			break;
+		default:
+			error("Unsupported scale 1/%u\n", priv->scale);
+		}
+		if (priv->flags & TINYJPEG_FLAGS_PIXART_JPEG)
+			error("Scaled decoding not supported for PIXART JPEG's\n");
+		if (pixfmt == TINYJPEG_FMT_RGB24)
+			convert_to_pixfmt = YCrCB_to_RGB24_scaled_rgb;
+		else if (pixfmt == TINYJPEG_FMT_BGR24)
+			convert_to_pixfmt = YCrCB_to_RGB24_scaled_bgr;
+		else if (pixfmt == TINYJPEG_FMT_YCBCR24)
+			convert_to_pixfmt = YCrCB_to_RGB24_scaled_ycbcr;
+		else
+			error("Scaled decoding only supported to RGB24 / BGR24 / YCbCr24\n");
+	}
+
 	resync(priv);
 
 	/* Don't forget to that block can be either 8 or 16 lines */
@@ -2364,6 +2790,20 @@ int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
 	bytes_per_mcu[1] *= xstride_by_mcu / 8;
 	bytes_per_mcu[2] *= xstride_by_mcu / 8;
 
+	/* Scaled decoding is to packed formats only, so only plane 0 is used */
+	bytes_per_blocklines[0] /= priv->scale * priv->scale;
+	bytes_per_mcu[0] /= priv->scale;
+
+	if (priv->threads && priv->restart_interval > 0 &&
+	    !(priv->flags & TINYJPEG_FLAGS_PIXART_JPEG)) {
+		int ret = decode_parallel(priv, decode_MCU, convert_to_pixfmt,
+				bytes_per_blocklines, bytes_per_mcu,
+				(priv->width + xstride_by_mcu - 1) / xstride_by_mcu,
+				priv->height / ystride_by_mcu);
+		if (ret <= 0)
+			return ret;
+	}
+
 	/* Just the decode the image by macroblock (size is 8x8, 8x16, or 16x16) */
 	for (y = 0; y < priv->height / ystride_by_mcu; y++) {
 		//trace("Decoding row %d\n", y);
@@ -2494,6 +2934,25 @@ int tinyjpeg_decode_planar(struct jdec_private *priv, int pixfmt)
 		v_buf += 7 * (priv->width / 2);
 	}
 
+	if (pixfmt != TINYJPEG_FMT_YUV420P && v4lconvert_simd.jpeg_ycbcr_to_rgb24) {
+		y_buf = priv->tmp_buf[cY];
+		u_buf = priv->tmp_buf[cCb];
+		v_buf = priv->tmp_buf[cCr];
+		p = priv->components[0];
+
+		for (y = 0; y < priv->height; y++) {
+			v4lconvert_simd.jpeg_ycbcr_to_rgb24(y_buf, u_buf, v_buf, p,
+					priv->width, 1, pixfmt == TINYJPEG_FMT_BGR24);
+			y_buf += priv->width;
+			if (y & 1) {
+				u_buf += priv->width / 2;
+				v_buf += priv->width / 2;
+			}
+			p += priv->width * 3;
+		}
+		return 0;
+	}
+
 #define SCALEBITS       10
 #define ONE_HALF        (1UL << (SCALEBITS - 1))
 #define FIX(x)          ((int)((x) * (1UL << SCALEBITS) + 0.5))
@@ -2668,3 +3127,25 @@ int tinyjpeg_set_flags(struct jdec_private *priv, int flags)
 	return oldflags;
 }
 
+/**
+ * Decode the image at 1/scale of its size, scale must be 1, 2, 4 or 8.
+ * Scaled decoding is only supported to RGB24, BGR24 and YCBCR24.
+ */
+int tinyjpeg_set_scale(struct jdec_private *priv, unsigned int scale)
+{
+	int oldscale = priv->scale;
+
+	priv->scale = scale;
+	return oldscale;
+}
+
+/**
+ * Decode the restart intervals of JPEG-s which have them in parallel, using
+ * the given thread pool (NULL to decode in the calling thread only).
+ */
+void tinyjpeg_set_threads(struct jdec_private *priv,
+			  struct v4lconvert_threads *threads)
+{
+	priv->threads = threads;
+}
+
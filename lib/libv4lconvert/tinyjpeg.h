@@ -40,6 +40,7 @@ extern "C" {
 #endif
 
 struct jdec_private;
+struct v4lconvert_threads;
 
 /* Flags that can be set by any applications */
 #define TINYJPEG_FLAGS_MJPEG_TABLE	(1<<1)
@@ -52,6 +53,7 @@ enum tinyjpeg_fmt {
 	TINYJPEG_FMT_BGR24,
 	TINYJPEG_FMT_RGB24,
 	TINYJPEG_FMT_YUV420P,
+	TINYJPEG_FMT_YCBCR24,	/* Packed, only for scaled decoding */
 };
 
 struct jdec_private *tinyjpeg_init(void);
@@ -65,6 +67,9 @@ int tinyjpeg_get_components(struct jdec_private *priv, unsigned char **component
 int tinyjpeg_set_components(struct jdec_private *priv, unsigned char **components,
 				unsigned int ncomponents);
 int tinyjpeg_set_flags(struct jdec_private *priv, int flags);
+int tinyjpeg_set_scale(struct jdec_private *priv, unsigned int scale);
+void tinyjpeg_set_threads(struct jdec_private *priv,
+			  struct v4lconvert_threads *threads);
 
 #ifdef __cplusplus
 }